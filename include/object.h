@@ -78,6 +78,7 @@ int section_dump(SECTION * section, const char * filename);
 int section_free(SECTION * section, char itself);
 int binary_write(SECTION * section, ADDRESS entrypoint, const char * filename);
 int binary_read(const char * filename, unsigned char * memory, ADDRESS * entrypoint, unsigned memsize);
+int binary_locate(const char * filename, ADDRESS * entrypoint, unsigned * offset, unsigned * length);
 int section_data_copy(SECTION * section, unsigned char * dest, unsigned size);
 
 SYMBOL * symbol_set(SECTION * section, unsigned char * name, ADDRESS address, uint8_t flags);
@@ -94,6 +95,7 @@ OBJECT * object_create(const char * filename);
 int object_write(const OBJECT * object);
 OBJECT * object_load(const char * filename);
 SECTION * object_get_section_by_name(OBJECT * object, const char * section_name);
+int object_locate_section(const char * filename, const char * section_name, unsigned * offset, unsigned * length);
 int object_free(OBJECT * object);
 
 #endif
@@ -5,27 +5,216 @@
 
 typedef uint16_t (* vmMemoryRead)(unsigned char * memory, uint16_t address, int half);
 typedef void (* vmMemoryWrite)(unsigned char * memory, uint16_t address, uint16_t data, int half);
+typedef uint16_t (* vmDeviceRead)(void * device, uint16_t address, int half);
+typedef void (* vmDeviceWrite)(void * device, uint16_t address, uint16_t data, int half);
 
-enum VM_State { VM_OK = 0, VM_ILLEGAL_OPCODE, VM_SOFTINT, VM_OUT_OF_MEMORY, VM_DIVIDE_BY_ZERO, VM_UNALIGNED_MEMORY };
+enum VM_State { VM_OK = 0, VM_ILLEGAL_OPCODE, VM_SOFTINT, VM_OUT_OF_MEMORY, VM_DIVIDE_BY_ZERO, VM_UNALIGNED_MEMORY, VM_JIT_MISMATCH, VM_WRITE_PROTECTED, VM_REPLAY_END, VM_REPLAY_DIVERGED };
 
 typedef uint8_t VM_STATE;
 
+/** Rezimy vykonavania instrukcii. */
+enum VM_Mode {
+	VM_MODE_INTERPRET = 0,		// kazda instrukcia sa nacita a dekoduje pri kazdom vykonani
+	VM_MODE_BLOCKS,				// kod sa dekoduje po zakladnych blokoch, ktore sa ukladaju podla PC
+	VM_MODE_JIT,				// casto vykonavane bloky sa prekladaju do strojoveho kodu hostitela (iba x86-64)
+	VM_MODE_JIT_VERIFY			// ako VM_MODE_JIT, kazdy prelozeny blok sa kontroluje interpretom
+};
+
+#define VM_PAGE_SIZE		256
+#define VM_PAGE_COUNT		256
+
+#define VM_MEMORY_FULL_SIZE		65536
+
+#define VM_MEMORY_FULL			(1 << 0)		// stroj vlastni cely 64 KiB adresny priestor, adresa nemoze byt mimo pamate
+#define VM_MEMORY_STRICT_ALIGN	(1 << 1)		// zarovnanie adries sa kontroluje aj pri VM_MEMORY_FULL
+#define VM_MEMORY_MAPPED		(1 << 2)		// pamat je namapovana (kopia obrazu pri zapise, okno bank), nie alokovana
+
+#define VM_INTERRUPT_RETURN	0xFF			// INT s tymto cislom ukonci obsluhu prerusenia
+#define VM_INTERRUPT_NATIVE	0xFE			// INT s tymto cislom na adrese s nativnou funkciou ju zavola
+#define VM_INTERRUPT_SWAP	0xFD			// na jadre zhluku atomicky vymeni R0 so slovom na adrese R1
+#define VM_INTERRUPT_CORE	0xFC			// na jadre zhluku nacita do R0 cislo jadra a do R1 pocet jadier
+#define VM_INTERRUPT_IPI	0xFB			// na jadre zhluku posle prerusenie R0 jadru R1, R0 = 0 alebo 0xFFFF pri chybe
+
+#define VM_LOCKSTEP_LANES	16				// najvacsi pocet strojov vykonavanych spolocne
+
+#define VM_CLUSTER_CORES	16				// najvacsi pocet jadier so spolocnou pamatou
+
+#define VM_BANK_COUNT		65536			// najvacsi pocet bank rozsirenej pamate, cislo banky je slovo
+
+#define VM_PAGE_CODE		(1 << 0)		// na stranke je kod, ktory ma predekodovane alebo prelozene bloky
+#define VM_PAGE_SNAPSHOT	(1 << 1)		// stranka sa od vytvorenia alebo obnovenia snimky nezmenila
+#define VM_PAGE_CHECKPOINT	(1 << 2)		// stranka sa od posledneho kontrolneho bodu nezmenila
+#define VM_PAGE_DEVICE		(1 << 3)		// citanie a zapis na stranke obsluhuje pripojene zariadenie
+#define VM_PAGE_READONLY	(1 << 4)		// zapis na stranku skonci chybou VM_WRITE_PROTECTED
+#define VM_PAGE_TRANSLATED	(1 << 5)		// kod na stranke je prelozeny vopred (maot) a od pripojenia prekladu sa nezmenil
+#define VM_PAGE_RECORDED	(1 << 6)		// stranka sa od poslednej synchronizacie so zaznamom vstupov nezmenila
+
+/** Pocitadla profilu vykonavania. */
+enum VM_ProfileCounter {
+	VM_PROFILE_ALU = 0,				// aritmeticke, logicke a posuvne instrukcie, FLINVERT
+	VM_PROFILE_LOAD,				// LOAD vo vsetkych formach adresovania
+	VM_PROFILE_STORE,				// STORE vo vsetkych formach adresovania
+	VM_PROFILE_MOVE,				// ILOAD, MOV, SWAP
+	VM_PROFILE_BRANCH_TAKEN,		// vykonane skoky
+	VM_PROFILE_BRANCH_NOT_TAKEN,	// skoky preskocene pre nesplnenu podmienku
+	VM_PROFILE_SKIPPED,				// ostatne instrukcie preskocene pre nesplnenu podmienku
+	VM_PROFILE_INT,					// instrukcie INT
+	VM_PROFILE_ILLEGAL,				// neplatne instrukcie
+	VM_PROFILE_MEM_READS,			// citania dat z pamate (bez nacitania instrukcii)
+	VM_PROFILE_MEM_WRITES,			// zapisy dat do pamate
+	VM_PROFILE_COUNTERS
+};
+
+enum VM_ProfileFormat { VM_PROFILE_BINARY = 0, VM_PROFILE_CSV };
+
+#define VM_PROFILE_WORDS		32768
+
+/** Profil vykonavania programu virtualneho stroja. */
+struct VirtualMachineProfile {
+	uint64_t counters[VM_PROFILE_COUNTERS];		// pocty podla VM_ProfileCounter
+	uint64_t pc[VM_PROFILE_WORDS];				// pocet nacitani instrukcie pre kazde slovo adresneho priestoru
+};
+
+typedef struct VirtualMachineProfile VM_PROFILE;
+
+/** Dovody zastavenia behu stroja funkciou resumeVirtualMachine. */
+enum VM_StopReason {
+	VM_STOP_BUDGET = 0,				// vykonal sa cely limit instrukcii
+	VM_STOP_SOFTINT,				// instrukcia INT, cislo prerusenia je vo vector
+	VM_STOP_FAULT,					// chyba, stav je v state a adresa chyby vo fault_address
+	VM_STOP_BREAKPOINT,				// PC je na adrese so zarazkou, instrukcia na nej sa este nevykonala
+	VM_STOP_INTERRUPT,				// prerusenie od hostitela, ktore program stroja neobsluhuje
+	VM_STOP_IDLE,					// planovac nema ziadny pripraveny stroj
+	VM_STOP_REPLAY					// prehravanie zaznamu skoncilo, vysledok je v state
+};
+
+/** Popis zastavenia behu stroja. */
+struct VirtualMachineStop {
+	uint64_t retired;				// pocet vykonanych instrukcii
+	VM_STATE state;					// stav, ktory vratilo jadro
+	uint8_t reason;					// VM_StopReason
+	uint8_t vector;					// cislo prerusenia pri VM_STOP_SOFTINT a VM_STOP_INTERRUPT
+	uint16_t pc;					// PC po zastaveni
+	uint16_t fault_address;			// adresa chyby pri VM_STOP_FAULT
+};
+
+typedef struct VirtualMachineStop VM_STOP;
+
+struct BlockCache;
+struct JitCache;
+struct InterruptController;
+struct DeviceBus;
+struct EventQueue;
+struct NativeTable;
+struct BankSet;
+struct Recording;
+
+typedef struct VirtualMachineSnapshot VM_SNAPSHOT;
+typedef struct VirtualMachineCheckpoint VM_CHECKPOINT;
+typedef struct VirtualMachineScheduler VM_SCHEDULER;
+typedef struct VirtualMachineCluster VM_CLUSTER;
+typedef struct VirtualMachineImage VM_IMAGE;
+typedef struct VirtualMachineTranslation VM_TRANSLATION;
+
 struct VirtualMachine {
 	uint16_t registers[16];
 	uint8_t flags;
 	unsigned char * memory;
 	uint16_t mem_size;
+	uint8_t mem_flags;
 	vmMemoryRead read_func;
 	vmMemoryWrite write_func;
 	uint8_t ext_interrupt;
+	uint8_t interrupt_pending;		// na stroj caka prerusenie od hostitela, nastavuje postInterruptVirtualMachine
+	uint8_t mode;
+	struct BlockCache * block_cache;
+	struct JitCache * jit;
+	VM_PROFILE * profile;
+	VM_SNAPSHOT * snapshot;
+	struct InterruptController * interrupts;
+	struct DeviceBus * devices;		// zariadenia pripojene na stranky, NULL ak ziadne nie su
+	struct EventQueue * events;		// naplanovane udalosti, NULL ak stroj este ziadnu nemal
+	struct NativeTable * natives;	// nativne funkcie pripojene na adresy programu, NULL ak ziadne nie su
+	struct BankSet * banks;			// banky rozsirenej pamate zobrazovane do okna, NULL ak ich stroj nema
+	const VM_TRANSLATION * translation;	// program prelozeny vopred do kodu hostitela, NULL ak ho stroj nema
+	struct Recording * recording;	// zaznam alebo prehravanie vstupov stroja, NULL ak ziadne nie je
+	uint8_t * breakpoints;			// bitova mapa adries so zarazkou, NULL ak ziadna nie je
+	uint16_t retired;				// pocet instrukcii vykonanych poslednym behom s nenulovym limitom
+	uint16_t fault_address;			// adresa poslednej chyby pamate alebo neplatnej instrukcie
+	uint64_t clock;					// hodiny stroja, pocet vsetkych vykonanych instrukcii
+	VM_CLUSTER * cluster;			// zhluk jadier so spolocnou pamatou, NULL ak stroj ma pamat sam
+	uint8_t core;					// cislo jadra v zhluku
+	uint8_t page_flags[VM_PAGE_COUNT];
 };
 
 typedef struct VirtualMachine VIRTUAL_MACHINE;
 
+typedef uint64_t (* vmEventHandler)(VIRTUAL_MACHINE * machine, void * data);
+typedef VM_STATE (* vmNativeRoutine)(VIRTUAL_MACHINE * machine, void * data);
+typedef VM_STATE (* vmTranslatedCode)(VIRTUAL_MACHINE * machine, int64_t * budget);
+
+/** Program stroja prelozeny vopred do kodu hostitela, vytvara ho nastroj maot. */
+struct VirtualMachineTranslation {
+	vmTranslatedCode run;				// vykona prelozene bloky od PC stroja
+	const uint8_t * image;				// obsah pamate od adresy 0, z ktoreho bol program prelozeny
+	uint32_t length;					// dlzka obrazu v bytoch
+	uint16_t entrypoint;				// vstupny bod programu
+	uint8_t pages[VM_PAGE_COUNT];		// 1 pre stranky s prelozenym kodom
+};
+
 void dumpRegistersVirtualMachine(VIRTUAL_MACHINE * machine);
 
 VIRTUAL_MACHINE * createVirtualMachine(char * memory, uint16_t mem_size, uint16_t pc);
+void destroyVirtualMachine(VIRTUAL_MACHINE * machine);
+VM_IMAGE * createImageVirtualMachine(const void * data, uint32_t length);
+void destroyImageVirtualMachine(VM_IMAGE * image);
+VIRTUAL_MACHINE * createFromImageVirtualMachine(VM_IMAGE * image, uint16_t pc);
+VIRTUAL_MACHINE * createFromFileVirtualMachine(const char * filename, uint32_t offset, uint32_t length, uint16_t pc);
+void protectMemoryVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t length, int enable);
+int setModeVirtualMachine(VIRTUAL_MACHINE * machine, uint8_t mode);
+void invalidateCodeVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint16_t length);
+int setProfilingVirtualMachine(VIRTUAL_MACHINE * machine, int enable);
+int writeProfileVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename, uint8_t format);
+VM_SNAPSHOT * createSnapshotVirtualMachine(VIRTUAL_MACHINE * machine);
+int restoreSnapshotVirtualMachine(VIRTUAL_MACHINE * machine, VM_SNAPSHOT * snapshot);
+void destroySnapshotVirtualMachine(VM_SNAPSHOT * snapshot);
+VM_CHECKPOINT * createCheckpointVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename, int append);
+int writeCheckpointVirtualMachine(VM_CHECKPOINT * checkpoint, uint64_t position);
+int destroyCheckpointVirtualMachine(VM_CHECKPOINT * checkpoint);
+long loadCheckpointVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename, long index, uint64_t * position);
 VM_STATE runVirtualMachine(VIRTUAL_MACHINE * machine);
 VM_STATE traceVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t instructions);
+VM_STATE resumeVirtualMachine(VIRTUAL_MACHINE * machine, uint64_t budget, VM_STOP * stop);
+int mapDeviceVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t length, vmDeviceRead read, vmDeviceWrite write, void * device);
+void unmapDeviceVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t length);
+int attachBanksVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t window, uint32_t size, uint32_t count, uint16_t control);
+uint8_t * getBankMemoryVirtualMachine(VIRTUAL_MACHINE * machine, uint32_t bank);
+int selectBankVirtualMachine(VIRTUAL_MACHINE * machine, uint32_t bank);
+long getBankVirtualMachine(VIRTUAL_MACHINE * machine);
+uint16_t readMemoryVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, int half);
+VM_STATE writeMemoryVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint16_t data, int half);
+int attachTranslationVirtualMachine(VIRTUAL_MACHINE * machine, const VM_TRANSLATION * translation);
+int startRecordingVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename);
+int startReplayVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename);
+int stopRecordingVirtualMachine(VIRTUAL_MACHINE * machine);
+int scheduleEventVirtualMachine(VIRTUAL_MACHINE * machine, uint64_t delay, vmEventHandler handler, void * data);
+int cancelEventVirtualMachine(VIRTUAL_MACHINE * machine, vmEventHandler handler, void * data);
+int bindNativeVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, vmNativeRoutine routine, void * data);
+void unbindNativeVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address);
+vmNativeRoutine findNativeVirtualMachine(const char * name);
+int postInterruptVirtualMachine(VIRTUAL_MACHINE * machine, uint8_t vector);
+void setInterruptTableVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address);
+int setBreakpointVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, int enable);
+VM_SCHEDULER * createSchedulerVirtualMachine(uint64_t quantum);
+void destroySchedulerVirtualMachine(VM_SCHEDULER * scheduler);
+int addSchedulerVirtualMachine(VM_SCHEDULER * scheduler, VIRTUAL_MACHINE * machine);
+void removeSchedulerVirtualMachine(VM_SCHEDULER * scheduler, VIRTUAL_MACHINE * machine);
+void wakeSchedulerVirtualMachine(VM_SCHEDULER * scheduler, VIRTUAL_MACHINE * machine);
+VIRTUAL_MACHINE * runSchedulerVirtualMachine(VM_SCHEDULER * scheduler, unsigned slices, VM_STOP * stop);
+VM_CLUSTER * createClusterVirtualMachine(VIRTUAL_MACHINE * machine, unsigned cores);
+void destroyClusterVirtualMachine(VM_CLUSTER * cluster);
+VIRTUAL_MACHINE * getCoreVirtualMachine(VM_CLUSTER * cluster, unsigned core);
+int runClusterVirtualMachine(VM_CLUSTER * cluster, uint64_t budget, VM_STOP * stops);
+int traceLockstepVirtualMachines(VIRTUAL_MACHINE ** machines, unsigned count, uint16_t instructions, VM_STATE * states);
 
 #endif
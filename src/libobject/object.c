@@ -181,6 +181,67 @@ int binary_read(const char * filename, unsigned char * memory, ADDRESS * entrypo
 	return 0;
 }
 
+/** Zisti polohu obrazu pamate v subore BIN bez jeho nacitania.
+ * Obraz je za hlavickou suboru a moze sa priamo namapovat do pamate (createFromFileVirtualMachine).
+ * @param filename nazov suboru s obrazom
+ * @param entrypoint miesto, kam bude ulozena pociatocna adresa vykonavania
+ * @param offset miesto, kam bude ulozena pozicia obrazu v subore
+ * @param length miesto, kam bude ulozena dlzka obrazu
+ * @return chybovy kod, 0 znamena ziadnu chybu, -1 chybu pri zistovani vlastnosti suboru alebo nespravnu signaturu, -5 neexistujuci subor
+ */
+int binary_locate(const char * filename, ADDRESS * entrypoint, unsigned * offset, unsigned * length) {
+	unsigned char header[5];
+	struct stat vmm_stat;
+	int fd = open(filename, O_RDONLY);
+	if (fd == -1) return -5;
+	if (fstat(fd, &vmm_stat) == -1 || read(fd, header, 5) != 5 || strncmp((char *) header, "BIN", 3) != 0) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	*entrypoint = (header[3] << 8) | header[4];
+	*offset = 5;
+	*length = vmm_stat.st_size - 5;
+	return 0;
+}
+
+/** Zisti polohu dat sekcie v objektovom subore bez nacitania objektu.
+ * @param filename nazov objektoveho suboru
+ * @param section_name nazov hladanej sekcie
+ * @param offset miesto, kam bude ulozena pozicia dat sekcie v subore
+ * @param length miesto, kam bude ulozena dlzka dat sekcie
+ * @return chybovy kod, 0 znamena ziadnu chybu, -1 ak sa sekcia nenasla alebo subor nie je mozne citat
+ */
+int object_locate_section(const char * filename, const char * section_name, unsigned * offset, unsigned * length) {
+	_OBJECT w_obj;
+	_SECTION w_sect;
+	_SYMBOL w_sym;
+	off_t position = sizeof(_OBJECT);
+	int fd, q, w, rc = -1;
+
+	fd = open(filename, O_RDONLY);
+	if (fd == -1) return -1;
+	if (read(fd, &w_obj, sizeof(_OBJECT)) != sizeof(_OBJECT)) w_obj.section_count = 0;
+	for (q = 0; q < w_obj.section_count; q++) {
+		if (pread(fd, &w_sect, sizeof(_SECTION), position) != sizeof(_SECTION)) break;
+		position += sizeof(_SECTION);
+		if (strncmp(w_sect.name, section_name, sizeof(w_sect.name)) == 0) {
+			*offset = position;
+			*length = w_sect.size;
+			rc = 0;
+			break;
+		}
+		position += w_sect.size;
+		for (w = 0; w < w_sect.symbol_count; w++) {
+			if (pread(fd, &w_sym, sizeof(_SYMBOL), position) != sizeof(_SYMBOL)) break;
+			position += sizeof(_SYMBOL) + w_sym.relocation_count * sizeof(RELOCATION);
+		}
+		if (w < w_sect.symbol_count) break;
+	}
+	close(fd);
+	return rc;
+}
+
 /** Najde symbol v sekcii
  * Najde symbol v sekcii podla jeho nazvu. 
  * @param name nazov, ktory sa hlada. Implementacia obmedzuje nazvy na max. 32 znakov (resp. 31 znakov) 
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/// Velkost mapovanej pamate stroja, rovnaka ako alokovana pamat v rezime VM_MEMORY_FULL
+#define MEMORY_SIZE		(VM_MEMORY_FULL_SIZE + 1)
+
+/** Namapuje banku do okna a zneplatni predekodovany kod okna.
+ * Obsah banky sa nekopiruje, okno sa iba premapuje na iny usek suboru bank.
+ * @param machine popisovac virtualneho stroja
+ * @param bank cislo banky
+ * @return 0 ak je banka vybrana, -1 ak taka banka nie je alebo sa ju nepodarilo namapovat
+ */
+static int __select(VIRTUAL_MACHINE * machine, uint32_t bank) {
+	struct BankSet * banks = machine->banks;
+	uint32_t page;
+	if (bank >= banks->count) return -1;
+	if (bank == banks->selected) return 0;
+	if (mmap(machine->memory + banks->window, banks->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+			banks->fd, (off_t) bank * banks->size) == MAP_FAILED) return -1;
+	banks->selected = bank;
+	for (page = banks->window >> 8; page < (banks->window + banks->size) >> 8; page++) {
+		machine->page_flags[page] &= ~(VM_PAGE_SNAPSHOT | VM_PAGE_CHECKPOINT | VM_PAGE_TRANSLATED | VM_PAGE_RECORDED);
+		if (machine->page_flags[page] & VM_PAGE_CODE) {
+			vmInvalidateBlocks(machine, page);
+			banks->switched = 1;
+		}
+	}
+	if (banks->switched) vmJitInvalidate(machine);
+	return 0;
+}
+
+/** Obsluha citania stranky s riadiacim slovom, ostatne adresy stranky su pamat stroja. */
+static uint16_t __controlRead(void * device, uint16_t address, int half) {
+	VIRTUAL_MACHINE * machine = device;
+	struct BankSet * banks = machine->banks;
+	uint16_t offset = banks->control & (VM_PAGE_SIZE - 1);
+	if (address == offset) return half ? (banks->selected & 0xFF) : banks->selected;
+	if (address == offset + 1 && half) return banks->selected >> 8;
+	return machine->read_func(machine->memory, (banks->control & ~(VM_PAGE_SIZE - 1)) + address, half);
+}
+
+/** Obsluha zapisu na stranku s riadiacim slovom, zapis cisla neexistujucej banky sa ignoruje. */
+static void __controlWrite(void * device, uint16_t address, uint16_t data, int half) {
+	VIRTUAL_MACHINE * machine = device;
+	struct BankSet * banks = machine->banks;
+	uint16_t offset = banks->control & (VM_PAGE_SIZE - 1);
+	if (address == offset) __select(machine, half ? ((banks->selected & 0xFF00) | data) : data);
+	else if (address == offset + 1 && half) __select(machine, (banks->selected & 0x00FF) | (data << 8));
+	else machine->write_func(machine->memory, (banks->control & ~(VM_PAGE_SIZE - 1)) + address, data, half);
+}
+
+/** Zmeni alokovanu pamat stroja (alebo mapovanu pamat nezarovnanu na stranku hostitela) na
+ * mapovanu a zarovnanu, aby sa do nej dalo namapovat okno bank.
+ * @param machine popisovac virtualneho stroja s pamatou VM_MEMORY_FULL
+ * @param host velkost stranky hostitela
+ * @return 0 ak je pamat mapovana, -1 ak sa ju nepodarilo namapovat
+ */
+static int __mapMemory(VIRTUAL_MACHINE * machine, long host) {
+	void * memory;
+	if ((machine->mem_flags & VM_MEMORY_MAPPED) && (uintptr_t) machine->memory % host == 0) return 0;
+	memory = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) return -1;
+	memcpy(memory, machine->memory, MEMORY_SIZE);
+	vmFreeMemory(machine);
+	machine->memory = memory;
+	machine->mem_flags |= VM_MEMORY_MAPPED;
+	/* prelozeny kod moze mat adresu pamate v sebe */
+	vmJitInvalidate(machine);
+	return 0;
+}
+
+/** Pripoji k stroju banky rozsirenej pamate.
+ * Banky su pamat hostitela mimo 16 bitoveho adresneho priestoru stroja, v okne adresneho
+ * priestoru je vzdy jedna z nich. Program stroja vyberie banku zapisom jej cisla do
+ * riadiaceho slova, banka sa do okna premapuje bez kopirovania a dalsia instrukcia uz vidi
+ * jej obsah (aj predekodovany kod okna sa zneplatni). Citanie riadiaceho slova vrati cislo
+ * vybranej banky, zapis cisla neexistujucej banky sa ignoruje. Stranka s riadiacim slovom
+ * sa pripoji ako zariadenie (vid mapDeviceVirtualMachine), jej ostatne adresy zostanu
+ * pamatou. Sucasny obsah okna sa stane obsahom banky 0, ktora je po pripojeni vybrana,
+ * ostatne banky su vynulovane. Okno a velkost banky musia byt zarovnane na stranku
+ * hostitela (4 KiB), lebo okno je mapovanie pamate hostitela. Snimky a kontrolne body
+ * ukladaju iba adresny priestor stroja, nie obsah nevybranych bank ani cislo vybranej banky.
+ * Stroj musi mat cely adresny priestor (VM_MEMORY_FULL) a nesmie byt v zhluku. Funkcia sa
+ * nesmie volat pocas behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param window adresa okna
+ * @param size velkost okna a kazdej banky v bytoch
+ * @param count pocet bank, najviac VM_BANK_COUNT
+ * @param control zarovnana adresa riadiaceho slova mimo okna
+ * @return 0 ak boli banky pripojene, -1 ak stroj uz banky ma, nema cely adresny priestor, je
+ * v zhluku, okno alebo riadiace slovo je nespravne, alebo sa banky nepodarilo vytvorit
+ */
+int attachBanksVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t window, uint32_t size, uint32_t count, uint16_t control) {
+	long host = sysconf(_SC_PAGESIZE);
+	struct BankSet * banks;
+	uint16_t page = control & ~(VM_PAGE_SIZE - 1);
+
+	if (machine->banks != NULL || machine->cluster != NULL || !(machine->mem_flags & VM_MEMORY_FULL) ||
+			size == 0 || count == 0 || count > VM_BANK_COUNT || host <= 0 || window % host != 0 || size % host != 0 ||
+			(uint32_t) window + size > VM_MEMORY_FULL_SIZE || (control & 1) ||
+			(page + VM_PAGE_SIZE > window && page < (uint32_t) window + size)) return -1;
+	if (__mapMemory(machine, host) != 0 || (banks = calloc(1, sizeof(struct BankSet))) == NULL) return -1;
+	banks->window = window;
+	banks->size = size;
+	banks->count = count;
+	banks->control = control;
+	banks->store = MAP_FAILED;
+	if ((banks->fd = vmAnonymousFile()) < 0 || ftruncate(banks->fd, (off_t) count * size) != 0 ||
+			(banks->store = mmap(NULL, (size_t) count * size, PROT_READ | PROT_WRITE, MAP_SHARED, banks->fd, 0)) == MAP_FAILED) goto fail;
+	if (mapDeviceVirtualMachine(machine, page, VM_PAGE_SIZE, __controlRead, __controlWrite, machine) != 0) goto fail;
+	memcpy(banks->store, machine->memory + window, size);
+	if (mmap(machine->memory + window, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, banks->fd, 0) == MAP_FAILED) {
+		unmapDeviceVirtualMachine(machine, page, VM_PAGE_SIZE);
+		goto fail;
+	}
+	machine->banks = banks;
+	return 0;
+
+fail:
+	machine->banks = banks;
+	vmFreeBanks(machine);
+	return -1;
+}
+
+/** Vrati obsah banky, hostitel ho moze citat aj menit (napr. nacitat do banky program).
+ * Zmeny obsahu vybranej banky su hned viditelne v okne, hostitel vsak musi zmenu kodu
+ * v okne oznamit funkciou invalidateCodeVirtualMachine.
+ * @param machine popisovac virtualneho stroja
+ * @param bank cislo banky
+ * @return obsah banky s velkostou okna, NULL ak stroj banky nema alebo taka banka nie je
+ */
+uint8_t * getBankMemoryVirtualMachine(VIRTUAL_MACHINE * machine, uint32_t bank) {
+	if (machine->banks == NULL || bank >= machine->banks->count) return NULL;
+	return machine->banks->store + (size_t) bank * machine->banks->size;
+}
+
+/** Vyberie banku do okna, rovnako ako zapis do riadiaceho slova programom stroja.
+ * Funkcia sa nesmie volat pocas behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param bank cislo banky
+ * @return 0 ak je banka vybrana, -1 ak stroj banky nema alebo taka banka nie je
+ */
+int selectBankVirtualMachine(VIRTUAL_MACHINE * machine, uint32_t bank) {
+	if (machine->banks == NULL || __select(machine, bank) != 0) return -1;
+	machine->banks->switched = 0;
+	return 0;
+}
+
+/** Vrati cislo banky vybranej do okna.
+ * @param machine popisovac virtualneho stroja
+ * @return cislo banky, -1 ak stroj banky nema
+ */
+long getBankVirtualMachine(VIRTUAL_MACHINE * machine) {
+	return (machine->banks != NULL) ? machine->banks->selected : -1;
+}
+
+/** Uvolni banky stroja. Okno zostane namapovane, kym sa neuvolni pamat stroja.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmFreeBanks(VIRTUAL_MACHINE * machine) {
+	struct BankSet * banks = machine->banks;
+	if (banks == NULL) return;
+	if (banks->store != MAP_FAILED) munmap(banks->store, (size_t) banks->count * banks->size);
+	if (banks->fd >= 0) close(banks->fd);
+	free(banks);
+	machine->banks = NULL;
+}
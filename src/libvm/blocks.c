@@ -0,0 +1,616 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <vm.h>
+#include "vm.h"
+
+#include "bits.h"
+#include "registers.h"
+#include "instruction.h"
+#include "decode.h"
+
+#define BLOCK_MAX_INSTRUCTIONS	64
+
+/** Superinstrukcie a pomocne operacie blokov.
+ * Cisluju sa za obsluhami jednotlivych instrukcii (VM_Handler), takze obe sady
+ * zdielaju jednu dispatch tabulku.
+ */
+enum Block_Handler {
+	BOP_LI16 = VMOP_COUNT,		// ILOAD Rx, hi; ILOAD Rx, lo
+	BOP_PUSH2,					// STORE [--Ra], Rx; STORE [--Ra], Ry
+	BOP_POP2,					// LOAD Rx, [Ra++]; LOAD Ry, [Ra++]
+	BOP_SUBS_BRANCH,			// SUBS Ra, Rb; BRANCH Cx ciel
+	BOP_SUBCS_BRANCH,			// SUBCS Ra, n; BRANCH Cx ciel
+	BOP_SETPC,					// nastavi PC pre instrukciu, ktora s nim pracuje
+	BOP_END,					// koniec bloku, pokracuje sa na adrese data
+	BOP_EXIT,					// koniec bloku, PC uz nastavila posledna instrukcia
+	BOP_COUNT
+};
+
+/** Predekodovana operacia bloku. */
+struct BlockOp {
+	uint8_t handler;			// obsluha (VM_Handler alebo Block_Handler)
+	uint8_t cond;				// priznak, ktory musi byt nastaveny, aby sa operacia vykonala
+	uint8_t arg1;
+	uint8_t arg2;
+	uint16_t pc;				// hodnota PC po nacitani (poslednej) instrukcie operacie
+	uint16_t data;				// cielova adresa skoku, 16 bitova konstanta, resp. druhy datovy register
+	uint8_t retired;			// pocet instrukcii bloku vykonanych po dokonceni tejto operacie
+	uint8_t aux;				// podmienka skoku superinstrukcie
+};
+
+typedef struct BlockOp BLOCK_OP;
+
+/** Zakladny blok predekodovaneho kodu.
+ * Blok nikdy nepresahuje stranku pamate, takze pri zapise na stranku staci zneplatnit
+ * bloky jednej stranky.
+ */
+struct Block {
+	uint16_t start;				// adresa prvej instrukcie bloku
+	uint8_t length;				// pocet instrukcii bloku
+	struct Block * next;		// dalsi blok na tej istej stranke, resp. v zozname zrusenych blokov
+	BLOCK_OP ops[0];
+};
+
+typedef struct Block BLOCK;
+
+struct BlockCache {
+	BLOCK * map[32768];			// bloky podla adresy prvej instrukcie (adresa / 2)
+	BLOCK * pages[VM_PAGE_COUNT];	// zoznamy blokov podla stranky
+	BLOCK * graveyard;			// zneplatnene bloky, ktore sa este mozu prave vykonavat
+};
+
+typedef struct BlockCache BLOCK_CACHE;
+
+/** Zisti, ci instrukcia cita alebo zapisuje register PC.
+ * Pred taku instrukciu sa vklada nastavenie PC a blok za nou konci.
+ * @param d predekodovana instrukcia
+ * @return 1 ak instrukcia pracuje s PC
+ */
+static int __touchesPC(const DECODED_INSTRUCTION * d) {
+	switch (d->handler) {
+		case VMOP_ILOAD:
+		case VMOP_FLINVERT:
+		case VMOP_BRANCH:
+		case VMOP_BRANCHL:
+		case VMOP_INT:
+		case VMOP_ILLEGAL:
+			return 0;
+
+		case VMOP_SHL:
+		case VMOP_SHR:
+		case VMOP_ADDC:
+		case VMOP_SUBC:
+		case VMOP_ADDCS:
+		case VMOP_SUBCS:
+			return d->arg1 == 15;
+
+		case VMOP_NOT:
+			return d->arg2 == 15;
+
+		default:
+			return d->arg1 == 15 || d->arg2 == 15;
+	}
+}
+
+/** Vypocita cielovu adresu skoku.
+ * @param instr slovo instrukcie BRANCH
+ * @param pc adresa nasledujucej instrukcie
+ * @return cielova adresa
+ */
+static uint16_t __branchTarget(uint16_t instr, uint16_t pc) {
+	if (instr & BIT11) return pc - (instr & 0x07FE);
+	return pc + (instr & 0x07FE);
+}
+
+/** Pokusi sa spojit dve po sebe iduce instrukcie do superinstrukcie.
+ * @param op operacia, do ktorej sa superinstrukcia zapise
+ * @param i1 prva instrukcia
+ * @param i2 druha instrukcia
+ * @param pc adresa za druhou instrukciou
+ * @return 1 ak sa instrukcie spojili
+ */
+static int __fuse(BLOCK_OP * op, uint16_t i1, uint16_t i2, uint16_t pc) {
+	const DECODED_INSTRUCTION * d1 = &vmDecodeTable[i1];
+	const DECODED_INSTRUCTION * d2 = &vmDecodeTable[i2];
+
+	if (d1->cond) return 0;
+	op->cond = 0;
+	op->arg1 = d1->arg1;
+	op->arg2 = d1->arg2;
+	op->pc = pc;
+	op->aux = 0;
+
+	if (d1->handler == VMOP_ILOAD && d2->handler == VMOP_ILOAD && !d2->cond && d1->arg1 == d2->arg1) {
+		op->handler = BOP_LI16;
+		op->data = (d1->arg2 << 8) | d2->arg2;
+		return 1;
+	}
+	if (d1->handler == VMOP_STORE_PREDEC && d2->handler == VMOP_STORE_PREDEC && !d2->cond && d1->arg1 == d2->arg1
+			&& !__touchesPC(d1) && !__touchesPC(d2) && d1->arg2 != d1->arg1 && d2->arg2 != d1->arg1) {
+		op->handler = BOP_PUSH2;
+		op->data = d2->arg2;
+		return 1;
+	}
+	if (d1->handler == VMOP_LOAD_POSTINC && d2->handler == VMOP_LOAD_POSTINC && !d2->cond && d1->arg1 == d2->arg1
+			&& !__touchesPC(d1) && !__touchesPC(d2) && d1->arg2 != d1->arg1 && d2->arg2 != d1->arg1) {
+		op->handler = BOP_POP2;
+		op->data = d2->arg2;
+		return 1;
+	}
+	if ((d1->handler == VMOP_SUBS || d1->handler == VMOP_SUBCS) && !__touchesPC(d1) && d2->handler == VMOP_BRANCH && d2->cond) {
+		op->handler = (d1->handler == VMOP_SUBS) ? BOP_SUBS_BRANCH : BOP_SUBCS_BRANCH;
+		op->aux = d2->cond;
+		op->data = __branchTarget(i2, pc);
+		return 1;
+	}
+	return 0;
+}
+
+/** Predekoduje zakladny blok zacinajuci na danej adrese.
+ * Blok konci skokom, instrukciou INT, neplatnou instrukciou, instrukciou pracujucou
+ * s PC, koncom stranky, alebo neplatnou adresou nasledujucej instrukcie.
+ * @param machine popisovac virtualneho stroja
+ * @param cache cache blokov stroja
+ * @param start adresa prvej instrukcie (musi byt platna)
+ * @return predekodovany blok, alebo NULL ak nie je dost pamate
+ */
+static BLOCK * __compileBlock(VIRTUAL_MACHINE * machine, BLOCK_CACHE * cache, uint16_t start) {
+	uint16_t words[BLOCK_MAX_INSTRUCTIONS];
+	BLOCK_OP ops[2 * BLOCK_MAX_INSTRUCTIONS + 1];
+	const DECODED_INSTRUCTION * d;
+	BLOCK * block;
+	uint16_t pc = start;
+	int count = 0, op_count = 0, q;
+	uint8_t end = BOP_END;
+
+	do {
+		words[count] = machine->read_func(machine->memory, pc, MEM_OP_WORD);
+		d = &vmDecodeTable[words[count++]];
+		pc += 2;
+		if (d->handler == VMOP_BRANCH || d->handler == VMOP_BRANCHL || d->handler == VMOP_INT || d->handler == VMOP_ILLEGAL) break;
+		if (__touchesPC(d)) break;
+	} while (count < BLOCK_MAX_INSTRUCTIONS && (pc >> 8) == (start >> 8) && __checkAddressValid(machine, pc) == VM_OK);
+
+	pc = start;
+	for (q = 0; q < count; q++) {
+		BLOCK_OP * op = &ops[op_count];
+		pc += 2;
+		if (q + 1 < count && __fuse(op, words[q], words[q + 1], pc + 2)) {
+			pc += 2;
+			q++;
+			op->retired = q + 1;
+			op_count++;
+			continue;
+		}
+		d = &vmDecodeTable[words[q]];
+		if (__touchesPC(d)) {
+			op->handler = BOP_SETPC;
+			op->cond = 0;
+			op->data = pc;
+			op->retired = q;
+			op = &ops[++op_count];
+			end = BOP_EXIT;
+		}
+		op->handler = d->handler;
+		op->cond = d->cond;
+		op->arg1 = d->arg1;
+		op->arg2 = d->arg2;
+		op->pc = pc;
+		op->data = (d->handler == VMOP_BRANCH || d->handler == VMOP_BRANCHL) ? __branchTarget(words[q], pc) : 0;
+		op->retired = q + 1;
+		op->aux = 0;
+		op_count++;
+	}
+	ops[op_count].handler = end;
+	ops[op_count].cond = 0;
+	ops[op_count].pc = pc;
+	ops[op_count].data = pc;
+	ops[op_count].retired = count;
+	op_count++;
+
+	block = malloc(sizeof(BLOCK) + op_count * sizeof(BLOCK_OP));
+	if (block == NULL) return NULL;
+	block->start = start;
+	block->length = count;
+	memcpy(block->ops, ops, op_count * sizeof(BLOCK_OP));
+
+	block->next = cache->pages[start >> 8];
+	cache->pages[start >> 8] = block;
+	cache->map[start >> 1] = block;
+	machine->page_flags[start >> 8] |= VM_PAGE_CODE;
+	return block;
+}
+
+/** Uvolni zneplatnene bloky.
+ * @param cache cache blokov stroja
+ */
+static void __freeGraveyard(BLOCK_CACHE * cache) {
+	BLOCK * block;
+	while ((block = cache->graveyard) != NULL) {
+		cache->graveyard = block->next;
+		free(block);
+	}
+}
+
+/** Zneplatni vsetky bloky na stranke.
+ * Bloky sa neuvolnuju okamzite, pretoze zapis mohol vykonat prave niektory z nich.
+ * @param machine popisovac virtualneho stroja
+ * @param page cislo stranky
+ */
+void vmInvalidateBlocks(VIRTUAL_MACHINE * machine, uint8_t page) {
+	BLOCK_CACHE * cache = machine->block_cache;
+	BLOCK * block;
+	machine->page_flags[page] &= ~VM_PAGE_CODE;
+	if (cache == NULL) return;
+	while ((block = cache->pages[page]) != NULL) {
+		cache->pages[page] = block->next;
+		cache->map[block->start >> 1] = NULL;
+		block->next = cache->graveyard;
+		cache->graveyard = block;
+	}
+}
+
+/** Uvolni vsetky predekodovane bloky a cache blokov.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmFreeBlocks(VIRTUAL_MACHINE * machine) {
+	int page;
+	if (machine->block_cache == NULL) return;
+	for (page = 0; page < VM_PAGE_COUNT; page++) {
+		vmInvalidateBlocks(machine, page);
+	}
+	__freeGraveyard(machine->block_cache);
+	free(machine->block_cache);
+	machine->block_cache = NULL;
+}
+
+/** Vykona instrukcie virtualneho stroja po predekodovanych blokoch.
+ * Blok sa pri prvom vykonani predekoduje do pola operacii, v ktorom su casti
+ * postupnosti instrukcii spojene do superinstrukcii, a ulozi sa podla adresy. Dalsie
+ * vykonania bloku uz instrukcie nenacitavaju ani nedekoduju. Zapis do pamate na stranku
+ * s predekodovanym kodom bloky danej stranky zneplatni.
+ * Ak limit instrukcii nestaci na cely blok, zvysok sa vykona interpretom, takze pocet
+ * vykonanych instrukcii aj stav stroja su rovnake ako pri vykonavani interpretom.
+ * @param machine popisovac virtualneho stroja
+ * @param limit limit vykonanych instrukcii, 0 znamena bez limitu
+ * @return dovod prerusenia behu stroja, rovnako ako pri interprete
+ */
+VM_STATE vmExecBlocks(VIRTUAL_MACHINE * machine, uint16_t limit) {
+	static const void * dispatch[BOP_COUNT] = {
+		&&op_illegal,
+		&&op_branch, &&op_branchl,
+		&&op_load, &&op_load_predec, &&op_load_postinc, &&op_load_byte,
+		&&op_store, &&op_store_predec, &&op_store_postinc, &&op_store_byte,
+		&&op_iload,
+		&&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod, &&op_and, &&op_or, &&op_xor,
+		&&op_adds, &&op_subs, &&op_muls, &&op_divs, &&op_mods, &&op_ands, &&op_ors, &&op_xors,
+		&&op_shl, &&op_shr, &&op_not, &&op_flinvert,
+		&&op_addc, &&op_subc, &&op_addcs, &&op_subcs,
+		&&op_mov, &&op_swap, &&op_int,
+		&&op_li16, &&op_push2, &&op_pop2, &&op_subs_branch, &&op_subcs_branch,
+		&&op_setpc, &&op_end, &&op_exit
+	};
+	BLOCK_CACHE * cache = machine->block_cache;
+	uint32_t remaining = (limit != 0) ? limit : 1;
+	uint8_t step = (limit != 0);
+	uint16_t * reg = machine->registers;
+	const BLOCK_OP * op;
+	BLOCK * block;
+	uint8_t vm_state;
+	signed long result;
+	signed long flags_result = 0;
+	uint8_t flags_lazy = 0;
+	const int flat = __flatMemory(machine);
+	const int bus = (machine->devices != NULL);
+
+	if (cache == NULL) {
+		cache = machine->block_cache = calloc(1, sizeof(BLOCK_CACHE));
+		if (cache == NULL) return vmInterpret(machine, limit);
+	}
+
+/* Odlozene priznaky, rovnako ako v interprete (vid interp.h). Pred volanim interpretu
+ * a pred navratom musia byt priznaky v machine->flags platne. */
+#define LAZY_FLAGS(_r) \
+	do { flags_result = (_r); flags_lazy = 1; } while (0)
+
+#define CLEAR_FLAGS() \
+	do { machine->flags = 0; flags_lazy = 0; } while (0)
+
+#define SYNC_FLAGS() \
+	do { if (flags_lazy) { machine->flags = __aluFlags(flags_result); flags_lazy = 0; } } while (0)
+
+#define EXIT(_state) \
+	do { SYNC_FLAGS(); machine->retired = limit - remaining; return (_state); } while (0)
+
+/* Ukonci beh uprostred bloku, z ktoreho sa vykonalo _retired instrukcii. */
+#define EXIT_IN_BLOCK(_state, _retired) \
+	do { if (step) remaining += block->length - (_retired); EXIT(_state); } while (0)
+
+/* Vykona instrukcie interpretom a skonci, zapocitaju sa aj instrukcie vykonane interpretom. */
+#define EXIT_INTERPRET(_limit) \
+	do { \
+		SYNC_FLAGS(); \
+		vm_state = vmInterpret(machine, (_limit)); \
+		if (step) remaining -= machine->retired; \
+		EXIT(vm_state); \
+	} while (0)
+
+#define DISPATCH() \
+	do { \
+		if (op->cond) { \
+			SYNC_FLAGS(); \
+			if (!(machine->flags & op->cond)) { op++; goto skip; } \
+		} \
+		goto *dispatch[op->handler]; \
+	} while (0)
+
+#define NEXT() \
+	do { \
+		op++; \
+		DISPATCH(); \
+	} while (0)
+
+/* Pri standardnych operaciach pamate sa do pamate pristupuje priamo, bez nepriameho volania,
+ * stranky zariadeni a vlastne operacie pamate idu cez zbernicu. */
+#define DIRECT(_a) (flat && !(bus && __devicePage(machine, (_a))))
+
+#define MEM_READ(_a, _half) \
+	(DIRECT(_a) ? __memRead(machine->memory, (_a), (_half)) : vmBusRead(machine, (_a), (_half)))
+
+#define MEM_WRITE(_a, _d, _half) \
+	if (DIRECT(_a)) __memWrite(machine->memory, (_a), (_d), (_half)); \
+	else vmBusWrite(machine, (_a), (_d), (_half))
+
+#define FAULT(_a, _pc, _retired) \
+	if ((vm_state = __checkAddressValid(machine, (_a))) != VM_OK) { \
+		reg[15] = (_pc); \
+		machine->fault_address = (_a); \
+		EXIT_IN_BLOCK(vm_state, (_retired)); \
+	}
+
+/* Zapis na stranku chranenu proti zapisu skonci chybou, instrukcia sa nevykona. Nezarovnane
+ * slovo na konci stranky zasahuje aj nasledujucu stranku. */
+#define PROTECTED(_a, _half, _pc, _retired) \
+	if (__storeFlags(machine, (_a), (_half)) & VM_PAGE_READONLY) { \
+		reg[15] = (_pc); \
+		machine->fault_address = (_a); \
+		EXIT_IN_BLOCK(VM_WRITE_PROTECTED, (_retired)); \
+	}
+
+/* Zapis do predekodovaneho kodu ukonci blok za aktualnou instrukciou. Ak bol adresovym
+ * registrom PC, instrukcia uz PC nastavila sama. */
+#define PAGE_WRITTEN(_a, _half, _pc, _retired) \
+	if (__storeFlags(machine, (_a), (_half)) && vmPageWritten(machine, (_a), (_half))) { \
+		if (op->arg1 != 15) reg[15] = (_pc); \
+		if (step) remaining += block->length - (_retired); \
+		goto block_end; \
+	}
+
+	machine->ext_interrupt = 0;
+	for (;;) {
+		if (cache->graveyard != NULL) __freeGraveyard(cache);
+		if ((vm_state = __checkAddressValid(machine, reg[15])) != VM_OK) {
+			machine->fault_address = reg[15];
+			EXIT(vm_state);
+		}
+		if (reg[15] & 1) {
+			/* neparne PC je mozne iba pri VM_MEMORY_FULL bez kontroly zarovnania, vykona ho interpret */
+			SYNC_FLAGS();
+			if ((vm_state = vmInterpret(machine, 1)) != VM_OK) {
+				if (step) remaining -= machine->retired;
+				EXIT(vm_state);
+			}
+			remaining -= step;
+			goto block_end;
+		}
+		block = cache->map[reg[15] >> 1];
+		if (block == NULL) {
+			block = __compileBlock(machine, cache, reg[15]);
+			if (block == NULL) EXIT_INTERPRET(step ? remaining : 0);
+		}
+		if (step) {
+			if (remaining < block->length) EXIT_INTERPRET(remaining);
+			remaining -= block->length;
+		}
+		op = block->ops;
+		DISPATCH();
+
+skip:
+		DISPATCH();
+
+op_branchl:
+		reg[14] = op->pc;
+op_branch:
+		reg[15] = op->data;
+		goto block_end;
+
+op_load_predec:
+		reg[op->arg1] -= 2;
+op_load:
+		FAULT(reg[op->arg1], op->pc, op->retired - 1);
+		reg[op->arg2] = MEM_READ(reg[op->arg1], MEM_OP_WORD);
+		NEXT();
+
+op_load_postinc:
+		FAULT(reg[op->arg1], op->pc, op->retired - 1);
+		reg[op->arg2] = MEM_READ(reg[op->arg1], MEM_OP_WORD);
+		reg[op->arg1] += 2;
+		NEXT();
+
+op_load_byte:
+		FAULT(reg[op->arg1], op->pc, op->retired - 1);
+		reg[op->arg2] = MEM_READ(reg[op->arg1], MEM_OP_BYTE);
+		NEXT();
+
+op_store_predec:
+		reg[op->arg1] -= 2;
+op_store:
+		FAULT(reg[op->arg1], op->pc, op->retired - 1);
+		PROTECTED(reg[op->arg1], MEM_OP_WORD, op->pc, op->retired - 1);
+		MEM_WRITE(reg[op->arg1], reg[op->arg2], MEM_OP_WORD);
+		PAGE_WRITTEN(reg[op->arg1], MEM_OP_WORD, op->pc, op->retired);
+		NEXT();
+
+op_store_postinc:
+		FAULT(reg[op->arg1], op->pc, op->retired - 1);
+		PROTECTED(reg[op->arg1], MEM_OP_WORD, op->pc, op->retired - 1);
+		MEM_WRITE(reg[op->arg1], reg[op->arg2], MEM_OP_WORD);
+		reg[op->arg1] += 2;
+		PAGE_WRITTEN(reg[op->arg1] - 2, MEM_OP_WORD, op->pc, op->retired);
+		NEXT();
+
+op_store_byte:
+		FAULT(reg[op->arg1], op->pc, op->retired - 1);
+		PROTECTED(reg[op->arg1], MEM_OP_BYTE, op->pc, op->retired - 1);
+		MEM_WRITE(reg[op->arg1], reg[op->arg2], MEM_OP_BYTE);
+		PAGE_WRITTEN(reg[op->arg1], MEM_OP_BYTE, op->pc, op->retired);
+		NEXT();
+
+op_iload:
+		reg[op->arg1] = (reg[op->arg1] << 8) | op->arg2;
+		NEXT();
+
+op_add:	reg[op->arg1] += reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_sub:	reg[op->arg1] -= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_mul:	reg[op->arg1] = (uint32_t) reg[op->arg1] * reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_div:	reg[op->arg1] /= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_mod:	reg[op->arg1] %= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_and:	reg[op->arg1] &= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_or:	reg[op->arg1] |= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_xor:	reg[op->arg1] ^= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+
+op_adds:	result = (signed long) reg[op->arg1] + reg[op->arg2]; goto alu_flags;
+op_subs:	result = (signed long) reg[op->arg1] - reg[op->arg2]; goto alu_flags;
+op_muls:	result = (signed long) reg[op->arg1] * reg[op->arg2]; goto alu_flags;
+op_divs:	result = (signed long) reg[op->arg1] / reg[op->arg2]; goto alu_flags;
+op_mods:	result = (signed long) reg[op->arg1] % reg[op->arg2]; goto alu_flags;
+op_ands:	result = reg[op->arg1] & reg[op->arg2]; goto alu_flags;
+op_ors:		result = reg[op->arg1] | reg[op->arg2]; goto alu_flags;
+op_xors:	result = reg[op->arg1] ^ reg[op->arg2];
+alu_flags:
+		LAZY_FLAGS(result);
+		reg[op->arg1] = result & 0xFFFF;
+		NEXT();
+
+op_shl:
+		reg[op->arg1] <<= op->arg2;
+		NEXT();
+
+op_shr:
+		reg[op->arg1] >>= op->arg2;
+		NEXT();
+
+op_not:
+		reg[op->arg2] = ~reg[op->arg2];
+		NEXT();
+
+op_flinvert:
+		SYNC_FLAGS();
+		machine->flags = machine->flags ^ ~(op->arg2 << 4);
+		NEXT();
+
+op_addc:
+		reg[op->arg1] += op->arg2;
+		NEXT();
+
+op_subc:
+		reg[op->arg1] -= op->arg2;
+		NEXT();
+
+op_addcs:
+		reg[op->arg1] += op->arg2;
+		LAZY_FLAGS(reg[op->arg1]);
+		NEXT();
+
+op_subcs:
+		reg[op->arg1] -= op->arg2;
+		LAZY_FLAGS(reg[op->arg1]);
+		NEXT();
+
+op_mov:
+		reg[op->arg1] = reg[op->arg2];
+		NEXT();
+
+op_swap:
+		result = reg[op->arg1];
+		reg[op->arg1] = reg[op->arg2];
+		reg[op->arg2] = result;
+		NEXT();
+
+op_int:
+		reg[15] = op->pc;
+		machine->ext_interrupt = op->arg1 << 4 | op->arg2;
+		EXIT_IN_BLOCK(VM_SOFTINT, op->retired);
+
+op_illegal:
+		reg[15] = op->pc;
+		machine->fault_address = op->pc - 2;
+		EXIT_IN_BLOCK(VM_ILLEGAL_OPCODE, op->retired - 1);
+
+op_li16:
+		reg[op->arg1] = op->data;
+		NEXT();
+
+op_push2:
+		reg[op->arg1] -= 2;
+		FAULT(reg[op->arg1], op->pc - 2, op->retired - 2);
+		PROTECTED(reg[op->arg1], MEM_OP_WORD, op->pc - 2, op->retired - 2);
+		MEM_WRITE(reg[op->arg1], reg[op->arg2], MEM_OP_WORD);
+		PAGE_WRITTEN(reg[op->arg1], MEM_OP_WORD, op->pc - 2, op->retired - 1);
+		reg[op->arg1] -= 2;
+		FAULT(reg[op->arg1], op->pc, op->retired - 1);
+		PROTECTED(reg[op->arg1], MEM_OP_WORD, op->pc, op->retired - 1);
+		MEM_WRITE(reg[op->arg1], reg[op->data], MEM_OP_WORD);
+		PAGE_WRITTEN(reg[op->arg1], MEM_OP_WORD, op->pc, op->retired);
+		NEXT();
+
+op_pop2:
+		FAULT(reg[op->arg1], op->pc - 2, op->retired - 2);
+		reg[op->arg2] = MEM_READ(reg[op->arg1], MEM_OP_WORD);
+		reg[op->arg1] += 2;
+		FAULT(reg[op->arg1], op->pc, op->retired - 1);
+		reg[op->data] = MEM_READ(reg[op->arg1], MEM_OP_WORD);
+		reg[op->arg1] += 2;
+		NEXT();
+
+op_subs_branch:
+		result = (signed long) reg[op->arg1] - reg[op->arg2];
+		LAZY_FLAGS(result);
+		reg[op->arg1] = result & 0xFFFF;
+		reg[15] = (__aluFlags(result) & op->aux) ? op->data : op->pc;
+		goto block_end;
+
+op_subcs_branch:
+		reg[op->arg1] -= op->arg2;
+		LAZY_FLAGS(reg[op->arg1]);
+		reg[15] = (reg[op->arg1] == 0 && (op->aux & ZERO_FLAG)) ? op->data : op->pc;
+		goto block_end;
+
+op_setpc:
+		reg[15] = op->data;
+		NEXT();
+
+op_end:
+		reg[15] = op->data;
+op_exit:
+block_end:
+		if (step && remaining == 0) EXIT(VM_OK);
+		if (__interruptPending(machine)) EXIT(VM_OK);
+	}
+
+#undef PAGE_WRITTEN
+#undef PROTECTED
+#undef FAULT
+#undef MEM_WRITE
+#undef MEM_READ
+#undef DIRECT
+#undef NEXT
+#undef DISPATCH
+#undef EXIT_INTERPRET
+#undef EXIT_IN_BLOCK
+#undef EXIT
+#undef SYNC_FLAGS
+#undef CLEAR_FLAGS
+#undef LAZY_FLAGS
+}
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/** Pripoji zariadenie na stranky adresneho priestoru stroja.
+ * Citanie a zapis instrukciami na adresu v mapovanej oblasti sa namiesto pamate stroja
+ * posle obsluhe zariadenia s posunom adresy od zaciatku oblasti. Ak je read alebo write
+ * NULL, ide dany smer do pamate stroja (napr. zariadenie iba so zapisom, alebo pamat iba
+ * na citanie s obsluhou zapisu, ktora zapis zahodi). O zariadeni rozhoduje stranka adresy
+ * pristupu, nezarovnane slovo na konci stranky teda patri cele jej stranke. Instrukcie sa
+ * z mapovanych stranok nacitavaju vzdy z pamate stroja. Ostatne stranky zostavaju na
+ * priamom pristupe do pamate. Funkcia sa nesmie volat pocas behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param address zaciatok oblasti, musi byt nasobkom VM_PAGE_SIZE
+ * @param length dlzka oblasti v bytoch, zaokruhli sa nahor na cele stranky
+ * @param read obsluha citania, alebo NULL
+ * @param write obsluha zapisu, alebo NULL
+ * @param device parameter obsluh zariadenia
+ * @return 0 ak bolo zariadenie pripojene, -1 ak oblast nie je zarovnana, nie je cela
+ * v pamati stroja, prekryva ine zariadenie, alebo sa nepodarilo alokovat tabulku stranok
+ */
+int mapDeviceVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t length, vmDeviceRead read, vmDeviceWrite write, void * device) {
+	struct DeviceBus * bus = machine->devices;
+	uint32_t first = address / VM_PAGE_SIZE, last = ((uint32_t) address + length + VM_PAGE_SIZE - 1) / VM_PAGE_SIZE, page;
+	uint32_t limit = (machine->mem_flags & VM_MEMORY_FULL) ? VM_MEMORY_FULL_SIZE : machine->mem_size;
+
+	if (length == 0 || (address % VM_PAGE_SIZE) != 0 || last * VM_PAGE_SIZE > limit) return -1;
+	for (page = first; page < last; page++) {
+		if (machine->page_flags[page] & VM_PAGE_DEVICE) return -1;
+	}
+	if (bus == NULL && (bus = calloc(1, sizeof(struct DeviceBus))) == NULL) return -1;
+	machine->devices = bus;
+	for (page = first; page < last; page++) {
+		bus->pages[page].read = read;
+		bus->pages[page].write = write;
+		bus->pages[page].device = device;
+		bus->pages[page].base = address;
+		machine->page_flags[page] |= VM_PAGE_DEVICE;
+		bus->mapped++;
+	}
+	/* prelozeny kod cita pamat priamo, bez kontroly stranok zariadeni */
+	vmJitInvalidate(machine);
+	return 0;
+}
+
+/** Odpoji zariadenia zo stranok adresneho priestoru stroja.
+ * Stranky oblasti sa vratia pamati stroja. Ked sa odpoji posledne zariadenie, stroj sa
+ * vrati k jadrom bez kontroly stranok zariadeni. Funkcia sa nesmie volat pocas behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param address zaciatok oblasti
+ * @param length dlzka oblasti v bytoch
+ */
+void unmapDeviceVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t length) {
+	struct DeviceBus * bus = machine->devices;
+	uint32_t page;
+	if (bus == NULL || length == 0) return;
+	for (page = address / VM_PAGE_SIZE; page <= ((uint32_t) address + length - 1) / VM_PAGE_SIZE && page < VM_PAGE_COUNT; page++) {
+		if (!(machine->page_flags[page] & VM_PAGE_DEVICE)) continue;
+		machine->page_flags[page] &= ~VM_PAGE_DEVICE;
+		bus->mapped--;
+	}
+	if (bus->mapped == 0) {
+		free(bus);
+		machine->devices = NULL;
+	}
+}
+
+/** Nacita slovo alebo byte z adresy stroja cez zbernicu.
+ * Pouzivaju ho jadra pre stranky s VM_PAGE_DEVICE a kod mimo jadier, ktory cita pamat
+ * stroja ako program stroja. Pri zazname vstupov sa nacitana hodnota zaznamena, pri
+ * prehravani sa nahradi hodnotou zo zaznamu.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @param half ak je 1, nacita iba jeden byte
+ * @return nacitana hodnota
+ */
+uint16_t vmBusRead(VIRTUAL_MACHINE * machine, uint16_t address, int half) {
+	struct DevicePage * page = NULL;
+	uint16_t data;
+	if (__devicePage(machine, address)) page = &machine->devices->pages[address >> 8];
+	if (page != NULL && page->read != NULL) data = page->read(page->device, address - page->base, half);
+	else data = machine->read_func(machine->memory, address, half);
+	if (machine->recording != NULL) data = vmRecordRead(machine, address, half, data);
+	return data;
+}
+
+/** Zapise slovo alebo byte na adresu stroja cez zbernicu.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @param data zapisovana hodnota
+ * @param half ak je 1, zapise iba jeden byte
+ */
+void vmBusWrite(VIRTUAL_MACHINE * machine, uint16_t address, uint16_t data, int half) {
+	struct DevicePage * page;
+	if (__devicePage(machine, address)) {
+		page = &machine->devices->pages[address >> 8];
+		if (page->write != NULL) {
+			page->write(page->device, address - page->base, half ? (data & 0xFF) : data, half);
+			return;
+		}
+	}
+	machine->write_func(machine->memory, address, data, half);
+}
+
+/** Nacita slovo alebo byte z adresy stroja rovnako ako instrukcia LOAD.
+ * Pouziva ho kod prelozeny vopred (maot) pre stranky so zariadenim, hostitel ho moze pouzit
+ * na citanie pamate stroja vratane zariadeni.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @param half ak je 1, nacita iba jeden byte
+ * @return nacitana hodnota
+ */
+uint16_t readMemoryVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, int half) {
+	return vmBusRead(machine, address, half);
+}
+
+/** Zapise slovo alebo byte na adresu stroja rovnako ako instrukcia STORE.
+ * Zapis na stranku chranenu proti zapisu sa nevykona, zapis na stranku s atributmi sa ohlasi
+ * (zneplatni predekodovany aj prelozeny kod stranky, oznaci stranku ako zmenenu pre snimky
+ * a kontrolne body). Pouziva ho kod prelozeny vopred (maot) pre stranky s atributmi.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @param data zapisovana hodnota
+ * @param half ak je 1, zapise iba jeden byte
+ * @return VM_OK, alebo VM_WRITE_PROTECTED s adresou v fault_address
+ */
+VM_STATE writeMemoryVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint16_t data, int half) {
+	if (__checkWritable(machine, address, half) != VM_OK) {
+		machine->fault_address = address;
+		return VM_WRITE_PROTECTED;
+	}
+	vmBusWrite(machine, address, data, half);
+	if (__storeFlags(machine, address, half)) vmPageWritten(machine, address, half);
+	return VM_OK;
+}
@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/// Najvacsia dlzka zakodovanej stranky: kazdy beh okrem posledneho pokryva aspon 2 byty
+#define ENCODED_PAGE_MAX	(VM_PAGE_SIZE + 2 * (VM_PAGE_SIZE / 2 + 1))
+
+/// Verzia formatu suboru, verzia 2 pridala do zaznamu cas stroja
+#define CHECKPOINT_VERSION	2
+
+/// Dlzka hlavicky zaznamu: druh, pozicia, registre, priznaky, ext_interrupt, posledny byte, cas stroja, pocet stranok
+#define RECORD_HEADER		(1 + 8 + 8 + 16 * 2 + 1 + 1 + 1 + 2)
+
+/// Pocet poloziek nacitanej hlavicky zaznamu (bez druhu a poctu stranok)
+#define RECORD_FIELDS		21
+
+/// Dlzka zaznamu so vsetkymi strankami
+#define RECORD_MAX			(RECORD_HEADER + VM_PAGE_COUNT * (1 + 2 + ENCODED_PAGE_MAX))
+
+enum { CHECKPOINT_DELTA = 0, CHECKPOINT_KEY };
+
+/** Subor kontrolnych bodov otvoreny pre zapis. */
+struct VirtualMachineCheckpoint {
+	VIRTUAL_MACHINE * machine;
+	FILE * file;
+	uint32_t length;				// dlzka pamate stroja v bytoch
+	uint8_t key;					// dalsi zaznam bude uplny
+	unsigned char * shadow;			// obsah pamate v case posledneho kontrolneho bodu
+	unsigned char * record;			// zostavovany zaznam
+};
+
+/** Zapise cislo v poradi MSB, LSB do pamate.
+ * @param p miesto zapisu
+ * @param value hodnota
+ * @param bytes pocet bytov
+ * @return miesto za zapisanym cislom
+ */
+static unsigned char * __putNumber(unsigned char * p, uint64_t value, int bytes) {
+	while (bytes-- > 0) *p++ = (value >> (8 * bytes)) & 0xFF;
+	return p;
+}
+
+/** Nacita cislo v poradi MSB, LSB zo suboru.
+ * @param f vstupny subor
+ * @param value miesto pre hodnotu
+ * @param bytes pocet bytov
+ * @return 0 ak sa cislo podarilo nacitat, -1 na konci suboru
+ */
+static int __readNumber(FILE * f, uint64_t * value, int bytes) {
+	int c;
+	*value = 0;
+	while (bytes-- > 0) {
+		if ((c = fgetc(f)) == EOF) return -1;
+		*value = (*value << 8) | c;
+	}
+	return 0;
+}
+
+/** Zakoduje rozdiel stranky (XOR s predchadzajucim obsahom) ako postupnost behov:
+ * pocet nulovych bytov (1 byte), pocet literalov (1 byte) a literaly.
+ * @param delta rozdiel stranky
+ * @param size dlzka stranky
+ * @param out miesto pre zakodovany rozdiel, najmenej ENCODED_PAGE_MAX bytov
+ * @return dlzka zakodovaneho rozdielu, 0 ak je rozdiel nulovy
+ */
+static unsigned __encodePage(const unsigned char * delta, unsigned size, unsigned char * out) {
+	unsigned pos = 0, length = 0, zeros, literals;
+	while (pos < size) {
+		for (zeros = 0; pos + zeros < size && zeros < 255 && delta[pos + zeros] == 0; zeros++);
+		if (pos + zeros == size) break;
+		pos += zeros;
+		for (literals = 0; pos + literals < size && literals < 255 && delta[pos + literals] != 0; literals++);
+		out[length++] = zeros;
+		out[length++] = literals;
+		memcpy(out + length, delta + pos, literals);
+		length += literals;
+		pos += literals;
+	}
+	return length;
+}
+
+/** Nacita a dekoduje zvysok zaznamu kontrolneho bodu (za druhom zaznamu).
+ * @param f vstupny subor
+ * @param length dlzka pamate
+ * @param delta vynulovany rozdiel pamate, doplnia sa don zmenene stranky
+ * @param header miesto pre poziciu, registre, priznaky, ext_interrupt, posledny byte a cas stroja
+ * @return 0 ak je zaznam cely a spravny, -1 inac
+ */
+static int __readRecord(FILE * f, uint32_t length, unsigned char * delta, uint64_t * header) {
+	unsigned char data[ENCODED_PAGE_MAX];
+	uint64_t value, pages, page, size;
+	unsigned q, pos, run;
+	if (__readNumber(f, &header[0], 8) != 0) return -1;
+	for (q = 1; q <= 16; q++) if (__readNumber(f, &header[q], 2) != 0) return -1;
+	for (q = 17; q <= 19; q++) if (__readNumber(f, &header[q], 1) != 0) return -1;
+	if (__readNumber(f, &header[20], 8) != 0) return -1;
+	if (__readNumber(f, &pages, 2) != 0) return -1;
+	while (pages-- > 0) {
+		if (__readNumber(f, &page, 1) != 0 || __readNumber(f, &value, 2) != 0) return -1;
+		if (value > ENCODED_PAGE_MAX || page * VM_PAGE_SIZE >= length) return -1;
+		if (fread(data, 1, value, f) != value) return -1;
+		size = length - page * VM_PAGE_SIZE;
+		if (size > VM_PAGE_SIZE) size = VM_PAGE_SIZE;
+		for (q = 0, pos = 0; q + 2 <= value; ) {
+			pos += data[q];
+			run = data[q + 1];
+			q += 2;
+			if (pos + run > size || q + run > value) return -1;
+			memcpy(delta + page * VM_PAGE_SIZE + pos, data + q, run);
+			pos += run;
+			q += run;
+		}
+		if (q != value) return -1;
+	}
+	return 0;
+}
+
+/** Vytvori subor kontrolnych bodov stroja.
+ * Prvy zaznam po vytvoreni obsahuje celu pamat, dalsie iba stranky zmenene od
+ * predchadzajuceho kontrolneho bodu. Pri append sa zaznamy pridaju za posledny cely
+ * zaznam existujuceho suboru (napr. po obnoveni z neho), ak subor neexistuje, vytvori sa.
+ * @param machine popisovac virtualneho stroja
+ * @param filename nazov suboru
+ * @param append 1 ak sa ma pokracovat v existujucom subore
+ * @return subor kontrolnych bodov, NULL pri chybe alebo ak existujuci subor patri
+ * stroju s inou velkostou pamate
+ */
+VM_CHECKPOINT * createCheckpointVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename, int append) {
+	VM_CHECKPOINT * checkpoint = calloc(1, sizeof(VM_CHECKPOINT));
+	unsigned char header[8];
+	unsigned page;
+	if (checkpoint == NULL) return NULL;
+	checkpoint->machine = machine;
+	checkpoint->length = __memoryLength(machine, 0);
+	checkpoint->key = 1;
+	checkpoint->shadow = calloc(1, checkpoint->length);
+	checkpoint->record = malloc(RECORD_MAX);
+	if (checkpoint->shadow == NULL || checkpoint->record == NULL) goto fail;
+	__putNumber(header + 3, CHECKPOINT_VERSION, 1);
+	__putNumber(header + 4, checkpoint->length, 4);
+	memcpy(header, "CKP", 3);
+	if (append && (checkpoint->file = fopen(filename, "r+b")) != NULL) {
+		unsigned char existing[8];
+		uint64_t kind, state[RECORD_FIELDS];
+		long end = 8;
+		if (fread(existing, 1, 8, checkpoint->file) != 8 || memcmp(existing, header, 8) != 0) goto fail;
+		/* nedokonceny zaznam na konci suboru sa prepise */
+		while (__readNumber(checkpoint->file, &kind, 1) == 0 && __readRecord(checkpoint->file, checkpoint->length, checkpoint->shadow, state) == 0) {
+			end = ftell(checkpoint->file);
+		}
+		memset(checkpoint->shadow, 0, checkpoint->length);
+		if (fseek(checkpoint->file, end, SEEK_SET) != 0 || ftruncate(fileno(checkpoint->file), end) != 0) goto fail;
+	} else {
+		if ((checkpoint->file = fopen(filename, "wb")) == NULL) goto fail;
+		if (fwrite(header, 1, 8, checkpoint->file) != 8 || fflush(checkpoint->file) != 0) goto fail;
+	}
+	for (page = 0; page < VM_PAGE_COUNT; page++) machine->page_flags[page] &= ~VM_PAGE_CHECKPOINT;
+	return checkpoint;
+
+fail:
+	if (checkpoint->file != NULL) fclose(checkpoint->file);
+	free(checkpoint->shadow);
+	free(checkpoint->record);
+	free(checkpoint);
+	return NULL;
+}
+
+/** Zapise kontrolny bod: cas stroja, registre, priznaky, ext_interrupt a stranky pamate zmenene od
+ * predchadzajuceho kontrolneho bodu, ako rozdiel voci ich predchadzajucemu obsahu.
+ * Zmenene stranky sa zistuju z page_flags, prvy zapis na stranku po kontrolnom bode sa
+ * ohlasi cez vmPageWritten. Zaznam sa na disk zapise cely naraz, nedokonceny zaznam na
+ * konci suboru sa pri obnoveni ignoruje.
+ * @param checkpoint subor kontrolnych bodov
+ * @param position pozicia kontrolneho bodu urcena volajucim (napr. pocet vykonanych instrukcii)
+ * @return 0 ak bol kontrolny bod zapisany, -1 pri chybe
+ */
+int writeCheckpointVirtualMachine(VM_CHECKPOINT * checkpoint, uint64_t position) {
+	VIRTUAL_MACHINE * machine = checkpoint->machine;
+	unsigned char delta[VM_PAGE_SIZE];
+	unsigned char * p = checkpoint->record + RECORD_HEADER, * h;
+	unsigned page, pages = 0, q;
+	uint8_t tail = (machine->mem_flags & VM_MEMORY_FULL) ? machine->memory[VM_MEMORY_FULL_SIZE] : 0;
+
+	for (page = 0; page < VM_PAGE_COUNT; page++) {
+		uint32_t base = page * VM_PAGE_SIZE, size;
+		unsigned length;
+		if (base >= checkpoint->length) break;
+		/* nezarovnany zapis slova na konci predchadzajucej stranky meni iba prvy byte */
+		if ((machine->page_flags[page] & VM_PAGE_CHECKPOINT) && machine->memory[base] == checkpoint->shadow[base]) continue;
+		size = checkpoint->length - base;
+		if (size > VM_PAGE_SIZE) size = VM_PAGE_SIZE;
+		for (q = 0; q < size; q++) delta[q] = machine->memory[base + q] ^ checkpoint->shadow[base + q];
+		length = __encodePage(delta, size, p + 3);
+		memcpy(checkpoint->shadow + base, machine->memory + base, size);
+		if (length == 0) continue;
+		p = __putNumber(p, page, 1);
+		p = __putNumber(p, length, 2);
+		p += length;
+		pages++;
+	}
+
+	h = __putNumber(checkpoint->record, checkpoint->key ? CHECKPOINT_KEY : CHECKPOINT_DELTA, 1);
+	h = __putNumber(h, position, 8);
+	for (q = 0; q < 16; q++) h = __putNumber(h, machine->registers[q], 2);
+	h = __putNumber(h, machine->flags, 1);
+	h = __putNumber(h, machine->ext_interrupt, 1);
+	h = __putNumber(h, tail, 1);
+	h = __putNumber(h, machine->clock, 8);
+	__putNumber(h, pages, 2);
+
+	if (fwrite(checkpoint->record, 1, p - checkpoint->record, checkpoint->file) != (size_t) (p - checkpoint->record) ||
+		fflush(checkpoint->file) != 0) {
+		/* tien uz nezodpoveda suboru, dalsi zaznam bude uplny */
+		memset(checkpoint->shadow, 0, checkpoint->length);
+		for (page = 0; page < VM_PAGE_COUNT; page++) machine->page_flags[page] &= ~VM_PAGE_CHECKPOINT;
+		checkpoint->key = 1;
+		return -1;
+	}
+	for (page = 0; page < VM_PAGE_COUNT; page++) machine->page_flags[page] |= VM_PAGE_CHECKPOINT;
+	checkpoint->key = 0;
+	return 0;
+}
+
+/** Zatvori subor kontrolnych bodov.
+ * @param checkpoint subor kontrolnych bodov
+ * @return 0 ak sa subor podarilo zatvorit, -1 pri chybe
+ */
+int destroyCheckpointVirtualMachine(VM_CHECKPOINT * checkpoint) {
+	int rc = (fclose(checkpoint->file) == 0) ? 0 : -1;
+	free(checkpoint->shadow);
+	free(checkpoint->record);
+	free(checkpoint);
+	return rc;
+}
+
+/** Obnovi stav stroja z kontrolneho bodu v subore.
+ * Stroj musi mat rovnako velku pamat, ako stroj, ktory kontrolne body zapisal. Predekodovany
+ * kod sa zneplatni a cela pamat sa oznaci ako zmenena.
+ * @param machine popisovac virtualneho stroja
+ * @param filename nazov suboru kontrolnych bodov
+ * @param index poradove cislo kontrolneho bodu od 0, alebo -1 pre posledny
+ * @param position miesto pre poziciu obnoveneho kontrolneho bodu, alebo NULL
+ * @return poradove cislo obnoveneho kontrolneho bodu, -1 pri chybe
+ */
+long loadCheckpointVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename, long index, uint64_t * position) {
+	uint32_t length = __memoryLength(machine, 0), q;
+	uint64_t header[RECORD_FIELDS], state[RECORD_FIELDS], kind;
+	unsigned char expected[8], existing[8];
+	unsigned char * image, * delta;
+	long loaded = -1;
+	FILE * f = fopen(filename, "rb");
+	if (f == NULL) return -1;
+	memcpy(expected, "CKP", 3);
+	__putNumber(expected + 3, CHECKPOINT_VERSION, 1);
+	__putNumber(expected + 4, length, 4);
+	image = calloc(1, length);
+	delta = malloc(length);
+	if (image == NULL || delta == NULL || fread(existing, 1, 8, f) != 8 || memcmp(existing, expected, 8) != 0) {
+		fclose(f);
+		free(image);
+		free(delta);
+		return -1;
+	}
+	while ((index < 0 || loaded < index) && __readNumber(f, &kind, 1) == 0) {
+		memset(delta, 0, length);
+		if (__readRecord(f, length, delta, header) != 0) break;
+		if (kind == CHECKPOINT_KEY) memset(image, 0, length);
+		for (q = 0; q < length; q++) image[q] ^= delta[q];
+		memcpy(state, header, sizeof(state));
+		loaded++;
+	}
+	fclose(f);
+	if (loaded >= 0 && (index < 0 || loaded == index)) {
+		memcpy(machine->memory, image, length);
+		if (machine->mem_flags & VM_MEMORY_FULL) machine->memory[VM_MEMORY_FULL_SIZE] = state[19];
+		for (q = 0; q < 16; q++) machine->registers[q] = state[q + 1];
+		machine->flags = state[17];
+		machine->ext_interrupt = state[18];
+		machine->clock = state[20];
+		if (position != NULL) *position = state[0];
+		for (q = 0; q < length; q += VM_PAGE_SIZE) invalidateCodeVirtualMachine(machine, q, VM_PAGE_SIZE);
+	} else {
+		loaded = -1;
+	}
+	free(image);
+	free(delta);
+	return loaded;
+}
@@ -0,0 +1,233 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/** Zhluk jadier, ktore zdielaju pamat stroja. */
+struct VirtualMachineCluster {
+	VIRTUAL_MACHINE * cores[VM_CLUSTER_CORES];
+	unsigned count;
+};
+
+/** Spustenie behu jadier zhluku, vlakna jadier cakaju, kym su vytvorene vsetky. */
+struct ClusterStart {
+	pthread_mutex_t lock;
+	pthread_cond_t signal;
+	int state;						// 0 vlakna cakaju, 1 jadra bezia, -1 beh sa rusi
+};
+
+/** Beh jedneho jadra zhluku na vlastnom vlakne hostitela. */
+struct ClusterRun {
+	VIRTUAL_MACHINE * core;
+	uint64_t budget;
+	VM_STOP * stop;
+	struct ClusterStart * start;
+	pthread_t thread;
+};
+
+/** Skopiruje do noveho jadra zariadenia a nativne funkcie prveho jadra.
+ * Stranky zariadeni aj instrukcie INT VM_INTERRUPT_NATIVE su v spolocnej pamati, jadro bez
+ * nich by pristupovalo do pamate, resp. skoncilo na kazdej nativnej funkcii.
+ * @param core nove jadro
+ * @param machine prve jadro
+ * @return 0 ak sa podarilo, -1 ak nie je dost pamate
+ */
+static int __inherit(VIRTUAL_MACHINE * core, VIRTUAL_MACHINE * machine) {
+	uint32_t page;
+	if (machine->devices != NULL) {
+		if ((core->devices = malloc(sizeof(struct DeviceBus))) == NULL) return -1;
+		memcpy(core->devices, machine->devices, sizeof(struct DeviceBus));
+		for (page = 0; page < VM_PAGE_COUNT; page++) core->page_flags[page] |= machine->page_flags[page] & VM_PAGE_DEVICE;
+	}
+	if (machine->natives != NULL) {
+		if ((core->natives = calloc(1, sizeof(struct NativeTable))) == NULL) return -1;
+		if ((core->natives->bindings = malloc(machine->natives->capacity * sizeof(struct NativeBinding))) == NULL) return -1;
+		memcpy(core->natives->bindings, machine->natives->bindings, machine->natives->count * sizeof(struct NativeBinding));
+		core->natives->count = machine->natives->count;
+		core->natives->capacity = machine->natives->capacity;
+	}
+	return 0;
+}
+
+/** Vytvori zhluk jadier, ktore zdielaju pamat stroja.
+ * Stroj sa stane jadrom 0, dalsie jadra dostanu jeho pamat, nastavenie pamate, rezim,
+ * tabulku vektorov preruseni, pripojene zariadenia a nativne funkcie a kopiu jeho registrov
+ * vratane PC, program stroja si cislo jadra zisti instrukciou INT VM_INTERRUPT_CORE. Jadra
+ * sa vykonavaju kazde na svojom vlakne hostitela (runClusterVirtualMachine, alebo vlastne
+ * vlakna volajuceho s resumeVirtualMachine), udalosti, prerusenia a hodiny ma kazde jadro
+ * vlastne. Poradie pristupov do pamate medzi jadrami nie je definovane, okrem instrukcii
+ * INT VM_INTERRUPT_SWAP, ktora atomicky vymeni R0 so zarovnanym slovom na adrese R1 a je
+ * uplnou barierou: zapisy jadra pred nou uvidi kazde jadro, ktore po nej vymenu vykona.
+ * INT VM_INTERRUPT_IPI posle jadru R1 prerusenie cislo R0 (vid postInterruptVirtualMachine).
+ * Program, ktory jadra vykonavaju, sa pocas behu nesmie menit (predekodovany kod ineho jadra
+ * by zmenu nezistil) a obsluhy zariadeni musia byt pripravene na volanie z viacerych vlakien.
+ * Slucky necinnosti jadra neskracuju, lebo pamat moze zmenit ine jadro. Stroj musi mat
+ * standardne operacie pamate, pamat zarovnanu aspon na slovo hostitela a nesmie mat banky
+ * rozsirenej pamate, rezim VM_MODE_JIT_VERIFY jadra nepodporuju.
+ * @param machine popisovac virtualneho stroja, jadro 0
+ * @param cores pocet jadier, 1 az VM_CLUSTER_CORES
+ * @return zhluk, NULL ak stroj uz je v zhluku, nema standardne operacie pamate alebo zarovnanu pamat,
+ * ma banky, je v rezime VM_MODE_JIT_VERIFY, pocet jadier je nespravny alebo nie je dost pamate
+ */
+VM_CLUSTER * createClusterVirtualMachine(VIRTUAL_MACHINE * machine, unsigned cores) {
+	VM_CLUSTER * cluster;
+	VIRTUAL_MACHINE * core;
+	unsigned q;
+
+	if (machine->cluster != NULL || machine->banks != NULL || !__flatMemory(machine) || ((uintptr_t) machine->memory & 1) ||
+			machine->mode == VM_MODE_JIT_VERIFY || cores == 0 || cores > VM_CLUSTER_CORES) return NULL;
+	if ((cluster = calloc(1, sizeof(VM_CLUSTER))) == NULL) return NULL;
+	cluster->cores[0] = machine;
+	cluster->count = 1;
+	machine->cluster = cluster;
+	machine->core = 0;
+	for (q = 1; q < cores; q++) {
+		if ((core = createVirtualMachine((char *) machine->memory, machine->mem_size, machine->PC)) == NULL) break;
+		core->cluster = cluster;
+		core->core = q;
+		cluster->cores[cluster->count++] = core;
+		core->mem_flags = machine->mem_flags;
+		memcpy(core->registers, machine->registers, sizeof(core->registers));
+		core->flags = machine->flags;
+		core->interrupts->table = machine->interrupts->table;
+		if (setModeVirtualMachine(core, machine->mode) != 0 || __inherit(core, machine) != 0) break;
+	}
+	if (q < cores) {
+		destroyClusterVirtualMachine(cluster);
+		return NULL;
+	}
+	return cluster;
+}
+
+/** Zrusi zhluk a vsetky jeho jadra okrem jadra 0, ktoremu zostane pamat.
+ * Funkcia sa nesmie volat pocas behu jadier.
+ * @param cluster zhluk jadier
+ */
+void destroyClusterVirtualMachine(VM_CLUSTER * cluster) {
+	unsigned q;
+	for (q = 1; q < cluster->count; q++) destroyVirtualMachine(cluster->cores[q]);
+	cluster->cores[0]->cluster = NULL;
+	free(cluster);
+}
+
+/** Vrati jadro zhluku.
+ * @param cluster zhluk jadier
+ * @param core cislo jadra
+ * @return popisovac jadra, NULL ak jadro s takym cislom nie je
+ */
+VIRTUAL_MACHINE * getCoreVirtualMachine(VM_CLUSTER * cluster, unsigned core) {
+	return (core < cluster->count) ? cluster->cores[core] : NULL;
+}
+
+/** Atomicky vymeni slovo v spolocnej pamati.
+ * @param machine popisovac jadra
+ * @param address zarovnana adresa slova
+ * @param data zapisovane slovo
+ * @return povodne slovo
+ */
+static uint16_t __swap(VIRTUAL_MACHINE * machine, uint16_t address, uint16_t data) {
+	uint16_t * word = (uint16_t *) (machine->memory + address);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	/* pamat stroja je little endian */
+	return __builtin_bswap16(__atomic_exchange_n(word, __builtin_bswap16(data), __ATOMIC_SEQ_CST));
+#else
+	return __atomic_exchange_n(word, data, __ATOMIC_SEQ_CST);
+#endif
+}
+
+/** Vykona instrukciu INT s cislom vyhradenym pre jadra zhluku.
+ * Vola ho traceVirtualMachine, ked jadro zhluku skonci na instrukcii INT.
+ * @param machine popisovac jadra, PC je za instrukciou INT
+ * @return VM_OK ak sa instrukcia vykonala, VM_SOFTINT ak stroj nie je v zhluku alebo cislo
+ * prerusenia nie je vyhradene, chyba pamate pri VM_INTERRUPT_SWAP; vtedy je PC na instrukcii
+ */
+VM_STATE vmCoreInterrupt(VIRTUAL_MACHINE * machine) {
+	VM_CLUSTER * cluster = machine->cluster;
+	uint16_t address = machine->registers[1], data;
+	VM_STATE state;
+	if (cluster == NULL) return VM_SOFTINT;
+	switch (machine->ext_interrupt) {
+		case VM_INTERRUPT_SWAP:
+			if ((state = __checkAddressValid(machine, address)) == VM_OK && (address & 1)) state = VM_UNALIGNED_MEMORY;
+			if (state == VM_OK) state = __checkWritable(machine, address, MEM_OP_WORD);
+			if (state != VM_OK) {
+				machine->fault_address = address;
+				machine->PC -= 2;
+				return state;
+			}
+			if (__devicePage(machine, address)) {
+				/* o atomicite pristupu na zariadenie rozhoduje jeho obsluha */
+				data = vmBusRead(machine, address, MEM_OP_WORD);
+				vmBusWrite(machine, address, machine->registers[0], MEM_OP_WORD);
+				machine->registers[0] = data;
+			} else {
+				machine->registers[0] = __swap(machine, address, machine->registers[0]);
+			}
+			if (__storeFlags(machine, address, MEM_OP_WORD)) vmPageWritten(machine, address, MEM_OP_WORD);
+			break;
+
+		case VM_INTERRUPT_CORE:
+			machine->registers[0] = machine->core;
+			machine->registers[1] = cluster->count;
+			break;
+
+		case VM_INTERRUPT_IPI:
+			if (address >= cluster->count || postInterruptVirtualMachine(cluster->cores[address], machine->registers[0] & 0xFF) != 0) {
+				machine->registers[0] = 0xFFFF;
+			} else {
+				machine->registers[0] = 0;
+			}
+			break;
+
+		default:
+			return VM_SOFTINT;
+	}
+	machine->ext_interrupt = 0;
+	return VM_OK;
+}
+
+/** Vlakno jadra pre runClusterVirtualMachine. */
+static void * __runCore(void * arg) {
+	struct ClusterRun * run = arg;
+	int state;
+	pthread_mutex_lock(&run->start->lock);
+	while ((state = run->start->state) == 0) pthread_cond_wait(&run->start->signal, &run->start->lock);
+	pthread_mutex_unlock(&run->start->lock);
+	if (state > 0) resumeVirtualMachine(run->core, run->budget, run->stop);
+	return NULL;
+}
+
+/** Vykona vsetky jadra zhluku naraz, kazde na vlastnom vlakne hostitela.
+ * Kazde jadro bezi ako pri resumeVirtualMachine, kym samo nezastavi, funkcia sa vrati, ked
+ * zastavia vsetky. Hostitel moze beh jadier ukoncit prerusenim, ktore program stroja
+ * neobsluhuje (postInterruptVirtualMachine).
+ * @param cluster zhluk jadier
+ * @param budget najvacsi pocet instrukcii kazdeho jadra, 0 znamena bez limitu
+ * @param stops pole s popisom zastavenia pre kazde jadro, alebo NULL
+ * @return 0 ak sa jadra vykonali, -1 ak sa nepodarilo vytvorit vlakno; vtedy sa nevykonalo
+ * ziadne jadro
+ */
+int runClusterVirtualMachine(VM_CLUSTER * cluster, uint64_t budget, VM_STOP * stops) {
+	struct ClusterRun runs[VM_CLUSTER_CORES];
+	struct ClusterStart start = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 };
+	unsigned q, started;
+	for (q = 0; q < cluster->count; q++) {
+		runs[q].core = cluster->cores[q];
+		runs[q].budget = budget;
+		runs[q].stop = (stops != NULL) ? &stops[q] : NULL;
+		runs[q].start = &start;
+	}
+	/* jadro 0 bezi na volajucom vlakne */
+	for (started = 1; started < cluster->count; started++) {
+		if (pthread_create(&runs[started].thread, NULL, __runCore, &runs[started]) != 0) break;
+	}
+	pthread_mutex_lock(&start.lock);
+	start.state = (started == cluster->count) ? 1 : -1;
+	pthread_cond_broadcast(&start.signal);
+	pthread_mutex_unlock(&start.lock);
+	if (start.state > 0) resumeVirtualMachine(runs[0].core, budget, runs[0].stop);
+	for (q = 1; q < started; q++) pthread_join(runs[q].thread, NULL);
+	return (started == cluster->count) ? 0 : -1;
+}
@@ -6,9 +6,7 @@
 #include "bits.h"
 #include "registers.h"
 #include "instruction.h"
-
-#define MEM_OP_BYTE			1
-#define MEM_OP_WORD			0
+#include "decode.h"
 
 /** Standardna operacia pre citanie z pamate virtualneho procesora.
  * Tato operacia sa pouziva v pripade, ze virtualny procesor nema ziadne specialne
@@ -19,12 +17,7 @@
  * @return nacitana hodnota
  */
 uint16_t vmDefaultMemoryRead(unsigned char * memory, uint16_t address, int half) {
-	uint16_t ret = 0;
-	ret = memory[address];
-	if (half == 0) {
-		ret |= (memory[address + 1] << 8);
-	}
-	return ret;
+	return __memRead(memory, address, half);
 }
 
 /** Standardna operacia pre zapis do pamate virtualneho procesora.
@@ -35,161 +28,78 @@ uint16_t vmDefaultMemoryRead(unsigned char * memory, uint16_t address, int half)
  * @param half ak je 1, zapise iba jeden byte dat na adresu danej parametrom address, inac zapise 2 byty v poradi MSB, LSB na dve po sebe nasledujuce bunky dane parametrom address.
  */ 
 void vmDefaultMemoryWrite(unsigned char * memory, uint16_t address, uint16_t data, int half) {
-	memory[address] = data & 0xFF;
-	if (half == 0) memory[address + 1] = (data >> 8) & 0xFF;
-	return;
+	__memWrite(memory, address, data, half);
 }
 
-/** Overi, ci adresa je spravna.
- * Overi, ci dana adresa je v ramci limitov danych nastavenim virtualneho stroja, 
- * najma ci nie je vacsia, ako je velkost pamate a ci sa nejedna o nezarovnany pristup k pamati.
- * @param machine popisovac virtualneho stroja
- * @param address adresa, ktora sa overuje
- * @return stav overovania
- */
-static inline uint8_t __checkAddressValid(VIRTUAL_MACHINE * machine, uint16_t address) {
-	if (address & 1) return VM_UNALIGNED_MEMORY;
-	else if (address >= machine->mem_size) return VM_OUT_OF_MEMORY;
-	return VM_OK;
-}
+/* Jadro pre stroj so standardnymi operaciami pamate, pamat je priamo pristupne pole. */
+#define EXEC_NAME __execVMFlat
+#define MEM_READ(_a, _half) __memRead(machine->memory, (_a), (_half))
+#define MEM_WRITE(_a, _d, _half) __memWrite(machine->memory, (_a), (_d), (_half))
+#define ADDRESS_CHECK(_a) __checkAddressValid(machine, (_a))
+#include "interp.h"
 
-/** Vykona instrukcie virtualneho stroja.
- * Tato funkcia je jadrom virtualneho stroja. Vykonava instrukcie virtualneho 
- * stroja, cim virtualizuje (emuluje) jeho cinnost. Tato funkcia vykonava instrukcie
- * bud do vyskytu chyby, volania vonkajsieho prerusenia (instrukcia INT), alebo 
- * kym nie je dosiahnuty pocet instrukcii dany argumentom limit (v pripade, ze ma 
- * nenulovu hodnotu).
- * @note Ak funkcia pri volani nema limit na pocet vykonanych instrukcii, kod vovnutri stroja
- * moze sposobit, ze sa program vovnutri stroja zacykli, nedojde ani k chybe, ani volaniu 
- * externeho prerusenia, co sposobi, ze sa "zacykli" aj program, ktory virtualny stroj zavolal.
- * V takom pripade sa nejedna o chybu v emulatore virtualneho stroja. Tento nie je 
- * pisany s ohladom na multivlaknovost, alebo potrebu necakaneho zasahu do behu stroja.
+/* Jadro pre stroj s celym 64 KiB adresnym priestorom, adresy sa vobec nekontroluju. */
+#define EXEC_NAME __execVMFull
+#define MEM_READ(_a, _half) __memRead(machine->memory, (_a), (_half))
+#define MEM_WRITE(_a, _d, _half) __memWrite(machine->memory, (_a), (_d), (_half))
+#define ADDRESS_CHECK(_a) VM_OK
+#include "interp.h"
+
+/* Jadro pre stroj s celym 64 KiB adresnym priestorom a kontrolou zarovnania. */
+#define EXEC_NAME __execVMFullStrict
+#define MEM_READ(_a, _half) __memRead(machine->memory, (_a), (_half))
+#define MEM_WRITE(_a, _d, _half) __memWrite(machine->memory, (_a), (_d), (_half))
+#define ADDRESS_CHECK(_a) (((_a) & 1) ? VM_UNALIGNED_MEMORY : VM_OK)
+#include "interp.h"
+
+/* Jadro pre stroj so standardnymi operaciami pamate a pripojenymi zariadeniami. Pristupy
+ * na stranky zariadeni idu cez zbernicu, ostatne priamo do pamate. */
+#define EXEC_NAME __execVMBus
+#define MEM_READ(_a, _half) (__devicePage(machine, (_a)) ? vmBusRead(machine, (_a), (_half)) : __memRead(machine->memory, (_a), (_half)))
+#define MEM_WRITE(_a, _d, _half) \
+	do { if (__devicePage(machine, (_a))) vmBusWrite(machine, (_a), (_d), (_half)); else __memWrite(machine->memory, (_a), (_d), (_half)); } while (0)
+#define ADDRESS_CHECK(_a) __checkAddressValid(machine, (_a))
+#define FETCH_READ(_a) __memRead(machine->memory, (_a), MEM_OP_WORD)
+#include "interp.h"
+
+/* Jadro pre stroj s vlastnymi operaciami pamate. */
+#define EXEC_NAME __execVMGeneric
+#define MEM_READ(_a, _half) vmBusRead(machine, (_a), (_half))
+#define MEM_WRITE(_a, _d, _half) vmBusWrite(machine, (_a), (_d), (_half))
+#define ADDRESS_CHECK(_a) __checkAddressValid(machine, (_a))
+#define FETCH_READ(_a) machine->read_func(machine->memory, (_a), MEM_OP_WORD)
+#include "interp.h"
+
+/* Jadro pre profilovanie, pocita nacitane instrukcie podla adresy, triedy instrukcii
+ * a pristupy do pamate. Pouziva sa pre vsetky operacie pamate a vsetky rezimy stroja. */
+#define EXEC_NAME __execVMProfile
+#define MEM_READ(_a, _half) (machine->profile->counters[VM_PROFILE_MEM_READS]++, vmBusRead(machine, (_a), (_half)))
+#define MEM_WRITE(_a, _d, _half) (machine->profile->counters[VM_PROFILE_MEM_WRITES]++, vmBusWrite(machine, (_a), (_d), (_half)))
+#define ADDRESS_CHECK(_a) __checkAddressValid(machine, (_a))
+#define FETCH_READ(_a) machine->read_func(machine->memory, (_a), MEM_OP_WORD)
+#define PROFILE_FETCH(_a) machine->profile->pc[(_a) >> 1]++
+#define PROFILE_EXEC(_op) machine->profile->counters[vmProfileClass[(_op)->handler]]++
+#define PROFILE_SKIP(_op) \
+	machine->profile->counters[((_op)->handler == VMOP_BRANCH || (_op)->handler == VMOP_BRANCHL) ? VM_PROFILE_BRANCH_NOT_TAKEN : VM_PROFILE_SKIPPED]++
+#include "interp.h"
+
+/** Vykona instrukcie virtualneho stroja verziou jadra podla operacii pamate stroja.
+ * Ak ma stroj standardne operacie pamate, pouzije sa verzia jadra bez nepriamych volani
+ * pri nacitani instrukcie, citani a zapise. V rezime VM_MEMORY_FULL sa navyse pouzije
+ * verzia bez kontroly rozsahu adries. Stroj s pripojenymi zariadeniami kontroluje pri
+ * kazdom pristupe do pamate stranku adresy.
  * @param machine popisovac virtualneho stroja
- * @param limit limit vykonanych instrukcii, kym dojde k navratu z funkcie. Ak je nastaveny na 0, instrukcie sa vykonavaju bez explicitneho limitu
- * @return dovod, pre ktory bol preruseny beh virtualneho stroja VM_OK znamena, ze bol dosiahnuty limit instrukcii a virtualny stroj normalne moze bezat dalej, VM_SOFTINT znamena ziadost o vonkajsie prerusenie, VM_ILLEGAL_OPCODE znamena chybnu instrukciu
+ * @param limit limit vykonanych instrukcii, 0 znamena bez limitu
+ * @return dovod prerusenia behu stroja
  */
 static VM_STATE __execVM(VIRTUAL_MACHINE * machine, uint16_t limit) {
-	uint8_t interrupt = (limit != 0);
-	uint16_t instr;
-	uint8_t vm_state;
-	char * dis_opcode;
-	machine->ext_interrupt = 0;
-	while ((limit > 0 || !interrupt) && !machine->ext_interrupt) {
-		if ((vm_state = __checkAddressValid(machine, machine->PC)) != VM_OK) {
-			return vm_state;
-		}
-		instr = machine->read_func(machine->memory, machine->PC, MEM_OP_WORD);
-		machine->PC += 2;
-		do {
-			if (IF_IS_ZERO(instr) && !(machine->flags & ZERO_FLAG)) break;
-			if (IF_IS_CARRY(instr) && !(machine->flags & CARRY_FLAG)) break;
-			if (IF_IS_SIGN(instr) && !(machine->flags & SIGN_FLAG)) break;
-			
-			if (IS_BRANCH(instr)) {
-				instr = GET_LARGEIMMED(instr);
-				if (instr & 1) {
-					machine->RL = machine->PC;
-				}
-				if (instr & BIT11) machine->PC -= instr & ~(BIT11 | BIT0);
-				else machine->PC += instr & ~(BIT11 | BIT0);
-				//				printf("New PC is %04X\n", machine->PC);
-			} else if (IS_STORE(instr) || IS_LOAD(instr)) {
-				unsigned char addr_reg = GET_ARG1(instr);
-				unsigned char data_reg = GET_ARG2(instr);
-				if (IS_PRE_DECREMENT(instr)) {
-					machine->registers[addr_reg] -= 2;
-				}
-				vm_state = __checkAddressValid(machine, machine->registers[addr_reg]);
-				if (vm_state != VM_OK) return vm_state;
-				if (IS_LOAD(instr)) {
-					if (IS_8BIT(instr)) machine->registers[data_reg] = machine->read_func(machine->memory, machine->registers[addr_reg], MEM_OP_BYTE);
-					else machine->registers[data_reg] = machine->read_func(machine->memory, machine->registers[addr_reg], MEM_OP_WORD);
-				}
-				if (IS_STORE(instr)) {
-					if (IS_8BIT(instr)) machine->write_func(machine->memory, machine->registers[addr_reg], machine->registers[data_reg], MEM_OP_BYTE);
-					else machine->write_func(machine->memory, machine->registers[addr_reg], machine->registers[data_reg], MEM_OP_WORD);
-				}
-				if (IS_POST_INCREMENT(instr)) {
-					machine->registers[addr_reg] += 2;
-				}
-			} else if (IS_ILOAD(instr)) {
-				char reg = (instr >> 8) & 7;
-				machine->registers[reg] = (machine->registers[reg] << 8) | GET_IMMEDIATE(instr);
-			} else if (IS_ALU2(instr)) {
-				unsigned char source_reg = GET_ARG2(instr);
-				unsigned char dest_reg = GET_ARG1(instr);
-				char flags = 0;
-				signed long source = machine->registers[source_reg];
-				signed long dest = machine->registers[dest_reg];
-				switch (OPCODE(instr, 5)) {
-					case OP_ADD:	dest += source; break;
-					case OP_SUB:	dest -= source; break;
-					case OP_MUL:	dest *= source; break;
-					case OP_DIV:	dest /= source; break;
-					case OP_MOD:	dest %= source; break;
-					case OP_AND:	dest &= source; break;
-					case OP_OR:		dest |= source; break;
-					case OP_XOR:	dest ^= source; break;
-				}
-				if (GET_OPFLAG(instr)) {
-					if (abs(dest) >= 1 << 16) {
-						flags |= OVERFLOW_FLAG;
-					}
-					if (dest < 0) {
-						flags |= SIGN_FLAG;
-					}
-					if (dest == 0) {
-						flags |= ZERO_FLAG;
-					}
-				}
-				machine->flags = flags;
-				machine->registers[dest_reg] = dest & 0xFFFF;
-			} else if (IS_SHIFT(instr)) {
-				unsigned char data_reg = GET_ARG1(instr);
-				unsigned char shift_amount = GET_ARG2(instr);
-				switch (GET_OPFLAG(instr)) {
-					case 0:	machine->registers[data_reg] <<= shift_amount; break;
-					case 1:	machine->registers[data_reg] >>= shift_amount; break;
-				}
-			} else if (IS_NOT(instr)) {
-				machine->registers[GET_ARG2(instr)] = ~machine->registers[GET_ARG2(instr)];
-			} else if (IS_FLINVERT(instr)) {
-				machine->flags = machine->flags ^ ~(GET_ARG2(instr) << 4);
-			} else if (IS_ADDC(instr) || IS_SUBC(instr)) {
-				char flags = 0;
-				if (IS_ADDC(instr)) machine->registers[GET_ARG1(instr)] += GET_ARG2(instr);
-				else machine->registers[GET_ARG1(instr)] -= GET_ARG2(instr);
-				if (GET_OPFLAG(instr)) {
-					if (machine->registers[GET_ARG1(instr)] >= 1 << 16) {
-						flags |= OVERFLOW_FLAG;
-					}
-					if (machine->registers[GET_ARG1(instr)] < 0) {
-						flags |= SIGN_FLAG;
-					}
-					if (machine->registers[GET_ARG1(instr)] == 0) {
-						flags |= ZERO_FLAG;
-					}
-					machine->flags = flags;
-				}
-			} else if (IS_MOV(instr) || IS_SWAP(instr)) {
-				unsigned char dest_reg = GET_ARG1(instr);
-				unsigned char source_reg = GET_ARG2(instr);
-				if (IS_MOV(instr)) {
-					machine->registers[dest_reg] = machine->registers[source_reg];
-				} else {
-					uint16_t tmp = machine->registers[dest_reg];
-					machine->registers[dest_reg] = machine->registers[source_reg];
-					machine->registers[source_reg] = tmp;
-				}
-			} else if (IS_INT(instr)) {
-				machine->ext_interrupt = GET_IMMEDIATE(instr);
-				return VM_SOFTINT;
-			} else return VM_ILLEGAL_OPCODE;
-		} while (0);
-		if (limit > 0) limit--;
+	if (__flatMemory(machine)) {
+		if (machine->devices != NULL) return __execVMBus(machine, limit);
+		if (!(machine->mem_flags & VM_MEMORY_FULL)) return __execVMFlat(machine, limit);
+		if (machine->mem_flags & VM_MEMORY_STRICT_ALIGN) return __execVMFullStrict(machine, limit);
+		return __execVMFull(machine, limit);
 	}
-	
-	return VM_OK;
+	return __execVMGeneric(machine, limit);
 }
 
 /** Spusti virtualny stroj bez obmedzenia instrukcii.
@@ -197,15 +107,152 @@ static VM_STATE __execVM(VIRTUAL_MACHINE * machine, uint16_t limit) {
  * @return chybovy kod prerusenia behu stroja
  */
 VM_STATE runVirtualMachine(VIRTUAL_MACHINE * machine) {
-	return __execVM(machine, 0);
+	return traceVirtualMachine(machine, 0);
+}
+
+/** Vykona instrukcie jadrom podla rezimu stroja, resp. prelozenym kodom, ak ho stroj ma.
+ * @param machine popisovac virtualneho stroja
+ * @param instructions pocet instrukcii, ktore budu maximalne emulovane, 0 znamena bez limitu
+ * @return chybovy kod prerusenia behu stroja
+ */
+static VM_STATE __trace(VIRTUAL_MACHINE * machine, uint16_t instructions) {
+	if (machine->profile != NULL) return __execVMProfile(machine, instructions);
+	if (machine->translation != NULL) return vmExecTranslated(machine, instructions);
+	switch (machine->mode) {
+		case VM_MODE_BLOCKS:
+			return vmExecBlocks(machine, instructions);
+
+		case VM_MODE_JIT:
+		case VM_MODE_JIT_VERIFY:
+			return vmExecJit(machine, instructions);
+	}
+	return __execVM(machine, instructions);
+}
+
+/** Zisti cas, po ktory moze jadro bezat bez prerusenia.
+ * @param machine popisovac virtualneho stroja
+ * @return hodnota machine->clock najblizsej naplanovanej udalosti, resp. pri prehravani
+ * najblizsieho vstupu zo zaznamu, UINT64_MAX ak ziadna nie je
+ */
+static inline uint64_t __nextStop(VIRTUAL_MACHINE * machine) {
+	uint64_t next = __nextEvent(machine), input;
+	if (machine->recording != NULL && (input = vmReplayNext(machine)) < next) next = input;
+	return next;
+}
+
+/** Vykona slucku necinnosti na PC stroja a preskoci jej dalsie opakovania.
+ * Vykona jedno opakovanie slucky. Ak sa po nom registre ani priznaky nezmenili, telo slucky
+ * do pamate nezapisuje a pamat ani zariadenia sa medzi udalostami a preruseniami nemenia,
+ * takze kazde dalsie opakovanie by bolo rovnake: opakovania, ktore sa zmestia do slice, sa
+ * iba zapocitaju do machine->retired. Ak stroj nema limit ani naplanovanu udalost, vlakno
+ * namiesto toho caka na prerusenie od hostitela.
+ * @param machine popisovac virtualneho stroja
+ * @param length pocet instrukcii jedneho opakovania (vid vmIdleLoop)
+ * @param slice najvacsi pocet vykonanych a preskocenych instrukcii
+ * @param wait 1 ak ma vlakno cakat na prerusenie
+ * @return stav, ktory vratilo jadro
+ */
+static VM_STATE __idle(VIRTUAL_MACHINE * machine, uint16_t length, uint16_t slice, int wait) {
+	uint16_t registers[16];
+	uint8_t flags = machine->flags;
+	VM_STATE state;
+	memcpy(registers, machine->registers, sizeof(registers));
+	state = __trace(machine, length);
+	if (state != VM_OK || machine->retired != length || machine->flags != flags ||
+			memcmp(registers, machine->registers, sizeof(registers)) != 0) return state;
+	if (wait) vmWaitInterrupt(machine);
+	else machine->retired += (slice - length) / length * length;
+	return VM_OK;
 }
 
 /** Spusti virtualny stroj bez s obmedzenim poctu emulovanych instrukcii.
- * @note Tato funkcia je iba verejnym rozhranim k funkcii __execVM, ktora nie je viditelna mimo tuto kompilacnu jednotku
+ * @note Tato funkcia je iba verejnym rozhranim k funkcii __execVM, ktora nie je viditelna mimo tuto kompilacnu jednotku, resp. k vykonavaniu po blokoch alebo prekladacu podla rezimu stroja. Pri zapnutom profilovani sa instrukcie vykonavaju vzdy profilujucim interpretom, inac ma prednost program prelozeny vopred (vid attachTranslationVirtualMachine).
+ * Pri nenulovom limite ulozi pocet skutocne vykonanych instrukcii do machine->retired,
+ * o vykonane instrukcie vzdy posunie hodiny stroja machine->clock.
+ * Prerusenia od hostitela obsluhuje pred behom a vzdy, ked kvoli nim jadro skonci: ak ich
+ * program stroja obsluhuje, skoci do obsluhy a pokracuje, inac skonci s VM_OK a cislom
+ * prerusenia v ext_interrupt. INT VM_INTERRUPT_RETURN v obsluhe sa vrati z obsluhy a beh
+ * pokracuje (vid setInterruptTableVirtualMachine). INT VM_INTERRUPT_NATIVE na vstupnom bode
+ * funkcie s pripojenou nativnou funkciou ju zavola a beh pokracuje na navratovej adrese (vid
+ * bindNativeVirtualMachine), jadro zhluku vykona INT s cislami vyhradenymi pre zhluk (vid
+ * createClusterVirtualMachine). Jadro sa vzdy spusti najviac po cas
+ * najblizsej naplanovanej udalosti, ktorej obsluha sa spusti pred dalsou instrukciou (vid
+ * scheduleEventVirtualMachine). Ak program stroja caka v slucke necinnosti, beh preskoci
+ * jej opakovania az po najblizsiu udalost alebo limit instrukcii, resp. bez limitu a udalosti
+ * caka na prerusenie od hostitela bez zapocitania casu do hodin stroja. Pri zazname vstupov
+ * sa slucka necinnosti nepreskakuje a beh sa pri prehravani zastavi na case kazdeho vstupu
+ * zo zaznamu (vid startRecordingVirtualMachine).
  * @param machine popisovac virtualneho stroja
  * @param instructions pocet instrukcii, ktore budu maximalne emulovane v jednom behu 
  * @return chybovy kod prerusenia behu stroja
  */
 VM_STATE traceVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t instructions) {
-	return __execVM(machine, instructions);
+	VM_STATE state = VM_OK;
+	uint16_t retired = 0, slice, length;
+	uint64_t until;
+
+	/* krokovanie po jednej instrukcii ide priamo do jadra */
+	if (instructions == 1 && __nextEvent(machine) > machine->clock && machine->natives == NULL &&
+			machine->recording == NULL && machine->cluster == NULL && !__interruptPending(machine) &&
+			!machine->interrupts->active) {
+		state = __trace(machine, instructions);
+		machine->clock += machine->retired;
+		return state;
+	}
+	/* beh bez limitu ide po castiach, aby sa dal zapocitat do hodin stroja */
+	machine->ext_interrupt = 0;
+	if (machine->recording != NULL) vmRecordEnter(machine);
+	while (instructions == 0 || retired < instructions) {
+		if (machine->recording != NULL && (state = vmReplayInputs(machine)) != VM_OK) break;
+		if (__nextEvent(machine) <= machine->clock) {
+			if (machine->recording != NULL) vmRecordEvents(machine);
+			else vmRunEvents(machine);
+		}
+		if (__interruptPending(machine)) {
+			state = vmServiceInterrupts(machine);
+			if (state != VM_OK || machine->ext_interrupt) break;
+		}
+		slice = instructions ? instructions - retired : RUN_CHUNK;
+		until = __nextStop(machine) - machine->clock;
+		if (until < slice) slice = until;
+		/* pamat jadra zhluku moze zmenit ine jadro a pri zazname je kazde citanie zariadenia
+		 * v slucke vstupom, slucka necinnosti sa neda preskocit */
+		length = (slice > 1 && machine->profile == NULL && machine->cluster == NULL && machine->recording == NULL) ?
+			vmIdleLoop(machine) : 0;
+		if (length != 0 && 2 * length <= slice) {
+			state = __idle(machine, length, slice, instructions == 0 && __nextEvent(machine) == UINT64_MAX);
+		} else {
+			state = __trace(machine, slice);
+		}
+		retired += machine->retired;
+		machine->clock += machine->retired;
+		if (state == VM_SOFTINT && (machine->natives != NULL || machine->cluster != NULL)) {
+			if (machine->ext_interrupt == VM_INTERRUPT_NATIVE && machine->natives != NULL) state = vmCallNative(machine);
+			else state = vmCoreInterrupt(machine);
+			if (state == VM_OK) continue;
+			/* chyba nativnej funkcie alebo vymeny sa rovnako ako chybna instrukcia nezapocita */
+			if (state != VM_SOFTINT) {
+				retired--;
+				machine->clock--;
+			}
+		}
+		if (state == VM_SOFTINT && machine->interrupts->active && machine->ext_interrupt == VM_INTERRUPT_RETURN) {
+			if ((state = vmReturnInterrupt(machine)) != VM_OK) break;
+			continue;
+		}
+		if (state != VM_OK) break;
+	}
+	if (machine->recording != NULL) vmRecordLeave(machine, state);
+	machine->retired = retired;
+	return state;
+}
+
+/** Vykona instrukcie interpretom bez ohladu na nastaveny rezim stroja.
+ * Pouzivaju ho ostatne rezimy pre instrukcie, ktore samy nevedia vykonat.
+ * @param machine popisovac virtualneho stroja
+ * @param limit limit vykonanych instrukcii, 0 znamena bez limitu
+ * @return chybovy kod prerusenia behu stroja
+ */
+VM_STATE vmInterpret(VIRTUAL_MACHINE * machine, uint16_t limit) {
+	return __execVM(machine, limit);
 }
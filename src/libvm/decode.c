@@ -0,0 +1,85 @@
+#include <pthread.h>
+#include <stdint.h>
+
+#include "bits.h"
+#include "registers.h"
+#include "instruction.h"
+#include "decode.h"
+
+DECODED_INSTRUCTION vmDecodeTable[65536];
+
+static pthread_once_t __decodeOnce = PTHREAD_ONCE_INIT;
+
+/** Zisti obsluhu instrukcie.
+ * Poradie testov zodpoveda poradiu, v akom instrukcie rozlisuje ISA, t.j. niektore
+ * instrukcie zdielaju prefix operacneho kodu a na poradi zalezi.
+ * @param instr slovo instrukcie
+ * @return obsluha instrukcie
+ */
+static uint8_t __decodeHandler(uint16_t instr) {
+	if (IS_BRANCH(instr)) {
+		return (instr & BIT0) ? VMOP_BRANCHL : VMOP_BRANCH;
+	} else if (IS_STORE(instr) || IS_LOAD(instr)) {
+		uint8_t base = IS_LOAD(instr) ? VMOP_LOAD : VMOP_STORE;
+		if (IS_PRE_DECREMENT(instr)) return base + 1;
+		if (IS_POST_INCREMENT(instr)) return base + 2;
+		if (IS_8BIT(instr)) return base + 3;
+		return base;
+	} else if (IS_ILOAD(instr)) {
+		return VMOP_ILOAD;
+	} else if (IS_ALU2(instr)) {
+		return (GET_OPFLAG(instr) ? VMOP_ADDS : VMOP_ADD) + OPCODE(instr, 5) - OP_ADD;
+	} else if (IS_SHIFT(instr)) {
+		return GET_OPFLAG(instr) ? VMOP_SHR : VMOP_SHL;
+	} else if (IS_NOT(instr)) {
+		return VMOP_NOT;
+	} else if (IS_FLINVERT(instr)) {
+		return VMOP_FLINVERT;
+	} else if (IS_ADDC(instr)) {
+		return GET_OPFLAG(instr) ? VMOP_ADDCS : VMOP_ADDC;
+	} else if (IS_SUBC(instr)) {
+		return GET_OPFLAG(instr) ? VMOP_SUBCS : VMOP_SUBC;
+	} else if (IS_MOV(instr)) {
+		return VMOP_MOV;
+	} else if (IS_SWAP(instr)) {
+		return VMOP_SWAP;
+	} else if (IS_INT(instr)) {
+		return VMOP_INT;
+	}
+	return VMOP_ILLEGAL;
+}
+
+/** Zostavi tabulku predekodovanych instrukcii.
+ * Zaznamy tabulky su odvodene vylucne z makier v instruction.h.
+ */
+static void __buildDecodeTable(void) {
+	uint32_t q;
+	for (q = 0; q < 65536; q++) {
+		uint16_t instr = q;
+		DECODED_INSTRUCTION * d = &vmDecodeTable[q];
+		d->handler = __decodeHandler(instr);
+		if (IF_IS_ZERO(instr)) d->cond = ZERO_FLAG;
+		else if (IF_IS_CARRY(instr)) d->cond = CARRY_FLAG;
+		else if (IF_IS_SIGN(instr)) d->cond = SIGN_FLAG;
+		else d->cond = 0;
+		switch (d->handler) {
+			case VMOP_ILOAD:
+				d->arg1 = (instr >> 8) & 7;
+				d->arg2 = GET_IMMEDIATE(instr);
+				break;
+
+			default:
+				d->arg1 = GET_ARG1(instr);
+				d->arg2 = GET_ARG2(instr);
+				break;
+		}
+	}
+}
+
+/** Zostavi tabulku predekodovanych instrukcii, ak este nie je zostavena.
+ * Funkciu mozu volat sucasne viacere vlakna (napr. pri vytvarani strojov), tabulka sa
+ * zostavi iba raz a po navrate je vzdy cela.
+ */
+void vmInitDecodeTable(void) {
+	pthread_once(&__decodeOnce, __buildDecodeTable);
+}
@@ -0,0 +1,40 @@
+#ifndef __SUNBLIND_DECODE_H__
+#define __SUNBLIND_DECODE_H__
+
+#include <stdint.h>
+
+/** Obsluhy instrukcii, na ktore sa instrukcie dekoduju.
+ * Poradie zodpoveda poradiu navesti v dispatch tabulke jadra virtualneho stroja.
+ */
+enum VM_Handler {
+	VMOP_ILLEGAL = 0,
+	VMOP_BRANCH, VMOP_BRANCHL,
+	VMOP_LOAD, VMOP_LOAD_PREDEC, VMOP_LOAD_POSTINC, VMOP_LOAD_BYTE,
+	VMOP_STORE, VMOP_STORE_PREDEC, VMOP_STORE_POSTINC, VMOP_STORE_BYTE,
+	VMOP_ILOAD,
+	VMOP_ADD, VMOP_SUB, VMOP_MUL, VMOP_DIV, VMOP_MOD, VMOP_AND, VMOP_OR, VMOP_XOR,
+	VMOP_ADDS, VMOP_SUBS, VMOP_MULS, VMOP_DIVS, VMOP_MODS, VMOP_ANDS, VMOP_ORS, VMOP_XORS,
+	VMOP_SHL, VMOP_SHR, VMOP_NOT, VMOP_FLINVERT,
+	VMOP_ADDC, VMOP_SUBC, VMOP_ADDCS, VMOP_SUBCS,
+	VMOP_MOV, VMOP_SWAP, VMOP_INT,
+	VMOP_COUNT
+};
+
+/** Predekodovana instrukcia.
+ * Pre kazde zo 65536 moznych slov instrukcie obsahuje tabulka jeden zaznam, takze
+ * dekodovanie instrukcie je iba jeden indexovany pristup do tabulky.
+ */
+struct DecodedInstruction {
+	uint8_t handler;			// obsluha instrukcie (VM_Handler)
+	uint8_t cond;				// priznak, ktory musi byt nastaveny, aby sa instrukcia vykonala, 0 ak sa vykona vzdy
+	uint8_t arg1;				// prvy operand (cielovy, resp. adresovy register; register ILOAD)
+	uint8_t arg2;				// druhy operand (zdrojovy, resp. datovy register; priama hodnota)
+};
+
+typedef struct DecodedInstruction DECODED_INSTRUCTION;
+
+extern DECODED_INSTRUCTION vmDecodeTable[65536];
+
+void vmInitDecodeTable(void);
+
+#endif
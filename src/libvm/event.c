@@ -0,0 +1,138 @@
+#include <stdlib.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/// Pociatocna kapacita fronty udalosti
+#define EVENT_QUEUE_INITIAL		16
+
+/** Zisti, ci sa udalost a ma spustit skor ako udalost b.
+ * Udalosti s rovnakym casom sa spustaju v poradi, v akom boli naplanovane.
+ * @param a udalost
+ * @param b udalost
+ * @return 1 ak ma udalost a prednost
+ */
+static inline int __before(const struct Event * a, const struct Event * b) {
+	if (a->deadline != b->deadline) return a->deadline < b->deadline;
+	return a->sequence < b->sequence;
+}
+
+/** Posunie udalost na pozicii index v halde smerom ku korenu.
+ * @param queue fronta udalosti
+ * @param index pozicia udalosti
+ */
+static void __siftUp(struct EventQueue * queue, uint32_t index) {
+	struct Event event = queue->heap[index];
+	while (index > 0 && __before(&event, &queue->heap[(index - 1) / 2])) {
+		queue->heap[index] = queue->heap[(index - 1) / 2];
+		index = (index - 1) / 2;
+	}
+	queue->heap[index] = event;
+}
+
+/** Posunie udalost na pozicii index v halde smerom k listom.
+ * @param queue fronta udalosti
+ * @param index pozicia udalosti
+ */
+static void __siftDown(struct EventQueue * queue, uint32_t index) {
+	struct Event event = queue->heap[index];
+	uint32_t child;
+	while ((child = 2 * index + 1) < queue->count) {
+		if (child + 1 < queue->count && __before(&queue->heap[child + 1], &queue->heap[child])) child++;
+		if (!__before(&queue->heap[child], &event)) break;
+		queue->heap[index] = queue->heap[child];
+		index = child;
+	}
+	queue->heap[index] = event;
+}
+
+/** Vlozi udalost do fronty.
+ * @param queue fronta udalosti
+ * @param deadline hodnota hodin stroja, pri ktorej sa udalost spusti
+ * @param handler obsluha udalosti
+ * @param data parameter obsluhy
+ * @return 0 ak bola udalost vlozena, -1 ak sa nepodarilo zvacsit frontu
+ */
+static int __push(struct EventQueue * queue, uint64_t deadline, vmEventHandler handler, void * data) {
+	struct Event * heap;
+	uint32_t capacity;
+	if (queue->count == queue->capacity) {
+		capacity = queue->capacity ? queue->capacity * 2 : EVENT_QUEUE_INITIAL;
+		if ((heap = realloc(queue->heap, capacity * sizeof(struct Event))) == NULL) return -1;
+		queue->heap = heap;
+		queue->capacity = capacity;
+	}
+	queue->heap[queue->count].deadline = deadline;
+	queue->heap[queue->count].sequence = queue->sequence++;
+	queue->heap[queue->count].handler = handler;
+	queue->heap[queue->count].data = data;
+	__siftUp(queue, queue->count++);
+	return 0;
+}
+
+/** Naplanuje udalost po vykonani delay dalsich instrukcii stroja.
+ * Cas stroja su jeho hodiny machine->clock, t.j. pocet vykonanych instrukcii. Beh stroja
+ * (traceVirtualMachine a vsetko, co ho pouziva) vykona instrukcie iba do casu najblizsej
+ * udalosti, spusti jej obsluhu a pokracuje; periferie preto nemusia kontrolovat stav pri
+ * kazdej instrukcii. Obsluha moze poslat prerusenie (postInterruptVirtualMachine), ktore sa
+ * obsluzi skor, ako sa vykona dalsia instrukcia, a naplanovat dalsie udalosti. Ak obsluha
+ * vrati nenulovu hodnotu, udalost sa zopakuje o tolko instrukcii po svojom case (periodicky
+ * casovac). Funkcia sa nesmie volat pocas behu stroja, okrem obsluhy udalosti.
+ * @param machine popisovac virtualneho stroja
+ * @param delay pocet instrukcii do udalosti, 0 spusti udalost pred dalsou instrukciou
+ * @param handler obsluha udalosti
+ * @param data parameter obsluhy
+ * @return 0 ak bola udalost naplanovana, -1 ak sa nepodarilo alokovat pamat
+ */
+int scheduleEventVirtualMachine(VIRTUAL_MACHINE * machine, uint64_t delay, vmEventHandler handler, void * data) {
+	if (machine->events == NULL && (machine->events = calloc(1, sizeof(struct EventQueue))) == NULL) return -1;
+	return __push(machine->events, machine->clock + delay, handler, data);
+}
+
+/** Zrusi vsetky naplanovane udalosti s danou obsluhou a parametrom.
+ * @param machine popisovac virtualneho stroja
+ * @param handler obsluha udalosti
+ * @param data parameter obsluhy
+ * @return pocet zrusenych udalosti
+ */
+int cancelEventVirtualMachine(VIRTUAL_MACHINE * machine, vmEventHandler handler, void * data) {
+	struct EventQueue * queue = machine->events;
+	uint32_t q, kept = 0;
+	int cancelled;
+	if (queue == NULL) return 0;
+	for (q = 0; q < queue->count; q++) {
+		if (queue->heap[q].handler == handler && queue->heap[q].data == data) continue;
+		queue->heap[kept++] = queue->heap[q];
+	}
+	cancelled = queue->count - kept;
+	queue->count = kept;
+	if (cancelled) for (q = kept / 2; q-- > 0;) __siftDown(queue, q);
+	return cancelled;
+}
+
+/** Spusti obsluhy vsetkych udalosti, ktorych cas uz nastal.
+ * Vola ho traceVirtualMachine vzdy, ked hodiny stroja dosiahnu cas najblizsej udalosti.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmRunEvents(VIRTUAL_MACHINE * machine) {
+	struct EventQueue * queue = machine->events;
+	struct Event event;
+	uint64_t period;
+	while (queue->count > 0 && queue->heap[0].deadline <= machine->clock) {
+		event = queue->heap[0];
+		queue->heap[0] = queue->heap[--queue->count];
+		if (queue->count > 0) __siftDown(queue, 0);
+		period = event.handler(machine, event.data);
+		if (period != 0) __push(queue, event.deadline + period, event.handler, event.data);
+	}
+}
+
+/** Uvolni frontu udalosti stroja.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmFreeEvents(VIRTUAL_MACHINE * machine) {
+	if (machine->events == NULL) return;
+	free(machine->events->heap);
+	free(machine->events);
+	machine->events = NULL;
+}
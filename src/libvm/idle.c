@@ -0,0 +1,39 @@
+#include <vm.h>
+#include "vm.h"
+
+#include "bits.h"
+#include "decode.h"
+
+/** Zisti, ci instrukcia nemeni nic okrem registrov a priznakov.
+ * Taka instrukcia moze byt v tele slucky, ktora caka na udalost alebo prerusenie.
+ * @param d dekodovana instrukcia
+ * @return 1 ak instrukcia nezapisuje do pamate, neskace a nevyvolava prerusenie
+ */
+static inline int __pure(const DECODED_INSTRUCTION * d) {
+	if (d->handler == VMOP_LOAD || d->handler == VMOP_LOAD_BYTE) return 1;
+	return d->handler >= VMOP_ILOAD && d->handler <= VMOP_SWAP;
+}
+
+/** Najde slucku necinnosti zacinajucu na PC stroja.
+ * Kandidatom je skok na seba (BRANCH na vlastnu adresu) a kratka slucka, ktora iba cita
+ * pamat alebo registre zariadenia, pocita v registroch a podmienenym alebo nepodmienenym
+ * skokom sa vracia na PC. Ci sa stav stroja v slucke naozaj nemeni, overi az jedno vykonane
+ * opakovanie (vid traceVirtualMachine).
+ * @param machine popisovac virtualneho stroja
+ * @return pocet instrukcii jedneho opakovania slucky, 0 ak na PC slucka necinnosti nie je
+ */
+uint16_t vmIdleLoop(VIRTUAL_MACHINE * machine) {
+	const DECODED_INSTRUCTION * d;
+	uint16_t pc = machine->PC, target, instr, length;
+	for (length = 1; length <= IDLE_LOOP_LENGTH; length++, pc += 2) {
+		if (__checkAddressValid(machine, pc) != VM_OK) return 0;
+		instr = machine->read_func(machine->memory, pc, MEM_OP_WORD);
+		d = &vmDecodeTable[instr];
+		if (d->handler == VMOP_BRANCH) {
+			target = (instr & BIT11) ? pc + 2 - (instr & 0x07FE) : pc + 2 + (instr & 0x07FE);
+			return (target == machine->PC) ? length : 0;
+		}
+		if (!__pure(d)) return 0;
+	}
+	return 0;
+}
@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/// Velkost mapovanej pamate stroja, rovnaka ako alokovana pamat v rezime VM_MEMORY_FULL
+#define IMAGE_SIZE		(VM_MEMORY_FULL_SIZE + 1)
+
+/** Obraz pamate zdielany strojmi. */
+struct VirtualMachineImage {
+	int fd;							// anonymny subor s obsahom obrazu
+};
+
+/** Vytvori anonymny subor, ktory nema meno v suborovom systeme.
+ * Pouziva sa ako spolocny obsah mapovanej pamate (obrazy, banky).
+ * @return deskriptor suboru, -1 pri chybe
+ */
+int vmAnonymousFile(void) {
+#ifdef __linux__
+	return memfd_create("marisc", MFD_CLOEXEC);
+#else
+	FILE * f = tmpfile();
+	int fd;
+	if (f == NULL) return -1;
+	fd = dup(fileno(f));
+	fclose(f);
+	return fd;
+#endif
+}
+
+/** Vytvori obraz pamate, z ktoreho mozu vzniknut stroje so zdielanou pamatou.
+ * Obsah obrazu je jediny nemenny buffer (anonymny subor) a pamat kazdeho stroja vytvoreneho
+ * funkciou createFromImageVirtualMachine je jeho sukromne mapovanie: stranky, do ktorych
+ * stroj nezapisuje (typicky kod programu), maju vsetky stroje v pamati hostitela iba raz,
+ * stranku, do ktorej stroj zapise (data, zasobnik), si jadro hostitela pri prvom zapise
+ * skopiruje len pre tento stroj.
+ * @param data obsah pamate od adresy 0
+ * @param length dlzka obsahu v bytoch, najviac VM_MEMORY_FULL_SIZE, zvysok pamate su nuly
+ * @return obraz, NULL ak je obsah prilis dlhy alebo sa obraz nepodarilo vytvorit
+ */
+VM_IMAGE * createImageVirtualMachine(const void * data, uint32_t length) {
+	VM_IMAGE * image;
+	void * contents;
+	if (length > VM_MEMORY_FULL_SIZE || (image = malloc(sizeof(VM_IMAGE))) == NULL) return NULL;
+	if ((image->fd = vmAnonymousFile()) < 0) {
+		free(image);
+		return NULL;
+	}
+	if (ftruncate(image->fd, IMAGE_SIZE) != 0 ||
+			(contents = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, image->fd, 0)) == MAP_FAILED) {
+		destroyImageVirtualMachine(image);
+		return NULL;
+	}
+	memcpy(contents, data, length);
+	munmap(contents, IMAGE_SIZE);
+	return image;
+}
+
+/** Zrusi obraz pamate. Stroje vytvorene z obrazu zostavaju platne.
+ * @param image obraz pamate
+ */
+void destroyImageVirtualMachine(VM_IMAGE * image) {
+	close(image->fd);
+	free(image);
+}
+
+/** Vytvori stroj s celym 64 KiB adresnym priestorom (VM_MEMORY_FULL), ktoreho pamat je
+ * sukromna kopia obrazu pri zapise (copy-on-write, vid createImageVirtualMachine). Stroj
+ * ma v mem_flags VM_MEMORY_MAPPED a inak sa sprava rovnako ako stroj z createVirtualMachine
+ * s pamatou NULL, zapisy jedneho stroja ostatne stroje ani obraz nevidia.
+ * @param image obraz pamate
+ * @param pc startovacia adresa behu virtualneho stroja
+ * @return popisovac virtualneho stroja, NULL ak sa pamat nepodarilo namapovat
+ */
+VIRTUAL_MACHINE * createFromImageVirtualMachine(VM_IMAGE * image, uint16_t pc) {
+	VIRTUAL_MACHINE * machine;
+	void * memory = mmap(NULL, IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, image->fd, 0);
+	if (memory == MAP_FAILED) return NULL;
+	if ((machine = createVirtualMachine(memory, VM_MEMORY_FULL_SIZE - 1, pc)) == NULL) {
+		munmap(memory, IMAGE_SIZE);
+		return NULL;
+	}
+	machine->mem_flags = VM_MEMORY_FULL | VM_MEMORY_MAPPED;
+	return machine;
+}
+
+/** Vytvori stroj s celym 64 KiB adresnym priestorom (VM_MEMORY_FULL), ktoreho pamat je
+ * priamo sukromne mapovanie obrazu v subore (napr. BIN za hlavickou). Obsah sa nekopiruje:
+ * stranky obrazu poskytuje cache suborov hostitela a jadro hostitela nacita iba stranky, ktore
+ * stroj pouzije. Prvy zapis na stranku si jadro skopiruje len pre tento stroj, subor sa nemeni.
+ * Pamat za obrazom su nuly. Ak offset nie je nasobkom stranky hostitela, nie je na stranku
+ * zarovnana ani pamat stroja (attachBanksVirtualMachine ju preto pri pripajani bank skopiruje,
+ * pri neparnom posune stroj nemoze byt v zhluku). Stroj ma v mem_flags VM_MEMORY_MAPPED a inak
+ * sa sprava rovnako ako stroj z createVirtualMachine s pamatou NULL. Subor sa pocas zivota stroja
+ * nesmie skratit; ak ho iny proces zmeni, stroj moze zmenu na strankach, kam este nezapisal, vidiet.
+ * @param filename nazov suboru s obrazom
+ * @param offset pozicia obrazu v subore
+ * @param length dlzka obrazu v bytoch, najviac VM_MEMORY_FULL_SIZE
+ * @param pc startovacia adresa behu virtualneho stroja
+ * @return popisovac virtualneho stroja, NULL ak je obraz prilis dlhy, presahuje koniec suboru,
+ * alebo sa subor nepodarilo otvorit ci namapovat
+ */
+VIRTUAL_MACHINE * createFromFileVirtualMachine(const char * filename, uint32_t offset, uint32_t length, uint16_t pc) {
+	long host = sysconf(_SC_PAGESIZE);
+	VIRTUAL_MACHINE * machine;
+	struct stat file;
+	uint8_t * base, * memory;
+	uint32_t skip, end;
+	int fd;
+
+	if (host <= 0 || length > VM_MEMORY_FULL_SIZE || (fd = open(filename, O_RDONLY | O_CLOEXEC)) < 0) return NULL;
+	skip = offset % host;
+	if (fstat(fd, &file) != 0 || (off_t) offset + length > file.st_size ||
+			(base = mmap(NULL, skip + IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	/* obraz prekryje zaciatok vyhradenej oblasti, zvysok zostanu anonymne nuly */
+	if (length > 0 && mmap(base, skip + length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset - skip) == MAP_FAILED) {
+		close(fd);
+		munmap(base, skip + IMAGE_SIZE);
+		return NULL;
+	}
+	close(fd);
+	memory = base + skip;
+	/* posledna stranka obrazu moze obsahovat dalsie data suboru, pamat za obrazom su nuly */
+	end = (skip + length + host - 1) / host * host - skip;
+	if (length > 0 && (off_t) offset + length < file.st_size) memset(memory + length, 0, (end < IMAGE_SIZE ? end : IMAGE_SIZE) - length);
+	if ((machine = createVirtualMachine((char *) memory, VM_MEMORY_FULL_SIZE - 1, pc)) == NULL) {
+		munmap(base, skip + IMAGE_SIZE);
+		return NULL;
+	}
+	machine->mem_flags = VM_MEMORY_FULL | VM_MEMORY_MAPPED;
+	return machine;
+}
+
+/** Uvolni pamat stroja, ktoru si stroj sam alokoval alebo namapoval.
+ * Mapovana pamat nemusi zacinat na zaciatku stranky hostitela (createFromFileVirtualMachine).
+ * @param machine popisovac virtualneho stroja
+ */
+void vmFreeMemory(VIRTUAL_MACHINE * machine) {
+	uintptr_t skip;
+	if (machine->mem_flags & VM_MEMORY_MAPPED) {
+		skip = (uintptr_t) machine->memory % sysconf(_SC_PAGESIZE);
+		munmap(machine->memory - skip, skip + IMAGE_SIZE);
+	} else if (machine->mem_flags & VM_MEMORY_FULL) free(machine->memory);
+}
+
+/** Zapne alebo vypne ochranu stranok pamate stroja proti zapisu.
+ * Zapis instrukciou stroja na chranenu stranku (aj obsluhou prerusenia alebo nativnou
+ * funkciou) sa nevykona a beh skonci chybou VM_WRITE_PROTECTED s adresou zapisu vo
+ * fault_address. Nezarovnane slovo na konci stranky zapisuje aj do nasledujucej stranky,
+ * zapis skonci chybou, ak je chranena ktorakolvek z nich. Hostitel moze do chranenych
+ * stranok zapisovat.
+ * Urcene najma pre kod programu, ktory sa nema menit.
+ * @param machine popisovac virtualneho stroja
+ * @param address zaciatok oblasti
+ * @param length dlzka oblasti v bytoch, chranene su vsetky stranky, do ktorych oblast zasahuje
+ * @param enable 1 ochranu zapne, 0 ju vypne
+ */
+void protectMemoryVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t length, int enable) {
+	uint32_t page;
+	if (length == 0) return;
+	for (page = address >> 8; page <= ((uint32_t) address + length - 1) >> 8 && page < VM_PAGE_COUNT; page++) {
+		if (enable) machine->page_flags[page] |= VM_PAGE_READONLY;
+		else machine->page_flags[page] &= ~VM_PAGE_READONLY;
+	}
+}
@@ -0,0 +1,279 @@
+/* Telo jadra virtualneho stroja.
+ * Tento subor sa zahrna do core.c viackrat, zakazdym s inou definiciou makier:
+ * EXEC_NAME - meno vytvorenej funkcie
+ * MEM_READ(address, half) - citanie z pamate stroja
+ * MEM_WRITE(address, data, half) - zapis do pamate stroja
+ * ADDRESS_CHECK(address) - kontrola adresy, vysledok ako pri __checkAddressValid
+ * Volitelne moze zahrnajuci subor definovat aj makra pre profilovanie:
+ * FETCH_READ(address) - nacitanie instrukcie, inak MEM_READ
+ * PROFILE_FETCH(address) - instrukcia bola nacitana z adresy
+ * PROFILE_EXEC(op) - instrukcia sa vykona
+ * PROFILE_SKIP(op) - instrukcia sa pre nesplnenu podmienku preskoci
+ * Kazde zahrnutie tak vytvori samostatnu verziu jadra, v ktorej prekladac pozna
+ * sposob pristupu do pamate uz pri preklade.
+ */
+
+/** Vykona instrukcie virtualneho stroja.
+ * Tato funkcia je jadrom virtualneho stroja. Vykonava instrukcie virtualneho 
+ * stroja, cim virtualizuje (emuluje) jeho cinnost. Tato funkcia vykonava instrukcie
+ * bud do vyskytu chyby, volania vonkajsieho prerusenia (instrukcia INT), alebo 
+ * kym nie je dosiahnuty pocet instrukcii dany argumentom limit (v pripade, ze ma 
+ * nenulovu hodnotu).
+ * Instrukcie sa nedekoduju postupnym testovanim operacneho kodu, ale jednym pristupom
+ * do tabulky predekodovanych instrukcii (vid decode.c), ktora priamo urci obsluhu,
+ * podmienku vykonania a operandy instrukcie. Na obsluhu sa skace cez tabulku navesti
+ * (computed goto), skok na dalsiu instrukciu je na konci kazdej obsluhy.
+ * Pristup do pamate ide cez makra MEM_READ, MEM_WRITE a ADDRESS_CHECK, ktore urcuje zahrnajuci subor.
+ * Priznaky sa pocas behu pocitaju odlozene: operacia, ktora ich nastavuje, si iba zapamata
+ * svoj vysledok a priznaky sa z neho vypocitaju az pri podmienenej instrukcii, FLINVERT,
+ * alebo pri navrate z funkcie, takze po navrate su v machine->flags vzdy platne.
+ * Pri nenulovom limite ulozi pocet vykonanych instrukcii (vratane INT, bez instrukcie, ktora
+ * sposobila chybu) do machine->retired, pri chybe ulozi adresu chyby do machine->fault_address.
+ * @note Ak funkcia pri volani nema limit na pocet vykonanych instrukcii, kod vovnutri stroja
+ * moze sposobit, ze sa program vovnutri stroja zacykli, nedojde ani k chybe, ani volaniu 
+ * externeho prerusenia, co sposobi, ze sa "zacykli" aj program, ktory virtualny stroj zavolal.
+ * V takom pripade sa nejedna o chybu v emulatore virtualneho stroja. Tento nie je 
+ * pisany s ohladom na multivlaknovost, alebo potrebu necakaneho zasahu do behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param limit limit vykonanych instrukcii, kym dojde k navratu z funkcie. Ak je nastaveny na 0, instrukcie sa vykonavaju bez explicitneho limitu
+ * @return dovod, pre ktory bol preruseny beh virtualneho stroja VM_OK znamena, ze bol dosiahnuty limit instrukcii a virtualny stroj normalne moze bezat dalej, VM_SOFTINT znamena ziadost o vonkajsie prerusenie, VM_ILLEGAL_OPCODE znamena chybnu instrukciu
+ */
+#ifndef FETCH_READ
+#define FETCH_READ(_a) MEM_READ((_a), MEM_OP_WORD)
+#endif
+#ifndef PROFILE_FETCH
+#define PROFILE_FETCH(_a)
+#endif
+#ifndef PROFILE_EXEC
+#define PROFILE_EXEC(_op)
+#endif
+#ifndef PROFILE_SKIP
+#define PROFILE_SKIP(_op)
+#endif
+
+static VM_STATE EXEC_NAME(VIRTUAL_MACHINE * machine, uint16_t limit) {
+	static const void * dispatch[VMOP_COUNT] = {
+		&&op_illegal,
+		&&op_branch, &&op_branchl,
+		&&op_load, &&op_load_predec, &&op_load_postinc, &&op_load_byte,
+		&&op_store, &&op_store_predec, &&op_store_postinc, &&op_store_byte,
+		&&op_iload,
+		&&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod, &&op_and, &&op_or, &&op_xor,
+		&&op_adds, &&op_subs, &&op_muls, &&op_divs, &&op_mods, &&op_ands, &&op_ors, &&op_xors,
+		&&op_shl, &&op_shr, &&op_not, &&op_flinvert,
+		&&op_addc, &&op_subc, &&op_addcs, &&op_subcs,
+		&&op_mov, &&op_swap, &&op_int
+	};
+	uint32_t remaining = (limit != 0) ? limit : 1;
+	uint8_t step = (limit != 0);
+	const DECODED_INSTRUCTION * op;
+	uint16_t * reg = machine->registers;
+	uint16_t instr;
+	uint8_t vm_state;
+	signed long result;
+	signed long flags_result = 0;
+	uint8_t flags_lazy = 0;
+
+/* Odlozene priznaky: flags_lazy znamena, ze priznaky su dane vysledkom flags_result. */
+#define LAZY_FLAGS(_r) \
+	do { flags_result = (_r); flags_lazy = 1; } while (0)
+
+#define CLEAR_FLAGS() \
+	do { machine->flags = 0; flags_lazy = 0; } while (0)
+
+#define SYNC_FLAGS() \
+	do { if (flags_lazy) { machine->flags = __aluFlags(flags_result); flags_lazy = 0; } } while (0)
+
+/* Pocet vykonanych instrukcii sa zapamata v machine->retired (plati iba pri nenulovom limite). */
+#define EXIT(_state) \
+	do { SYNC_FLAGS(); machine->retired = limit - remaining; return (_state); } while (0)
+
+/* Chyba pamate na adrese _a, instrukcia sa nevykonala. */
+#define FAULT(_a, _state) \
+	do { machine->fault_address = (_a); EXIT(_state); } while (0)
+
+/* Nacita, dekoduje a spusti obsluhu nasledujucej instrukcie. Je rozvinute na konci
+ * kazdej obsluhy, aby mal kazdy nepriamy skok vlastnu predikciu. */
+#define FETCH() \
+	do { \
+		if ((vm_state = ADDRESS_CHECK(reg[15])) != VM_OK) FAULT(reg[15], vm_state); \
+		instr = FETCH_READ(reg[15]); \
+		PROFILE_FETCH(reg[15]); \
+		reg[15] += 2; \
+		op = &vmDecodeTable[instr]; \
+		if (op->cond) { \
+			SYNC_FLAGS(); \
+			if (!(machine->flags & op->cond)) { PROFILE_SKIP(op); goto skip; } \
+		} \
+		PROFILE_EXEC(op); \
+		goto *dispatch[op->handler]; \
+	} while (0)
+
+#define NEXT() \
+	do { \
+		remaining -= step; \
+		if (remaining == 0 || __interruptPending(machine)) EXIT(VM_OK); \
+		FETCH(); \
+	} while (0)
+
+#define CHECK_ADDRESS(_a) \
+	if ((vm_state = ADDRESS_CHECK(_a)) != VM_OK) FAULT((_a), vm_state)
+
+/* Zapis na stranku s atributmi (napr. predekodovany kod) musi byt ohlaseny, zapis na stranku
+ * chranenu proti zapisu skonci chybou a nevykona sa. Nezarovnane slovo na konci stranky
+ * zasahuje aj nasledujucu stranku. */
+#define STORE(_a, _d, _half) \
+	do { \
+		uint8_t __flags = __storeFlags(machine, (_a), (_half)); \
+		if (__flags & VM_PAGE_READONLY) FAULT((_a), VM_WRITE_PROTECTED); \
+		MEM_WRITE((_a), (_d), (_half)); \
+		if (__flags) vmPageWritten(machine, (_a), (_half)); \
+	} while (0)
+
+	machine->ext_interrupt = 0;
+	FETCH();
+
+skip:
+	NEXT();
+
+op_branchl:
+	machine->RL = reg[15];
+op_branch:
+	if (instr & BIT11) reg[15] -= instr & 0x07FE;
+	else reg[15] += instr & 0x07FE;
+	NEXT();
+
+op_load_predec:
+	reg[op->arg1] -= 2;
+op_load:
+	CHECK_ADDRESS(reg[op->arg1]);
+	reg[op->arg2] = MEM_READ(reg[op->arg1], MEM_OP_WORD);
+	NEXT();
+
+op_load_postinc:
+	CHECK_ADDRESS(reg[op->arg1]);
+	reg[op->arg2] = MEM_READ(reg[op->arg1], MEM_OP_WORD);
+	reg[op->arg1] += 2;
+	NEXT();
+
+op_load_byte:
+	CHECK_ADDRESS(reg[op->arg1]);
+	reg[op->arg2] = MEM_READ(reg[op->arg1], MEM_OP_BYTE);
+	NEXT();
+
+op_store_predec:
+	reg[op->arg1] -= 2;
+op_store:
+	CHECK_ADDRESS(reg[op->arg1]);
+	STORE(reg[op->arg1], reg[op->arg2], MEM_OP_WORD);
+	NEXT();
+
+op_store_postinc:
+	CHECK_ADDRESS(reg[op->arg1]);
+	STORE(reg[op->arg1], reg[op->arg2], MEM_OP_WORD);
+	reg[op->arg1] += 2;
+	NEXT();
+
+op_store_byte:
+	CHECK_ADDRESS(reg[op->arg1]);
+	STORE(reg[op->arg1], reg[op->arg2], MEM_OP_BYTE);
+	NEXT();
+
+op_iload:
+	reg[op->arg1] = (reg[op->arg1] << 8) | op->arg2;
+	NEXT();
+
+op_add:	reg[op->arg1] += reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_sub:	reg[op->arg1] -= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_mul:	reg[op->arg1] = (uint32_t) reg[op->arg1] * reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_div:	reg[op->arg1] /= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_mod:	reg[op->arg1] %= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_and:	reg[op->arg1] &= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_or:	reg[op->arg1] |= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+op_xor:	reg[op->arg1] ^= reg[op->arg2]; CLEAR_FLAGS(); NEXT();
+
+op_adds:	result = (signed long) reg[op->arg1] + reg[op->arg2]; goto alu_flags;
+op_subs:	result = (signed long) reg[op->arg1] - reg[op->arg2]; goto alu_flags;
+op_muls:	result = (signed long) reg[op->arg1] * reg[op->arg2]; goto alu_flags;
+op_divs:	result = (signed long) reg[op->arg1] / reg[op->arg2]; goto alu_flags;
+op_mods:	result = (signed long) reg[op->arg1] % reg[op->arg2]; goto alu_flags;
+op_ands:	result = reg[op->arg1] & reg[op->arg2]; goto alu_flags;
+op_ors:		result = reg[op->arg1] | reg[op->arg2]; goto alu_flags;
+op_xors:	result = reg[op->arg1] ^ reg[op->arg2];
+alu_flags:
+	LAZY_FLAGS(result);
+	reg[op->arg1] = result & 0xFFFF;
+	NEXT();
+
+op_shl:
+	reg[op->arg1] <<= op->arg2;
+	NEXT();
+
+op_shr:
+	reg[op->arg1] >>= op->arg2;
+	NEXT();
+
+op_not:
+	reg[op->arg2] = ~reg[op->arg2];
+	NEXT();
+
+op_flinvert:
+	SYNC_FLAGS();
+	machine->flags = machine->flags ^ ~(op->arg2 << 4);
+	NEXT();
+
+op_addc:
+	reg[op->arg1] += op->arg2;
+	NEXT();
+
+op_subc:
+	reg[op->arg1] -= op->arg2;
+	NEXT();
+
+op_addcs:
+	reg[op->arg1] += op->arg2;
+	LAZY_FLAGS(reg[op->arg1]);
+	NEXT();
+
+op_subcs:
+	reg[op->arg1] -= op->arg2;
+	LAZY_FLAGS(reg[op->arg1]);
+	NEXT();
+
+op_mov:
+	reg[op->arg1] = reg[op->arg2];
+	NEXT();
+
+op_swap:
+	result = reg[op->arg1];
+	reg[op->arg1] = reg[op->arg2];
+	reg[op->arg2] = result;
+	NEXT();
+
+op_int:
+	machine->ext_interrupt = GET_IMMEDIATE(instr);
+	remaining -= step;
+	EXIT(VM_SOFTINT);
+
+op_illegal:
+	FAULT(reg[15] - 2, VM_ILLEGAL_OPCODE);
+
+#undef STORE
+#undef CHECK_ADDRESS
+#undef NEXT
+#undef FETCH
+#undef FAULT
+#undef EXIT
+#undef SYNC_FLAGS
+#undef CLEAR_FLAGS
+#undef LAZY_FLAGS
+}
+
+#undef PROFILE_SKIP
+#undef PROFILE_EXEC
+#undef PROFILE_FETCH
+#undef FETCH_READ
+#undef ADDRESS_CHECK
+#undef MEM_WRITE
+#undef MEM_READ
+#undef EXEC_NAME
@@ -0,0 +1,221 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/// Ako dlho spi vlakno stroja medzi kontrolami, ci prislo prerusenie (ns)
+#define INTERRUPT_WAIT_NS	200000
+
+/** Vytvori radic preruseni s prazdnou frontou.
+ * @return radic preruseni, NULL ak sa ho nepodarilo alokovat
+ */
+struct InterruptController * vmCreateInterrupts(void) {
+	struct InterruptController * irq = calloc(1, sizeof(struct InterruptController));
+	uint32_t q;
+	if (irq == NULL) return NULL;
+	for (q = 0; q < INTERRUPT_QUEUE_SIZE; q++) irq->sequence[q] = q;
+	return irq;
+}
+
+/** Zisti, ci je vo fronte zverejnene prerusenie. Vola iba vlakno stroja.
+ * @param irq radic preruseni
+ * @return 1 ak fronta nie je prazdna
+ */
+static int __queued(struct InterruptController * irq) {
+	uint32_t slot = irq->head & (INTERRUPT_QUEUE_SIZE - 1);
+	return __atomic_load_n(&irq->sequence[slot], __ATOMIC_ACQUIRE) == irq->head + 1;
+}
+
+/** Vyberie z fronty najstarsie prerusenie. Vola iba vlakno stroja.
+ * @param irq radic preruseni
+ * @param vector miesto pre cislo prerusenia
+ * @return 1 ak bolo prerusenie vybrane, 0 ak je fronta prazdna
+ */
+static int __pop(struct InterruptController * irq, uint8_t * vector) {
+	uint32_t slot = irq->head & (INTERRUPT_QUEUE_SIZE - 1);
+	if (!__queued(irq)) return 0;
+	*vector = irq->vectors[slot];
+	/* pozicia sa uvolni pre zapis o jedno otocenie fronty neskor */
+	__atomic_store_n(&irq->sequence[slot], irq->head + INTERRUPT_QUEUE_SIZE, __ATOMIC_RELEASE);
+	irq->head++;
+	return 1;
+}
+
+/** Ohlasi jadru, ze na stroj caka prerusenie. */
+static void __raise(VIRTUAL_MACHINE * machine) {
+	__atomic_store_n(&machine->interrupt_pending, 1, __ATOMIC_SEQ_CST);
+}
+
+/** Posle stroju prerusenie.
+ * Funkciu moze volat lubovolne vlakno hostitela aj obsluha signalu, aj pocas behu stroja,
+ * nepouziva zamky ani nealokuje pamat. Bezace jadro prerusenie zisti pri najblizsej kontrole
+ * vo svojej hlavnej slucke a skonci, traceVirtualMachine ho potom obsluzi (vid
+ * setInterruptTableVirtualMachine). Prerusenia sa obsluhuju v poradi, v akom boli poslane.
+ * @param machine popisovac virtualneho stroja
+ * @param vector cislo prerusenia 1 az 255
+ * @return 0 ak bolo prerusenie zaradene, -1 ak je fronta plna alebo vector je 0
+ */
+int postInterruptVirtualMachine(VIRTUAL_MACHINE * machine, uint8_t vector) {
+	struct InterruptController * irq = machine->interrupts;
+	uint32_t pos = __atomic_load_n(&irq->tail, __ATOMIC_RELAXED), slot, sequence;
+	if (vector == 0) return -1;
+	for (;;) {
+		slot = pos & (INTERRUPT_QUEUE_SIZE - 1);
+		sequence = __atomic_load_n(&irq->sequence[slot], __ATOMIC_ACQUIRE);
+		if (sequence == pos) {
+			/* pozicia je volna, rezervuje ju ten producent, ktoremu sa podari posunut tail */
+			if (__atomic_compare_exchange_n(&irq->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		} else if ((int32_t) (sequence - pos) < 0) {
+			/* pozicia z predchadzajuceho otocenia este nebola vybrana */
+			return -1;
+		} else {
+			pos = __atomic_load_n(&irq->tail, __ATOMIC_RELAXED);
+		}
+	}
+	irq->vectors[slot] = vector;
+	__atomic_store_n(&irq->sequence[slot], pos + 1, __ATOMIC_RELEASE);
+	__raise(machine);
+	return 0;
+}
+
+/** Nastavi tabulku vektorov preruseni v pamati stroja.
+ * Tabulka obsahuje pre kazde cislo prerusenia slovo s adresou jeho obsluhy, polozka pre
+ * prerusenie n je na adrese address + 2 * n. Pri obsluhe prerusenia sa na zasobnik stroja
+ * (SP) ulozi PC a potom slovo s cislom prerusenia v hornom a priznakmi v dolnom byte, PC sa
+ * nastavi na adresu obsluhy a dalsie prerusenia cakaju vo fronte. Obsluha sa vrati instrukciou
+ * INT VM_INTERRUPT_RETURN, ktora obnovi priznaky, PC a SP. Prerusenie s nulovou polozkou
+ * v tabulke, resp. kazde prerusenie, ak je address 0, program stroja neobsluhuje: beh stroja
+ * skonci so stavom VM_OK a cislom prerusenia v ext_interrupt. Funkcia sa nesmie volat pocas
+ * behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa tabulky vektorov, 0 vypne obsluhu preruseni programom stroja
+ */
+void setInterruptTableVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address) {
+	machine->interrupts->table = address;
+}
+
+/** Overi, ci sa na zasobnik stroja zmestia dve slova.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa nizsieho slova
+ * @param write 1 ak sa ramec bude zapisovat
+ * @return stav overenia, pri chybe nastavi fault_address
+ */
+static VM_STATE __checkFrame(VIRTUAL_MACHINE * machine, uint16_t address, int write) {
+	VM_STATE state;
+	if ((state = __checkAddressValid(machine, address)) != VM_OK) machine->fault_address = address;
+	else if ((state = __checkAddressValid(machine, address + 2)) != VM_OK) machine->fault_address = address + 2;
+	else if (write && (state = __checkWritable(machine, address, MEM_OP_WORD)) != VM_OK) machine->fault_address = address;
+	else if (write && (state = __checkWritable(machine, address + 2, MEM_OP_WORD)) != VM_OK) machine->fault_address = address + 2;
+	return state;
+}
+
+/** Zapise slovo na adresu stroja a ohlasi zapis na stranku s atributmi.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @param data zapisovane slovo
+ */
+static void __write(VIRTUAL_MACHINE * machine, uint16_t address, uint16_t data) {
+	vmBusWrite(machine, address, data, MEM_OP_WORD);
+	if (__storeFlags(machine, address, MEM_OP_WORD)) vmPageWritten(machine, address, MEM_OP_WORD);
+}
+
+/** Obsluzi najstarsie prerusenie vo fronte.
+ * Vola ho traceVirtualMachine pred behom jadra a vzdy, ked jadro skonci pre cakajuce
+ * prerusenie. Kym program stroja obsluhuje prerusenie, ostatne zostavaju vo fronte.
+ * @param machine popisovac virtualneho stroja
+ * @return VM_OK, alebo chyba, ak sa ramec prerusenia nezmestil na zasobnik; ak program stroja
+ * prerusenie neobsluhuje, je jeho cislo v ext_interrupt
+ */
+VM_STATE vmServiceInterrupts(VIRTUAL_MACHINE * machine) {
+	struct InterruptController * irq = machine->interrupts;
+	uint16_t handler = 0, entry, frame = machine->SP - 4;
+	uint8_t vector;
+	VM_STATE state;
+
+	/* priznak sa zrusi pred vyberom z fronty, prerusenie poslane potom ho nastavi znova */
+	__atomic_exchange_n(&machine->interrupt_pending, 0, __ATOMIC_SEQ_CST);
+	if (irq->active || !__pop(irq, &vector)) return VM_OK;
+	if (machine->recording != NULL) vmRecordInterrupt(machine, vector);
+	if (irq->table != 0) {
+		entry = irq->table + 2 * vector;
+		if (__checkAddressValid(machine, entry) == VM_OK) handler = vmBusRead(machine, entry, MEM_OP_WORD);
+	}
+	if (handler == 0) {
+		machine->ext_interrupt = vector;
+		if (__queued(irq)) __raise(machine);
+		return VM_OK;
+	}
+	if ((state = __checkFrame(machine, frame, 1)) != VM_OK) return state;
+	__write(machine, frame + 2, machine->PC);
+	__write(machine, frame, vector << 8 | machine->flags);
+	machine->SP = frame;
+	machine->PC = handler;
+	irq->active = 1;
+	return VM_OK;
+}
+
+/** Vrati sa z obsluhy prerusenia: obnovi priznaky a PC zo zasobnika stroja.
+ * Ak vo fronte cakaju dalsie prerusenia, ohlasi ich jadru.
+ * @param machine popisovac virtualneho stroja
+ * @return VM_OK, alebo chyba, ak ramec prerusenia nie je na platnej adrese
+ */
+VM_STATE vmReturnInterrupt(VIRTUAL_MACHINE * machine) {
+	struct InterruptController * irq = machine->interrupts;
+	uint16_t frame = machine->SP;
+	VM_STATE state;
+	if ((state = __checkFrame(machine, frame, 0)) != VM_OK) return state;
+	machine->flags = vmBusRead(machine, frame, MEM_OP_WORD) & 0xFF;
+	machine->PC = vmBusRead(machine, frame + 2, MEM_OP_WORD);
+	machine->SP = frame + 4;
+	machine->ext_interrupt = 0;
+	irq->active = 0;
+	if (__queued(irq)) __raise(machine);
+	return VM_OK;
+}
+
+/** Uspi vlakno stroja, kym mu hostitel neposle prerusenie.
+ * Pouziva sa, ked program stroja caka v slucke necinnosti a nic ine ho nezobudi.
+ * Prerusenie moze poslat aj obsluha signalu, preto sa priznak iba periodicky kontroluje.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmWaitInterrupt(VIRTUAL_MACHINE * machine) {
+	struct timespec pause = { 0, INTERRUPT_WAIT_NS };
+	while (!__interruptPending(machine)) nanosleep(&pause, NULL);
+}
+
+/** Ulozi stav radica preruseni: tabulku vektorov, obsluhu v behu a cakajuce prerusenia.
+ * Prerusenie, ktore hostitel prave posiela, sa ulozi iba ak uz je zverejnene.
+ * @param machine popisovac virtualneho stroja
+ * @param state miesto pre stav
+ */
+void vmSaveInterrupts(VIRTUAL_MACHINE * machine, struct InterruptState * state) {
+	struct InterruptController * irq = machine->interrupts;
+	uint32_t pos = irq->head, slot;
+	state->table = irq->table;
+	state->active = irq->active;
+	for (state->count = 0; state->count < INTERRUPT_QUEUE_SIZE; state->count++, pos++) {
+		slot = pos & (INTERRUPT_QUEUE_SIZE - 1);
+		if (__atomic_load_n(&irq->sequence[slot], __ATOMIC_ACQUIRE) != pos + 1) break;
+		state->vectors[state->count] = irq->vectors[slot];
+	}
+}
+
+/** Obnovi stav radica preruseni, fronta bude obsahovat prave ulozene prerusenia.
+ * Nesmie sa volat sucasne s postInterruptVirtualMachine.
+ * @param machine popisovac virtualneho stroja
+ * @param state ulozeny stav
+ */
+void vmRestoreInterrupts(VIRTUAL_MACHINE * machine, const struct InterruptState * state) {
+	struct InterruptController * irq = machine->interrupts;
+	uint32_t q;
+	for (q = 0; q < INTERRUPT_QUEUE_SIZE; q++) irq->sequence[q] = (q < state->count) ? q + 1 : q;
+	memcpy(irq->vectors, state->vectors, state->count);
+	irq->head = 0;
+	__atomic_store_n(&irq->tail, state->count, __ATOMIC_RELEASE);
+	irq->table = state->table;
+	irq->active = state->active;
+	__atomic_store_n(&machine->interrupt_pending, 0, __ATOMIC_SEQ_CST);
+	if (state->count > 0) __raise(machine);
+}
@@ -0,0 +1,894 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <vm.h>
+#include "vm.h"
+
+#include "bits.h"
+#include "registers.h"
+#include "instruction.h"
+#include "decode.h"
+
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE		(4 << 20)
+#define JIT_BLOCK_RESERVE	(16 << 10)
+#define JIT_MAX_INSTRUCTIONS	64
+#define JIT_HOT_THRESHOLD	8
+
+enum JIT_Exit { JIT_EXIT_CHAIN = 1, JIT_EXIT_INTERPRET, JIT_EXIT_BUDGET, JIT_EXIT_INTERRUPT };
+
+/** Stav prekladaneho kodu.
+ * Prelozeny kod ma na neho pocas behu ukazovatel v registri r15. Registre stroja, ktore
+ * nie su pripnute v registroch hostitela, su pocas behu iba tu.
+ */
+struct JitState {
+	int64_t budget;				// zostavajuci pocet instrukcii
+	int64_t result;				// vysledok poslednej operacie nastavujucej priznaky (ak lazy)
+	uint8_t lazy;				// 1 ak su priznaky dane hodnotou result, 0 ak su v flags
+	uint8_t flags;
+	uint16_t exit_pc;			// adresa, na ktorej sa vykonavanie prelozeneho kodu skoncilo
+	uint16_t registers[16];
+	uint32_t mem_size;
+	unsigned char * memory;
+	uint8_t * page_flags;
+	uint8_t * interrupt_pending;
+	unsigned char * link;		// miesto skoku, ktore sa da prepojit priamo na cielovy blok
+};
+
+typedef struct JitState JIT_STATE;
+
+struct JitEntry {
+	unsigned char * code;		// vstup prelozeneho bloku, NULL ak blok nie je prelozeny
+	uint16_t count;				// pocet vykonani interpretom
+	uint8_t length;				// pocet instrukcii bloku
+	uint8_t failed;				// blok sa neda prelozit
+};
+
+typedef struct JitEntry JIT_ENTRY;
+
+struct JitCache {
+	JIT_STATE state;
+	unsigned char * code;
+	size_t used;
+	uint32_t (* enter)(JIT_STATE * state, void * code);
+	unsigned char * exit;
+	VIRTUAL_MACHINE * shadow;	// stroj pre kontrolu prekladu interpretom
+	unsigned char * shadow_memory;
+	JIT_ENTRY map[32768];
+};
+
+typedef struct JitCache JIT_CACHE;
+
+/* Pripnutie registrov stroja do registrov hostitela, -1 znamena register v JitState.
+ * rax, rcx a rdx su pracovne registre, r14 je baza pamate stroja a r15 ukazuje na JitState. */
+#define H_RAX	0
+#define H_RCX	1
+#define H_RDX	2
+#define H_R14	14
+#define H_R15	15
+
+static const int8_t __pinned[16] = { 3, 5, 6, 7, 8, 9, 10, 11, -1, -1, -1, -1, -1, 12, 13, -1 };
+
+#define OFF(_f)		((uint8_t) offsetof(JIT_STATE, _f))
+#define OFF_REG(_r)	((uint8_t) (offsetof(JIT_STATE, registers) + 2 * (_r)))
+#define MODRM(_mod, _reg, _rm)	((uint8_t) (((_mod) << 6) | (((_reg) & 7) << 3) | ((_rm) & 7)))
+
+/** Zapisovac strojoveho kodu. */
+struct Emitter {
+	unsigned char * p;
+	unsigned char * end;
+};
+
+typedef struct Emitter EMITTER;
+
+static void __b(EMITTER * e, uint8_t b) {
+	if (e->p < e->end) *e->p = b;
+	e->p++;
+}
+
+static void __d16(EMITTER * e, uint16_t v) {
+	__b(e, v & 0xFF);
+	__b(e, v >> 8);
+}
+
+static void __d32(EMITTER * e, uint32_t v) {
+	__d16(e, v & 0xFFFF);
+	__d16(e, v >> 16);
+}
+
+static void __d64(EMITTER * e, uint64_t v) {
+	__d32(e, v & 0xFFFFFFFF);
+	__d32(e, v >> 32);
+}
+
+/** Zapise prefix REX, ak je potrebny. */
+static void __rex(EMITTER * e, int w, int r, int b) {
+	uint8_t v = 0x40 | (w << 3) | ((r >> 3) << 2) | (b >> 3);
+	if (v != 0x40) __b(e, v);
+}
+
+/** Zapise podmieneny (cc >= 0) alebo nepodmieneny (cc < 0) skok s 32 bitovym posunutim.
+ * @return miesto posunutia, ktore sa doplni neskor
+ */
+static unsigned char * __jump(EMITTER * e, int cc) {
+	unsigned char * site;
+	if (cc >= 0) {
+		__b(e, 0x0F);
+		__b(e, 0x80 | cc);
+	} else __b(e, 0xE9);
+	site = e->p;
+	__d32(e, 0);
+	return site;
+}
+
+/** Doplni posunutie skoku na ciel. */
+static void __patch(EMITTER * e, unsigned char * site, unsigned char * target) {
+	int32_t rel = (int32_t) (target - (site + 4));
+	if (site + 4 > e->end) return;
+	memcpy(site, &rel, 4);
+}
+
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_L	0xC
+#define CC_GE	0xD
+
+/** Nacita register stroja do pracovneho registra hostitela (nulami rozsireny). */
+static void __loadReg(EMITTER * e, int host, int guest) {
+	int pin = __pinned[guest];
+	if (pin >= 0) {
+		__rex(e, 0, pin, host);
+		__b(e, 0x89);
+		__b(e, MODRM(3, pin, host));
+	} else {
+		__rex(e, 0, host, H_R15);
+		__b(e, 0x0F);
+		__b(e, 0xB7);
+		__b(e, MODRM(1, host, H_R15));
+		__b(e, OFF_REG(guest));
+	}
+}
+
+/** Zapise dolnych 16 bitov pracovneho registra do registra stroja. */
+static void __storeReg(EMITTER * e, int guest, int host) {
+	int pin = __pinned[guest];
+	if (pin >= 0) {
+		__rex(e, 0, pin, host);
+		__b(e, 0x0F);
+		__b(e, 0xB7);
+		__b(e, MODRM(3, pin, host));
+	} else {
+		__b(e, 0x66);
+		__rex(e, 0, host, H_R15);
+		__b(e, 0x89);
+		__b(e, MODRM(1, host, H_R15));
+		__b(e, OFF_REG(guest));
+	}
+}
+
+/** mov eax, imm32 */
+static void __movImm(EMITTER * e, int host, uint32_t imm) {
+	__rex(e, 0, 0, host);
+	__b(e, 0xB8 | (host & 7));
+	__d32(e, imm);
+}
+
+/** movzx eax, ax */
+static void __zext16(EMITTER * e, int host) {
+	__rex(e, 0, host, host);
+	__b(e, 0x0F);
+	__b(e, 0xB7);
+	__b(e, MODRM(3, host, host));
+}
+
+/** 64 bitova operacia dst = dst op src (add, sub, and, or, xor). */
+static void __alu64(EMITTER * e, uint8_t opcode, int dst, int src) {
+	__rex(e, 1, src, dst);
+	__b(e, opcode);
+	__b(e, MODRM(3, src, dst));
+}
+
+/** mov byte [r15 + off], imm8 */
+static void __setByte(EMITTER * e, uint8_t off, uint8_t imm) {
+	__b(e, 0x41);
+	__b(e, 0xC6);
+	__b(e, MODRM(1, 0, H_R15));
+	__b(e, off);
+	__b(e, imm);
+}
+
+/** mov word [r15 + exit_pc], imm16 */
+static void __setExitPC(EMITTER * e, uint16_t pc) {
+	__b(e, 0x66);
+	__b(e, 0x41);
+	__b(e, 0xC7);
+	__b(e, MODRM(1, 0, H_R15));
+	__b(e, OFF(exit_pc));
+	__d16(e, pc);
+}
+
+/** add/sub qword [r15 + budget], imm32 */
+static void __budget(EMITTER * e, int sub, uint32_t count) {
+	__b(e, 0x49);
+	__b(e, 0x81);
+	__b(e, MODRM(1, sub ? 5 : 0, H_R15));
+	__b(e, OFF(budget));
+	__d32(e, count);
+}
+
+/** Ulozi vysledok z rax ako zdroj priznakov. */
+static void __lazyFlags(EMITTER * e) {
+	__b(e, 0x49);
+	__b(e, 0x89);
+	__b(e, MODRM(1, H_RAX, H_R15));
+	__b(e, OFF(result));
+	__setByte(e, OFF(lazy), 1);
+}
+
+/** Vynuluje priznaky (ALU operacia bez S). */
+static void __clearFlags(EMITTER * e) {
+	__setByte(e, OFF(lazy), 0);
+	__setByte(e, OFF(flags), 0);
+}
+
+/** Staticky znamy stav priznakov v ramci prekladaneho bloku. */
+enum JIT_Flags { FLAGS_UNKNOWN = 0, FLAGS_LAZY, FLAGS_ZERO };
+
+#define MAX_SITES	8
+
+/** Zapise test podmienky vykonania instrukcie.
+ * @param e zapisovac
+ * @param cond priznak, ktory musi byt nastaveny
+ * @param known staticky znamy stav priznakov
+ * @param skip pole, do ktoreho sa pridaju skoky na preskocenie instrukcie
+ * @return pocet skokov v poli skip
+ */
+static int __condition(EMITTER * e, uint8_t cond, int known, unsigned char ** skip) {
+	int count = 0;
+	unsigned char * lazy_site = NULL, * body_site;
+	if (known == FLAGS_ZERO) {
+		skip[count++] = __jump(e, -1);
+		return count;
+	}
+	if (known == FLAGS_UNKNOWN) {
+		/* cmp byte [r15 + lazy], 0; je materialized */
+		__b(e, 0x41);
+		__b(e, 0x80);
+		__b(e, MODRM(1, 7, H_R15));
+		__b(e, OFF(lazy));
+		__b(e, 0);
+		lazy_site = __jump(e, CC_E);
+	}
+	if (cond == CARRY_FLAG) {
+		/* ALU operacie priznak CARRY nenastavuju */
+		skip[count++] = __jump(e, -1);
+	} else {
+		/* cmp qword [r15 + result], 0 */
+		__b(e, 0x49);
+		__b(e, 0x83);
+		__b(e, MODRM(1, 7, H_R15));
+		__b(e, OFF(result));
+		__b(e, 0);
+		skip[count++] = __jump(e, (cond == ZERO_FLAG) ? CC_NE : CC_GE);
+	}
+	if (known == FLAGS_UNKNOWN) {
+		body_site = __jump(e, -1);
+		__patch(e, lazy_site, e->p);
+		/* test byte [r15 + flags], cond; jz skip */
+		__b(e, 0x41);
+		__b(e, 0xF6);
+		__b(e, MODRM(1, 0, H_R15));
+		__b(e, OFF(flags));
+		__b(e, cond);
+		skip[count++] = __jump(e, CC_E);
+		__patch(e, body_site, e->p);
+	}
+	return count;
+}
+
+/** Zisti, ci instrukciu vie prekladac prelozit.
+ * @param d predekodovana instrukcia
+ * @return 1 ak sa instrukcia da prelozit
+ */
+static int __supported(const DECODED_INSTRUCTION * d) {
+	switch (d->handler) {
+		case VMOP_ILLEGAL:
+		case VMOP_INT:
+		case VMOP_FLINVERT:
+			return 0;
+
+		case VMOP_BRANCH:
+		case VMOP_BRANCHL:
+		case VMOP_ILOAD:
+			return 1;
+
+		case VMOP_SHL:
+		case VMOP_SHR:
+		case VMOP_ADDC:
+		case VMOP_SUBC:
+		case VMOP_ADDCS:
+		case VMOP_SUBCS:
+			return d->arg1 != 15;
+
+		case VMOP_NOT:
+			return d->arg2 != 15;
+
+		default:
+			return d->arg1 != 15 && d->arg2 != 15;
+	}
+}
+
+/** Miesto v prelozenom kode, z ktoreho sa skace na vystup. */
+struct JitExit {
+	unsigned char * sites[MAX_SITES];
+	int count;
+	uint16_t pc;				// adresa, kde sa ma pokracovat
+	uint8_t kind;				// JIT_Exit
+	uint32_t refund;			// pocet instrukcii, ktore sa vratia do budgetu
+};
+
+typedef struct JitExit JIT_EXIT;
+
+/** Zapise vystupy z bloku.
+ * @param jit prekladac
+ * @param e zapisovac
+ * @param exits vystupy
+ * @param count pocet vystupov
+ */
+static void __emitExits(JIT_CACHE * jit, EMITTER * e, JIT_EXIT * exits, int count) {
+	int q, s;
+	for (q = 0; q < count; q++) {
+		unsigned char * stub = e->p;
+		for (s = 0; s < exits[q].count; s++) __patch(e, exits[q].sites[s], stub);
+		if (exits[q].refund) __budget(e, 0, exits[q].refund);
+		__setExitPC(e, exits[q].pc);
+		if (exits[q].kind == JIT_EXIT_CHAIN) {
+			/* mov rax, site; mov [r15 + link], rax */
+			__b(e, 0x48);
+			__b(e, 0xB8);
+			__d64(e, (uint64_t) (uintptr_t) exits[q].sites[0]);
+			__b(e, 0x49);
+			__b(e, 0x89);
+			__b(e, MODRM(1, H_RAX, H_R15));
+			__b(e, OFF(link));
+		}
+		__movImm(e, H_RAX, exits[q].kind);
+		__patch(e, __jump(e, -1), jit->exit);
+	}
+}
+
+/** Prelozi pristup do pamate (LOAD/STORE vo vsetkych formach adresovania).
+ * Pri nezarovnanej adrese, adrese mimo pamate, zapise na stranku s atributmi alebo slova na
+ * posledny byte stranky, alebo citani zo stranky zariadenia sa instrukcia nevykona a riadenie sa vrati interpretu, ktory ju
+ * vykona sam. Kontroly, ktore rezim pamate stroja nevyzaduje (VM_MEMORY_FULL), ani kontrola
+ * citania stroja bez zariadeni sa do kodu nezapisu.
+ */
+static void __emitMemory(EMITTER * e, const DECODED_INSTRUCTION * d, uint8_t mem_flags, int devices, JIT_EXIT * side) {
+	int store = (d->handler >= VMOP_STORE);
+	int mode = d->handler - (store ? VMOP_STORE : VMOP_LOAD);	// 0 nepriamo, 1 predekrement, 2 postinkrement, 3 byte
+	__loadReg(e, H_RAX, d->arg1);
+	if (mode == 1) {
+		__b(e, 0x83); __b(e, 0xE8); __b(e, 2);		// sub eax, 2
+		__zext16(e, H_RAX);
+	}
+	if (!(mem_flags & VM_MEMORY_FULL) || (mem_flags & VM_MEMORY_STRICT_ALIGN)) {
+		__b(e, 0xA8); __b(e, 0x01);					// test al, 1
+		side->sites[side->count++] = __jump(e, CC_NE);
+	}
+	if (!(mem_flags & VM_MEMORY_FULL)) {
+		__b(e, 0x41); __b(e, 0x3B); __b(e, MODRM(1, H_RAX, H_R15)); __b(e, OFF(mem_size));	// cmp eax, [r15 + mem_size]
+		side->sites[side->count++] = __jump(e, CC_AE);
+	}
+	if (store && mode != 3 && (mem_flags & (VM_MEMORY_FULL | VM_MEMORY_STRICT_ALIGN)) == VM_MEMORY_FULL) {
+		/* nezarovnane slovo na konci stranky zasahuje aj nasledujucu stranku */
+		__b(e, 0x3C); __b(e, 0xFF);					// cmp al, 0xFF
+		side->sites[side->count++] = __jump(e, CC_E);
+	}
+	if (store || devices) {
+		__b(e, 0x89); __b(e, 0xC2);					// mov edx, eax
+		__b(e, 0xC1); __b(e, 0xEA); __b(e, 8);		// shr edx, 8
+		__b(e, 0x49); __b(e, 0x03); __b(e, MODRM(1, H_RDX, H_R15)); __b(e, OFF(page_flags));	// add rdx, [r15 + page_flags]
+		if (store) {
+			__b(e, 0x80); __b(e, 0x3A); __b(e, 0);				// cmp byte [rdx], 0
+		} else {
+			__b(e, 0xF6); __b(e, 0x02); __b(e, VM_PAGE_DEVICE);	// test byte [rdx], VM_PAGE_DEVICE
+		}
+		side->sites[side->count++] = __jump(e, CC_NE);
+	}
+	if (mode == 1) __storeReg(e, d->arg1, H_RAX);
+	if (store) {
+		__loadReg(e, H_RCX, d->arg2);
+		if (mode == 3) {
+			__b(e, 0x41); __b(e, 0x88); __b(e, 0x0C); __b(e, 0x06);					// mov [r14 + rax], cl
+		} else {
+			__b(e, 0x66); __b(e, 0x41); __b(e, 0x89); __b(e, 0x0C); __b(e, 0x06);	// mov [r14 + rax], cx
+		}
+	} else {
+		__b(e, 0x41); __b(e, 0x0F); __b(e, (mode == 3) ? 0xB6 : 0xB7); __b(e, 0x0C); __b(e, 0x06);	// movzx ecx, [r14 + rax]
+		__storeReg(e, d->arg2, H_RCX);
+	}
+	if (mode == 2) {
+		__loadReg(e, H_RAX, d->arg1);
+		__b(e, 0x83); __b(e, 0xC0); __b(e, 2);		// add eax, 2
+		__storeReg(e, d->arg1, H_RAX);
+	}
+}
+
+/** Prelozi zakladny blok zacinajuci na adrese pc.
+ * @param machine popisovac virtualneho stroja
+ * @param jit prekladac
+ * @param start adresa prvej instrukcie
+ * @return vstup prelozeneho bloku, alebo NULL ak sa blok neda prelozit
+ */
+static unsigned char * __translate(VIRTUAL_MACHINE * machine, JIT_CACHE * jit, uint16_t start) {
+	uint16_t words[JIT_MAX_INSTRUCTIONS];
+	JIT_EXIT exits[JIT_MAX_INSTRUCTIONS + 4];
+	unsigned char * skip[MAX_SITES];
+	const DECODED_INSTRUCTION * d;
+	int count = 0, exit_count = 0, skip_count, q, s, ended = 0;
+	int known = FLAGS_UNKNOWN;
+	uint16_t pc = start;
+	EMITTER e;
+	unsigned char * entry;
+
+	do {
+		words[count] = vmDefaultMemoryRead(machine->memory, pc, MEM_OP_WORD);
+		d = &vmDecodeTable[words[count]];
+		if (!__supported(d)) break;
+		count++;
+		pc += 2;
+		if (d->handler == VMOP_BRANCH || d->handler == VMOP_BRANCHL) break;
+	} while (count < JIT_MAX_INSTRUCTIONS && (pc >> 8) == (start >> 8) && __checkAddressValid(machine, pc) == VM_OK);
+	if (count == 0) return NULL;
+
+	if (JIT_CODE_SIZE - jit->used < JIT_BLOCK_RESERVE) vmJitInvalidate(machine);
+	entry = jit->code + jit->used;
+	e.p = entry;
+	e.end = jit->code + JIT_CODE_SIZE;
+
+	/* prerusenie od hostitela: mov rax, [r15 + interrupt_pending]; cmp byte [rax], 0; jne */
+	__b(&e, 0x49); __b(&e, 0x8B); __b(&e, MODRM(1, H_RAX, H_R15)); __b(&e, OFF(interrupt_pending));
+	__b(&e, 0x80); __b(&e, 0x38); __b(&e, 0);
+	memset(&exits[exit_count], 0, sizeof(JIT_EXIT));
+	exits[exit_count].sites[exits[exit_count].count++] = __jump(&e, CC_NE);
+	exits[exit_count].pc = start;
+	exits[exit_count++].kind = JIT_EXIT_INTERRUPT;
+	/* budget: sub qword [r15 + budget], count; jl */
+	__budget(&e, 1, count);
+	memset(&exits[exit_count], 0, sizeof(JIT_EXIT));
+	exits[exit_count].sites[exits[exit_count].count++] = __jump(&e, CC_L);
+	exits[exit_count].pc = start;
+	exits[exit_count].refund = count;
+	exits[exit_count++].kind = JIT_EXIT_BUDGET;
+
+	pc = start;
+	for (q = 0; q < count; q++) {
+		uint16_t instr = words[q];
+		d = &vmDecodeTable[instr];
+		pc += 2;
+		skip_count = 0;
+		if (d->cond) skip_count = __condition(&e, d->cond, known, skip);
+
+		switch (d->handler) {
+			case VMOP_BRANCHL:
+				__movImm(&e, H_RAX, pc);
+				__storeReg(&e, 14, H_RAX);
+				/* fall through */
+			case VMOP_BRANCH:
+				memset(&exits[exit_count], 0, sizeof(JIT_EXIT));
+				exits[exit_count].sites[exits[exit_count].count++] = __jump(&e, -1);
+				exits[exit_count].pc = (instr & BIT11) ? pc - (instr & 0x07FE) : pc + (instr & 0x07FE);
+				exits[exit_count++].kind = JIT_EXIT_CHAIN;
+				ended = 1;
+				break;
+
+			case VMOP_LOAD: case VMOP_LOAD_PREDEC: case VMOP_LOAD_POSTINC: case VMOP_LOAD_BYTE:
+			case VMOP_STORE: case VMOP_STORE_PREDEC: case VMOP_STORE_POSTINC: case VMOP_STORE_BYTE:
+				memset(&exits[exit_count], 0, sizeof(JIT_EXIT));
+				__emitMemory(&e, d, machine->mem_flags, machine->devices != NULL, &exits[exit_count]);
+				exits[exit_count].pc = pc - 2;
+				exits[exit_count].refund = count - q;
+				exits[exit_count++].kind = JIT_EXIT_INTERPRET;
+				break;
+
+			case VMOP_ILOAD:
+				__loadReg(&e, H_RAX, d->arg1);
+				__b(&e, 0xC1); __b(&e, 0xE0); __b(&e, 8);			// shl eax, 8
+				__b(&e, 0x0C); __b(&e, d->arg2);					// or al, imm8
+				__storeReg(&e, d->arg1, H_RAX);
+				break;
+
+			case VMOP_ADD: case VMOP_SUB: case VMOP_MUL: case VMOP_AND: case VMOP_OR: case VMOP_XOR:
+			case VMOP_ADDS: case VMOP_SUBS: case VMOP_MULS: case VMOP_ANDS: case VMOP_ORS: case VMOP_XORS:
+			{
+				static const uint8_t opcodes[8] = { 0x01, 0x29, 0, 0, 0, 0x21, 0x09, 0x31 };
+				int alu = (d->handler >= VMOP_ADDS) ? d->handler - VMOP_ADDS : d->handler - VMOP_ADD;
+				__loadReg(&e, H_RAX, d->arg1);
+				__loadReg(&e, H_RCX, d->arg2);
+				if (alu == 2) {
+					__b(&e, 0x48); __b(&e, 0x0F); __b(&e, 0xAF); __b(&e, MODRM(3, H_RAX, H_RCX));	// imul rax, rcx
+				} else __alu64(&e, opcodes[alu], H_RAX, H_RCX);
+				if (d->handler >= VMOP_ADDS) __lazyFlags(&e); else __clearFlags(&e);
+				__storeReg(&e, d->arg1, H_RAX);
+				break;
+			}
+
+			case VMOP_DIV: case VMOP_MOD: case VMOP_DIVS: case VMOP_MODS:
+				memset(&exits[exit_count], 0, sizeof(JIT_EXIT));
+				__loadReg(&e, H_RAX, d->arg1);
+				__loadReg(&e, H_RCX, d->arg2);
+				__b(&e, 0x85); __b(&e, 0xC9);						// test ecx, ecx
+				exits[exit_count].sites[exits[exit_count].count++] = __jump(&e, CC_E);
+				exits[exit_count].pc = pc - 2;
+				exits[exit_count].refund = count - q;
+				exits[exit_count++].kind = JIT_EXIT_INTERPRET;
+				__b(&e, 0x31); __b(&e, 0xD2);						// xor edx, edx
+				__b(&e, 0xF7); __b(&e, 0xF1);						// div ecx
+				if (d->handler == VMOP_MOD || d->handler == VMOP_MODS) {
+					__b(&e, 0x89); __b(&e, 0xD0);					// mov eax, edx
+				}
+				if (d->handler >= VMOP_ADDS) __lazyFlags(&e); else __clearFlags(&e);
+				__storeReg(&e, d->arg1, H_RAX);
+				break;
+
+			case VMOP_SHL:
+			case VMOP_SHR:
+				__loadReg(&e, H_RAX, d->arg1);
+				__b(&e, 0xC1); __b(&e, (d->handler == VMOP_SHL) ? 0xE0 : 0xE8); __b(&e, d->arg2);
+				__storeReg(&e, d->arg1, H_RAX);
+				break;
+
+			case VMOP_NOT:
+				__loadReg(&e, H_RAX, d->arg2);
+				__b(&e, 0xF7); __b(&e, 0xD0);						// not eax
+				__storeReg(&e, d->arg2, H_RAX);
+				break;
+
+			case VMOP_ADDC: case VMOP_SUBC: case VMOP_ADDCS: case VMOP_SUBCS:
+				__loadReg(&e, H_RAX, d->arg1);
+				__b(&e, 0x83);
+				__b(&e, (d->handler == VMOP_ADDC || d->handler == VMOP_ADDCS) ? 0xC0 : 0xE8);
+				__b(&e, d->arg2);
+				__zext16(&e, H_RAX);
+				if (d->handler == VMOP_ADDCS || d->handler == VMOP_SUBCS) __lazyFlags(&e);
+				__storeReg(&e, d->arg1, H_RAX);
+				break;
+
+			case VMOP_MOV:
+				__loadReg(&e, H_RAX, d->arg2);
+				__storeReg(&e, d->arg1, H_RAX);
+				break;
+
+			case VMOP_SWAP:
+				__loadReg(&e, H_RAX, d->arg1);
+				__loadReg(&e, H_RCX, d->arg2);
+				__storeReg(&e, d->arg1, H_RCX);
+				__storeReg(&e, d->arg2, H_RAX);
+				break;
+		}
+
+		for (s = 0; s < skip_count; s++) __patch(&e, skip[s], e.p);
+
+		switch (d->handler) {
+			case VMOP_ADD: case VMOP_SUB: case VMOP_MUL: case VMOP_DIV: case VMOP_MOD: case VMOP_AND: case VMOP_OR: case VMOP_XOR:
+				known = d->cond ? FLAGS_UNKNOWN : FLAGS_ZERO;
+				break;
+
+			case VMOP_ADDS: case VMOP_SUBS: case VMOP_MULS: case VMOP_DIVS: case VMOP_MODS: case VMOP_ANDS: case VMOP_ORS: case VMOP_XORS:
+			case VMOP_ADDCS: case VMOP_SUBCS:
+				known = d->cond ? FLAGS_UNKNOWN : FLAGS_LAZY;
+				break;
+		}
+	}
+
+	/* pokracovanie za blokom (aj nesplneny podmieneny skok) */
+	if (!ended || vmDecodeTable[words[count - 1]].cond) {
+		memset(&exits[exit_count], 0, sizeof(JIT_EXIT));
+		exits[exit_count].sites[exits[exit_count].count++] = __jump(&e, -1);
+		exits[exit_count].pc = pc;
+		exits[exit_count++].kind = JIT_EXIT_CHAIN;
+	}
+	__emitExits(jit, &e, exits, exit_count);
+
+	if (e.p > e.end) {
+		/* nedostatok miesta, prelozi sa znova po vyprazdneni */
+		vmJitInvalidate(machine);
+		return NULL;
+	}
+	jit->used = e.p - jit->code;
+	jit->map[start >> 1].length = count;
+	machine->page_flags[start >> 8] |= VM_PAGE_CODE;
+	return entry;
+}
+
+/** Vytvori vstupny a vystupny kod prekladaca.
+ * Vstup ulozi registre hostitela, ktore musi zachovat, nacita pripnute registre stroja
+ * a skoci do prelozeneho bloku. Vystup ulozi pripnute registre spat do JitState.
+ */
+static void __emitStubs(JIT_CACHE * jit) {
+	static const uint8_t saved[6] = { 3, 5, 12, 13, 14, 15 };
+	EMITTER e;
+	int q;
+	e.p = jit->code;
+	e.end = jit->code + JIT_CODE_SIZE;
+
+	jit->enter = (uint32_t (*)(JIT_STATE *, void *)) e.p;
+	for (q = 0; q < 6; q++) {
+		__rex(&e, 0, 0, saved[q]);
+		__b(&e, 0x50 | (saved[q] & 7));					// push
+	}
+	__b(&e, 0x49); __b(&e, 0x89); __b(&e, 0xFF);		// mov r15, rdi
+	__b(&e, 0x48); __b(&e, 0x89); __b(&e, 0xF0);		// mov rax, rsi
+	__b(&e, 0x4D); __b(&e, 0x8B); __b(&e, MODRM(1, H_R14, H_R15)); __b(&e, OFF(memory));	// mov r14, [r15 + memory]
+	for (q = 0; q < 16; q++) {
+		if (__pinned[q] >= 0) {
+			__rex(&e, 0, __pinned[q], H_R15);
+			__b(&e, 0x0F); __b(&e, 0xB7); __b(&e, MODRM(1, __pinned[q], H_R15)); __b(&e, OFF_REG(q));
+		}
+	}
+	__b(&e, 0xFF); __b(&e, 0xE0);						// jmp rax
+
+	jit->exit = e.p;
+	for (q = 0; q < 16; q++) {
+		if (__pinned[q] >= 0) {
+			__b(&e, 0x66);
+			__rex(&e, 0, __pinned[q], H_R15);
+			__b(&e, 0x89); __b(&e, MODRM(1, __pinned[q], H_R15)); __b(&e, OFF_REG(q));
+		}
+	}
+	for (q = 5; q >= 0; q--) {
+		__rex(&e, 0, 0, saved[q]);
+		__b(&e, 0x58 | (saved[q] & 7));					// pop
+	}
+	__b(&e, 0xC3);										// ret
+	jit->used = e.p - jit->code;
+}
+
+/** Zisti, ci je prekladac na tomto hostitelovi dostupny.
+ * @return 1 ak je dostupny
+ */
+int vmJitAvailable(void) {
+	return 1;
+}
+
+/** Zahodi vsetok prelozeny kod.
+ * Vola sa pri zapise do pamate s prelozenym kodom a pri zaplneni pamate pre kod.
+ * Nikdy sa nevola pocas behu prelozeneho kodu, zapisy do stranok s kodom vykonava interpret.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmJitInvalidate(VIRTUAL_MACHINE * machine) {
+	JIT_CACHE * jit = machine->jit;
+	int page;
+	if (jit == NULL) return;
+	memset(jit->map, 0, sizeof(jit->map));
+	__emitStubs(jit);
+	for (page = 0; page < VM_PAGE_COUNT; page++) machine->page_flags[page] &= ~VM_PAGE_CODE;
+}
+
+/** Uvolni prekladac stroja.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmFreeJit(VIRTUAL_MACHINE * machine) {
+	JIT_CACHE * jit = machine->jit;
+	if (jit == NULL) return;
+	munmap(jit->code, JIT_CODE_SIZE);
+	if (jit->shadow != NULL) destroyVirtualMachine(jit->shadow);
+	free(jit->shadow_memory);
+	free(jit);
+	machine->jit = NULL;
+}
+
+/** Vytvori prekladac stroja.
+ * @return prekladac, alebo NULL ak sa neda alokovat spustitelna pamat
+ */
+static JIT_CACHE * __createJit(VIRTUAL_MACHINE * machine) {
+	JIT_CACHE * jit = calloc(1, sizeof(JIT_CACHE));
+	if (jit == NULL) return NULL;
+	jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (jit->code == MAP_FAILED) {
+		free(jit);
+		return NULL;
+	}
+	machine->jit = jit;
+	__emitStubs(jit);
+	return jit;
+}
+
+/** Zisti pocet instrukcii zakladneho bloku pre interpret.
+ * @return pocet instrukcii po najblizsi skok alebo instrukciu pracujucu s PC vratane
+ */
+static uint8_t __coldLength(VIRTUAL_MACHINE * machine, uint16_t pc) {
+	uint8_t count = 0;
+	const DECODED_INSTRUCTION * d;
+	uint16_t start = pc;
+	do {
+		d = &vmDecodeTable[vmDefaultMemoryRead(machine->memory, pc, MEM_OP_WORD)];
+		count++;
+		pc += 2;
+		if (d->handler == VMOP_BRANCH || d->handler == VMOP_BRANCHL || !__supported(d)) break;
+	} while (count < JIT_MAX_INSTRUCTIONS && (pc >> 8) == (start >> 8) && __checkAddressValid(machine, pc) == VM_OK);
+	return count;
+}
+
+/** Zisti velkost kopie pamate pre kontrolu interpretom.
+ * Pri neparnej velkosti pamate cita interpret slovo na poslednej parnej adrese aj z bytu
+ * za koncom pamate, preto ho musi obsahovat aj kopia.
+ */
+static uint32_t __shadowSize(VIRTUAL_MACHINE * machine) {
+	if (machine->mem_flags & VM_MEMORY_FULL) return VM_MEMORY_FULL_SIZE + 1;
+	return (uint32_t) machine->mem_size + (machine->mem_size & 1);
+}
+
+/** Porovna stav stroja po vykonani prelozeneho kodu so stavom po vykonani interpretom.
+ * @param machine popisovac virtualneho stroja (po prelozenom kode)
+ * @param shadow stroj, na ktorom rovnake instrukcie vykonal interpret
+ * @param pc adresa bloku, ktory sa kontroloval
+ * @return 0 ak sa stavy zhoduju
+ */
+static int __verify(VIRTUAL_MACHINE * machine, VIRTUAL_MACHINE * shadow, uint16_t pc) {
+	uint32_t q, size = __shadowSize(machine);
+	int bad = 0;
+	for (q = 0; q < 16; q++) {
+		if (machine->registers[q] != shadow->registers[q]) {
+			fprintf(stderr, "jit: block 0x%04X: R%d is 0x%04X, interpreter has 0x%04X\n", pc, q, machine->registers[q], shadow->registers[q]);
+			bad = 1;
+		}
+	}
+	if (machine->flags != shadow->flags) {
+		fprintf(stderr, "jit: block 0x%04X: flags are 0x%02X, interpreter has 0x%02X\n", pc, machine->flags, shadow->flags);
+		bad = 1;
+	}
+	if (memcmp(machine->memory, shadow->memory, size) != 0) {
+		for (q = 0; q < size; q++) {
+			if (machine->memory[q] != shadow->memory[q]) {
+				fprintf(stderr, "jit: block 0x%04X: memory 0x%04X is 0x%02X, interpreter has 0x%02X\n", pc, q, machine->memory[q], shadow->memory[q]);
+				break;
+			}
+		}
+		bad = 1;
+	}
+	return bad;
+}
+
+/** Vykona instrukcie virtualneho stroja prekladom do strojoveho kodu x86-64.
+ * Bloky, ktore sa vykonali aspon JIT_HOT_THRESHOLD krat, sa prelozia do strojoveho kodu.
+ * Ostatny kod, instrukcie, ktore prekladac nepodporuje (INT, FLINVERT, instrukcie pracujuce
+ * s PC), chybne pristupy do pamate a zapisy na stranky s atributmi vykonava interpret.
+ * Stroj s vlastnymi funkciami pre citanie alebo zapis pamate vykonava vzdy interpret.
+ * V rezime VM_MODE_JIT_VERIFY sa kazdy prelozeny blok vykona aj interpretom na kopii
+ * stroja a pri rozdiele sa beh zastavi so stavom VM_JIT_MISMATCH.
+ * @param machine popisovac virtualneho stroja
+ * @param limit limit vykonanych instrukcii, 0 znamena bez limitu
+ * @return dovod prerusenia behu stroja, rovnako ako pri interprete
+ */
+VM_STATE vmExecJit(VIRTUAL_MACHINE * machine, uint16_t limit) {
+	JIT_CACHE * jit = machine->jit;
+	JIT_STATE * state;
+	JIT_ENTRY * entry;
+	int64_t remaining = (limit != 0) ? limit : INT64_MAX / 2;
+	int64_t budget;
+	uint8_t step = (limit != 0);
+	uint8_t verify = (machine->mode == VM_MODE_JIT_VERIFY);
+	uint32_t reason;
+	VM_STATE vm_state;
+	uint16_t pc;
+	uint8_t length;
+
+	if (!__flatMemory(machine)) return vmInterpret(machine, limit);
+	if (jit == NULL && (jit = __createJit(machine)) == NULL) return vmInterpret(machine, limit);
+	if (verify && jit->shadow == NULL) {
+		if (machine->mem_flags & VM_MEMORY_FULL) jit->shadow = createVirtualMachine(NULL, 0, 0);
+		else if ((jit->shadow_memory = malloc(__shadowSize(machine))) != NULL) jit->shadow = createVirtualMachine((char *) jit->shadow_memory, machine->mem_size, 0);
+		if (jit->shadow == NULL) return vmInterpret(machine, limit);
+		jit->shadow->mem_flags = machine->mem_flags & ~VM_MEMORY_MAPPED;
+	}
+	state = &jit->state;
+
+/* Skonci beh so stavom posledneho volania interpretu, machine->retired zahrna aj instrukcie
+ * vykonane predtym. */
+#define EXIT_INTERPRET(_state) \
+	do { vm_state = (_state); machine->retired += limit - remaining; return vm_state; } while (0)
+
+	machine->ext_interrupt = 0;
+	while (!(step && remaining == 0) && !__interruptPending(machine)) {
+		pc = machine->PC;
+		if (__checkAddressValid(machine, pc) != VM_OK) EXIT_INTERPRET(vmInterpret(machine, 1));
+		/* neparne PC je mozne iba pri VM_MEMORY_FULL bez kontroly zarovnania, vykona ho interpret */
+		entry = (pc & 1) ? NULL : &jit->map[pc >> 1];
+		if (entry != NULL && entry->code == NULL && !entry->failed && ++entry->count >= JIT_HOT_THRESHOLD) {
+			entry->code = __translate(machine, jit, pc);
+			if (entry->code == NULL) entry->failed = 1;
+		}
+		if (entry == NULL || entry->code == NULL) {
+			length = (entry != NULL) ? __coldLength(machine, pc) : 1;
+			if (step && remaining < length) length = remaining;
+			vm_state = vmInterpret(machine, length);
+			if (vm_state != VM_OK) EXIT_INTERPRET(vm_state);
+			/* pri cakajucom preruseni interpret skonci skor, ako vykona cely usek */
+			remaining -= step ? machine->retired : 0;
+			continue;
+		}
+		if (step && remaining < entry->length) EXIT_INTERPRET(vmInterpret(machine, remaining));
+
+		budget = (verify && remaining > entry->length) ? entry->length : remaining;
+		if (verify) {
+			memcpy(jit->shadow->registers, machine->registers, sizeof(machine->registers));
+			jit->shadow->flags = machine->flags;
+			memcpy(jit->shadow->memory, machine->memory, __shadowSize(machine));
+		}
+		memcpy(state->registers, machine->registers, sizeof(state->registers));
+		state->flags = machine->flags;
+		state->lazy = 0;
+		state->budget = budget;
+		state->mem_size = (machine->mem_flags & VM_MEMORY_FULL) ? VM_MEMORY_FULL_SIZE : machine->mem_size;
+		state->memory = machine->memory;
+		state->page_flags = machine->page_flags;
+		state->interrupt_pending = &machine->interrupt_pending;
+
+		reason = jit->enter(state, entry->code);
+
+		memcpy(machine->registers, state->registers, sizeof(state->registers));
+		machine->flags = state->lazy ? __aluFlags(state->result) : state->flags;
+		machine->PC = state->exit_pc;
+		if (step) remaining -= budget - state->budget;
+
+		if (verify && budget - state->budget > 0) {
+			vmInterpret(jit->shadow, budget - state->budget);
+			if (__verify(machine, jit->shadow, pc)) {
+				machine->retired = limit - remaining;
+				return VM_JIT_MISMATCH;
+			}
+		}
+
+		switch (reason) {
+			case JIT_EXIT_CHAIN:
+				/* cielovy blok uz je prelozeny, skok sa prepoji priamo nan */
+				entry = &jit->map[state->exit_pc >> 1];
+				if (!verify && entry->code != NULL) {
+					int32_t rel = (int32_t) (entry->code - (state->link + 4));
+					memcpy(state->link, &rel, 4);
+				}
+				break;
+
+			case JIT_EXIT_INTERPRET:
+				if (step && remaining == 0) break;
+				vm_state = vmInterpret(machine, 1);
+				if (vm_state != VM_OK) EXIT_INTERPRET(vm_state);
+				remaining -= step;
+				break;
+
+			case JIT_EXIT_BUDGET:
+			case JIT_EXIT_INTERRUPT:
+				break;
+		}
+	}
+	machine->retired = limit - remaining;
+	return VM_OK;
+
+#undef EXIT_INTERPRET
+}
+
+#else
+
+int vmJitAvailable(void) {
+	return 0;
+}
+
+void vmJitInvalidate(VIRTUAL_MACHINE * machine) {
+}
+
+void vmFreeJit(VIRTUAL_MACHINE * machine) {
+}
+
+VM_STATE vmExecJit(VIRTUAL_MACHINE * machine, uint16_t limit) {
+	return vmInterpret(machine, limit);
+}
+
+#endif
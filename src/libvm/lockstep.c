@@ -0,0 +1,460 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vm.h>
+#include "vm.h"
+
+#include "bits.h"
+#include "instruction.h"
+#include "decode.h"
+
+/* Jadro sa preklada pre AVX2 aj pre zakladnu instrukcnu sadu, verzia sa vyberie pri spusteni. */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && defined(__linux__)
+#define LOCKSTEP_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define LOCKSTEP_CLONES
+#endif
+
+/** Po kolkych instrukciach, pocas ktorych stroj caka na ostatne stroje, sa stroj vyradi
+ * zo spolocneho vykonavania a dobehne samostatne. */
+#define LOCKSTEP_WAIT_LIMIT		1024
+
+/** Po kolkych krokoch sa kontroluju prerusenia od hostitela. */
+#define LOCKSTEP_INTERRUPT_CHECK	1024
+
+/** Jeden register vsetkych strojov skupiny, jeden 16-bitovy prvok na stroj. */
+typedef uint16_t LANES __attribute__((vector_size(2 * VM_LOCKSTEP_LANES)));
+
+static const LANES __laneBits = {
+	1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7,
+	1 << 8, 1 << 9, 1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, 1 << 15
+};
+
+/* Vyberie prvky _new pre stroje v maske _m a prvky _old pre ostatne. */
+#define BLEND(_m, _new, _old) (((_new) & (_m)) | ((_old) & ~(_m)))
+
+/* Maska (0xFFFF / 0) zo vysledku porovnania vektorov. */
+#define MASK(_cmp) ((LANES) (_cmp))
+
+/* Vykona telo pre kazdy stroj _l z bitovej masky _bits. */
+#define FOR_LANES(_l, _bits, ...) \
+	for (uint32_t __bits = (_bits); __bits && ((_l = __builtin_ctz(__bits)), 1); __bits &= __bits - 1) { __VA_ARGS__ }
+
+/* Ukonci stroj _l so stavom _state. */
+#define STOP(_l, _state) \
+	do { states[_l] = (_state); running &= ~(1 << (_l)); } while (0)
+
+/* Ukonci stroj _l s chybou na adrese _a. Instrukcia, ktora chybu sposobila, sa nezapocita. */
+#define FAULT(_l, _state, _a) \
+	do { machines[_l]->fault_address = (_a); if (limit) budget[_l]++; STOP(_l, _state); } while (0)
+
+/* Vyradi stroj _l zo skupiny, dobehne samostatne. */
+#define EJECT(_l) \
+	do { running &= ~(1 << (_l)); *scalar |= 1 << (_l); } while (0)
+
+/** Zisti, ci je niektory prvok vektora nenulovy.
+ * @param v vektor
+ * @return 1 ak je aspon jeden prvok nenulovy
+ */
+static inline int __anyLane(const LANES * v) {
+	uint64_t w[sizeof(LANES) / sizeof(uint64_t)];
+	unsigned q;
+	uint64_t any = 0;
+	memcpy(w, v, sizeof(w));
+	for (q = 0; q < sizeof(LANES) / sizeof(uint64_t); q++) any |= w[q];
+	return any != 0;
+}
+
+/** Prevedie masku vektora na bitovu masku strojov.
+ * @param m maska (0xFFFF / 0 pre kazdy stroj)
+ * @param lanes bitova maska strojov, ktore sa beru do uvahy
+ * @return bitova maska strojov s nenulovym prvkom masky
+ */
+static inline uint32_t __laneBitsOf(const LANES * m, uint32_t lanes) {
+	uint32_t bits = 0;
+	unsigned l;
+	FOR_LANES(l, lanes, if ((*m)[l]) bits |= 1 << l;)
+	return bits;
+}
+
+/** Overi, ci je stranka pamate rovnaka vo vsetkych strojoch.
+ * Vsetky stroje skupiny maju rovnake nastavenie pamate, rozhoduje prvy z nich.
+ * @param machines stroje skupiny
+ * @param lanes bitova maska porovnavanych strojov
+ * @param page cislo stranky
+ * @return 1 ak je stranka vo vsetkych strojoch rovnaka
+ */
+static int __samePage(VIRTUAL_MACHINE ** machines, uint32_t lanes, uint8_t page) {
+	unsigned base = page * VM_PAGE_SIZE, length = VM_PAGE_SIZE, first = __builtin_ctz(lanes), l;
+	VIRTUAL_MACHINE * machine = machines[first];
+	if (!(machine->mem_flags & VM_MEMORY_FULL)) {
+		if (base >= machine->mem_size) return 0;
+		if (machine->mem_size - base < length) length = machine->mem_size - base;
+	}
+	FOR_LANES(l, lanes & ~(1 << first),
+		if (memcmp(machines[l]->memory + base, machine->memory + base, length) != 0) return 0;
+	)
+	return 1;
+}
+
+/** Vykona instrukcie skupiny strojov spolocne.
+ * Registre a priznaky vsetkych strojov su ulozene po registroch (struct of arrays), takze
+ * jedna operacia nad vektorom LANES vykona instrukciu pre vsetky stroje naraz. V kazdom
+ * kroku sa vykona instrukcia na najnizsej adrese PC spomedzi strojov; stroje s inym PC
+ * cakaju, takze po rozdeleni na podmienenom skoku sa stroje opat spoja na spolocnej adrese.
+ * Podmienene instrukcie sa vykonaju iba pre stroje so splnenou podmienkou. Stroje, ktore
+ * cakaju prilis dlho alebo maju na adrese PC inu instrukciu, sa zo skupiny vyradia a volajuci
+ * ich dobehne samostatne.
+ * @param machines stroje skupiny
+ * @param count pocet strojov
+ * @param limit limit instrukcii pre kazdy stroj, 0 znamena bez limitu
+ * @param states stavy strojov, ktore skoncili
+ * @param scalar bitova maska strojov, ktore sa maju dokoncit samostatne
+ * @param left zostavajuci limit instrukcii pre stroje vyradene do scalar
+ */
+static LOCKSTEP_CLONES void __lockstep(VIRTUAL_MACHINE ** machines, unsigned count, uint16_t limit, VM_STATE * states, uint32_t * scalar, uint16_t * left) {
+	LANES reg[16];
+	LANES flags = { 0 }, budget = { 0 };
+	unsigned char * memory[VM_LOCKSTEP_LANES];
+	VIRTUAL_MACHINE * config = NULL;
+	uint16_t wait[VM_LOCKSTEP_LANES] = { 0 };
+	uint8_t same[VM_PAGE_COUNT] = { 0 }, retry[VM_PAGE_COUNT] = { 0 };
+	uint32_t running = 0, lockstep, at, exec;
+	uint32_t steps = 0;
+	uint8_t converged = 0;
+	unsigned l, r;
+	int vm_state;
+
+	for (l = 0; l < count; l++) {
+		VIRTUAL_MACHINE * machine = machines[l];
+		if (*scalar & (1 << l)) continue;
+		running |= 1 << l;
+		if (config == NULL) config = machine;
+		memory[l] = machine->memory;
+		machine->ext_interrupt = 0;
+		for (r = 0; r < 16; r++) reg[r][l] = machine->registers[r];
+		flags[l] = machine->flags;
+		budget[l] = limit;
+	}
+	lockstep = running;
+
+	/* Skupina ma zmysel, kym v nej su aspon dva stroje. */
+	while (running & (running - 1)) {
+		const DECODED_INSTRUCTION * op;
+		VIRTUAL_MACHINE * first;
+		uint16_t leader = 0xFFFF, instr = 0;
+		uint8_t page;
+		LANES m, m_at;
+
+		if (converged) {
+			leader = reg[15][__builtin_ctz(running)];
+			at = running;
+		} else {
+			FOR_LANES(l, running, if (reg[15][l] <= leader) leader = reg[15][l];)
+			at = 0;
+			FOR_LANES(l, running,
+				if (reg[15][l] == leader) {
+					at |= 1 << l;
+					wait[l] = 0;
+				} else if (++wait[l] > LOCKSTEP_WAIT_LIMIT) {
+					EJECT(l);
+				}
+			)
+			if (!(running & (running - 1))) break;
+		}
+
+		/* Adresa je pre vsetky stroje rovnaka a stroje maju rovnake nastavenie pamate. */
+		first = machines[__builtin_ctz(at)];
+		if ((vm_state = __checkAddressValid(config, leader)) != VM_OK) {
+			FOR_LANES(l, at, machines[l]->fault_address = leader; STOP(l, vm_state);)
+			converged = 0;
+			continue;
+		}
+		page = leader >> 8;
+		if (!same[page] && retry[page]-- == 0) {
+			same[page] = __samePage(machines, running, page);
+			retry[page] = 255;
+		}
+		instr = __memRead(first->memory, leader, MEM_OP_WORD);
+		if (!same[page] || (leader & (VM_PAGE_SIZE - 1)) == VM_PAGE_SIZE - 1) {
+			/* Kod na stranke sa v strojoch moze lisit, stroje s inou instrukciou sa vyradia. */
+			FOR_LANES(l, at,
+				if (__memRead(memory[l], leader, MEM_OP_WORD) != instr) {
+					EJECT(l);
+					at &= ~(1 << l);
+				}
+			)
+		}
+
+		op = &vmDecodeTable[instr];
+		m_at = MASK((__laneBits & (uint16_t) at) != 0);
+		reg[15] += m_at & 2;
+		if (limit) budget -= m_at & 1;
+		m = m_at;
+		if (op->cond) {
+			m &= MASK((flags & op->cond) != 0);
+			exec = __laneBitsOf(&m, at);
+		} else {
+			exec = at;
+		}
+
+		switch (op->handler) {
+			case VMOP_BRANCHL:
+				reg[14] = BLEND(m, reg[15], reg[14]);
+				/* fall through */
+			case VMOP_BRANCH:
+				if (instr & BIT11) reg[15] -= m & (instr & 0x07FE);
+				else reg[15] += m & (instr & 0x07FE);
+				break;
+
+			case VMOP_LOAD_PREDEC:
+				reg[op->arg1] -= m & 2;
+				/* fall through */
+			case VMOP_LOAD:
+			case VMOP_LOAD_POSTINC:
+			case VMOP_LOAD_BYTE:
+				FOR_LANES(l, exec,
+					uint16_t address = reg[op->arg1][l];
+					if ((vm_state = __checkAddressValid(config, address)) != VM_OK) {
+						FAULT(l, vm_state, address);
+						continue;
+					}
+					reg[op->arg2][l] = __memRead(memory[l], address, op->handler == VMOP_LOAD_BYTE ? MEM_OP_BYTE : MEM_OP_WORD);
+					if (op->handler == VMOP_LOAD_POSTINC) reg[op->arg1][l] += 2;
+				)
+				break;
+
+			case VMOP_STORE_PREDEC:
+				reg[op->arg1] -= m & 2;
+				/* fall through */
+			case VMOP_STORE:
+			case VMOP_STORE_POSTINC:
+			case VMOP_STORE_BYTE:
+				FOR_LANES(l, exec,
+					uint16_t address = reg[op->arg1][l];
+					int half = (op->handler == VMOP_STORE_BYTE) ? MEM_OP_BYTE : MEM_OP_WORD;
+					if ((vm_state = __checkAddressValid(config, address)) != VM_OK) {
+						FAULT(l, vm_state, address);
+						continue;
+					}
+					if (__storeFlags(machines[l], address, half) & VM_PAGE_READONLY) {
+						FAULT(l, VM_WRITE_PROTECTED, address);
+						continue;
+					}
+					__memWrite(memory[l], address, reg[op->arg2][l], half);
+					same[address >> 8] = same[(uint16_t) (address + 1) >> 8] = 0;
+					if (__storeFlags(machines[l], address, half)) vmPageWritten(machines[l], address, half);
+					if (op->handler == VMOP_STORE_POSTINC) reg[op->arg1][l] += 2;
+				)
+				break;
+
+			case VMOP_ILOAD:
+				reg[op->arg1] = BLEND(m, (reg[op->arg1] << 8) | op->arg2, reg[op->arg1]);
+				break;
+
+			case VMOP_ADD: reg[op->arg1] = BLEND(m, reg[op->arg1] + reg[op->arg2], reg[op->arg1]); flags &= ~m; break;
+			case VMOP_SUB: reg[op->arg1] = BLEND(m, reg[op->arg1] - reg[op->arg2], reg[op->arg1]); flags &= ~m; break;
+			case VMOP_MUL: reg[op->arg1] = BLEND(m, reg[op->arg1] * reg[op->arg2], reg[op->arg1]); flags &= ~m; break;
+			case VMOP_AND: reg[op->arg1] = BLEND(m, reg[op->arg1] & reg[op->arg2], reg[op->arg1]); flags &= ~m; break;
+			case VMOP_OR: reg[op->arg1] = BLEND(m, reg[op->arg1] | reg[op->arg2], reg[op->arg1]); flags &= ~m; break;
+			case VMOP_XOR: reg[op->arg1] = BLEND(m, reg[op->arg1] ^ reg[op->arg2], reg[op->arg1]); flags &= ~m; break;
+
+			case VMOP_DIV:
+			case VMOP_MOD:
+				FOR_LANES(l, exec,
+					if (op->handler == VMOP_DIV) reg[op->arg1][l] /= reg[op->arg2][l];
+					else reg[op->arg1][l] %= reg[op->arg2][l];
+					flags[l] = 0;
+				)
+				break;
+
+			/* Priznaky podla __aluFlags, vypocitane bez rozsirenia na plnu presnost. */
+			case VMOP_ADDS: {
+				LANES a = reg[op->arg1], b = reg[op->arg2], sum = a + b;
+				LANES f = (MASK((a | b) == 0) & ZERO_FLAG) | (MASK(sum < a) & OVERFLOW_FLAG);
+				reg[op->arg1] = BLEND(m, sum, a);
+				flags = BLEND(m, f, flags);
+				break;
+			}
+
+			case VMOP_SUBS: {
+				LANES a = reg[op->arg1], b = reg[op->arg2];
+				LANES f = (MASK(a == b) & ZERO_FLAG) | (MASK(a < b) & SIGN_FLAG);
+				reg[op->arg1] = BLEND(m, a - b, a);
+				flags = BLEND(m, f, flags);
+				break;
+			}
+
+			case VMOP_ANDS:
+			case VMOP_ORS:
+			case VMOP_XORS: {
+				LANES a = reg[op->arg1], b = reg[op->arg2], res;
+				if (op->handler == VMOP_ANDS) res = a & b;
+				else if (op->handler == VMOP_ORS) res = a | b;
+				else res = a ^ b;
+				reg[op->arg1] = BLEND(m, res, a);
+				flags = BLEND(m, MASK(res == 0) & ZERO_FLAG, flags);
+				break;
+			}
+
+			case VMOP_MULS:
+			case VMOP_DIVS:
+			case VMOP_MODS:
+				FOR_LANES(l, exec,
+					signed long result;
+					if (op->handler == VMOP_MULS) result = (signed long) reg[op->arg1][l] * reg[op->arg2][l];
+					else if (op->handler == VMOP_DIVS) result = (signed long) reg[op->arg1][l] / reg[op->arg2][l];
+					else result = (signed long) reg[op->arg1][l] % reg[op->arg2][l];
+					flags[l] = __aluFlags(result);
+					reg[op->arg1][l] = result & 0xFFFF;
+				)
+				break;
+
+			case VMOP_SHL: reg[op->arg1] = BLEND(m, reg[op->arg1] << op->arg2, reg[op->arg1]); break;
+			case VMOP_SHR: reg[op->arg1] = BLEND(m, reg[op->arg1] >> op->arg2, reg[op->arg1]); break;
+			case VMOP_NOT: reg[op->arg2] = BLEND(m, ~reg[op->arg2], reg[op->arg2]); break;
+
+			case VMOP_FLINVERT:
+				flags = BLEND(m, flags ^ (uint16_t) (~(op->arg2 << 4) & 0xFF), flags);
+				break;
+
+			case VMOP_ADDC: reg[op->arg1] += m & op->arg2; break;
+			case VMOP_SUBC: reg[op->arg1] -= m & op->arg2; break;
+
+			case VMOP_ADDCS:
+			case VMOP_SUBCS:
+				if (op->handler == VMOP_ADDCS) reg[op->arg1] += m & op->arg2;
+				else reg[op->arg1] -= m & op->arg2;
+				flags = BLEND(m, MASK(reg[op->arg1] == 0) & ZERO_FLAG, flags);
+				break;
+
+			case VMOP_MOV:
+				reg[op->arg1] = BLEND(m, reg[op->arg2], reg[op->arg1]);
+				break;
+
+			case VMOP_SWAP: {
+				LANES t = reg[op->arg1];
+				reg[op->arg1] = BLEND(m, reg[op->arg2], t);
+				reg[op->arg2] = BLEND(m, t, reg[op->arg2]);
+				break;
+			}
+
+			case VMOP_INT:
+				FOR_LANES(l, exec,
+					machines[l]->ext_interrupt = GET_IMMEDIATE(instr);
+					STOP(l, VM_SOFTINT);
+				)
+				break;
+
+			case VMOP_ILLEGAL:
+				FOR_LANES(l, exec, FAULT(l, VM_ILLEGAL_OPCODE, leader);)
+				break;
+		}
+
+		if (limit) {
+			LANES finished = MASK(budget == 0) & m_at;
+			if (__anyLane(&finished)) FOR_LANES(l, at & running, if (budget[l] == 0) STOP(l, VM_OK);)
+		}
+		if (++steps % LOCKSTEP_INTERRUPT_CHECK == 0) FOR_LANES(l, running, if (__interruptPending(machines[l])) EJECT(l);)
+		if (running) {
+			LANES running_mask = MASK((__laneBits & (uint16_t) running) != 0);
+			LANES diverged = (reg[15] ^ reg[15][__builtin_ctz(running)]) & running_mask;
+			if (!converged && !__anyLane(&diverged)) {
+				converged = 1;
+				memset(wait, 0, sizeof(wait));
+			} else {
+				converged = !__anyLane(&diverged);
+			}
+		}
+	}
+
+	/* Posledny stroj skupiny dobehne samostatne. */
+	*scalar |= running;
+	for (l = 0; l < count; l++) {
+		VIRTUAL_MACHINE * machine = machines[l];
+		if (!(lockstep & (1 << l))) continue;
+		for (r = 0; r < 16; r++) machine->registers[r] = reg[r][l];
+		machine->flags = flags[l];
+		left[l] = budget[l];
+	}
+}
+
+/** Vykona instrukcie skupiny strojov s nenulovym limitom a posunie ich hodiny.
+ * @param machines stroje skupiny
+ * @param count pocet strojov
+ * @param instructions limit instrukcii pre kazdy stroj
+ * @param states pole pre dovod prerusenia behu kazdeho stroja
+ */
+static void __traceGroup(VIRTUAL_MACHINE ** machines, unsigned count, uint16_t instructions, VM_STATE * states) {
+	uint16_t left[VM_LOCKSTEP_LANES];
+	VIRTUAL_MACHINE * first = NULL;
+	uint32_t scalar = 0;
+	unsigned l;
+	for (l = 0; l < count; l++) {
+		VIRTUAL_MACHINE * machine = machines[l];
+		states[l] = VM_OK;
+		left[l] = instructions;
+		if (!__flatMemory(machine) || machine->devices != NULL || machine->natives != NULL ||
+				machine->recording != NULL || machine->cluster != NULL || machine->profile != NULL || machine->interrupts->active ||
+				__interruptPending(machine) || __nextEvent(machine) - machine->clock < instructions) {
+			scalar |= 1 << l;
+		} else if (first == NULL) {
+			first = machine;
+		} else if (machine->mem_flags != first->mem_flags || machine->mem_size != first->mem_size) {
+			scalar |= 1 << l;
+		}
+	}
+	__lockstep(machines, count, instructions, states, &scalar, left);
+	for (l = 0; l < count; l++) {
+		uint16_t retired = instructions - left[l];
+		machines[l]->retired = retired;
+		machines[l]->clock += retired;
+		if (!(scalar & (1 << l))) continue;
+		if (left[l] == 0) continue;
+		states[l] = traceVirtualMachine(machines[l], left[l]);
+		machines[l]->retired += retired;
+	}
+}
+
+/** Vykona instrukcie skupiny virtualnych strojov spolocne (lockstep).
+ * Urcene pre stroje s rovnakym programom a roznymi vstupmi. Vysledok je pre kazdy stroj
+ * rovnaky, ako keby bol spusteny samostatne funkciou traceVirtualMachine: kazdy stroj vykona
+ * najviac instructions instrukcii a skonci pri chybe alebo instrukcii INT. Stroje s vlastnymi
+ * operaciami pamate, pripojenymi zariadeniami alebo nativnymi funkciami, jadra zhluku, stroje
+ * so zapnutym profilovanim, s inym nastavenim pamate ako prvy stroj, stroje, ktore cakaju na
+ * prerusenie alebo ho obsluhuju, s udalostou pred koncom limitu, alebo ktore sa od ostatnych
+ * prilis vzdialia, sa vykonaju samostatne podla svojho rezimu.
+ * @param machines stroje skupiny
+ * @param count pocet strojov, najviac VM_LOCKSTEP_LANES
+ * @param instructions limit instrukcii pre kazdy stroj, 0 znamena bez limitu
+ * @param states pole pre dovod prerusenia behu kazdeho stroja
+ * @return 0 ak boli stroje vykonane, -1 pri nespravnom pocte strojov
+ */
+int traceLockstepVirtualMachines(VIRTUAL_MACHINE ** machines, unsigned count, uint16_t instructions, VM_STATE * states) {
+	VIRTUAL_MACHINE * group[VM_LOCKSTEP_LANES];
+	VM_STATE group_states[VM_LOCKSTEP_LANES];
+	unsigned index[VM_LOCKSTEP_LANES], size = count, l, n;
+	if (count == 0 || count > VM_LOCKSTEP_LANES) return -1;
+	if (instructions != 0) {
+		__traceGroup(machines, count, instructions, states);
+		return 0;
+	}
+	/* beh bez limitu ide po castiach, aby sa dal zapocitat do hodin strojov; pokracuju stroje,
+	 * ktore vycerpali cely limit casti */
+	for (l = 0; l < count; l++) {
+		group[l] = machines[l];
+		index[l] = l;
+	}
+	while (size > 0) {
+		__traceGroup(group, size, RUN_CHUNK, group_states);
+		for (l = 0, n = 0; l < size; l++) {
+			states[index[l]] = group_states[l];
+			if (group_states[l] != VM_OK || group[l]->ext_interrupt) continue;
+			group[n] = group[l];
+			index[n++] = index[l];
+		}
+		size = n;
+	}
+	return 0;
+}
@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/// Pociatocna kapacita tabulky nativnych funkcii
+#define NATIVE_TABLE_INITIAL	16
+
+/// Instrukcia INT VM_INTERRUPT_NATIVE, ktora nahradi prve slovo funkcie v programe stroja
+#define NATIVE_TRAP				(0x2E00 | VM_INTERRUPT_NATIVE)
+
+/** Najde poziciu adresy v tabulke nativnych funkcii.
+ * @param table tabulka nativnych funkcii
+ * @param address adresa
+ * @return index prvej funkcie s adresou vacsou alebo rovnou address
+ */
+static uint32_t __lowerBound(struct NativeTable * table, uint16_t address) {
+	uint32_t lo = 0, hi = table->count, mid;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (table->bindings[mid].address < address) lo = mid + 1; else hi = mid;
+	}
+	return lo;
+}
+
+/** Pripoji nativnu funkciu hostitela na vstupny bod funkcie programu stroja.
+ * Prve slovo funkcie v pamati stroja sa nahradi instrukciou INT VM_INTERRUPT_NATIVE, jadra
+ * teda nemusia kontrolovat PC pri kazdej instrukcii. Ked ju stroj vykona, traceVirtualMachine
+ * zavola routine nad registrami a pamatou stroja a pokracuje na navratovej adrese v RL, cele
+ * volanie sa zapocita ako jedna instrukcia. Ak routine vrati chybu, beh skonci s touto chybou
+ * a PC na vstupnom bode funkcie. Ked program stroja prve slovo funkcie prepise, vykonava sa
+ * znova jeho vlastny kod. Opakovane pripojenie na tu istu adresu iba vymeni funkciu. Funkcia
+ * sa nesmie volat pocas behu stroja, okrem nativnej funkcie a obsluhy udalosti.
+ * @param machine popisovac virtualneho stroja
+ * @param address vstupny bod funkcie, zarovnana adresa v pamati stroja
+ * @param routine nativna funkcia, vid findNativeVirtualMachine
+ * @param data parameter nativnej funkcie
+ * @return 0 ak bola funkcia pripojena, -1 ak adresa nie je platna alebo sa nepodarilo
+ * alokovat tabulku
+ */
+int bindNativeVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, vmNativeRoutine routine, void * data) {
+	struct NativeTable * table = machine->natives;
+	struct NativeBinding * bindings;
+	uint32_t index, capacity;
+
+	if (routine == NULL || (address & 1) || __checkAddressValid(machine, address) != VM_OK) return -1;
+	if (table == NULL && (table = calloc(1, sizeof(struct NativeTable))) == NULL) return -1;
+	machine->natives = table;
+	index = __lowerBound(table, address);
+	if (index < table->count && table->bindings[index].address == address) {
+		table->bindings[index].routine = routine;
+		table->bindings[index].data = data;
+		return 0;
+	}
+	if (table->count == table->capacity) {
+		capacity = table->capacity ? table->capacity * 2 : NATIVE_TABLE_INITIAL;
+		if ((bindings = realloc(table->bindings, capacity * sizeof(struct NativeBinding))) == NULL) return -1;
+		table->bindings = bindings;
+		table->capacity = capacity;
+	}
+	memmove(&table->bindings[index + 1], &table->bindings[index], (table->count - index) * sizeof(struct NativeBinding));
+	table->bindings[index].address = address;
+	table->bindings[index].saved = machine->read_func(machine->memory, address, MEM_OP_WORD);
+	table->bindings[index].routine = routine;
+	table->bindings[index].data = data;
+	table->count++;
+	machine->write_func(machine->memory, address, NATIVE_TRAP, MEM_OP_WORD);
+	invalidateCodeVirtualMachine(machine, address, 2);
+	return 0;
+}
+
+/** Odpoji nativnu funkciu zo vstupneho bodu funkcie programu stroja.
+ * Ak je na adrese este instrukcia INT VM_INTERRUPT_NATIVE, vrati sa na jej miesto povodne
+ * slovo funkcie. Funkcia sa nesmie volat pocas behu stroja, okrem nativnej funkcie a obsluhy
+ * udalosti.
+ * @param machine popisovac virtualneho stroja
+ * @param address vstupny bod funkcie
+ */
+void unbindNativeVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address) {
+	struct NativeTable * table = machine->natives;
+	uint32_t index;
+	if (table == NULL) return;
+	index = __lowerBound(table, address);
+	if (index == table->count || table->bindings[index].address != address) return;
+	if (machine->read_func(machine->memory, address, MEM_OP_WORD) == NATIVE_TRAP) {
+		machine->write_func(machine->memory, address, table->bindings[index].saved, MEM_OP_WORD);
+		invalidateCodeVirtualMachine(machine, address, 2);
+	}
+	table->count--;
+	memmove(&table->bindings[index], &table->bindings[index + 1], (table->count - index) * sizeof(struct NativeBinding));
+	if (table->count == 0) vmFreeNatives(machine);
+}
+
+/** Zavola nativnu funkciu, ktorej instrukciu INT VM_INTERRUPT_NATIVE stroj prave vykonal.
+ * Vola ho traceVirtualMachine, ked jadro skonci na takejto instrukcii.
+ * @param machine popisovac virtualneho stroja, PC je za instrukciou INT
+ * @return VM_OK ak sa funkcia vykonala a PC je na navratovej adrese, VM_SOFTINT ak na adrese
+ * instrukcie ziadna funkcia nie je a stroj sa nezmenil, inac chyba, ktoru vratila funkcia;
+ * vtedy je PC na vstupnom bode funkcie
+ */
+VM_STATE vmCallNative(VIRTUAL_MACHINE * machine) {
+	struct NativeTable * table = machine->natives;
+	uint16_t entry = machine->PC - 2;
+	uint32_t index = __lowerBound(table, entry);
+	VM_STATE state;
+	if (index == table->count || table->bindings[index].address != entry) return VM_SOFTINT;
+	machine->PC = entry;
+	machine->ext_interrupt = 0;
+	if ((state = table->bindings[index].routine(machine, table->bindings[index].data)) != VM_OK) return state;
+	machine->PC = machine->RL;
+	return VM_OK;
+}
+
+/** Uvolni tabulku nativnych funkcii stroja.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmFreeNatives(VIRTUAL_MACHINE * machine) {
+	if (machine->natives == NULL) return;
+	free(machine->natives->bindings);
+	free(machine->natives);
+	machine->natives = NULL;
+}
+
+/** Zisti, ci moze nativna funkcia pristupovat do pamate stroja priamo.
+ * @param machine popisovac virtualneho stroja
+ * @return 1 ak ma stroj standardne operacie pamate a ziadne zariadenia
+ */
+static inline int __direct(VIRTUAL_MACHINE * machine) {
+	return __flatMemory(machine) && machine->devices == NULL;
+}
+
+/** Overi, ci je cela oblast v pamati stroja, pri chybe nastavi fault_address.
+ * @param machine popisovac virtualneho stroja
+ * @param address zaciatok oblasti
+ * @param length dlzka oblasti v bytoch
+ * @return stav overenia
+ */
+static VM_STATE __range(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t length) {
+	uint32_t limit = (machine->mem_flags & VM_MEMORY_FULL) ? VM_MEMORY_FULL_SIZE : machine->mem_size;
+	if ((uint32_t) address + length <= limit) return VM_OK;
+	machine->fault_address = (address < limit) ? limit : address;
+	return VM_OUT_OF_MEMORY;
+}
+
+/** Overi, ci sa do celej oblasti smie zapisovat, pri chybe nastavi fault_address.
+ * Oblast musi byt v pamati stroja (vid __range).
+ * @param machine popisovac virtualneho stroja
+ * @param address zaciatok oblasti
+ * @param length dlzka oblasti v bytoch
+ * @return VM_OK, alebo VM_WRITE_PROTECTED ak je niektora stranka oblasti chranena proti zapisu
+ */
+static VM_STATE __writable(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t length) {
+	uint32_t end = (uint32_t) address + length, q;
+	for (q = address; q < end; q = (q | 0xFF) + 1) {
+		if (__checkWritable(machine, q, MEM_OP_BYTE) != VM_OK) {
+			machine->fault_address = q;
+			return VM_WRITE_PROTECTED;
+		}
+	}
+	return VM_OK;
+}
+
+/** Nacita byte z pamate stroja. Adresu musi overit volajuci.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @return nacitany byte
+ */
+static inline uint8_t __peek(VIRTUAL_MACHINE * machine, uint16_t address) {
+	if (__direct(machine)) return machine->memory[address];
+	return vmBusRead(machine, address, MEM_OP_BYTE);
+}
+
+/** Zapise byte do pamate stroja a ohlasi zapis na stranku s atributmi. Adresu musi overit
+ * volajuci.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @param data zapisovany byte
+ */
+static inline void __poke(VIRTUAL_MACHINE * machine, uint16_t address, uint8_t data) {
+	if (__direct(machine)) machine->memory[address] = data;
+	else vmBusWrite(machine, address, data, MEM_OP_BYTE);
+	if (machine->page_flags[address >> 8]) vmPageWritten(machine, address, MEM_OP_BYTE);
+}
+
+/** Najde dlzku retazca v pamati stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param address zaciatok retazca
+ * @param length miesto pre dlzku retazca bez ukoncovacieho nuloveho bytu
+ * @return VM_OK, alebo VM_OUT_OF_MEMORY ak retazec nie je ukonceny pred koncom pamate
+ */
+static VM_STATE __string(VIRTUAL_MACHINE * machine, uint16_t address, uint32_t * length) {
+	VM_STATE state;
+	for (*length = 0; (state = __range(machine, address, *length + 1)) == VM_OK; (*length)++) {
+		if (__peek(machine, address + *length) == 0) break;
+	}
+	return state;
+}
+
+/** Skopiruje oblast pamate stroja, oblasti sa mozu prekryvat.
+ * @param machine popisovac virtualneho stroja
+ * @param dst ciel
+ * @param src zdroj
+ * @param length dlzka v bytoch
+ */
+static void __move(VIRTUAL_MACHINE * machine, uint16_t dst, uint16_t src, uint16_t length) {
+	uint16_t q;
+	if (length == 0) return;
+	if (__direct(machine)) {
+		memmove(machine->memory + dst, machine->memory + src, length);
+		invalidateCodeVirtualMachine(machine, dst, length);
+	} else if (dst <= src) {
+		for (q = 0; q < length; q++) __poke(machine, dst + q, __peek(machine, src + q));
+	} else {
+		for (q = length; q-- > 0;) __poke(machine, dst + q, __peek(machine, src + q));
+	}
+}
+
+/* Zabudovane nativne funkcie. Argumenty su v R0, R1, R2, vysledok v R0, 32-bitove hodnoty
+ * su v dvojiciach registrov R1:R0 a R3:R2 (vyssie slovo v R1, resp. R3). Ostatne registre
+ * a priznaky sa nemenia. */
+
+/** memcpy(R0 ciel, R1 zdroj, R2 dlzka), R0 = ciel; aj pre prekryvajuce sa oblasti. */
+static VM_STATE __nativeMemmove(VIRTUAL_MACHINE * machine, void * data) {
+	uint16_t * r = machine->registers;
+	VM_STATE state;
+	(void) data;
+	if ((state = __range(machine, r[0], r[2])) != VM_OK || (state = __range(machine, r[1], r[2])) != VM_OK) return state;
+	if ((state = __writable(machine, r[0], r[2])) != VM_OK) return state;
+	__move(machine, r[0], r[1], r[2]);
+	return VM_OK;
+}
+
+/** memset(R0 ciel, R1 byte, R2 dlzka), R0 = ciel. */
+static VM_STATE __nativeMemset(VIRTUAL_MACHINE * machine, void * data) {
+	uint16_t * r = machine->registers, q;
+	VM_STATE state;
+	(void) data;
+	if ((state = __range(machine, r[0], r[2])) != VM_OK || (state = __writable(machine, r[0], r[2])) != VM_OK) return state;
+	if (r[2] == 0) return VM_OK;
+	if (__direct(machine)) {
+		memset(machine->memory + r[0], r[1] & 0xFF, r[2]);
+		invalidateCodeVirtualMachine(machine, r[0], r[2]);
+	} else {
+		for (q = 0; q < r[2]; q++) __poke(machine, r[0] + q, r[1] & 0xFF);
+	}
+	return VM_OK;
+}
+
+/** memcmp(R0 a, R1 b, R2 dlzka), R0 = rozdiel prvych roznych bytov, 0 ak su oblasti rovnake. */
+static VM_STATE __nativeMemcmp(VIRTUAL_MACHINE * machine, void * data) {
+	uint16_t * r = machine->registers, q;
+	uint8_t a = 0, b = 0;
+	VM_STATE state;
+	(void) data;
+	if ((state = __range(machine, r[0], r[2])) != VM_OK || (state = __range(machine, r[1], r[2])) != VM_OK) return state;
+	for (q = 0; q < r[2] && a == b; q++) {
+		a = __peek(machine, r[0] + q);
+		b = __peek(machine, r[1] + q);
+	}
+	r[0] = a - b;
+	return VM_OK;
+}
+
+/** strlen(R0 retazec), R0 = dlzka. */
+static VM_STATE __nativeStrlen(VIRTUAL_MACHINE * machine, void * data) {
+	uint32_t length;
+	VM_STATE state;
+	(void) data;
+	if ((state = __string(machine, machine->registers[0], &length)) != VM_OK) return state;
+	machine->registers[0] = length;
+	return VM_OK;
+}
+
+/** strcmp(R0 a, R1 b), R0 = rozdiel prvych roznych bytov, 0 ak su retazce rovnake. */
+static VM_STATE __nativeStrcmp(VIRTUAL_MACHINE * machine, void * data) {
+	uint16_t * r = machine->registers;
+	uint32_t q;
+	uint8_t a, b;
+	VM_STATE state;
+	(void) data;
+	for (q = 0;; q++) {
+		if ((state = __range(machine, r[0], q + 1)) != VM_OK || (state = __range(machine, r[1], q + 1)) != VM_OK) return state;
+		a = __peek(machine, r[0] + q);
+		b = __peek(machine, r[1] + q);
+		if (a != b || a == 0) break;
+	}
+	r[0] = a - b;
+	return VM_OK;
+}
+
+/** strcpy(R0 ciel, R1 zdroj), R0 = ciel. */
+static VM_STATE __nativeStrcpy(VIRTUAL_MACHINE * machine, void * data) {
+	uint16_t * r = machine->registers;
+	uint32_t length;
+	VM_STATE state;
+	(void) data;
+	if ((state = __string(machine, r[1], &length)) != VM_OK || (state = __range(machine, r[0], length + 1)) != VM_OK ||
+			(state = __writable(machine, r[0], length + 1)) != VM_OK) return state;
+	__move(machine, r[0], r[1], length + 1);
+	return VM_OK;
+}
+
+/** Nacita 32-bitovu hodnotu z dvojice registrov.
+ * @param machine popisovac virtualneho stroja
+ * @param low register s nizsim slovom, vyssie slovo je v nasledujucom registri
+ * @return hodnota
+ */
+static inline uint32_t __pair(VIRTUAL_MACHINE * machine, unsigned low) {
+	return (uint32_t) machine->registers[low + 1] << 16 | machine->registers[low];
+}
+
+/** Ulozi 32-bitovy vysledok do R1:R0.
+ * @param machine popisovac virtualneho stroja
+ * @param value vysledok
+ */
+static inline void __result(VIRTUAL_MACHINE * machine, uint32_t value) {
+	machine->registers[0] = value & 0xFFFF;
+	machine->registers[1] = value >> 16;
+}
+
+/** __mulsi3(R1:R0, R3:R2), R1:R0 = nizsich 32 bitov sucinu. */
+static VM_STATE __nativeMul32(VIRTUAL_MACHINE * machine, void * data) {
+	(void) data;
+	__result(machine, __pair(machine, 0) * __pair(machine, 2));
+	return VM_OK;
+}
+
+/** __udivsi3(R1:R0, R3:R2), R1:R0 = podiel bez znamienka. */
+static VM_STATE __nativeUdiv32(VIRTUAL_MACHINE * machine, void * data) {
+	(void) data;
+	if (__pair(machine, 2) == 0) return VM_DIVIDE_BY_ZERO;
+	__result(machine, __pair(machine, 0) / __pair(machine, 2));
+	return VM_OK;
+}
+
+/** __umodsi3(R1:R0, R3:R2), R1:R0 = zvysok bez znamienka. */
+static VM_STATE __nativeUmod32(VIRTUAL_MACHINE * machine, void * data) {
+	(void) data;
+	if (__pair(machine, 2) == 0) return VM_DIVIDE_BY_ZERO;
+	__result(machine, __pair(machine, 0) % __pair(machine, 2));
+	return VM_OK;
+}
+
+/** __divsi3(R1:R0, R3:R2), R1:R0 = podiel so znamienkom zaokruhleny k nule. */
+static VM_STATE __nativeDiv32(VIRTUAL_MACHINE * machine, void * data) {
+	(void) data;
+	if (__pair(machine, 2) == 0) return VM_DIVIDE_BY_ZERO;
+	__result(machine, (int64_t) (int32_t) __pair(machine, 0) / (int32_t) __pair(machine, 2));
+	return VM_OK;
+}
+
+/** __modsi3(R1:R0, R3:R2), R1:R0 = zvysok so znamienkom delenca. */
+static VM_STATE __nativeMod32(VIRTUAL_MACHINE * machine, void * data) {
+	(void) data;
+	if (__pair(machine, 2) == 0) return VM_DIVIDE_BY_ZERO;
+	__result(machine, (int64_t) (int32_t) __pair(machine, 0) % (int32_t) __pair(machine, 2));
+	return VM_OK;
+}
+
+/** Zabudovana nativna funkcia a meno symbolu, ktory implementuje. */
+struct NativeBuiltin {
+	const char * name;
+	vmNativeRoutine routine;
+};
+
+static const struct NativeBuiltin __builtins[] = {
+	{ "memcpy", __nativeMemmove },
+	{ "memmove", __nativeMemmove },
+	{ "memset", __nativeMemset },
+	{ "memcmp", __nativeMemcmp },
+	{ "strlen", __nativeStrlen },
+	{ "strcmp", __nativeStrcmp },
+	{ "strcpy", __nativeStrcpy },
+	{ "__mulsi3", __nativeMul32 },
+	{ "__udivsi3", __nativeUdiv32 },
+	{ "__umodsi3", __nativeUmod32 },
+	{ "__divsi3", __nativeDiv32 },
+	{ "__modsi3", __nativeMod32 },
+};
+
+/** Najde zabudovanu nativnu implementaciu funkcie programu stroja podla mena symbolu.
+ * Libvm ma nativne implementacie funkcii memcpy, memmove, memset, memcmp, strlen, strcmp,
+ * strcpy a 32-bitoveho nasobenia a delenia __mulsi3, __udivsi3, __umodsi3, __divsi3 a
+ * __modsi3. Argumenty dostavaju v R0, R1, R2, resp. 32-bitove v R1:R0 a R3:R2 (vyssie
+ * slovo v R1, resp. R3), vysledok vracaju v R0, resp. R1:R0, ostatne registre ani priznaky
+ * nemenia. Pamat stroja citaju a zapisuju cez zbernicu ako instrukcie stroja, pristup mimo
+ * pamate stroja skonci chybou VM_OUT_OF_MEMORY, zapis na stranku chranenu proti zapisu
+ * chybou VM_WRITE_PROTECTED, delenie nulou chybou VM_DIVIDE_BY_ZERO.
+ * Vlastna nativna funkcia moze menit registre a pamat stroja, zapisanu oblast musi ohlasit
+ * funkciou invalidateCodeVirtualMachine.
+ * @param name meno symbolu funkcie
+ * @return nativna funkcia pre bindNativeVirtualMachine, NULL ak pre symbol ziadna nie je
+ */
+vmNativeRoutine findNativeVirtualMachine(const char * name) {
+	unsigned q;
+	for (q = 0; q < sizeof(__builtins) / sizeof(struct NativeBuiltin); q++) {
+		if (strcmp(__builtins[q].name, name) == 0) return __builtins[q].routine;
+	}
+	return NULL;
+}
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <vm.h>
+#include "vm.h"
+
+#include "decode.h"
+
+/** Trieda instrukcie pre profil podla jej obsluhy. */
+const uint8_t vmProfileClass[VMOP_COUNT] = {
+	VM_PROFILE_ILLEGAL,
+	VM_PROFILE_BRANCH_TAKEN, VM_PROFILE_BRANCH_TAKEN,
+	VM_PROFILE_LOAD, VM_PROFILE_LOAD, VM_PROFILE_LOAD, VM_PROFILE_LOAD,
+	VM_PROFILE_STORE, VM_PROFILE_STORE, VM_PROFILE_STORE, VM_PROFILE_STORE,
+	VM_PROFILE_MOVE,
+	VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU,
+	VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU,
+	VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU,
+	VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU, VM_PROFILE_ALU,
+	VM_PROFILE_MOVE, VM_PROFILE_MOVE, VM_PROFILE_INT
+};
+
+/** Nazvy pocitadiel profilu v exporte CSV, v poradi VM_ProfileCounter. */
+static const char * __counterNames[VM_PROFILE_COUNTERS] = {
+	"alu", "load", "store", "move", "branch_taken", "branch_not_taken", "skipped", "int", "illegal", "mem_reads", "mem_writes"
+};
+
+/** Zapne alebo vypne profilovanie stroja.
+ * Pri zapnuti sa alokuje novy, vynulovany profil. Kym je profilovanie zapnute, vykonava
+ * instrukcie vzdy profilujuci interpret bez ohladu na rezim stroja. Pri vypnuti sa profil
+ * zahodi.
+ * @param machine popisovac virtualneho stroja
+ * @param enable 1 zapne profilovanie, 0 ho vypne
+ * @return 0 ak sa podarilo, -1 ak sa nepodarilo alokovat profil
+ */
+int setProfilingVirtualMachine(VIRTUAL_MACHINE * machine, int enable) {
+	if (!enable) {
+		free(machine->profile);
+		machine->profile = NULL;
+		return 0;
+	}
+	if (machine->profile != NULL) return 0;
+	machine->profile = calloc(1, sizeof(VM_PROFILE));
+	return (machine->profile != NULL) ? 0 : -1;
+}
+
+/** Zapise cislo v poradi MSB, LSB.
+ * @param f vystupny subor
+ * @param value hodnota
+ * @param bytes pocet bytov
+ */
+static void __writeNumber(FILE * f, uint64_t value, int bytes) {
+	while (bytes-- > 0) fputc((value >> (8 * bytes)) & 0xFF, f);
+}
+
+/** Zapise profil stroja do suboru.
+ * Binarny format (VM_PROFILE_BINARY) zacina signaturou "PRF" a verziou (1 byte), nasleduje
+ * pocet pocitadiel (2 byty) a pocitadla (po 8 bytov), pocet zaznamov pre adresy (4 byty)
+ * a zaznamy iba pre adresy s nenulovym poctom: adresa (2 byty) a pocet (8 bytov). Vsetky
+ * cisla su v poradi MSB, LSB, rovnako ako v obraze pamate.
+ * Format CSV (VM_PROFILE_CSV) ma hlavicku "kind,name,count" a riadky "counter,<nazov>,<pocet>"
+ * pre pocitadla a "pc,0x<adresa>,<pocet>" pre adresy s nenulovym poctom.
+ * @param machine popisovac virtualneho stroja
+ * @param filename nazov vystupneho suboru
+ * @param format format suboru (VM_ProfileFormat)
+ * @return 0 ak bol profil zapisany, -1 pri chybe alebo ak profilovanie nie je zapnute
+ */
+int writeProfileVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename, uint8_t format) {
+	VM_PROFILE * profile = machine->profile;
+	uint32_t q, records = 0;
+	FILE * f;
+	int rc;
+	if (profile == NULL) return -1;
+	f = fopen(filename, (format == VM_PROFILE_CSV) ? "w" : "wb");
+	if (f == NULL) return -1;
+	if (format == VM_PROFILE_CSV) {
+		fprintf(f, "kind,name,count\n");
+		for (q = 0; q < VM_PROFILE_COUNTERS; q++) {
+			fprintf(f, "counter,%s,%llu\n", __counterNames[q], (unsigned long long) profile->counters[q]);
+		}
+		for (q = 0; q < VM_PROFILE_WORDS; q++) {
+			if (profile->pc[q]) fprintf(f, "pc,0x%04X,%llu\n", q << 1, (unsigned long long) profile->pc[q]);
+		}
+	} else {
+		fwrite("PRF", 1, 3, f);
+		fputc(1, f);
+		__writeNumber(f, VM_PROFILE_COUNTERS, 2);
+		for (q = 0; q < VM_PROFILE_COUNTERS; q++) __writeNumber(f, profile->counters[q], 8);
+		for (q = 0; q < VM_PROFILE_WORDS; q++) if (profile->pc[q]) records++;
+		__writeNumber(f, records, 4);
+		for (q = 0; q < VM_PROFILE_WORDS; q++) {
+			if (profile->pc[q]) {
+				__writeNumber(f, q << 1, 2);
+				__writeNumber(f, profile->pc[q], 8);
+			}
+		}
+	}
+	rc = ferror(f) ? -1 : 0;
+	if (fclose(f) != 0) rc = -1;
+	return rc;
+}
@@ -0,0 +1,650 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/// Verzia formatu zaznamu vstupov
+#define RECORD_VERSION		1
+
+/// Dlzka hlavicky: "RPL", verzia, dlzka pamate, pociatocne hodiny, mapa stranok
+#define RECORD_HEADER		(3 + 1 + 4 + 8 + VM_PAGE_COUNT)
+
+#define RECORD_PAGE_READ	(1 << 0)		// citanie stranky je vstup (zariadenie alebo vlastne operacie pamate)
+#define RECORD_PAGE_WRITE	(1 << 1)		// zapis na stranku obsluhuje zariadenie, pri prehravani sa zahodi
+
+/// Polozky stavu stroja v zazname stavu za 16 registrami, bit masky polozky je 1 << index
+#define STATE_FLAGS			16
+#define STATE_TABLE			17				// adresa tabulky vektorov preruseni
+#define STATE_ACTIVE		18				// program stroja obsluhuje prerusenie
+#define STATE_VALUES		19
+
+/// Hodnoty pre 64 bitovy FNV-1a hash stavu na konci zaznamu
+#define HASH_BASIS			0xCBF29CE484222325ULL
+#define HASH_PRIME			0x100000001B3ULL
+
+/** Druhy zaznamov, okrem RECORD_READ maju vsetky cas ako rozdiel od casu predchadzajuceho. */
+enum {
+	RECORD_STATE = 0,		// zmena stavu mimo vykonavania instrukcii: maska, hodnoty, behy zmenenej pamate
+	RECORD_INTERRUPT,		// vybratie prerusenia z fronty: cislo prerusenia
+	RECORD_READ,			// citanie vstupu s inou hodnotou ako pamat: pocet preskocenych citani, hodnota
+	RECORD_CLOCK,			// hostitel zmenil hodiny stroja: nove hodiny
+	RECORD_FAULT,			// beh skoncil chybou: stav
+	RECORD_END				// koniec zaznamu: pocet preskocenych citani, hash stavu
+};
+
+/** Zaznam s casom nacitany pri prehravani. */
+struct Input {
+	uint8_t type;
+	uint64_t time;					// hodnota machine->clock, pri ktorej sa zaznam pouzije
+	uint64_t value;					// cislo prerusenia, nove hodiny, stav, resp. pocet citani pri RECORD_END
+	uint64_t hash;					// hash stavu pri RECORD_END
+	size_t payload;					// pozicia masky zaznamu stavu
+};
+
+/** Zaznam alebo prehravanie vstupov stroja. */
+struct Recording {
+	uint8_t replay;					// 1 pri prehravani
+	uint8_t running;				// stroj vykonava instrukcie, citania na strankach vstupov su vstupy
+	uint8_t error;					// zapis zlyhal, resp. prehravanie sa odchylilo od zaznamu
+	uint32_t length;				// dlzka pamate stroja v bytoch
+	uint8_t pages[VM_PAGE_COUNT];	// RECORD_PAGE_READ a RECORD_PAGE_WRITE pre kazdu stranku
+	uint64_t last;					// cas predchadzajuceho zaznamu s casom
+	uint64_t skipped;				// pocet citani vstupov od posledneho zaznamu citania
+	/* zaznam */
+	FILE * file;
+	unsigned char * shadow;			// obsah pamate v case poslednej synchronizacie
+	uint16_t state[STATE_VALUES];	// registre, priznaky a radic preruseni v case poslednej synchronizacie
+	uint64_t clock;					// hodiny stroja v case poslednej synchronizacie
+	/* prehravanie */
+	unsigned char * data;			// cely subor zaznamu
+	size_t size;
+	size_t timed;					// pozicia za dalsim zaznamom s casom
+	size_t reads;					// pozicia za dalsim zaznamom citania
+	struct Input input;				// dalsi zaznam s casom
+	uint8_t pending;				// input je platny
+	uint8_t read_pending;			// read_skip a read_value su platne
+	uint64_t read_skip;				// pocet citani pred dalsim zaznamenanym citanim
+	uint16_t read_value;			// hodnota dalsieho zaznamenaneho citania
+	VM_STATE result;				// VM_OK, kym prehravanie neskoncilo
+};
+
+/** Zapise cislo v poradi MSB, LSB do pamate.
+ * @param p miesto zapisu
+ * @param value hodnota
+ * @param bytes pocet bytov
+ * @return miesto za zapisanym cislom
+ */
+static unsigned char * __putNumber(unsigned char * p, uint64_t value, int bytes) {
+	while (bytes-- > 0) *p++ = (value >> (8 * bytes)) & 0xFF;
+	return p;
+}
+
+/** Nacita cislo v poradi MSB, LSB z pamate.
+ * @param p miesto citania
+ * @param bytes pocet bytov
+ * @return hodnota
+ */
+static uint64_t __getNumber(const unsigned char * p, int bytes) {
+	uint64_t value = 0;
+	while (bytes-- > 0) value = (value << 8) | *p++;
+	return value;
+}
+
+/** Zapise cislo do suboru ako varint: po 7 bitoch od najnizsich, horny bit bytu
+ * oznacuje, ze cislo pokracuje.
+ * @param f vystupny subor
+ * @param value hodnota
+ */
+static void __putVarint(FILE * f, uint64_t value) {
+	while (value >= 0x80) {
+		putc((value & 0x7F) | 0x80, f);
+		value >>= 7;
+	}
+	putc(value, f);
+}
+
+/** Nacita varint zo zaznamu pri prehravani.
+ * @param rec prehravany zaznam
+ * @param pos pozicia v zazname, posunie sa za cislo
+ * @param value miesto pre hodnotu
+ * @return 0 ak sa cislo podarilo nacitat, -1 ak je zaznam skrateny alebo cislo prilis dlhe
+ */
+static int __getVarint(struct Recording * rec, size_t * pos, uint64_t * value) {
+	unsigned shift = 0;
+	uint8_t c;
+	*value = 0;
+	do {
+		if (*pos >= rec->size || shift > 63) return -1;
+		c = rec->data[(*pos)++];
+		*value |= (uint64_t) (c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return 0;
+}
+
+/** Zapise druh zaznamu s casom a posun casu od predchadzajuceho zaznamu.
+ * @param rec zaznam
+ * @param type druh zaznamu
+ * @param time cas zaznamu
+ */
+static void __putTime(struct Recording * rec, uint8_t type, uint64_t time) {
+	putc(type, rec->file);
+	__putVarint(rec->file, time - rec->last);
+	rec->last = time;
+}
+
+/** Nacita registre, priznaky a stav radica preruseni stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param state miesto pre STATE_VALUES hodnot
+ */
+static void __capture(VIRTUAL_MACHINE * machine, uint16_t * state) {
+	memcpy(state, machine->registers, sizeof(machine->registers));
+	state[STATE_FLAGS] = machine->flags;
+	state[STATE_TABLE] = machine->interrupts->table;
+	state[STATE_ACTIVE] = machine->interrupts->active;
+}
+
+/** Vypocita hash stavu stroja, ktorym sa na konci prehravania overi zhoda so zaznamom.
+ * @param state registre a priznaky
+ * @param memory pamat stroja
+ * @param length dlzka pamate
+ * @return hash
+ */
+static uint64_t __hash(const uint16_t * state, const unsigned char * memory, uint32_t length) {
+	uint64_t hash = HASH_BASIS;
+	uint32_t q;
+	for (q = 0; q <= STATE_FLAGS; q++) {
+		hash = (hash ^ (state[q] & 0xFF)) * HASH_PRIME;
+		hash = (hash ^ (state[q] >> 8)) * HASH_PRIME;
+	}
+	for (q = 0; q < length; q++) hash = (hash ^ memory[q]) * HASH_PRIME;
+	return hash;
+}
+
+/** Oznaci stranky pamate ako zhodne so zaznamom.
+ * @param machine popisovac virtualneho stroja
+ */
+static void __markPages(VIRTUAL_MACHINE * machine) {
+	uint32_t page;
+	for (page = 0; page * VM_PAGE_SIZE < machine->recording->length; page++) machine->page_flags[page] |= VM_PAGE_RECORDED;
+}
+
+/** Prevezme do tienovej kopie zmeny, ktore urobil program stroja.
+ * Vola sa vzdy, ked ma stroj prevziat hostitel. Zmeny programu stroja sa pri prehravani
+ * zopakuju, nezaznamenavaju sa; kopiruju sa iba stranky, na ktore sa zapisovalo.
+ * @param machine popisovac virtualneho stroja
+ */
+static void __sync(VIRTUAL_MACHINE * machine) {
+	struct Recording * rec = machine->recording;
+	uint32_t page, base, size;
+	for (page = 0; (base = page * VM_PAGE_SIZE) < rec->length; page++) {
+		if (machine->page_flags[page] & VM_PAGE_RECORDED) continue;
+		/* nezarovnany zapis slova na konci stranky zmeni aj prvy byte dalsej stranky */
+		size = rec->length - base;
+		if (size > VM_PAGE_SIZE + 1) size = VM_PAGE_SIZE + 1;
+		memcpy(rec->shadow + base, machine->memory + base, size);
+		machine->page_flags[page] |= VM_PAGE_RECORDED;
+	}
+	__capture(machine, rec->state);
+	rec->clock = machine->clock;
+}
+
+/** Zaznamena zmeny, ktore urobil hostitel od poslednej synchronizacie.
+ * Hostitel moze pamat menit aj priamo, preto sa porovna cela pamat s tienovou kopiou.
+ * Zmenena pamat sa zapise ako behy v ramci stranok: dlzka, posun od konca predchadzajuceho
+ * behu a obsah, zoznam behov konci nulovou dlzkou.
+ * @param machine popisovac virtualneho stroja
+ */
+static void __diff(VIRTUAL_MACHINE * machine) {
+	struct Recording * rec = machine->recording;
+	uint16_t state[STATE_VALUES];
+	uint32_t mask = 0, page, base, size, q, end, pos = 0;
+
+	if (machine->clock != rec->clock) {
+		__putTime(rec, RECORD_CLOCK, rec->clock);
+		__putVarint(rec->file, machine->clock);
+		rec->clock = rec->last = machine->clock;
+	}
+	__capture(machine, state);
+	for (q = 0; q < STATE_VALUES; q++) if (state[q] != rec->state[q]) mask |= 1 << q;
+	for (page = 0; (base = page * VM_PAGE_SIZE) < rec->length; page++) {
+		size = rec->length - base;
+		if (size > VM_PAGE_SIZE) size = VM_PAGE_SIZE;
+		if (memcmp(machine->memory + base, rec->shadow + base, size) != 0) break;
+	}
+	if (mask == 0 && base >= rec->length) {
+		__markPages(machine);
+		return;
+	}
+	__putTime(rec, RECORD_STATE, machine->clock);
+	__putVarint(rec->file, mask);
+	for (q = 0; q < STATE_VALUES; q++) if (mask & (1 << q)) __putVarint(rec->file, state[q]);
+	memcpy(rec->state, state, sizeof(state));
+	for (; (base = page * VM_PAGE_SIZE) < rec->length; page++) {
+		size = rec->length - base;
+		if (size > VM_PAGE_SIZE) size = VM_PAGE_SIZE;
+		if (memcmp(machine->memory + base, rec->shadow + base, size) == 0) continue;
+		for (q = 0; q < size; q = end) {
+			if (machine->memory[base + q] == rec->shadow[base + q]) {
+				end = q + 1;
+				continue;
+			}
+			for (end = q; end < size && machine->memory[base + end] != rec->shadow[base + end]; end++);
+			__putVarint(rec->file, end - q);
+			__putVarint(rec->file, base + q - pos);
+			fwrite(machine->memory + base + q, 1, end - q, rec->file);
+			memcpy(rec->shadow + base + q, machine->memory + base + q, end - q);
+			pos = base + end;
+		}
+	}
+	putc(0, rec->file);
+	__markPages(machine);
+}
+
+/** Preskoci, resp. pouzije zvysok zaznamu stavu.
+ * @param rec prehravany zaznam
+ * @param pos pozicia masky, posunie sa za zaznam
+ * @param machine stroj, na ktory sa zaznam pouzije, alebo NULL ak sa ma iba preskocit
+ * @return 0 ak je zaznam spravny, -1 inac
+ */
+static int __state(struct Recording * rec, size_t * pos, VIRTUAL_MACHINE * machine) {
+	uint64_t mask, value, length, gap;
+	uint32_t address = 0, q;
+	if (__getVarint(rec, pos, &mask) != 0 || mask >> STATE_VALUES) return -1;
+	for (q = 0; q < STATE_VALUES; q++) {
+		if (!(mask & (1 << q))) continue;
+		if (__getVarint(rec, pos, &value) != 0 || value > 0xFFFF) return -1;
+		if (machine == NULL) continue;
+		if (q < STATE_FLAGS) machine->registers[q] = value;
+		else if (q == STATE_FLAGS) machine->flags = value;
+		else if (q == STATE_TABLE) machine->interrupts->table = value;
+		else machine->interrupts->active = value;
+	}
+	for (;;) {
+		if (__getVarint(rec, pos, &length) != 0) return -1;
+		if (length == 0) return 0;
+		if (__getVarint(rec, pos, &gap) != 0 || length > VM_PAGE_SIZE || gap > rec->length ||
+				address + gap + length > rec->length || *pos + length > rec->size) return -1;
+		address += gap;
+		if (machine != NULL) {
+			memcpy(machine->memory + address, rec->data + *pos, length);
+			invalidateCodeVirtualMachine(machine, address, length);
+		}
+		address += length;
+		*pos += length;
+	}
+}
+
+/** Nacita dalsi zaznam s casom, zaznamy citania preskoci.
+ * Ak zaznam nie je spravny alebo skonci bez RECORD_END, prehravanie sa odchyli.
+ * @param rec prehravany zaznam
+ */
+static void __nextTimed(struct Recording * rec) {
+	struct Input * input = &rec->input;
+	uint64_t type, value;
+	rec->pending = 0;
+	for (;;) {
+		if (__getVarint(rec, &rec->timed, &type) != 0) break;
+		if (type == RECORD_READ) {
+			if (__getVarint(rec, &rec->timed, &value) != 0 || __getVarint(rec, &rec->timed, &value) != 0) break;
+			continue;
+		}
+		if (type > RECORD_END || __getVarint(rec, &rec->timed, &value) != 0) break;
+		input->type = type;
+		input->time = rec->last + value;
+		if (type == RECORD_STATE) {
+			input->payload = rec->timed;
+			if (__state(rec, &rec->timed, NULL) != 0) break;
+		} else if (__getVarint(rec, &rec->timed, &input->value) != 0) {
+			break;
+		} else if (type == RECORD_END && __getVarint(rec, &rec->timed, &input->hash) != 0) {
+			break;
+		}
+		rec->pending = 1;
+		return;
+	}
+	rec->error = 1;
+}
+
+/** Nacita dalsi zaznam citania, zaznamy s casom preskoci.
+ * @param rec prehravany zaznam
+ */
+static void __nextRead(struct Recording * rec) {
+	uint64_t type, value;
+	rec->read_pending = 0;
+	while (rec->reads < rec->size) {
+		if (__getVarint(rec, &rec->reads, &type) != 0) break;
+		if (type == RECORD_READ) {
+			if (__getVarint(rec, &rec->reads, &rec->read_skip) != 0 || __getVarint(rec, &rec->reads, &value) != 0) break;
+			rec->read_value = value;
+			rec->read_pending = 1;
+			return;
+		}
+		if (type > RECORD_END || __getVarint(rec, &rec->reads, &value) != 0) break;
+		if (type == RECORD_STATE) {
+			if (__state(rec, &rec->reads, NULL) != 0) break;
+		} else if (__getVarint(rec, &rec->reads, &value) != 0) {
+			break;
+		} else if (type == RECORD_END) {
+			/* za koncom zaznamu uz nic nie je */
+			rec->reads = rec->size;
+			return;
+		}
+	}
+	/* chybu zaznamu zisti __nextTimed, citanie za koncom vrati pamat */
+}
+
+/** Obsluha zapisu na stranku zariadenia pri prehravani, zapis zahodi. */
+static void __dropWrite(void * device, uint16_t address, uint16_t data, int half) {
+	(void) device; (void) address; (void) data; (void) half;
+}
+
+/** Vytvori popisovac zaznamu a mapu stranok, ktorych citanie je vstupom.
+ * @param machine popisovac virtualneho stroja
+ * @return popisovac zaznamu, NULL ak sa ho nepodarilo alokovat
+ */
+static struct Recording * __create(VIRTUAL_MACHINE * machine) {
+	struct Recording * rec = calloc(1, sizeof(struct Recording));
+	uint32_t page;
+	if (rec == NULL) return NULL;
+	rec->length = __memoryLength(machine, 0);
+	/* zariadenia sa mapuju iba na cele stranky pamate */
+	for (page = 0; (page + 1) * VM_PAGE_SIZE <= rec->length; page++) {
+		if (machine->read_func != vmDefaultMemoryRead) rec->pages[page] |= RECORD_PAGE_READ;
+		if (!__devicePage(machine, page * VM_PAGE_SIZE)) continue;
+		if (machine->devices->pages[page].read != NULL) rec->pages[page] |= RECORD_PAGE_READ;
+		if (machine->devices->pages[page].write != NULL) rec->pages[page] |= RECORD_PAGE_WRITE;
+	}
+	return rec;
+}
+
+/** Zacne zaznamenavat vstupy stroja do suboru.
+ * Zaznamenava sa vsetko, co beh stroja neurcuje sam: zmeny registrov, priznakov, pamate,
+ * tabulky vektorov a hodin, ktore urobil hostitel mimo vykonavania instrukcii (obsluha
+ * INT, udalosti, obnovenie snimky), prerusenia od hostitela v case ich obsluhy a citania
+ * zariadeni a vlastnej read_func, ktorych hodnota sa lisi od pamate stroja. Cas je hodnota
+ * machine->clock. Zaznamy su varinty, cas je rozdiel od predchadzajuceho zaznamu, citanie
+ * ma iba pocet citani so zhodnou hodnotou pred nim, zmenena pamat sa zapise po behoch
+ * zmenenych bytov. Pri kazdom behu (traceVirtualMachine) sa pamat porovna s tienovou
+ * kopiou a slucka necinnosti sa nepreskakuje. Zariadenia musia pamat stroja menit iba
+ * v obsluhe udalosti, nie pri citani alebo zapise, vlastne operacie pamate musia pouzivat
+ * pamat stroja a instrukcie nacitavat z nej. Nativne funkcie sa pri prehravani znova
+ * zavolaju. Zariadenia sa pocas zaznamu nesmu pripajat ani odpajat, stroj nesmie mat banky
+ * ani byt v zhluku. Zaznam je uplny az po
+ * stopRecordingVirtualMachine. Funkcia sa nesmie volat pocas behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param filename nazov suboru zaznamu
+ * @return 0 ak sa zaznam zacal, -1 ak stroj uz ma zaznam, ma banky, je v zhluku, alebo sa
+ * subor nepodarilo vytvorit
+ */
+int startRecordingVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename) {
+	struct Recording * rec;
+	unsigned char header[RECORD_HEADER], * p = header;
+
+	if (machine->recording != NULL || machine->banks != NULL || machine->cluster != NULL) return -1;
+	if ((rec = __create(machine)) == NULL) return -1;
+	if ((rec->shadow = calloc(1, rec->length)) == NULL || (rec->file = fopen(filename, "wb")) == NULL) {
+		free(rec->shadow);
+		free(rec);
+		return -1;
+	}
+	memcpy(p, "RPL", 3);
+	p[3] = RECORD_VERSION;
+	p = __putNumber(p + 4, rec->length, 4);
+	p = __putNumber(p, machine->clock, 8);
+	memcpy(p, rec->pages, VM_PAGE_COUNT);
+	fwrite(header, 1, RECORD_HEADER, rec->file);
+	rec->clock = rec->last = machine->clock;
+	machine->recording = rec;
+	/* pociatocny stav je rozdiel od vynulovaneho stroja */
+	__diff(machine);
+	return 0;
+}
+
+/** Zacne prehravat zaznam vstupov na stroji.
+ * Stroj dostane stav zo zaciatku zaznamu (ostatna pamat a registre sa vynuluju) a dalsie
+ * behy opakuju zaznamenany beh: zmeny od hostitela a prerusenia sa pouziju v case, kedy
+ * nastali, citania zariadeni vratia zaznamenane hodnoty. Stranky zariadeni sa pocas
+ * prehravania mapuju ako zariadenia, zapisy na ne sa zahodia. Na konci zaznamu beh skonci
+ * stavom VM_REPLAY_END, ak sa registre, priznaky a pamat zhoduju so zaznamom a vsetky
+ * zaznamenane citania sa pouzili, inac, rovnako ako pri chybe zaznamu, stavom
+ * VM_REPLAY_DIVERGED. Stroj musi mat rovnaku velkost pamate a nativne funkcie ako
+ * zaznamenany, standardne operacie pamate a ziadne zariadenia, banky ani udalosti,
+ * hostitel mu pocas prehravania nesmie posielat prerusenia ani menit jeho stav. Funkcia
+ * sa nesmie volat pocas behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param filename nazov suboru zaznamu
+ * @return 0 ak sa prehravanie zacalo, -1 ak stroj uz ma zaznam, nesplna podmienky, alebo
+ * subor nie je zaznam stroja s rovnakou velkostou pamate
+ */
+int startReplayVirtualMachine(VIRTUAL_MACHINE * machine, const char * filename) {
+	struct Recording * rec;
+	FILE * f;
+	long size;
+	uint32_t page, base;
+
+	if (machine->recording != NULL || machine->banks != NULL || machine->cluster != NULL ||
+			machine->devices != NULL || !__flatMemory(machine)) return -1;
+	if ((rec = calloc(1, sizeof(struct Recording))) == NULL) return -1;
+	rec->replay = 1;
+	rec->length = __memoryLength(machine, 0);
+	if ((f = fopen(filename, "rb")) == NULL) goto fail;
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < RECORD_HEADER || fseek(f, 0, SEEK_SET) != 0 ||
+			(rec->data = malloc(size)) == NULL || fread(rec->data, 1, size, f) != (size_t) size) {
+		fclose(f);
+		goto fail;
+	}
+	fclose(f);
+	rec->size = size;
+	if (memcmp(rec->data, "RPL", 3) != 0 || rec->data[3] != RECORD_VERSION || __getNumber(rec->data + 4, 4) != rec->length) goto fail;
+	memcpy(rec->pages, rec->data + 16, VM_PAGE_COUNT);
+	for (page = 0; page < VM_PAGE_COUNT; page++) {
+		if (rec->pages[page] == 0) continue;
+		if (mapDeviceVirtualMachine(machine, page * VM_PAGE_SIZE, VM_PAGE_SIZE, NULL,
+				(rec->pages[page] & RECORD_PAGE_WRITE) ? __dropWrite : NULL, NULL) != 0) {
+			unmapDeviceVirtualMachine(machine, 0, rec->length);
+			goto fail;
+		}
+	}
+
+	memset(machine->memory, 0, rec->length);
+	for (base = 0; base < rec->length; base += VM_PAGE_SIZE) invalidateCodeVirtualMachine(machine, base, VM_PAGE_SIZE);
+	memset(machine->registers, 0, sizeof(machine->registers));
+	machine->flags = 0;
+	machine->interrupts->table = 0;
+	machine->interrupts->active = 0;
+	machine->clock = rec->last = __getNumber(rec->data + 8, 8);
+	rec->timed = rec->reads = RECORD_HEADER;
+	__nextTimed(rec);
+	__nextRead(rec);
+	machine->recording = rec;
+	/* pociatocny stav */
+	vmReplayInputs(machine);
+	return 0;
+
+fail:
+	free(rec->data);
+	free(rec);
+	return -1;
+}
+
+/** Ukonci zaznam alebo prehravanie vstupov stroja.
+ * Zaznam skonci stavom stroja po poslednom behu, pri prehravani sa odpoja stranky
+ * zariadeni. Funkcia sa nesmie volat pocas behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @return 0 ak sa podarilo, -1 ak stroj zaznam nema alebo sa subor zaznamu nepodarilo zapisat
+ */
+int stopRecordingVirtualMachine(VIRTUAL_MACHINE * machine) {
+	struct Recording * rec = machine->recording;
+	uint32_t page;
+	int ret = 0;
+	if (rec == NULL) return -1;
+	if (rec->replay) {
+		for (page = 0; page < VM_PAGE_COUNT; page++) {
+			if (rec->pages[page]) unmapDeviceVirtualMachine(machine, page * VM_PAGE_SIZE, VM_PAGE_SIZE);
+		}
+		free(rec->data);
+	} else {
+		__putTime(rec, RECORD_END, rec->clock);
+		__putVarint(rec->file, rec->skipped);
+		__putVarint(rec->file, __hash(rec->state, rec->shadow, rec->length));
+		if (ferror(rec->file)) ret = -1;
+		if (fclose(rec->file) != 0) ret = -1;
+		free(rec->shadow);
+		for (page = 0; page < VM_PAGE_COUNT; page++) machine->page_flags[page] &= ~VM_PAGE_RECORDED;
+	}
+	free(rec);
+	machine->recording = NULL;
+	return ret;
+}
+
+/** Zacne beh stroja, vola ho traceVirtualMachine pred prvou instrukciou.
+ * Pri zazname zapise zmeny, ktore od predchadzajuceho behu urobil hostitel.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmRecordEnter(VIRTUAL_MACHINE * machine) {
+	if (!machine->recording->replay) __diff(machine);
+	machine->recording->running = 1;
+}
+
+/** Ukonci beh stroja, vola ho traceVirtualMachine pred navratom.
+ * Chyba sa zaznamena, lebo instrukcia, ktora ju sposobila, sa do hodin stroja nezapocita,
+ * ale stav stroja zmenit mohla; pri prehravani sa preto musi vykonat aj ona.
+ * @param machine popisovac virtualneho stroja
+ * @param state stav, ktorym beh skoncil
+ */
+void vmRecordLeave(VIRTUAL_MACHINE * machine, VM_STATE state) {
+	struct Recording * rec = machine->recording;
+	int fault = (state != VM_OK && state != VM_SOFTINT && state != VM_REPLAY_END && state != VM_REPLAY_DIVERGED);
+	rec->running = 0;
+	if (!rec->replay) {
+		if (fault) {
+			__putTime(rec, RECORD_FAULT, machine->clock);
+			__putVarint(rec->file, state);
+		}
+		__sync(machine);
+	} else if (fault) {
+		if (!rec->pending || rec->input.type != RECORD_FAULT || rec->input.time != machine->clock || rec->input.value != state) {
+			rec->error = 1;
+			return;
+		}
+		rec->last = rec->input.time;
+		__nextTimed(rec);
+	}
+}
+
+/** Spusti obsluhy udalosti, ktorych cas nastal, a zaznamena zmeny, ktore urobili.
+ * @param machine popisovac virtualneho stroja
+ */
+void vmRecordEvents(VIRTUAL_MACHINE * machine) {
+	struct Recording * rec = machine->recording;
+	if (!rec->replay) __sync(machine);
+	rec->running = 0;
+	vmRunEvents(machine);
+	rec->running = 1;
+	if (!rec->replay) __diff(machine);
+}
+
+/** Zaznamena prerusenie vybrate z fronty na obsluhu.
+ * @param machine popisovac virtualneho stroja
+ * @param vector cislo prerusenia
+ */
+void vmRecordInterrupt(VIRTUAL_MACHINE * machine, uint8_t vector) {
+	struct Recording * rec = machine->recording;
+	if (rec->replay) return;
+	__putTime(rec, RECORD_INTERRUPT, machine->clock);
+	__putVarint(rec->file, vector);
+}
+
+/** Spracuje citanie cez zbernicu, vola ho vmBusRead.
+ * Pocas behu stroja sa citanie stranky vstupov s hodnotou inou ako v pamati zaznamena,
+ * resp. pri prehravani sa jeho hodnota vezme zo zaznamu.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @param half ak je 1, cita sa iba jeden byte
+ * @param data nacitana hodnota
+ * @return hodnota, ktoru citanie vrati
+ */
+uint16_t vmRecordRead(VIRTUAL_MACHINE * machine, uint16_t address, int half, uint16_t data) {
+	struct Recording * rec = machine->recording;
+	if (!rec->running || !(rec->pages[address >> 8] & RECORD_PAGE_READ)) return data;
+	if (rec->replay) {
+		if (rec->read_pending && rec->skipped == rec->read_skip) {
+			data = rec->read_value;
+			rec->skipped = 0;
+			__nextRead(rec);
+		} else {
+			rec->skipped++;
+		}
+		return data;
+	}
+	if (data == __memRead(machine->memory, address, half)) {
+		rec->skipped++;
+		return data;
+	}
+	putc(RECORD_READ, rec->file);
+	__putVarint(rec->file, rec->skipped);
+	__putVarint(rec->file, data);
+	rec->skipped = 0;
+	return data;
+}
+
+/** Pouzije zaznamy, ktorych cas nastal, vola ho traceVirtualMachine pred kazdou castou behu.
+ * Zaznamy sa pouziju v poradi zaznamu, po preruseni sa skonci, aby sa obsluzilo pred dalsimi,
+ * pri chybe sa skonci, aby sa vykonala instrukcia, ktora ju sposobila.
+ * @param machine popisovac virtualneho stroja
+ * @return VM_OK, pri zazname vzdy; VM_REPLAY_END alebo VM_REPLAY_DIVERGED, ak prehravanie skoncilo
+ */
+VM_STATE vmReplayInputs(VIRTUAL_MACHINE * machine) {
+	struct Recording * rec = machine->recording;
+	struct Input * input = &rec->input;
+	uint16_t state[STATE_VALUES];
+	size_t pos;
+	if (!rec->replay || rec->result != VM_OK) return rec->result;
+	while (!rec->error && rec->pending && input->time <= machine->clock) {
+		/* zaznam, ktory mal byt pouzity skor: beh sa odchylil */
+		if (input->time < machine->clock) {
+			rec->error = 1;
+			break;
+		}
+		rec->last = input->time;
+		switch (input->type) {
+			case RECORD_STATE:
+				pos = input->payload;
+				if (__state(rec, &pos, machine) != 0) rec->error = 1;
+				break;
+			case RECORD_INTERRUPT:
+				if (postInterruptVirtualMachine(machine, input->value) != 0) rec->error = 1;
+				__nextTimed(rec);
+				return VM_OK;
+			case RECORD_FAULT:
+				/* pouzije sa az po chybe instrukcie, ktora nasleduje */
+				return VM_OK;
+			case RECORD_CLOCK:
+				machine->clock = rec->last = input->value;
+				break;
+			case RECORD_END:
+				__capture(machine, state);
+				rec->result = (!rec->read_pending && rec->skipped == input->value &&
+					__hash(state, machine->memory, rec->length) == input->hash) ? VM_REPLAY_END : VM_REPLAY_DIVERGED;
+				return rec->result;
+		}
+		__nextTimed(rec);
+	}
+	if (rec->error) rec->result = VM_REPLAY_DIVERGED;
+	return rec->result;
+}
+
+/** Zisti cas dalsieho zaznamu s casom pri prehravani.
+ * Ak zaznam s casom, ktory uz nastal, caka na dalsiu cast behu (chyba, resp. zaznam po
+ * preruseni), jadro vykona jednu instrukciu, zaznamenany beh totiz skoncil chybou.
+ * @param machine popisovac virtualneho stroja
+ * @return hodnota machine->clock, pri ktorej sa ma beh zastavit, UINT64_MAX pri zazname
+ */
+uint64_t vmReplayNext(VIRTUAL_MACHINE * machine) {
+	struct Recording * rec = machine->recording;
+	if (!rec->replay || !rec->pending) return UINT64_MAX;
+	return (rec->input.time > machine->clock) ? rec->input.time : machine->clock + 1;
+}
@@ -0,0 +1,92 @@
+#include <stdlib.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/// Velkost bitovej mapy zarazok v bytoch, jeden bit pre kazdu adresu
+#define BREAKPOINT_BYTES	(VM_MEMORY_FULL_SIZE / 8)
+
+/** Zisti, ci je na adrese zarazka.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @return nenulova hodnota ak je na adrese zarazka
+ */
+static inline int __isBreakpoint(VIRTUAL_MACHINE * machine, uint16_t address) {
+	return machine->breakpoints[address >> 3] & (1 << (address & 7));
+}
+
+/** Nastavi alebo zrusi zarazku na adrese.
+ * Kym ma stroj nejaku zarazku, resumeVirtualMachine vykonava instrukcie po jednej, aby
+ * sa mohol zastavit presne pred instrukciou na adrese so zarazkou.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa instrukcie
+ * @param enable 1 zarazku nastavi, 0 ju zrusi
+ * @return 0 ak sa podarilo, -1 ak sa nepodarilo alokovat bitovu mapu zarazok
+ */
+int setBreakpointVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, int enable) {
+	unsigned q;
+	if (enable) {
+		if (machine->breakpoints == NULL && (machine->breakpoints = calloc(1, BREAKPOINT_BYTES)) == NULL) return -1;
+		machine->breakpoints[address >> 3] |= 1 << (address & 7);
+		return 0;
+	}
+	if (machine->breakpoints == NULL) return 0;
+	machine->breakpoints[address >> 3] &= ~(1 << (address & 7));
+	for (q = 0; q < BREAKPOINT_BYTES; q++) if (machine->breakpoints[q]) return 0;
+	free(machine->breakpoints);
+	machine->breakpoints = NULL;
+	return 0;
+}
+
+/** Vykona najviac budget instrukcii a popise, preco sa beh zastavil.
+ * Na rozdiel od traceVirtualMachine nie je limit obmedzeny na 16 bitov a pocet vykonanych
+ * instrukcii je presny aj pri chybe alebo instrukcii INT (INT sa zapocita, instrukcia, ktora
+ * sposobila chybu, nie). Beh sa da dalsim volanim plynule obnovit, prva instrukcia po
+ * obnoveni sa vykona aj vtedy, ak je na jej adrese zarazka. Prerusenie poslane funkciou
+ * postInterruptVirtualMachine, ktore program stroja neobsluhuje, beh zastavi s dovodom
+ * VM_STOP_INTERRUPT, koniec prehravania zaznamu vstupov s dovodom VM_STOP_REPLAY.
+ * @param machine popisovac virtualneho stroja
+ * @param budget najvacsi pocet vykonanych instrukcii, 0 znamena bez limitu
+ * @param stop miesto pre popis zastavenia, alebo NULL
+ * @return stav, ktory vratilo jadro, rovnako ako pri traceVirtualMachine
+ */
+VM_STATE resumeVirtualMachine(VIRTUAL_MACHINE * machine, uint64_t budget, VM_STOP * stop) {
+	uint64_t retired = 0;
+	VM_STATE state = VM_OK;
+	uint8_t reason = VM_STOP_BUDGET;
+	uint16_t chunk;
+
+	while (budget == 0 || retired < budget) {
+		if (machine->breakpoints != NULL) {
+			if (retired > 0 && __isBreakpoint(machine, machine->PC)) {
+				reason = VM_STOP_BREAKPOINT;
+				break;
+			}
+			chunk = 1;
+		} else {
+			chunk = (budget == 0 || budget - retired > RUN_CHUNK) ? RUN_CHUNK : budget - retired;
+		}
+		state = traceVirtualMachine(machine, chunk);
+		retired += machine->retired;
+		if (state != VM_OK) {
+			if (state == VM_SOFTINT) reason = VM_STOP_SOFTINT;
+			else if (state == VM_REPLAY_END || state == VM_REPLAY_DIVERGED) reason = VM_STOP_REPLAY;
+			else reason = VM_STOP_FAULT;
+			break;
+		}
+		if (machine->ext_interrupt) {
+			reason = VM_STOP_INTERRUPT;
+			break;
+		}
+	}
+
+	if (stop != NULL) {
+		stop->retired = retired;
+		stop->state = state;
+		stop->reason = reason;
+		stop->vector = (reason == VM_STOP_SOFTINT || reason == VM_STOP_INTERRUPT) ? machine->ext_interrupt : 0;
+		stop->pc = machine->PC;
+		stop->fault_address = (reason == VM_STOP_FAULT) ? machine->fault_address : 0;
+	}
+	return state;
+}
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/** Stroj planovaca. */
+struct SchedulerEntry {
+	VIRTUAL_MACHINE * machine;
+	uint8_t ready;					// stroj sa moze vykonavat
+};
+
+/** Kooperativny planovac, ktory strieda stroje na jednom vlakne hostitela. */
+struct VirtualMachineScheduler {
+	uint64_t quantum;				// pocet instrukcii jedneho pridelenia
+	unsigned count;
+	unsigned capacity;
+	unsigned next;					// index stroja, ktory pride na rad
+	struct SchedulerEntry * entries;
+};
+
+/** Vytvori planovac.
+ * @param quantum pocet instrukcii, ktore stroj vykona pri jednom prideleni, najmenej 1
+ * @return planovac, NULL ak sa ho nepodarilo alokovat
+ */
+VM_SCHEDULER * createSchedulerVirtualMachine(uint64_t quantum) {
+	VM_SCHEDULER * scheduler = calloc(1, sizeof(VM_SCHEDULER));
+	if (scheduler == NULL) return NULL;
+	scheduler->quantum = quantum ? quantum : 1;
+	return scheduler;
+}
+
+/** Zrusi planovac. Stroje planovaca sa nerusia.
+ * @param scheduler planovac
+ */
+void destroySchedulerVirtualMachine(VM_SCHEDULER * scheduler) {
+	free(scheduler->entries);
+	free(scheduler);
+}
+
+/** Prida stroj do planovaca ako pripraveny.
+ * @param scheduler planovac
+ * @param machine popisovac virtualneho stroja
+ * @return 0 ak bol stroj pridany, -1 ak nie je dost pamate
+ */
+int addSchedulerVirtualMachine(VM_SCHEDULER * scheduler, VIRTUAL_MACHINE * machine) {
+	if (scheduler->count == scheduler->capacity) {
+		unsigned capacity = scheduler->capacity ? scheduler->capacity * 2 : 16;
+		struct SchedulerEntry * entries = realloc(scheduler->entries, capacity * sizeof(struct SchedulerEntry));
+		if (entries == NULL) return -1;
+		scheduler->entries = entries;
+		scheduler->capacity = capacity;
+	}
+	scheduler->entries[scheduler->count].machine = machine;
+	scheduler->entries[scheduler->count].ready = 1;
+	scheduler->count++;
+	return 0;
+}
+
+/** Odoberie stroj z planovaca. Poradie ostatnych strojov sa nemeni.
+ * @param scheduler planovac
+ * @param machine popisovac virtualneho stroja
+ */
+void removeSchedulerVirtualMachine(VM_SCHEDULER * scheduler, VIRTUAL_MACHINE * machine) {
+	unsigned q;
+	for (q = 0; q < scheduler->count; q++) {
+		if (scheduler->entries[q].machine != machine) continue;
+		memmove(&scheduler->entries[q], &scheduler->entries[q + 1], (scheduler->count - q - 1) * sizeof(struct SchedulerEntry));
+		scheduler->count--;
+		if (scheduler->next > q) scheduler->next--;
+		if (scheduler->next >= scheduler->count) scheduler->next = 0;
+		return;
+	}
+}
+
+/** Oznaci stroj zastaveny planovacom opat ako pripraveny, napr. po obsluzeni INT.
+ * @param scheduler planovac
+ * @param machine popisovac virtualneho stroja
+ */
+void wakeSchedulerVirtualMachine(VM_SCHEDULER * scheduler, VIRTUAL_MACHINE * machine) {
+	unsigned q;
+	for (q = 0; q < scheduler->count; q++) {
+		if (scheduler->entries[q].machine == machine) scheduler->entries[q].ready = 1;
+	}
+}
+
+/** Strieda pripravene stroje, kazdemu prideli quantum instrukcii.
+ * Ked sa stroj zastavi z ineho dovodu, ako vycerpanie pridelenia (INT, chyba, zarazka,
+ * neobsluzene prerusenie od hostitela), planovac ho oznaci ako nepripraveny a vrati ho volajucemu, ktory
+ * ho po obsluzeni moze znova zaradit funkciou wakeSchedulerVirtualMachine.
+ * @param scheduler planovac
+ * @param slices najvacsi pocet prideleni, 0 znamena bez obmedzenia
+ * @param stop miesto pre popis zastavenia vrateneho stroja, resp. VM_STOP_BUDGET ak sa
+ * vycerpali vsetky pridelenia a VM_STOP_IDLE ak ziadny stroj nie je pripraveny
+ * @return stroj, ktory sa zastavil, alebo NULL
+ */
+VIRTUAL_MACHINE * runSchedulerVirtualMachine(VM_SCHEDULER * scheduler, unsigned slices, VM_STOP * stop) {
+	unsigned done = 0, q;
+	while (slices == 0 || done < slices) {
+		struct SchedulerEntry * entry = NULL;
+		for (q = 0; q < scheduler->count; q++) {
+			unsigned index = (scheduler->next + q) % scheduler->count;
+			if (scheduler->entries[index].ready) {
+				entry = &scheduler->entries[index];
+				scheduler->next = (index + 1) % scheduler->count;
+				break;
+			}
+		}
+		if (entry == NULL) {
+			memset(stop, 0, sizeof(VM_STOP));
+			stop->reason = VM_STOP_IDLE;
+			return NULL;
+		}
+		resumeVirtualMachine(entry->machine, scheduler->quantum, stop);
+		done++;
+		if (stop->reason != VM_STOP_BUDGET) {
+			entry->ready = 0;
+			return entry->machine;
+		}
+	}
+	memset(stop, 0, sizeof(VM_STOP));
+	stop->reason = VM_STOP_BUDGET;
+	return NULL;
+}
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/** Snimka stavu virtualneho stroja. */
+struct VirtualMachineSnapshot {
+	uint16_t registers[16];
+	uint8_t flags;
+	uint8_t ext_interrupt;
+	uint64_t clock;
+	struct InterruptState interrupts;
+	uint32_t length;				// dlzka ulozenej pamate v bytoch
+	unsigned char memory[];
+};
+
+/** Vytvori snimku stavu stroja: registre, priznaky, ext_interrupt, hodiny, stav radica
+ * preruseni a obsah pamate.
+ * Stroj si snimku zapamata a od tejto chvile sleduje stranky, do ktorych sa zapisuje
+ * (prvy zapis na stranku sa ohlasi cez page_flags, dalsie zapisy uz idu priamo). Obnovenie
+ * tej istej snimky potom kopiruje iba zmenene stranky.
+ * @param machine popisovac virtualneho stroja
+ * @return snimka, NULL ak sa ju nepodarilo alokovat
+ */
+VM_SNAPSHOT * createSnapshotVirtualMachine(VIRTUAL_MACHINE * machine) {
+	uint32_t length = __memoryLength(machine, 1);
+	unsigned page;
+	VM_SNAPSHOT * snapshot = malloc(sizeof(VM_SNAPSHOT) + length);
+	if (snapshot == NULL) return NULL;
+	memcpy(snapshot->registers, machine->registers, sizeof(snapshot->registers));
+	snapshot->flags = machine->flags;
+	snapshot->ext_interrupt = machine->ext_interrupt;
+	snapshot->clock = machine->clock;
+	vmSaveInterrupts(machine, &snapshot->interrupts);
+	snapshot->length = length;
+	memcpy(snapshot->memory, machine->memory, length);
+	for (page = 0; page < VM_PAGE_COUNT; page++) machine->page_flags[page] |= VM_PAGE_SNAPSHOT;
+	machine->snapshot = snapshot;
+	return snapshot;
+}
+
+/** Obnovi stav stroja zo snimky.
+ * Ak bola snimka vytvorena alebo naposledy obnovena v tom istom stroji, skopiruju sa iba
+ * stranky zmenene od toho okamihu, inac cela pamat. Predekodovany kod na obnovenych
+ * strankach sa zneplatni. Snimku je mozne obnovit aj do ineho stroja s rovnako velkou
+ * pamatou. Hodiny stroja sa vratia na cas snimky, naplanovane udalosti sa nemenia. Fronta
+ * preruseni bude obsahovat prerusenia cakajuce v case snimky, preto sa snimka nesmie
+ * obnovovat sucasne s postInterruptVirtualMachine.
+ * @param machine popisovac virtualneho stroja
+ * @param snapshot snimka
+ * @return 0 ak bol stav obnoveny, -1 ak pamat stroja nema velkost snimky
+ */
+int restoreSnapshotVirtualMachine(VIRTUAL_MACHINE * machine, VM_SNAPSHOT * snapshot) {
+	uint32_t length = __memoryLength(machine, 1), base, size;
+	unsigned page, code = 0;
+	if (length != snapshot->length) return -1;
+	for (page = 0; page < VM_PAGE_COUNT; page++) {
+		if (machine->snapshot == snapshot && (machine->page_flags[page] & VM_PAGE_SNAPSHOT)) continue;
+		base = page * VM_PAGE_SIZE;
+		if (base < length) {
+			/* nezarovnany zapis slova na konci stranky zmeni aj prvy byte dalsej stranky */
+			size = length - base;
+			if (size > VM_PAGE_SIZE + 1) size = VM_PAGE_SIZE + 1;
+			memcpy(machine->memory + base, snapshot->memory + base, size);
+		}
+		if (machine->page_flags[page] & VM_PAGE_CODE) {
+			vmInvalidateBlocks(machine, page);
+			code = 1;
+		}
+		machine->page_flags[page] = (machine->page_flags[page] | VM_PAGE_SNAPSHOT) & ~(VM_PAGE_CHECKPOINT | VM_PAGE_TRANSLATED | VM_PAGE_RECORDED);
+	}
+	if (code) vmJitInvalidate(machine);
+	memcpy(machine->registers, snapshot->registers, sizeof(machine->registers));
+	machine->flags = snapshot->flags;
+	machine->ext_interrupt = snapshot->ext_interrupt;
+	machine->clock = snapshot->clock;
+	vmRestoreInterrupts(machine, &snapshot->interrupts);
+	machine->snapshot = snapshot;
+	return 0;
+}
+
+/** Zrusi snimku.
+ * Stroje, ktore snimku vytvorili alebo naposledy obnovili, na nu prestanu odkazovat az
+ * pri dalsom vytvoreni alebo obnoveni snimky, preto sa snimka nesmie zrusit skor, ako
+ * su tieto stroje zrusene alebo obnovene z inej snimky.
+ * @param snapshot snimka
+ */
+void destroySnapshotVirtualMachine(VM_SNAPSHOT * snapshot) {
+	free(snapshot);
+}
@@ -1,4 +1,6 @@
 #include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
 
 #include <vm.h>
 #include "vm.h"
@@ -6,20 +8,39 @@
 #include "bits.h"
 #include "registers.h"
 #include "instruction.h"
-
-#define MEM_OP_BYTE			1
-#define MEM_OP_WORD			0
+#include "decode.h"
 
 /** Vytvori popisovac virtualneho stroja.
- * @param memory adresa pamate vyhradenej ako virtualna pamat virtualneho stroja
- * @param memory_size velkost virtualnej pamate
+ * Ak je memory NULL, stroj si sam alokuje cely 64 KiB adresny priestor a jeden byte navyse
+ * (rezim VM_MEMORY_FULL). Ziadna 16 bitova adresa, ani slovo na adrese 0xFFFF, potom nemoze
+ * byt mimo pamate, takze jadro rozsah adries nekontroluje. Zarovnanie adries sa v tomto
+ * rezime kontroluje iba ak volajuci nastavi v mem_flags priznak VM_MEMORY_STRICT_ALIGN.
+ * @param memory adresa pamate vyhradenej ako virtualna pamat virtualneho stroja, alebo NULL
+ * @param memory_size velkost virtualnej pamate, ak je memory NULL, nepouziva sa
  * @param pc startovacia adresa behu virtualneho stroja
- * @return popisovac virtualneho stroja
+ * @return popisovac virtualneho stroja, NULL ak sa nepodarilo alokovat pamat
  */
 VIRTUAL_MACHINE * createVirtualMachine(char * memory, uint16_t memory_size, uint16_t pc) {
 	VIRTUAL_MACHINE * mach = malloc(sizeof(VIRTUAL_MACHINE));
+	if (mach == NULL) return NULL;
+	vmInitDecodeTable();
 	memset(mach, 0, sizeof(VIRTUAL_MACHINE));
-	mach->memory = memory;
+	if (memory == NULL) {
+		memory = calloc(1, VM_MEMORY_FULL_SIZE + 1);
+		if (memory == NULL) {
+			free(mach);
+			return NULL;
+		}
+		memory_size = VM_MEMORY_FULL_SIZE - 1;
+		mach->mem_flags = VM_MEMORY_FULL;
+	}
+	mach->interrupts = vmCreateInterrupts();
+	if (mach->interrupts == NULL) {
+		if (mach->mem_flags & VM_MEMORY_FULL) free(memory);
+		free(mach);
+		return NULL;
+	}
+	mach->memory = (unsigned char *) memory;
 	mach->mem_size = memory_size;
 	memset(mach->registers, 0, sizeof(mach->registers));
 	mach->read_func = vmDefaultMemoryRead;
@@ -29,6 +50,111 @@ VIRTUAL_MACHINE * createVirtualMachine(char * memory, uint16_t memory_size, uint
 	return mach;
 }
 
+/** Zrusi popisovac virtualneho stroja.
+ * Uvolni popisovac a vsetky struktury, ktore si stroj alokoval. Pamat virtualneho stroja
+ * patri volajucemu a neuvolnuje sa, okrem pamate v rezime VM_MEMORY_FULL (aj namapovanej
+ * z obrazu, VM_MEMORY_MAPPED). Tu ma ostatne jadra zhluku s jadrom 0 spolocnu, jadro 0 sa
+ * preto smie zrusit az po zruseni zhluku. Zaznam alebo prehravanie vstupov stroja sa ukonci
+ * (vid stopRecordingVirtualMachine).
+ * @param machine popisovac virtualneho stroja
+ */
+void destroyVirtualMachine(VIRTUAL_MACHINE * machine) {
+	stopRecordingVirtualMachine(machine);
+	vmFreeBlocks(machine);
+	vmFreeJit(machine);
+	free(machine->profile);
+	free(machine->breakpoints);
+	free(machine->interrupts);
+	free(machine->devices);
+	vmFreeEvents(machine);
+	vmFreeNatives(machine);
+	vmFreeBanks(machine);
+	if (machine->core == 0) vmFreeMemory(machine);
+	free(machine);
+}
+
+/** Nastavi rezim vykonavania instrukcii.
+ * Pri zmene rezimu sa zahodia predekodovane bloky aj prelozeny kod, ktory novy rezim
+ * nepouziva. Rezimy VM_MODE_JIT a VM_MODE_JIT_VERIFY su dostupne iba na hostitelovi x86-64.
+ * @param machine popisovac virtualneho stroja
+ * @param mode novy rezim (VM_Mode)
+ * @return 0 ak bol rezim nastaveny, -1 ak rezim nie je podporovany
+ */
+int setModeVirtualMachine(VIRTUAL_MACHINE * machine, uint8_t mode) {
+	switch (mode) {
+		case VM_MODE_INTERPRET:
+			vmFreeBlocks(machine);
+			vmFreeJit(machine);
+			break;
+
+		case VM_MODE_BLOCKS:
+			vmFreeJit(machine);
+			break;
+
+		case VM_MODE_JIT:
+		case VM_MODE_JIT_VERIFY:
+			if (!vmJitAvailable()) return -1;
+			/* kontrola interpretom nad pamatou, ktoru menia ine jadra, by hlasila chyby */
+			if (mode == VM_MODE_JIT_VERIFY && machine->cluster != NULL) return -1;
+			vmFreeBlocks(machine);
+			break;
+
+		default:
+			return -1;
+	}
+	machine->mode = mode;
+	return 0;
+}
+
+/** Oznami stroju, ze obsah pamate bol zmeneny mimo vykonavania instrukcii.
+ * Volajuci, ktory zapisuje priamo do pamate stroja (napr. debugger), musi takto
+ * zneplatnit predekodovany kod, ktory sa v zmenenej oblasti nachadza, a oznacit
+ * zmenene stranky pre obnovenie snimky a kontrolne body.
+ * @param machine popisovac virtualneho stroja
+ * @param address zaciatok zmenenej oblasti
+ * @param length dlzka zmenenej oblasti v bytoch
+ */
+void invalidateCodeVirtualMachine(VIRTUAL_MACHINE * machine, uint16_t address, uint16_t length) {
+	uint32_t page;
+	if (length == 0) return;
+	for (page = address >> 8; page <= ((uint32_t) address + length - 1) >> 8 && page < VM_PAGE_COUNT; page++) {
+		machine->page_flags[page] &= ~(VM_PAGE_SNAPSHOT | VM_PAGE_CHECKPOINT | VM_PAGE_TRANSLATED | VM_PAGE_RECORDED);
+		if (machine->page_flags[page] & VM_PAGE_CODE) {
+			vmInvalidateBlocks(machine, page);
+			vmJitInvalidate(machine);
+		}
+	}
+}
+
+/** Spracuje zapis na stranku, ktora ma nastavene atributy.
+ * Vola sa po kazdom zapise instrukciou, ktory zasiahol stranku s nenulovym page_flags (vid
+ * __storeFlags), nezarovnane slovo na konci stranky sa ohlasi obom strankam. Prvy zapis
+ * po vytvoreni alebo obnoveni snimky a po kontrolnom bode oznaci stranku ako zmenenu.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa, na ktoru sa zapisovalo
+ * @param half ak je 1, zapisal sa iba jeden byte
+ * @return 1 ak zapis zneplatnil predekodovany kod, inac 0
+ */
+int vmPageWritten(VIRTUAL_MACHINE * machine, uint16_t address, int half) {
+	uint32_t page, last = address >> 8;
+	int invalidated = 0;
+	if (machine->banks != NULL && machine->banks->switched) {
+		/* zapis do riadiaceho slova prepol banku s predekodovanym kodom */
+		machine->banks->switched = 0;
+		invalidated = 1;
+	}
+	if (!half && (address & 0xFF) == 0xFF && address != 0xFFFF) last++;
+	for (page = address >> 8; page <= last; page++) {
+		machine->page_flags[page] &= ~(VM_PAGE_SNAPSHOT | VM_PAGE_CHECKPOINT | VM_PAGE_TRANSLATED | VM_PAGE_RECORDED);
+		if (machine->page_flags[page] & VM_PAGE_CODE) {
+			vmInvalidateBlocks(machine, page);
+			vmJitInvalidate(machine);
+			invalidated = 1;
+		}
+	}
+	return invalidated;
+}
+
 /** Vypise obsah registrov virtualneho stroja v ludsky citatelnej forme.
  * @param machine popisovac virtualneho stroja
  */
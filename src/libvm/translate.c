@@ -0,0 +1,91 @@
+#include <string.h>
+
+#include <vm.h>
+#include "vm.h"
+
+/** Zisti, ci stranka pamate stroja ma rovnaky obsah ako obraz, z ktoreho bol program prelozeny.
+ * Pamat za koncom obrazu musi byt nulova.
+ * @param machine popisovac virtualneho stroja
+ * @param translation prelozeny program
+ * @param page cislo stranky
+ * @return 1 ak sa obsah zhoduje
+ */
+static int __samePage(VIRTUAL_MACHINE * machine, const VM_TRANSLATION * translation, uint32_t page) {
+	uint32_t base = page * VM_PAGE_SIZE, q;
+	for (q = base; q < base + VM_PAGE_SIZE; q++) {
+		if (machine->memory[q] != (q < translation->length ? translation->image[q] : 0)) return 0;
+	}
+	return 1;
+}
+
+/** Pripoji k stroju program prelozeny vopred do kodu hostitela (nastroj maot).
+ * Prelozeny kod sa pouzije na strankach, ktorych obsah sa zhoduje s obrazom, z ktoreho bol
+ * program prelozeny; tie dostanu priznak VM_PAGE_TRANSLATED. Zapis na taku stranku (aj
+ * hostitelom cez invalidateCodeVirtualMachine, obnovenie snimky alebo prepnutie banky) jej
+ * priznak zrusi a kod stranky odvtedy vykonava interpret. Prelozeny kod ma prednost pred
+ * rezimom stroja, adresy bez prekladu (napr. ciele nepriamych skokov, ktore prekladac
+ * nepoznal) vykonava interpret. Pouzije sa iba pri standardnych operaciach pamate, celom
+ * adresnom priestore (VM_MEMORY_FULL) bez VM_MEMORY_STRICT_ALIGN a bez profilovania, inac
+ * vsetko vykonava jadro podla rezimu stroja. Jadra zhluku preklad nededia. Funkcia sa nesmie
+ * volat pocas behu stroja.
+ * @param machine popisovac virtualneho stroja
+ * @param translation prelozeny program, NULL preklad odpoji; musi existovat, kym ho stroj pouziva
+ * @return pocet stranok, na ktorych sa prelozeny kod pouzije, -1 ak stroj nema cely adresny
+ * priestor alebo sa obsah ziadnej stranky nezhoduje
+ */
+int attachTranslationVirtualMachine(VIRTUAL_MACHINE * machine, const VM_TRANSLATION * translation) {
+	uint32_t page;
+	int count = 0;
+	for (page = 0; page < VM_PAGE_COUNT; page++) machine->page_flags[page] &= ~VM_PAGE_TRANSLATED;
+	machine->translation = NULL;
+	if (translation == NULL) return 0;
+	if (!(machine->mem_flags & VM_MEMORY_FULL)) return -1;
+	for (page = 0; page < VM_PAGE_COUNT; page++) {
+		if (translation->pages[page] && __samePage(machine, translation, page)) {
+			machine->page_flags[page] |= VM_PAGE_TRANSLATED;
+			count++;
+		}
+	}
+	if (count == 0) return -1;
+	machine->translation = translation;
+	return count;
+}
+
+/** Vykona instrukcie virtualneho stroja prelozenym kodom.
+ * Prelozeny kod bezi od PC po blokoch, kym ma rozpocet, nepride prerusenie od hostitela, nenastane
+ * chyba alebo INT a kym PC je na zaciatku bloku s prekladom na stranke s VM_PAGE_TRANSLATED.
+ * Blok, ktory sa do zvysku limitu nezmesti, a adresy bez prekladu vykona interpret po jednej
+ * instrukcii a prelozeny kod sa skusi znova.
+ * @param machine popisovac virtualneho stroja
+ * @param limit limit vykonanych instrukcii, 0 znamena bez limitu
+ * @return dovod prerusenia behu stroja, rovnako ako pri interprete
+ */
+VM_STATE vmExecTranslated(VIRTUAL_MACHINE * machine, uint16_t limit) {
+	int64_t remaining = (limit != 0) ? limit : INT64_MAX / 2;
+	int64_t budget;
+	uint8_t step = (limit != 0);
+	VM_STATE state;
+
+	if (!__flatMemory(machine) || (machine->mem_flags & (VM_MEMORY_FULL | VM_MEMORY_STRICT_ALIGN)) != VM_MEMORY_FULL) {
+		return vmInterpret(machine, limit);
+	}
+	machine->ext_interrupt = 0;
+	while (!(step && remaining == 0) && !__interruptPending(machine)) {
+		budget = remaining;
+		state = machine->translation->run(machine, &budget);
+		if (step) remaining = budget;
+		if (state != VM_OK) {
+			machine->retired = limit - remaining;
+			return state;
+		}
+		if ((step && remaining == 0) || __interruptPending(machine)) break;
+		state = vmInterpret(machine, 1);
+		if (state != VM_OK) {
+			machine->retired = limit - remaining + (step ? machine->retired : 0);
+			return state;
+		}
+		remaining -= step;
+	}
+	machine->retired = limit - remaining;
+	return VM_OK;
+}
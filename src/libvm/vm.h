@@ -1,10 +1,277 @@
 #ifndef __SUNBLINDCTL_VM_VM_H__
 #define __SUNBLINDCTL_VM_VM_H__
 
+#include <stddef.h>
 #include <stdint.h>
 #include <vm.h>
 
+#include "registers.h"
+
+#define MEM_OP_BYTE			1
+#define MEM_OP_WORD			0
+
 uint16_t vmDefaultMemoryRead(unsigned char * memory, uint16_t address, int half);
 void vmDefaultMemoryWrite(unsigned char * memory, uint16_t address, uint16_t data, int half);
 
+int vmPageWritten(VIRTUAL_MACHINE * machine, uint16_t address, int half);
+
+/// Najvacsi pocet instrukcii vykonanych jednym volanim jadra
+#define RUN_CHUNK			65535
+
+/// Najvacsi pocet instrukcii v slucke necinnosti
+#define IDLE_LOOP_LENGTH	8
+
+uint16_t vmIdleLoop(VIRTUAL_MACHINE * machine);
+
+/// Kapacita fronty preruseni od hostitela, musi byt mocninou 2
+#define INTERRUPT_QUEUE_SIZE	64
+
+/** Radic preruseni stroja.
+ * Fronta vektorov je obmedzeny kruhovy buffer bez zamkov: vlakna hostitela si poziciu
+ * rezervuju atomickym zvysenim tail a zapis zverejnia poradovym cislom pozicie, vybera
+ * iba vlakno, ktore stroj vykonava.
+ */
+struct InterruptController {
+	uint32_t tail;								// dalsia volna pozicia, posuvaju ju producenti
+	uint32_t head;								// dalsia pozicia na vybratie, posuva ju iba vlakno stroja
+	uint32_t sequence[INTERRUPT_QUEUE_SIZE];	// poradove cislo zapisu, resp. citania pozicie
+	uint8_t vectors[INTERRUPT_QUEUE_SIZE];
+	uint16_t table;								// adresa tabulky vektorov, 0 ak program stroja prerusenia neobsluhuje
+	uint8_t active;								// program stroja prave obsluhuje prerusenie
+};
+
+/** Stav radica preruseni ulozeny v snimke stroja. */
+struct InterruptState {
+	uint16_t table;
+	uint8_t active;
+	uint8_t count;								// pocet cakajucich preruseni
+	uint8_t vectors[INTERRUPT_QUEUE_SIZE];		// cakajuce prerusenia od najstarsieho
+};
+
+/** Zariadenie pripojene na stranku adresneho priestoru stroja. */
+struct DevicePage {
+	vmDeviceRead read;
+	vmDeviceWrite write;
+	void * device;
+	uint16_t base;								// zaciatok mapovanej oblasti, obsluhy dostavaju adresu od neho
+};
+
+/** Tabulka stranok zbernice, platne su iba polozky stranok s VM_PAGE_DEVICE. */
+struct DeviceBus {
+	struct DevicePage pages[VM_PAGE_COUNT];
+	uint32_t mapped;							// pocet stranok s pripojenym zariadenim
+};
+
+uint16_t vmBusRead(VIRTUAL_MACHINE * machine, uint16_t address, int half);
+void vmBusWrite(VIRTUAL_MACHINE * machine, uint16_t address, uint16_t data, int half);
+
+/** Udalost naplanovana na urcity cas stroja. */
+struct Event {
+	uint64_t deadline;							// hodnota machine->clock, pri ktorej sa udalost spusti
+	uint64_t sequence;							// poradie naplanovania, rozhoduje pri rovnakom case
+	vmEventHandler handler;
+	void * data;
+};
+
+/** Fronta udalosti stroja, binarna halda usporiadana podla casu udalosti. */
+struct EventQueue {
+	struct Event * heap;
+	uint32_t count;
+	uint32_t capacity;
+	uint64_t sequence;							// poradove cislo dalsej naplanovanej udalosti
+};
+
+void vmRunEvents(VIRTUAL_MACHINE * machine);
+void vmFreeEvents(VIRTUAL_MACHINE * machine);
+
+/** Nativna funkcia pripojena na adresu programu stroja. */
+struct NativeBinding {
+	uint16_t address;							// vstupny bod funkcie v programe stroja
+	uint16_t saved;								// povodne slovo na adrese, nahradene instrukciou INT
+	vmNativeRoutine routine;
+	void * data;
+};
+
+/** Nativne funkcie stroja usporiadane podla adresy. */
+struct NativeTable {
+	struct NativeBinding * bindings;
+	uint32_t count;
+	uint32_t capacity;
+};
+
+VM_STATE vmCallNative(VIRTUAL_MACHINE * machine);
+void vmFreeNatives(VIRTUAL_MACHINE * machine);
+
+VM_STATE vmCoreInterrupt(VIRTUAL_MACHINE * machine);
+
+void vmFreeMemory(VIRTUAL_MACHINE * machine);
+int vmAnonymousFile(void);
+
+/** Banky rozsirenej pamate, vybrana banka je namapovana do okna adresneho priestoru. */
+struct BankSet {
+	int fd;							// anonymny subor s obsahom vsetkych bank
+	uint8_t * store;				// obsah vsetkych bank namapovany pre hostitela
+	uint32_t count;
+	uint32_t size;					// velkost banky aj okna v bytoch
+	uint16_t window;				// adresa okna
+	uint16_t control;				// adresa riadiaceho slova s cislom vybranej banky
+	uint16_t selected;
+	uint8_t switched;				// prepnutie zneplatnilo predekodovany kod okna, vid vmPageWritten
+};
+
+void vmFreeBanks(VIRTUAL_MACHINE * machine);
+
+struct InterruptController * vmCreateInterrupts(void);
+VM_STATE vmServiceInterrupts(VIRTUAL_MACHINE * machine);
+VM_STATE vmReturnInterrupt(VIRTUAL_MACHINE * machine);
+void vmWaitInterrupt(VIRTUAL_MACHINE * machine);
+void vmSaveInterrupts(VIRTUAL_MACHINE * machine, struct InterruptState * state);
+void vmRestoreInterrupts(VIRTUAL_MACHINE * machine, const struct InterruptState * state);
+
+VM_STATE vmInterpret(VIRTUAL_MACHINE * machine, uint16_t limit);
+VM_STATE vmExecBlocks(VIRTUAL_MACHINE * machine, uint16_t limit);
+void vmInvalidateBlocks(VIRTUAL_MACHINE * machine, uint8_t page);
+void vmFreeBlocks(VIRTUAL_MACHINE * machine);
+extern const uint8_t vmProfileClass[];
+
+int vmJitAvailable(void);
+VM_STATE vmExecJit(VIRTUAL_MACHINE * machine, uint16_t limit);
+void vmJitInvalidate(VIRTUAL_MACHINE * machine);
+void vmFreeJit(VIRTUAL_MACHINE * machine);
+
+VM_STATE vmExecTranslated(VIRTUAL_MACHINE * machine, uint16_t limit);
+
+void vmRecordEnter(VIRTUAL_MACHINE * machine);
+void vmRecordLeave(VIRTUAL_MACHINE * machine, VM_STATE state);
+void vmRecordEvents(VIRTUAL_MACHINE * machine);
+void vmRecordInterrupt(VIRTUAL_MACHINE * machine, uint8_t vector);
+uint16_t vmRecordRead(VIRTUAL_MACHINE * machine, uint16_t address, int half, uint16_t data);
+VM_STATE vmReplayInputs(VIRTUAL_MACHINE * machine);
+uint64_t vmReplayNext(VIRTUAL_MACHINE * machine);
+
+/** Nacita slovo alebo byte z pamate, ktora je priamo pristupne pole.
+ * @param memory pamat virtualneho stroja
+ * @param address adresa
+ * @param half ak je 1, nacita iba jeden byte
+ * @return nacitana hodnota
+ */
+static inline uint16_t __memRead(unsigned char * memory, uint16_t address, int half) {
+	uint16_t ret = memory[address];
+	if (half == 0) ret |= (memory[address + 1] << 8);
+	return ret;
+}
+
+/** Zapise slovo alebo byte do pamate, ktora je priamo pristupne pole.
+ * @param memory pamat virtualneho stroja
+ * @param address adresa
+ * @param data zapisovana hodnota
+ * @param half ak je 1, zapise iba jeden byte
+ */
+static inline void __memWrite(unsigned char * memory, uint16_t address, uint16_t data, int half) {
+	memory[address] = data & 0xFF;
+	if (half == 0) memory[address + 1] = (data >> 8) & 0xFF;
+}
+
+/** Zisti, ci ma stroj standardne operacie pamate.
+ * Vtedy moze jadro pristupovat do pamate priamo, bez volania read_func a write_func.
+ * @param machine popisovac virtualneho stroja
+ * @return 1 ak su nastavene vmDefaultMemoryRead a vmDefaultMemoryWrite
+ */
+static inline int __flatMemory(VIRTUAL_MACHINE * machine) {
+	return machine->read_func == vmDefaultMemoryRead && machine->write_func == vmDefaultMemoryWrite;
+}
+
+/** Zisti dlzku pamate stroja v bytoch.
+ * @param machine popisovac virtualneho stroja
+ * @param tail ak je 1, v rezime VM_MEMORY_FULL sa zapocita aj byte navyse za koncom adresneho priestoru
+ * @return dlzka pamate
+ */
+static inline uint32_t __memoryLength(VIRTUAL_MACHINE * machine, int tail) {
+	return (machine->mem_flags & VM_MEMORY_FULL) ? VM_MEMORY_FULL_SIZE + (tail ? 1 : 0) : machine->mem_size;
+}
+
+/** Zisti, ci na stranke adresy je pripojene zariadenie.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @return nenulova hodnota ak pristup na adresu patri zariadeniu
+ */
+static inline uint8_t __devicePage(VIRTUAL_MACHINE * machine, uint16_t address) {
+	return machine->page_flags[address >> 8] & VM_PAGE_DEVICE;
+}
+
+/** Overi, ci adresa je spravna.
+ * Overi, ci dana adresa je v ramci limitov danych nastavenim virtualneho stroja, 
+ * najma ci nie je vacsia, ako je velkost pamate a ci sa nejedna o nezarovnany pristup k pamati.
+ * V rezime VM_MEMORY_FULL je kazda adresa v pamati a zarovnanie sa overuje iba pri
+ * VM_MEMORY_STRICT_ALIGN.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa, ktora sa overuje
+ * @return stav overovania
+ */
+static inline uint8_t __checkAddressValid(VIRTUAL_MACHINE * machine, uint16_t address) {
+	if (machine->mem_flags & VM_MEMORY_FULL) {
+		if ((machine->mem_flags & VM_MEMORY_STRICT_ALIGN) && (address & 1)) return VM_UNALIGNED_MEMORY;
+		return VM_OK;
+	}
+	if (address & 1) return VM_UNALIGNED_MEMORY;
+	else if (address >= machine->mem_size) return VM_OUT_OF_MEMORY;
+	return VM_OK;
+}
+
+/** Zisti atributy stranok, do ktorych zapisuje zapis na adresu.
+ * Nezarovnane slovo na poslednom byte stranky zapise aj prvy byte nasledujucej stranky
+ * (byte za koncom adresneho priestoru v rezime VM_MEMORY_FULL uz ziadnej stranke nepatri).
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa zapisu
+ * @param half ak je 1, zapisuje sa iba jeden byte
+ * @return zjednotenie page_flags zasiahnutych stranok
+ */
+static inline uint8_t __storeFlags(VIRTUAL_MACHINE * machine, uint16_t address, int half) {
+	uint8_t flags = machine->page_flags[address >> 8];
+	if (!half && (address & 0xFF) == 0xFF && address != 0xFFFF) flags |= machine->page_flags[(address >> 8) + 1];
+	return flags;
+}
+
+/** Overi, ci sa na adresu smie zapisovat.
+ * @param machine popisovac virtualneho stroja
+ * @param address adresa
+ * @param half ak je 1, zapisuje sa iba jeden byte
+ * @return VM_OK, alebo VM_WRITE_PROTECTED ak je niektora zasiahnuta stranka chranena proti zapisu
+ */
+static inline uint8_t __checkWritable(VIRTUAL_MACHINE * machine, uint16_t address, int half) {
+	return (__storeFlags(machine, address, half) & VM_PAGE_READONLY) ? VM_WRITE_PROTECTED : VM_OK;
+}
+
+/** Zisti, ci na stroj caka prerusenie od hostitela.
+ * Jadra to kontroluju v hlavnej slucke; priznak nastavuje ine vlakno, preto sa musi
+ * zakazdym znova nacitat z pamate.
+ * @param machine popisovac virtualneho stroja
+ * @return nenulova hodnota ak ma jadro skoncit a prerusenie obsluzit
+ */
+static inline uint8_t __interruptPending(VIRTUAL_MACHINE * machine) {
+	return __atomic_load_n(&machine->interrupt_pending, __ATOMIC_RELAXED);
+}
+
+/** Zisti cas najblizsej naplanovanej udalosti.
+ * @param machine popisovac virtualneho stroja
+ * @return hodnota machine->clock, pri ktorej sa ma spustit najblizsia udalost, UINT64_MAX
+ * ak ziadna nie je naplanovana
+ */
+static inline uint64_t __nextEvent(VIRTUAL_MACHINE * machine) {
+	if (machine->events == NULL || machine->events->count == 0) return UINT64_MAX;
+	return machine->events->heap[0].deadline;
+}
+
+/** Vypocita priznaky vysledku aritmetickej operacie.
+ * @param result vysledok operacie v plnej presnosti (pred orezanim na 16 bitov)
+ * @return priznaky ZERO, SIGN a OVERFLOW zodpovedajuce vysledku
+ */
+static inline uint8_t __aluFlags(signed long result) {
+	uint8_t flags = 0;
+	if (result >= 1 << 16 || result <= -(1 << 16)) flags |= OVERFLOW_FLAG;
+	if (result < 0) flags |= SIGN_FLAG;
+	if (result == 0) flags |= ZERO_FLAG;
+	return flags;
+}
+
 #endif
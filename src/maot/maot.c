@@ -0,0 +1,475 @@
+/* Ahead-of-time translator for C Minimalistic RISC machine
+ * Translates linked binary into C source, which runs the program natively on top of libvm
+ */
+
+#include <cmdline.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vm.h>
+#include <object.h>
+#include <bits.h>
+#include <instruction.h>
+
+#include "registers.h"
+#include "decode.h"
+
+/// Velkost pamate, do ktorej sa nacita obraz
+#define MEMORY_SIZE		(VM_MEMORY_FULL_SIZE + 1)
+
+/// Pocet slov adresneho priestoru stroja
+#define WORD_COUNT		(VM_MEMORY_FULL_SIZE / 2)
+
+long cmdline_verbose = 0;
+long cmdline_help = 0;
+char * cmdline_outfile = NULL;
+char * cmdline_name = "maot_program";
+char * cmdline_infile = NULL;
+
+struct cmdline_opts options[] = {
+	{ "-o", "--output", "out_file", "Write translated program to this C source file.", (void *) &cmdline_outfile, ARG_STR, MANDATORY, 0, NON_POSITIONAL },
+	{ "-n", "--name", "identifier", "Name of the exported translation [default maot_program].", (void *) &cmdline_name, ARG_STR, OPTIONAL, 0, NON_POSITIONAL },
+	{ "-v", "--verbose", NULL, "Write statistics of recovered control flow graph.", (void *) &cmdline_verbose, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL },
+	{ "-h", "--help", NULL, "Show this help", (void *) &cmdline_help, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ NULL, NULL, "bin_file", "Linked image, plain (ml) or debuggable (ml -d).", &cmdline_infile, ARG_STR, MANDATORY, 0, 1},
+};
+
+struct cmdline_args commandline = { options, 5 };
+
+static uint8_t memory[MEMORY_SIZE];
+static uint32_t image_length = 0;
+static ADDRESS entrypoint = 0;
+static SECTION * binary_section = NULL;
+
+static uint8_t leader[WORD_COUNT];			// na adrese zacina blok
+static uint8_t decoded[WORD_COUNT];			// instrukcia na adrese uz bola dekodovana
+static ADDRESS worklist[WORD_COUNT];
+static unsigned worklist_length = 0;
+
+/** Nacita slovo instrukcie z obrazu. */
+static uint16_t fetch(uint32_t address) {
+	return memory[address] | (memory[address + 1] << 8);
+}
+
+/** Zisti cielovu adresu priameho skoku (BRANCH, BRANCHL) na adrese.
+ * @param address adresa instrukcie skoku
+ * @return cielova adresa
+ */
+static ADDRESS branch_target(ADDRESS address) {
+	uint16_t instr = fetch(address);
+	ADDRESS next = address + 2;
+	return (instr & BIT11) ? next - (instr & 0x07FE) : next + (instr & 0x07FE);
+}
+
+/** Zisti, ci instrukcia moze zapisat do registra PC.
+ * Taka instrukcia (napr. MOV PC, LR) je nepriamy skok, ktoreho ciel sa pozna az za behu.
+ * @param d dekodovana instrukcia
+ * @return 1 ak instrukcia zapisuje do PC
+ */
+static int writes_pc(const DECODED_INSTRUCTION * d) {
+	switch (d->handler) {
+		case VMOP_LOAD: case VMOP_LOAD_BYTE:
+			return d->arg2 == 15;
+		case VMOP_LOAD_PREDEC: case VMOP_LOAD_POSTINC:
+			return d->arg1 == 15 || d->arg2 == 15;
+		case VMOP_STORE_PREDEC: case VMOP_STORE_POSTINC:
+		case VMOP_SHL: case VMOP_SHR:
+		case VMOP_ADDC: case VMOP_SUBC: case VMOP_ADDCS: case VMOP_SUBCS:
+		case VMOP_MOV:
+			return d->arg1 == 15;
+		case VMOP_NOT:
+			return d->arg2 == 15;
+		case VMOP_SWAP:
+			return d->arg1 == 15 || d->arg2 == 15;
+	}
+	return d->handler >= VMOP_ADD && d->handler <= VMOP_XORS && d->arg1 == 15;
+}
+
+/** Zisti, ci instrukcia cita register PC (ako operand, nie pri nacitani instrukcie). */
+static int reads_pc(const DECODED_INSTRUCTION * d) {
+	switch (d->handler) {
+		case VMOP_ILLEGAL: case VMOP_BRANCH: case VMOP_BRANCHL: case VMOP_ILOAD:
+		case VMOP_FLINVERT: case VMOP_INT:
+			return 0;
+		case VMOP_SHL: case VMOP_SHR:
+		case VMOP_ADDC: case VMOP_SUBC: case VMOP_ADDCS: case VMOP_SUBCS:
+			return d->arg1 == 15;
+	}
+	return d->arg1 == 15 || d->arg2 == 15;
+}
+
+/** Zisti, ci instrukcia konci blok: po nej nemusi nasledovat instrukcia na dalsej adrese. */
+static int ends_block(const DECODED_INSTRUCTION * d) {
+	return d->handler == VMOP_ILLEGAL || d->handler == VMOP_BRANCH || d->handler == VMOP_BRANCHL ||
+		d->handler == VMOP_INT || writes_pc(d);
+}
+
+/** Oznaci adresu ako zaciatok bloku a zaradi ju na dekodovanie.
+ * Neparne adresy a adresy mimo obrazu sa neprekladaju, vykona ich interpret.
+ * @param address adresa
+ */
+static void add_leader(uint32_t address) {
+	if ((address & 1) || address + 2 > image_length || leader[address >> 1]) return;
+	leader[address >> 1] = 1;
+	worklist[worklist_length++] = address;
+}
+
+/** Zisti, ci blok po instrukcii na adrese pokracuje dalsou instrukciou.
+ * @param address adresa instrukcie
+ * @return 1 ak je dalsia instrukcia v obraze, na tej istej stranke a nezacina novy blok
+ */
+static int continues(uint32_t address) {
+	uint32_t next = address + 2;
+	return next + 2 <= image_length && (next >> 8) == (address >> 8) && !leader[next >> 1];
+}
+
+/** Obnovi graf toku riadenia programu.
+ * Zaciatky blokov su vstupny bod, symboly obrazu, ciele priamych skokov a adresy za kazdym
+ * skokom, zapisom do PC a INT (navratove adresy volani, zaciatky dalsich funkcii). Nepriamy
+ * skok (zapis do PC) pokracuje prelozenym kodom iba na zaciatku bloku, ktory prekladac pozna,
+ * inac ciel vykona interpret.
+ * Blok konci skokom, zapisom do PC, INT, neplatnou instrukciou, koncom stranky alebo zaciatkom
+ * dalsieho bloku.
+ */
+static void recover_blocks(void) {
+	uint32_t address;
+	unsigned q;
+
+	add_leader(entrypoint);
+	if (binary_section != NULL) {
+		for (q = 0; q < binary_section->symbol_count; q++) {
+			if (strncmp(binary_section->symbols[q].name, "@@", 2) == 0) continue;
+			add_leader(binary_section->symbols[q].address);
+		}
+	}
+	while (worklist_length > 0) {
+		address = worklist[--worklist_length];
+		while (!decoded[address >> 1]) {
+			const DECODED_INSTRUCTION * d = &vmDecodeTable[fetch(address)];
+			decoded[address >> 1] = 1;
+			if (d->handler == VMOP_BRANCH || d->handler == VMOP_BRANCHL) add_leader(branch_target(address));
+			if (ends_block(d)) {
+				if (d->handler != VMOP_ILLEGAL || d->cond) add_leader(address + 2);
+				break;
+			}
+			if (address + 4 > image_length) break;
+			if (((address + 2) >> 8) != (address >> 8)) {
+				add_leader(address + 2);
+				break;
+			}
+			address += 2;
+		}
+	}
+}
+
+/** Vypise nazov symbolu na adrese ako komentar. */
+static void emit_symbols(FILE * out, ADDRESS address) {
+	unsigned q;
+	if (binary_section == NULL) return;
+	for (q = 0; q < binary_section->symbol_count; q++) {
+		if (binary_section->symbols[q].address == address && strncmp(binary_section->symbols[q].name, "@@", 2) != 0) {
+			fprintf(out, "/* %s */\n", binary_section->symbols[q].name);
+		}
+	}
+}
+
+/** Vypise skok na adresu: na blok, ak ho prekladac pozna, inac navrat do interpretu.
+ * @param out vystupny subor
+ * @param target cielova adresa
+ * @param back pocet nevykonanych instrukcii bloku, ktore sa vratia do rozpoctu
+ */
+static void emit_jump(FILE * out, ADDRESS target, unsigned back) {
+	if (back == 0 && !(target & 1) && leader[target >> 1]) fprintf(out, "\tgoto b_%04X;\n", target);
+	else fprintf(out, "\tEXIT(0x%04X, %u);\n", target, back);
+}
+
+/** Vypise telo jednej instrukcie.
+ * @param out vystupny subor
+ * @param address adresa instrukcie
+ * @param back pocet instrukcii bloku za touto instrukciou
+ */
+static void emit_instruction(FILE * out, ADDRESS address, unsigned back) {
+	uint16_t instr = fetch(address);
+	const DECODED_INSTRUCTION * d = &vmDecodeTable[instr];
+	ADDRESS next = address + 2;
+	unsigned a = d->arg1, b = d->arg2;
+	const char * op = NULL;
+
+	fprintf(out, "\t/* %04X: %04X */\n", address, instr);
+	if (reads_pc(d)) fprintf(out, "\tr15 = 0x%04X;\n", next);
+	if (d->cond) fprintf(out, "\tSYNC(); if (flags & 0x%02X) {\n", d->cond);
+	switch (d->handler) {
+		case VMOP_ILLEGAL:
+			fprintf(out, "\tmachine->fault_address = 0x%04X; state = VM_ILLEGAL_OPCODE; EXIT(0x%04X, %u);\n", address, next, back + 1);
+			break;
+		case VMOP_BRANCHL:
+			fprintf(out, "\tr14 = 0x%04X;\n", next);
+			/* fall through */
+		case VMOP_BRANCH:
+			emit_jump(out, branch_target(address), back);
+			break;
+		case VMOP_LOAD_PREDEC:
+			fprintf(out, "\tr%u -= 2;\n", a);
+			/* fall through */
+		case VMOP_LOAD:
+			fprintf(out, "\tr%u = LOAD(r%u, 0);\n", b, a);
+			break;
+		case VMOP_LOAD_POSTINC:
+			fprintf(out, "\tr%u = LOAD(r%u, 0);\n\tr%u += 2;\n", b, a, a);
+			break;
+		case VMOP_LOAD_BYTE:
+			fprintf(out, "\tr%u = LOAD(r%u, 1);\n", b, a);
+			break;
+		case VMOP_STORE_PREDEC:
+			fprintf(out, "\tr%u -= 2;\n", a);
+			/* fall through */
+		case VMOP_STORE:
+			fprintf(out, "\tSTORE(r%u, r%u, 0, 0x%04X, %u);\n", a, b, next, back + 1);
+			break;
+		case VMOP_STORE_POSTINC:
+			fprintf(out, "\tSTORE(r%u, r%u, 0, 0x%04X, %u);\n\tr%u += 2;\n", a, b, next, back + 1, a);
+			break;
+		case VMOP_STORE_BYTE:
+			fprintf(out, "\tSTORE(r%u, r%u, 1, 0x%04X, %u);\n", a, b, next, back + 1);
+			break;
+		case VMOP_ILOAD:
+			fprintf(out, "\tr%u = (r%u << 8) | 0x%02X;\n", a, a, b);
+			break;
+		case VMOP_ADD: op = "+="; goto alu;
+		case VMOP_SUB: op = "-="; goto alu;
+		case VMOP_DIV: op = "/="; goto alu;
+		case VMOP_MOD: op = "%="; goto alu;
+		case VMOP_AND: op = "&="; goto alu;
+		case VMOP_OR: op = "|="; goto alu;
+		case VMOP_XOR: op = "^=";
+		alu:
+			fprintf(out, "\tr%u %s r%u; CLEAR();\n", a, op, b);
+			break;
+		case VMOP_MUL:
+			fprintf(out, "\tr%u = (uint32_t) r%u * r%u; CLEAR();\n", a, a, b);
+			break;
+		case VMOP_ADDS: op = "+"; goto alu_flags;
+		case VMOP_SUBS: op = "-"; goto alu_flags;
+		case VMOP_MULS: op = "*"; goto alu_flags;
+		case VMOP_DIVS: op = "/"; goto alu_flags;
+		case VMOP_MODS: op = "%"; goto alu_flags;
+		case VMOP_ANDS: op = "&"; goto alu_flags;
+		case VMOP_ORS: op = "|"; goto alu_flags;
+		case VMOP_XORS: op = "^";
+		alu_flags:
+			fprintf(out, "\tresult = (signed long) r%u %s r%u; lazy = 1; r%u = result & 0xFFFF;\n", a, op, b, a);
+			break;
+		case VMOP_SHL:
+			fprintf(out, "\tr%u <<= %u;\n", a, b);
+			break;
+		case VMOP_SHR:
+			fprintf(out, "\tr%u >>= %u;\n", a, b);
+			break;
+		case VMOP_NOT:
+			fprintf(out, "\tr%u = ~r%u;\n", b, b);
+			break;
+		case VMOP_FLINVERT:
+			fprintf(out, "\tSYNC(); flags ^= (uint8_t) ~(%u << 4);\n", b);
+			break;
+		case VMOP_ADDC:
+			fprintf(out, "\tr%u += %u;\n", a, b);
+			break;
+		case VMOP_SUBC:
+			fprintf(out, "\tr%u -= %u;\n", a, b);
+			break;
+		case VMOP_ADDCS:
+			fprintf(out, "\tr%u += %u; result = r%u; lazy = 1;\n", a, b, a);
+			break;
+		case VMOP_SUBCS:
+			fprintf(out, "\tr%u -= %u; result = r%u; lazy = 1;\n", a, b, a);
+			break;
+		case VMOP_MOV:
+			fprintf(out, "\tr%u = r%u;\n", a, b);
+			break;
+		case VMOP_SWAP:
+			fprintf(out, "\tswap = r%u; r%u = r%u; r%u = swap;\n", a, a, b, b);
+			break;
+		case VMOP_INT:
+			fprintf(out, "\tmachine->ext_interrupt = 0x%02X; state = VM_SOFTINT; EXIT(0x%04X, %u);\n", GET_IMMEDIATE(instr), next, back);
+			break;
+	}
+	if (writes_pc(d)) fprintf(out, "\tpc = r15; goto dispatch;\n");
+	else if (d->handler >= VMOP_STORE && d->handler <= VMOP_STORE_BYTE) {
+		fprintf(out, "\tCHECK(0x%02X, 0x%04X, %u);\n", address >> 8, next, back);
+	}
+	if (d->cond) fprintf(out, "\t}\n");
+}
+
+/** Vypise jeden blok programu.
+ * @param out vystupny subor
+ * @param address adresa zaciatku bloku
+ * @return pocet instrukcii bloku
+ */
+static unsigned emit_block(FILE * out, ADDRESS address) {
+	unsigned length = 1, q;
+	uint32_t last = address;
+	const DECODED_INSTRUCTION * d;
+
+	while (!ends_block(&vmDecodeTable[fetch(last)]) && continues(last)) {
+		last += 2;
+		length++;
+	}
+	fprintf(out, "\n");
+	emit_symbols(out, address);
+	fprintf(out, "b_%04X:\n\tENTER(0x%04X, %u, 0x%02X);\n", address, address, length, address >> 8);
+	for (q = 0; q < length; q++) emit_instruction(out, address + 2 * q, length - q - 1);
+	d = &vmDecodeTable[fetch(last)];
+	if ((d->handler == VMOP_BRANCH || d->handler == VMOP_BRANCHL || writes_pc(d)) && !d->cond) return length;
+	if (d->handler == VMOP_ILLEGAL && !d->cond) return length;
+	if (d->handler == VMOP_INT) return length;
+	emit_jump(out, last + 2, 0);
+	return length;
+}
+
+/** Vypise prelozeny program ako zdrojovy subor C.
+ * Kazdy blok je usek kodu s navestim, priame skoky su skoky na navestie, nepriame skoky
+ * a navrat z interpretu idu cez switch podla PC. Registre stroja su lokalne premenne,
+ * priznaky sa pocitaju odlozene ako v interprete.
+ * @param out vystupny subor
+ * @return pocet prelozenych blokov
+ */
+static unsigned emit_program(FILE * out) {
+	uint8_t pages[VM_PAGE_COUNT];
+	unsigned blocks = 0, instructions = 0;
+	uint32_t address;
+	unsigned q;
+
+	memset(pages, 0, sizeof(pages));
+	fprintf(out, "/* Translated from %s by maot, do not edit. */\n\n", cmdline_infile);
+	fprintf(out, "#include <stdint.h>\n#include <vm.h>\n\n");
+	fprintf(out, "static const uint8_t image[%u] = {", image_length);
+	for (address = 0; address < image_length; address++) {
+		fprintf(out, "%s0x%02X,", (address % 16 == 0) ? "\n\t" : " ", memory[address]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out,
+		"#define ALU_FLAGS(_r) ((((_r) >= (1L << 16) || (_r) <= -(1L << 16)) ? 0x%02X : 0) | "
+		"(((_r) < 0) ? 0x%02X : 0) | (((_r) == 0) ? 0x%02X : 0))\n",
+		OVERFLOW_FLAG, SIGN_FLAG, ZERO_FLAG);
+	fprintf(out,
+		"#define SYNC() do { if (lazy) { flags = ALU_FLAGS(result); lazy = 0; } } while (0)\n"
+		"#define CLEAR() do { flags = 0; lazy = 0; } while (0)\n"
+		"#define EXIT(_pc, _back) do { pc = (_pc); left += (_back); goto leave; } while (0)\n"
+		"#define ENTER(_pc, _n, _page) \\\n"
+		"\tif (left < (_n) || !(machine->page_flags[_page] & VM_PAGE_TRANSLATED) || \\\n"
+		"\t\t\t__atomic_load_n(&machine->interrupt_pending, __ATOMIC_RELAXED)) EXIT((_pc), 0); \\\n"
+		"\tleft -= (_n)\n"
+		"#define LOAD(_a, _half) ((machine->page_flags[(_a) >> 8] & VM_PAGE_DEVICE) ? readMemoryVirtualMachine(machine, (_a), (_half)) : \\\n"
+		"\t(_half) ? memory[_a] : (uint16_t) (memory[_a] | (memory[(_a) + 1] << 8)))\n"
+		"#define STORE(_a, _d, _half, _pc, _back) \\\n"
+		"\tdo { \\\n"
+		"\t\tuint16_t __a = (_a); \\\n"
+		"\t\twritten = machine->page_flags[__a >> 8]; \\\n"
+		"\t\tif (!(_half) && (__a & 0xFF) == 0xFF && __a != 0xFFFF) written |= machine->page_flags[(__a >> 8) + 1]; \\\n"
+		"\t\tif (written != 0) { \\\n"
+		"\t\t\tif ((state = writeMemoryVirtualMachine(machine, __a, (_d), (_half))) != VM_OK) EXIT((_pc), (_back)); \\\n"
+		"\t\t} else { \\\n"
+		"\t\t\tmemory[__a] = (_d); \\\n"
+		"\t\t\tif (!(_half)) memory[__a + 1] = (_d) >> 8; \\\n"
+		"\t\t} \\\n"
+		"\t} while (0)\n"
+		"#define CHECK(_page, _pc, _back) \\\n"
+		"\tif (written && !(machine->page_flags[_page] & VM_PAGE_TRANSLATED)) EXIT((_pc), (_back))\n\n");
+
+	fprintf(out, "static VM_STATE run(VIRTUAL_MACHINE * machine, int64_t * budget) {\n");
+	fprintf(out, "\tuint8_t * memory = (uint8_t *) machine->memory;\n");
+	fprintf(out, "\tuint16_t r0, r1, r2, r3, r4, r5, r6, r7, r8, r9, r10, r11, r12, r13, r14, r15, swap, pc;\n");
+	fprintf(out, "\tuint8_t flags = machine->flags, lazy = 0, written = 0;\n");
+	fprintf(out, "\tsigned long result = 0;\n\tint64_t left = *budget;\n\tVM_STATE state = VM_OK;\n\n");
+	for (q = 0; q < 15; q++) fprintf(out, "\tr%u = machine->registers[%u];\n", q, q);
+	fprintf(out, "\tr15 = pc = machine->registers[15];\n\t(void) r15; (void) swap; (void) written; (void) memory;\n\n");
+	/* bez neprimych skokov sa na navestie nikto nevracia */
+	fprintf(out, "dispatch: __attribute__((unused));\n\tswitch (pc) {\n");
+	for (address = 0; address < image_length; address += 2) {
+		if (leader[address >> 1]) fprintf(out, "\t\tcase 0x%04X: goto b_%04X;\n", address, address);
+	}
+	fprintf(out, "\t}\n\tgoto leave;\n");
+
+	for (address = 0; address < image_length; address += 2) {
+		if (!leader[address >> 1]) continue;
+		instructions += emit_block(out, address);
+		pages[address >> 8] = 1;
+		blocks++;
+	}
+
+	fprintf(out, "\nleave:\n");
+	for (q = 0; q < 15; q++) fprintf(out, "\tmachine->registers[%u] = r%u;\n", q, q);
+	fprintf(out, "\tmachine->registers[15] = pc;\n");
+	fprintf(out, "\tmachine->flags = lazy ? ALU_FLAGS(result) : flags;\n");
+	fprintf(out, "\t*budget = left;\n\treturn state;\n}\n\n");
+
+	fprintf(out, "const VM_TRANSLATION %s = {\n\trun, image, %u, 0x%04X,\n\t{", cmdline_name, image_length, entrypoint);
+	for (q = 0; q < VM_PAGE_COUNT; q++) fprintf(out, "%s%u,", (q % 32 == 0) ? "\n\t\t" : " ", pages[q]);
+	fprintf(out, "\n\t}\n};\n");
+
+	if (cmdline_verbose) {
+		printf("%u blocks, %u instructions, average block length %.2f\n", blocks, instructions,
+			blocks ? (double) instructions / blocks : 0.0);
+	}
+	return blocks;
+}
+
+int main(int argc, char ** argv) {
+	FILE * out;
+	unsigned offset, length;
+	ADDRESS ignored;
+	int rc;
+	int cmdline_retval = process_commandline(argc, argv, &commandline);
+	if (cmdline_help) { print_help(&commandline, argv[0]); return 0; }
+	if (cmdline_retval != 0) return cmdline_retval;
+
+	rc = binary_locate(cmdline_infile, &entrypoint, &offset, &length);
+	if (rc == 0) {
+		if (binary_read(cmdline_infile, memory, &ignored, VM_MEMORY_FULL_SIZE) != 0) exit(1);
+		image_length = length;
+	} else if (rc == -1) {
+		OBJECT * binary_object;
+		/* object_load nad surovym suborom nemusi skoncit, preto najprv overime, ze ide o objekt s obrazom */
+		if (object_locate_section(cmdline_infile, ".binary", &offset, &length) != 0) {
+			fprintf(stderr, "Input is neither a virtual memory image nor a debuggable binary.\n");
+			exit(1);
+		}
+		binary_object = object_load(cmdline_infile);
+		if (binary_object == NULL) {
+			fprintf(stderr, "Unable to load virtual memory image nor as plain binary nor as debuggable binary.\n");
+			exit(1);
+		}
+		binary_section = object_get_section_by_name(binary_object, ".binary");
+		if (binary_section == NULL) {
+			fprintf(stderr, "Invalid virtual memory image. Cannot find image section.\n");
+			exit(1);
+		}
+		if (section_data_copy(binary_section, memory, VM_MEMORY_FULL_SIZE) != 0) {
+			fprintf(stderr, "Virtual memory image is too big to fit into memory.");
+			exit(1);
+		}
+		image_length = binary_section->size;
+		entrypoint = symbol_get_address(binary_section, "@@entrypoint");
+		if (entrypoint == 0xFFFF) {
+			fprintf(stderr, "Unable to find image entrypoint!\n");
+			exit(1);
+		}
+	} else {
+		exit(1);
+	}
+
+	vmInitDecodeTable();
+	recover_blocks();
+
+	out = fopen(cmdline_outfile, "w");
+	if (out == NULL) {
+		fprintf(stderr, "error: Unable to open output file '%s'\n", cmdline_outfile);
+		exit(1);
+	}
+	if (emit_program(out) == 0) {
+		fprintf(stderr, "warning: No code was found in the image, the program will be interpreted.\n");
+	}
+	fclose(out);
+	return 0;
+}
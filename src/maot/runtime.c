@@ -0,0 +1,92 @@
+/* Runtime of programs translated by maot
+ * Provides main() which runs the translated program in libvm machine
+ */
+
+#include <cmdline.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <vm.h>
+
+/// Prelozeny program, vytvara ho maot vo vystupnom zdrojovom subore
+extern const VM_TRANSLATION maot_program;
+
+long cmdline_steps = 0;
+long cmdline_dump = 0;
+long cmdline_interpret = 0;
+long cmdline_help = 0;
+
+struct cmdline_opts options[] = {
+	{ "-s", "--steps", "N", "Execute at most N instructions. If N is 0, run until error or interrupt.", (void *) &cmdline_steps, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-d", "--dump-registers", NULL, "Print registers and flags when the program stops.", (void *) &cmdline_dump, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-I", "--interpret", NULL, "Ignore translated code and interpret the program.", (void *) &cmdline_interpret, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-h", "--help", NULL, "Show this help", (void *) &cmdline_help, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+};
+
+struct cmdline_args commandline = { options, 4 };
+
+static VIRTUAL_MACHINE * mach;
+
+void sigint_handler(int sig) {
+	(void) sig;
+	postInterruptVirtualMachine(mach, 1);
+}
+
+/** Vypise dovod zastavenia stroja.
+ * @param stop popis zastavenia
+ */
+void print_stop(const VM_STOP * stop) {
+	switch (stop->reason) {
+		case VM_STOP_BUDGET:
+			printf("Instruction limit reached");
+			break;
+		case VM_STOP_SOFTINT:
+			printf("Interrupt %u", stop->vector);
+			break;
+		case VM_STOP_INTERRUPT:
+			printf("Interrupted");
+			break;
+		case VM_STOP_FAULT:
+			switch (stop->state) {
+				case VM_ILLEGAL_OPCODE: printf("Illegal instruction"); break;
+				case VM_WRITE_PROTECTED: printf("Write to protected memory"); break;
+				default: printf("Fault %u", stop->state); break;
+			}
+			printf(" at 0x%04X", stop->fault_address);
+			break;
+		default:
+			printf("Stopped");
+			break;
+	}
+	printf(" after %llu instructions, PC 0x%04X\n", (unsigned long long) stop->retired, stop->pc);
+}
+
+int main(int argc, char ** argv) {
+	VM_STOP stop;
+	unsigned q;
+	int cmdline_retval = process_commandline(argc, argv, &commandline);
+	if (cmdline_help) { print_help(&commandline, argv[0]); return 0; }
+	if (cmdline_retval != 0) return cmdline_retval;
+
+	mach = createVirtualMachine(NULL, 0, maot_program.entrypoint);
+	if (mach == NULL) {
+		fprintf(stderr, "error: Unable to allocate device memory\n");
+		exit(1);
+	}
+	memcpy(mach->memory, maot_program.image, maot_program.length);
+	if (!cmdline_interpret && attachTranslationVirtualMachine(mach, &maot_program) < 0) {
+		fprintf(stderr, "warning: Translated code cannot be used, the program will be interpreted.\n");
+	}
+
+	signal(SIGINT, sigint_handler);
+	resumeVirtualMachine(mach, cmdline_steps, &stop);
+	print_stop(&stop);
+
+	if (cmdline_dump) {
+		for (q = 0; q < 16; q++) printf("R%u = 0x%04X%s", q, mach->registers[q], (q % 4 == 3) ? "\n" : "\t");
+		printf("FLAGS = 0x%02X\n", mach->flags);
+	}
+	destroyVirtualMachine(mach);
+	return (stop.reason == VM_STOP_FAULT) ? 1 : 0;
+}
@@ -6,29 +6,41 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <vm.h>
 #include <object.h>
 #include <disasm.h>
 #include <signal.h>
+#include <sys/stat.h>
 
 char * cmdline_remote_id = NULL;
 char * cmdline_infile = NULL;
 long cmdline_help = 0;
-long cmdline_memsize = 65535;
+long cmdline_memsize = VM_MEMORY_FULL_SIZE;
+long cmdline_strict_align = 0;
 char * cmdline_dump_text_file = NULL;
 char * cmdline_dump_data_file = NULL;
+char * cmdline_profile = NULL;
+char * cmdline_profile_csv = NULL;
+long cmdline_native = 0;
+long cmdline_bank_control = -1;
 
 VIRTUAL_MACHINE * mach = NULL;
 
 struct cmdline_opts options[] = {
 	{ "-r", "--remote", "id", "Remotely connect to controller with name.", (void *) &cmdline_remote_id, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
-	{ "-m", "--memsize", "size", "Set size of device memory (0-65535) [default 65535].", (void *) &cmdline_memsize, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-m", "--memsize", "size", "Set size of device memory (0-65536) [default 65536, full address space].", (void *) &cmdline_memsize, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-a", "--strict-align", NULL, "Fail on unaligned memory accesses.", (void *) &cmdline_strict_align, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-p", "--profile", "FILE", "Count executed instructions and write binary profile to FILE on quit.", (void *) &cmdline_profile, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-P", "--profile-csv", "FILE", "Count executed instructions and write profile as CSV to FILE on quit.", (void *) &cmdline_profile_csv, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-n", "--native", NULL, "Run library functions of debuggable binary (memcpy, strlen, ...) natively.", (void *) &cmdline_native, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-k", "--bank-control", "address", "Load banks of extended memory linked by ml -B (bin_file.bank0, ...), bank is selected by word at address.", (void *) &cmdline_bank_control, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
 	{ "-h", "--help", NULL, "Show this help", (void *) &cmdline_help, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
 	{ NULL, NULL, "bin_file", "Virtual memory image file.", &cmdline_infile, ARG_STR, MANDATORY, 0, 1},
 };
 
-struct cmdline_args commandline = { options, 4 };
+struct cmdline_args commandline = { options, 9 };
 
 enum p_type { T_NONE, T_NUM, T_STR };
 
@@ -37,7 +49,7 @@ struct dbg_command {
 	enum p_type par_type[10];
 };
 
-enum cmd_ids { CMD_RUN, CMD_STEP, CMD_QUIT, CMD_DUMP_REGS, CMD_DISASSEBMLE, CMD_SET_REG, CMD_SET_MEM, CMD_DUMP_MEM, CMD_HELP, CMD_COMPUTER, CMD_HUMAN, CMD_AUTOSTAT };
+enum cmd_ids { CMD_RUN, CMD_STEP, CMD_QUIT, CMD_DUMP_REGS, CMD_DISASSEBMLE, CMD_SET_REG, CMD_SET_MEM, CMD_DUMP_MEM, CMD_HELP, CMD_COMPUTER, CMD_HUMAN, CMD_AUTOSTAT, CMD_BANK, CMD_BREAK, CMD_REVERSE_STEP, CMD_REVERSE_CONTINUE, CMD_REVERSE_WRITE };
 
 struct dbg_command commands[] = {
 	{ "run", { T_NONE }},
@@ -51,7 +63,12 @@ struct dbg_command commands[] = {
 	{ "help", { T_STR }},
 	{ "computer", { T_NONE }},
 	{ "human", { T_NONE }},
-	{ "auto-stat", { T_NONE }}
+	{ "auto-stat", { T_NONE }},
+	{ "bank", { T_NUM }},
+	{ "break", { T_NUM }},
+	{ "reverse-step", { T_NUM }},
+	{ "reverse-continue", { T_NONE }},
+	{ "reverse-write", { T_NUM }}
 };
 
 #define DBG_CMD_COUNT (sizeof(commands) / sizeof(struct dbg_command))
@@ -113,30 +130,430 @@ void free_command(struct dbg_runtime_command * command) {
 	return;
 }
 
+/** Pripoji zabudovane nativne implementacie libvm na funkcie ladiaceho obrazu.
+ * @param section sekcia obrazu so symbolmi
+ * @return pocet pripojenych funkcii
+ */
+int bind_natives(SECTION * section) {
+	vmNativeRoutine routine;
+	int q, bound = 0;
+	for (q = 0; q < section->symbol_count; q++) {
+		routine = findNativeVirtualMachine(section->symbols[q].name);
+		if (routine == NULL) continue;
+		if (bindNativeVirtualMachine(mach, section->symbols[q].address, routine, NULL) == 0) bound++;
+	}
+	return bound;
+}
+
+/** Nacita banky rozsirenej pamate zo suborov bin_file.bank0, bin_file.bank1, ... (ml -B).
+ * Okno je adresa, na ktoru su banky linkovane (vstupny bod obrazu banky), jeho velkost je
+ * velkost obrazu banky.
+ * @param image nazov obrazu programu
+ * @param control adresa riadiaceho slova
+ * @return pocet nacitanych bank, -1 ak ziadna banka nie je alebo sa banky nepodarilo pripojit
+ */
+int load_banks(const char * image, uint16_t control) {
+	char filename[1024];
+	struct stat bank_stat;
+	unsigned char * bank;
+	ADDRESS window;
+	uint32_t count, size = 0, q;
+	for (count = 0; count < VM_BANK_COUNT; count++) {
+		snprintf(filename, sizeof(filename), "%s.bank%u", image, count);
+		if (stat(filename, &bank_stat) != 0) break;
+		if (count == 0) size = bank_stat.st_size - 5;
+		else if (bank_stat.st_size - 5 != size) return -1;
+	}
+	if (count == 0 || size == 0) return -1;
+	if ((bank = malloc(size)) == NULL) return -1;
+	snprintf(filename, sizeof(filename), "%s.bank0", image);
+	if (binary_read(filename, bank, &window, size) != 0 || attachBanksVirtualMachine(mach, window, size, count, control) != 0) {
+		free(bank);
+		return -1;
+	}
+	free(bank);
+	for (q = 0; q < count; q++) {
+		snprintf(filename, sizeof(filename), "%s.bank%u", image, q);
+		if (binary_read(filename, getBankMemoryVirtualMachine(mach, q), &window, size) != 0) return -1;
+	}
+	return count;
+}
+
+/** Namapuje obraz programu zo suboru priamo ako pamat stroja, bez kopirovania.
+ * Z ladiaceho binarneho suboru (ml -d) sa namapuju data sekcie .binary a nacitaju jej symboly.
+ * @param filename nazov obrazu programu
+ * @param entrypoint miesto pre vstupny bod programu
+ * @param binary_section miesto pre sekciu ladiaceho binarneho suboru, plain binary ju nema
+ * @return stroj s celym adresnym priestorom, NULL ak sa obraz nepodarilo namapovat
+ */
+VIRTUAL_MACHINE * map_image(const char * filename, ADDRESS * entrypoint, SECTION ** binary_section) {
+	VIRTUAL_MACHINE * machine;
+	OBJECT * object;
+	SECTION * section;
+	unsigned offset, length;
+	if (binary_locate(filename, entrypoint, &offset, &length) == 0) {
+		if (length > VM_MEMORY_FULL_SIZE) return NULL;
+		return createFromFileVirtualMachine(filename, offset, length, *entrypoint);
+	}
+	if (object_locate_section(filename, ".binary", &offset, &length) != 0 || (object = object_load(filename)) == NULL) return NULL;
+	section = object_get_section_by_name(object, ".binary");
+	if (section == NULL || (*entrypoint = symbol_get_address(section, "@@entrypoint")) == 0xFFFF ||
+			(machine = createFromFileVirtualMachine(filename, offset, length, *entrypoint)) == NULL) {
+		object_free(object);
+		return NULL;
+	}
+	*binary_section = section;
+	return machine;
+}
+
+/// Vzdialenost bodov historie v jej najhustejsej casti (pocet instrukcii)
+#define HISTORY_INTERVAL 4096
+/// Pocet bodov historie na jednu uroven hustoty
+#define HISTORY_DENSITY 16
+/// Beh v historii sa zastavi na zarazke
+#define HISTORY_BREAK 1
+/// Beh v historii sa zastavi na instrukcii INT
+#define HISTORY_SOFTINT 2
+
+#define MAX_BREAKPOINTS 64
+
+/** Bod historie: snimka stroja v case clock. */
+struct history_point {
+	uint64_t clock;
+	VM_SNAPSHOT * snapshot;
+};
+
+/** Historia behu stroja pre spatne vykonavanie.
+ * Body su zoradene podla casu. Prvy je zaciatok historie (posledna zmena stavu hostitelom),
+ * ostatne lezia na nasobkoch HISTORY_INTERVAL instrukcii od neho. Stav medzi bodmi sa ziska
+ * opakovanym vykonanim od predchadzajuceho bodu.
+ */
+struct history {
+	struct history_point * points;
+	unsigned count;
+	unsigned capacity;
+	int enabled;
+} history = { NULL, 0, 0, 0 };
+
+/** Sledovanie zapisov na adresu (reverse-write). */
+struct write_watch {
+	uint16_t base;					// zaciatok oblasti namapovanej ako zariadenie
+	uint16_t address;				// sledovana adresa
+	int hit;						// od vynulovania bol zapis na sledovanu adresu
+} watch;
+
+uint16_t breakpoints[MAX_BREAKPOINTS];
+unsigned breakpoint_count = 0;
+
+/// Ctrl-C poslal stroju prerusenie, ktore este nezastavilo beh
+volatile sig_atomic_t host_interrupt = 0;
+
+/** Zisti, ci je na adrese zarazka.
+ * @param address adresa
+ * @return index zarazky, -1 ak na adrese nie je
+ */
+int find_breakpoint(uint16_t address) {
+	unsigned q;
+	for (q = 0; q < breakpoint_count; q++) if (breakpoints[q] == address) return q;
+	return -1;
+}
+
+/** Najde posledny bod historie, ktory nie je neskorsi ako target.
+ * @param target cas stroja, nesmie byt skorsi ako zaciatok historie
+ * @return index bodu
+ */
+unsigned history_find(uint64_t target) {
+	unsigned q = history.count - 1;
+	while (q > 0 && history.points[q].clock > target) q--;
+	return q;
+}
+
+/** Zriedi historiu podla vzdialenosti bodov od aktualneho casu stroja.
+ * Body blizsie ako HISTORY_INTERVAL * HISTORY_DENSITY instrukcii zostavaju vsetky, s kazdym
+ * dalsim zdvojnasobenim vzdialenosti zostava iba kazdy druhy bod predchadzajucej urovne. Pocet
+ * bodov tak rastie s logaritmom dlzky behu a navrat o N instrukcii vykona znova najviac
+ * 2 * N / HISTORY_DENSITY + HISTORY_INTERVAL instrukcii. Zaciatok historie a snimka, od ktorej
+ * stroj sleduje zmenene stranky, zostavaju vzdy.
+ */
+void history_thin(void) {
+	uint64_t origin = history.points[0].clock, distance;
+	struct history_point point;
+	unsigned q, kept = 1, level;
+	for (q = 1; q < history.count; q++) {
+		point = history.points[q];
+		distance = (point.clock > mach->clock) ? point.clock - mach->clock : mach->clock - point.clock;
+		for (level = 0; level < 48 && distance >= ((uint64_t) HISTORY_INTERVAL * HISTORY_DENSITY) << level; level++);
+		if (point.snapshot != mach->snapshot && ((point.clock - origin) / HISTORY_INTERVAL) & (((uint64_t) 1 << level) - 1)) {
+			destroySnapshotVirtualMachine(point.snapshot);
+		} else {
+			history.points[kept++] = point;
+		}
+	}
+	history.count = kept;
+}
+
+/** Prida do historie bod v aktualnom case stroja, ak este neexistuje, a historiu zriedi.
+ * @return 0 ak bol bod pridany alebo uz existoval, -1 ak sa ho nepodarilo alokovat
+ */
+int history_add(void) {
+	unsigned q = history_find(mach->clock);
+	struct history_point * points;
+	VM_SNAPSHOT * snapshot;
+	if (history.points[q].clock == mach->clock) return 0;
+	if (history.count == history.capacity) {
+		points = realloc(history.points, 2 * history.capacity * sizeof(struct history_point));
+		if (points == NULL) return -1;
+		history.points = points;
+		history.capacity *= 2;
+	}
+	if ((snapshot = createSnapshotVirtualMachine(mach)) == NULL) return -1;
+	memmove(&history.points[q + 2], &history.points[q + 1], (history.count - q - 1) * sizeof(struct history_point));
+	history.points[q + 1].clock = mach->clock;
+	history.points[q + 1].snapshot = snapshot;
+	history.count++;
+	history_thin();
+	return 0;
+}
+
+/** Zacne novu historiu v aktualnom stave stroja.
+ * Vola sa na zaciatku a po kazdej zmene stavu hostitelom (set-reg, set-mem), ktoru by opakovane
+ * vykonanie od skorsich bodov nezopakovalo. Ak sa snimku nepodari alokovat, historia sa vypne.
+ */
+void history_reset(void) {
+	VM_SNAPSHOT * snapshot;
+	unsigned q;
+	if (!history.enabled) return;
+	snapshot = createSnapshotVirtualMachine(mach);
+	for (q = 0; q < history.count; q++) destroySnapshotVirtualMachine(history.points[q].snapshot);
+	history.count = 0;
+	if (history.points == NULL && (history.points = malloc(HISTORY_DENSITY * sizeof(struct history_point))) != NULL) {
+		history.capacity = HISTORY_DENSITY;
+	}
+	if (snapshot == NULL || history.points == NULL) {
+		if (snapshot != NULL) destroySnapshotVirtualMachine(snapshot);
+		fprintf(stderr, "warning: Unable to allocate snapshot, reverse execution is disabled\n");
+		history.enabled = 0;
+		return;
+	}
+	history.points[0].clock = mach->clock;
+	history.points[0].snapshot = snapshot;
+	history.count = 1;
+}
+
+/** Vykona najviac budget instrukcii a cestou prida do historie body na hraniciach intervalov.
+ * Beh sa deli na useky po hranice intervalov, zarazky sa preto kontroluju aj na ich zaciatku.
+ * @param budget najvacsi pocet vykonanych instrukcii, 0 znamena bez limitu
+ * @param stops HISTORY_BREAK ak sa ma beh zastavit na zarazkach, HISTORY_SOFTINT ak na INT;
+ * chyba a prerusenie od hostitela zastavia beh vzdy
+ * @param stop miesto pre popis zastavenia, retired je pocet instrukcii za cely beh
+ * @return stav, ktory vratilo jadro
+ */
+VM_STATE history_run(uint64_t budget, int stops, VM_STOP * stop) {
+	uint64_t retired = 0, chunk, interval;
+	VM_STATE state = VM_OK;
+	for (;;) {
+		if ((stops & HISTORY_BREAK) && retired > 0 && find_breakpoint(mach->registers[15]) >= 0) {
+			stop->reason = VM_STOP_BREAKPOINT;
+			stop->state = VM_OK;
+			stop->pc = mach->registers[15];
+			break;
+		}
+		chunk = (budget != 0) ? budget - retired : 0;
+		if (history.enabled) {
+			interval = HISTORY_INTERVAL - (mach->clock - history.points[0].clock) % HISTORY_INTERVAL;
+			if (chunk == 0 || chunk > interval) chunk = interval;
+		}
+		state = resumeVirtualMachine(mach, chunk, stop);
+		retired += stop->retired;
+		if (history.enabled && (mach->clock - history.points[0].clock) % HISTORY_INTERVAL == 0) history_add();
+		if (budget != 0 && retired >= budget) break;
+		if (stop->reason == VM_STOP_BREAKPOINT && (stops & HISTORY_BREAK)) break;
+		if (stop->reason == VM_STOP_SOFTINT && (stops & HISTORY_SOFTINT)) break;
+		if (stop->reason == VM_STOP_INTERRUPT) host_interrupt = 0;
+		if (stop->reason == VM_STOP_FAULT || stop->reason == VM_STOP_INTERRUPT) break;
+	}
+	stop->retired = retired;
+	return state;
+}
+
+/** Vrati stroj do casu target: obnovi posledny bod historie pred nim a odtial vykona zvysok.
+ * @param target cas stroja, nesmie byt skorsi ako zaciatok historie
+ * @return 0 ak stroj dosiahol target, -1 ak beh prerusil hostitel
+ */
+int history_travel(uint64_t target) {
+	VM_STOP stop;
+	restoreSnapshotVirtualMachine(mach, history.points[history_find(target)].snapshot);
+	if (mach->clock < target) history_run(target - mach->clock, 0, &stop);
+	return (mach->clock == target) ? 0 : -1;
+}
+
+/** Vrati stroj na posledny okamih pred aktualnym casom, ked bolo PC na zarazke (instrukcia
+ * na nej sa este nevykonala), alebo na zaciatok historie. Historia sa prechadza od konca po
+ * usekoch medzi bodmi, kazdy usek sa vykona znova.
+ * @return 1 ak sa zarazka nasla, 0 ak stroj skoncil na zaciatku historie, -1 ak beh prerusil hostitel
+ */
+int history_reverse_continue(void) {
+	uint64_t end = mach->clock, start, found = 0;
+	VM_STOP stop;
+	int hit = 0;
+	while (!hit && end > history.points[0].clock) {
+		start = history.points[history_find(end - 1)].clock;
+		if (history_travel(start) != 0) return -1;
+		if (find_breakpoint(mach->registers[15]) >= 0) {
+			hit = 1;
+			found = start;
+		}
+		while (mach->clock < end) {
+			history_run(end - mach->clock, HISTORY_BREAK, &stop);
+			if (stop.reason == VM_STOP_BREAKPOINT && mach->clock < end) {
+				hit = 1;
+				found = mach->clock;
+			} else if (stop.reason == VM_STOP_FAULT || stop.reason == VM_STOP_INTERRUPT) {
+				return -1;
+			}
+		}
+		end = start;
+	}
+	if (history_travel(hit ? found : history.points[0].clock) != 0) return -1;
+	return hit;
+}
+
+/** Obsluha zapisu na stranky sledovane prikazom reverse-write. Zapis vykona do pamate stroja
+ * a poznaci, ci zasiahol sledovanu adresu.
+ */
+void watch_write(void * device, uint16_t address, uint16_t data, int half) {
+	struct write_watch * w = (struct write_watch *) device;
+	uint16_t at = w->base + address;
+	mach->write_func(mach->memory, at, data, half);
+	if ((uint16_t) (w->address - at) < (half ? 1 : 2)) w->hit = 1;
+}
+
+/** Vrati stroj tesne pred posledny zapis instrukcie na adresu pred aktualnym casom, alebo na
+ * zaciatok historie. Stranky adresy (a predchadzajuca stranka kvoli nezarovnanemu slovu) sa
+ * pocas hladania namapuju ako zariadenie, ktore zapisy sleduje, a useky historie sa od konca
+ * vykonavaju znova po jednej instrukcii.
+ * @param address sledovana adresa
+ * @return 1 ak sa zapis nasiel, 0 ak stroj skoncil na zaciatku historie, -1 ak beh prerusil
+ * hostitel, -2 ak sa adresa neda sledovat
+ */
+int history_reverse_write(uint16_t address) {
+	uint64_t end = mach->clock, start, at, found = 0;
+	uint32_t length;
+	VM_STOP stop;
+	int hit = 0, rc = 0;
+	watch.base = (address > 0) ? (address - 1) & 0xFF00 : 0;
+	watch.address = address;
+	length = (address & 0xFF00) + VM_PAGE_SIZE - watch.base;
+	if (mapDeviceVirtualMachine(mach, watch.base, length, NULL, watch_write, &watch) != 0) return -2;
+	while (!hit && rc == 0 && end > history.points[0].clock) {
+		start = history.points[history_find(end - 1)].clock;
+		if (history_travel(start) != 0) rc = -1;
+		while (rc == 0 && mach->clock < end) {
+			at = mach->clock;
+			watch.hit = 0;
+			resumeVirtualMachine(mach, 1, &stop);
+			if (stop.reason == VM_STOP_FAULT || stop.reason == VM_STOP_INTERRUPT) rc = -1;
+			else if (watch.hit) {
+				hit = 1;
+				found = at;
+			}
+			if ((mach->clock - history.points[0].clock) % HISTORY_INTERVAL == 0) history_add();
+		}
+		end = start;
+	}
+	unmapDeviceVirtualMachine(mach, watch.base, length);
+	if (rc != 0 || history_travel(hit ? found : history.points[0].clock) != 0) return -1;
+	return hit;
+}
+
+/** Vypise instrukciu na PC a registre stroja (auto-stat). */
+void print_stat(void) {
+	uint16_t instr;
+	ADDRESS d_addr = mach->registers[15];
+	char * d_str;
+	instr = mach->read_func(mach->memory, d_addr, 0);
+	d_str = disassemble(instr);
+	printf("0x%04X:\t%s\n", d_addr, d_str);
+	dumpRegistersVirtualMachine(mach);
+	free(d_str);
+}
+
+/** Vypise stav stroja po behu (run, step).
+ * @param state stav, ktory vratilo jadro
+ * @param stop popis zastavenia
+ * @param comp_out vystup pre pocitac
+ */
+void print_state(VM_STATE state, const VM_STOP * stop, int comp_out) {
+	if (stop->reason == VM_STOP_BREAKPOINT) {
+		if (comp_out) printf("BREAKPOINT\n"); else printf("Breakpoint at 0x%04X\n", stop->pc);
+		return;
+	}
+	if (comp_out) {
+		switch (state) {
+			case VM_OK: printf("OK\n"); break;
+			case VM_ILLEGAL_OPCODE: printf("ILL_OPCODE\n"); break;
+			case VM_DIVIDE_BY_ZERO: printf("DIV_BY_ZERO\n"); break;
+			case VM_OUT_OF_MEMORY: printf("OUT_OF_MEM\n"); break;
+			case VM_SOFTINT: printf("SOFTINT\n"); break;
+			case VM_UNALIGNED_MEMORY: printf("UNALIGNED\n"); break;
+			case VM_WRITE_PROTECTED: printf("WRITE_PROTECTED\n"); break;
+			case VM_JIT_MISMATCH: printf("JIT_MISMATCH\n"); break;
+			case VM_REPLAY_END: printf("REPLAY_END\n"); break;
+			case VM_REPLAY_DIVERGED: printf("REPLAY_DIVERGED\n"); break;
+			default: printf("UNKNOWN_STATE\n"); break;
+		}
+	}
+}
+
 void sigint_handler(int signo) {
-	mach->ext_interrupt = 1;
+	(void) signo;
+	host_interrupt = 1;
+	postInterruptVirtualMachine(mach, 1);
+}
+
+/** Zacne novu historiu, ak prerusenie od hostitela obsluzil program stroja.
+ * Opakovane vykonanie od skorsich bodov by prerusenie neposlalo a prebehlo by inak.
+ * Prerusenie, ktore zastavilo beh, zrusi priznak uz history_run.
+ */
+void history_check_interrupt(void) {
+	if (!host_interrupt || mach->interrupt_pending) return;
+	host_interrupt = 0;
+	history_reset();
 }
 
 int main(int argc, char ** argv) {
 	char * memory = NULL; 
 	char running = 1;
 	ADDRESS entrypoint = 0;
+	SECTION * binary_section = NULL;
 	char comp_out = 0;
 	int auto_stat = 0;
-	int rc;
+	int rc, mapped = 0;
 	int cmdline_retval = process_commandline(argc, argv, &commandline);
 	if (cmdline_help) { print_help(&commandline, argv[0]); return 0; }
 	if (cmdline_retval != 0) return cmdline_retval;
 
-	if (cmdline_memsize < 0 || cmdline_memsize > 65535) {
+	if (cmdline_memsize < 0 || cmdline_memsize > VM_MEMORY_FULL_SIZE) {
 		fprintf(stderr, "error: Invalid memory size %d\n", cmdline_memsize);
 		exit(1);
 	}
 	
-	memory = malloc(cmdline_memsize);
-	memset(memory, 0, cmdline_memsize);
+	if (cmdline_memsize == VM_MEMORY_FULL_SIZE) {
+		/* obraz sa namapuje priamo zo suboru, kopiruje sa iba ak sa to nepodari */
+		mach = map_image(cmdline_infile, &entrypoint, &binary_section);
+		mapped = (mach != NULL);
+		if (mach == NULL) mach = createVirtualMachine(NULL, 0, 0);
+		if (mach == NULL) {
+			fprintf(stderr, "error: Unable to allocate device memory\n");
+			exit(1);
+		}
+		memory = (char *) mach->memory;
+	} else {
+		memory = malloc(cmdline_memsize);
+		memset(memory, 0, cmdline_memsize);
+	}
 	
-	rc = binary_read(cmdline_infile, memory, &entrypoint, cmdline_memsize);
+	rc = mapped ? 0 : binary_read(cmdline_infile, memory, &entrypoint, cmdline_memsize);
 	
 	if (rc == -1) {
 		OBJECT * binary_object = object_load(cmdline_infile);
@@ -144,7 +561,7 @@ int main(int argc, char ** argv) {
 			fprintf(stderr, "Unable to load virtual memory image nor as plain binary nor as debuggable binary.\n");
 			exit(1);
 		}
-		SECTION * binary_section = object_get_section_by_name(binary_object, ".binary");
+		binary_section = object_get_section_by_name(binary_object, ".binary");
 		if (binary_section == NULL) {
 			fprintf(stderr, "Invalid virtual memory image. Cannot find image section.\n");
 			exit(1);
@@ -163,7 +580,28 @@ int main(int argc, char ** argv) {
 		exit(1);
 	}
 	
-	mach = createVirtualMachine(memory, cmdline_memsize, entrypoint);
+	if (mach == NULL) mach = createVirtualMachine(memory, cmdline_memsize, entrypoint);
+	else mach->registers[15] = entrypoint;
+	if (cmdline_strict_align) mach->mem_flags |= VM_MEMORY_STRICT_ALIGN;
+	if ((cmdline_profile != NULL || cmdline_profile_csv != NULL) && setProfilingVirtualMachine(mach, 1) != 0) {
+		fprintf(stderr, "error: Unable to allocate profile\n");
+		exit(1);
+	}
+	if (cmdline_bank_control >= 0) {
+		if (cmdline_memsize != VM_MEMORY_FULL_SIZE || (rc = load_banks(cmdline_infile, cmdline_bank_control)) < 0) {
+			fprintf(stderr, "error: Unable to load banks of '%s'\n", cmdline_infile);
+			exit(1);
+		}
+		fprintf(stderr, "%d banks loaded\n", rc);
+	}
+	if (cmdline_native) {
+		if (binary_section == NULL) fprintf(stderr, "warning: Plain binary has no symbols, no functions run natively\n");
+		else fprintf(stderr, "%d functions run natively\n", bind_natives(binary_section));
+	}
+
+	/* opakovane vykonanie nezopakuje prepinanie bank a profil by zapocital instrukcie viackrat */
+	history.enabled = (getBankVirtualMachine(mach) < 0 && cmdline_profile == NULL && cmdline_profile_csv == NULL);
+	history_reset();
 
 	signal(SIGINT, sigint_handler);
 	
@@ -171,6 +609,7 @@ int main(int argc, char ** argv) {
 	int arg_count = -1, q;
 	
 	VM_STATE mach_state;
+	VM_STOP stop;
 	struct dbg_runtime_command cmd;
 	
 	while (running) {
@@ -186,47 +625,22 @@ int main(int argc, char ** argv) {
 		if (arg_count >= 0) {
 			switch (cmd.command) {
 				case CMD_RUN:
-					mach_state = runVirtualMachine(mach);
-					if (comp_out) {
-						switch (mach_state) {
-							case VM_OK: printf("OK\n"); break;
-							case VM_ILLEGAL_OPCODE: printf("ILL_OPCODE\n"); break;
-							case VM_DIVIDE_BY_ZERO: printf("DIV_BY_ZERO\n"); break;
-							case VM_OUT_OF_MEMORY: printf("OUT_OF_MEM\n"); break;
-							case VM_SOFTINT: printf("SOFTINT\n"); break;
-						}
-					}
+					mach_state = history_run(0, HISTORY_BREAK | HISTORY_SOFTINT, &stop);
+					print_state(mach_state, &stop, comp_out);
 					break;
 					
 				case CMD_STEP:
 					if (arg_count == 0) {
-						mach_state = traceVirtualMachine(mach, 1);
-						if (auto_stat) {
-							uint16_t instr;
-							ADDRESS d_addr = mach->registers[15];
-							char * d_str;
-							instr = mach->read_func(mach->memory, d_addr, 0);
-							d_str = disassemble(instr);
-							printf("0x%04X:\t%s\n", d_addr, d_str);
-							dumpRegistersVirtualMachine(mach);
-							free(d_str);
-						}
+						mach_state = history_run(1, HISTORY_BREAK | HISTORY_SOFTINT, &stop);
+						if (auto_stat) print_stat();
 					} else {
-						if (cmd.cmd_argument > 0) mach_state = traceVirtualMachine(mach, cmd.cmd_argument[0].number);
+						if (cmd.cmd_argument[0].number > 0) mach_state = history_run(cmd.cmd_argument[0].number, HISTORY_BREAK | HISTORY_SOFTINT, &stop);
 						else {
 							if (!comp_out) fprintf(stderr, "invalid step count\n"); else printf("BAD_STEP\n");
 							break;
 						}
 					}
-					if (comp_out) {
-						switch (mach_state) {
-							case VM_OK: printf("OK\n"); break;
-							case VM_ILLEGAL_OPCODE: printf("ILL_OPCODE\n"); break;
-							case VM_DIVIDE_BY_ZERO: printf("DIV_BY_ZERO\n"); break;
-							case VM_OUT_OF_MEMORY: printf("OUT_OF_MEM\n"); break;
-							case VM_SOFTINT: printf("SOFTINT\n"); break;
-						}
-					}
+					print_state(mach_state, &stop, comp_out);
 					break;
 					
 				case CMD_QUIT: 
@@ -320,6 +734,7 @@ int main(int argc, char ** argv) {
 					} else {
 						if (cmd.cmd_argument[0].number >= 0 && cmd.cmd_argument[0].number <= 15) {
 							mach->registers[cmd.cmd_argument[0].number] = cmd.cmd_argument[1].number;
+							history_reset();
 							printf("OK\n");
 						} else {
 							if (!comp_out) fprintf(stderr, "error: invalid register number %d\n", cmd.cmd_argument[0].number); else printf("BAD_REG\n");
@@ -334,6 +749,7 @@ int main(int argc, char ** argv) {
 					} else {
 						if (cmd.cmd_argument[0].number >= 0 && cmd.cmd_argument[0].number < 0x10000) {
 							mach->write_func(mach->memory, cmd.cmd_argument[0].number, cmd.cmd_argument[1].number, 0);
+							history_reset();
 							printf("OK\n");
 						} else {
 							if (!comp_out) fprintf(stderr, "error: invalid address %d\n", cmd.cmd_argument[0].number); else printf("BAD_ADDR\n");
@@ -341,8 +757,79 @@ int main(int argc, char ** argv) {
 					}
 					break;
 					
+				case CMD_BANK:
+					if (getBankVirtualMachine(mach) < 0) {
+						if (!comp_out) fprintf(stderr, "error: no banks loaded\n"); else printf("BAD_CMD\n");
+					} else if (arg_count == 0) {
+						printf("%ld\n", getBankVirtualMachine(mach));
+					} else if (selectBankVirtualMachine(mach, cmd.cmd_argument[0].number) == 0) {
+						printf("OK\n");
+					} else {
+						if (!comp_out) fprintf(stderr, "error: invalid bank %d\n", cmd.cmd_argument[0].number); else printf("BAD_ARG\n");
+					}
+					break;
+
+				case CMD_BREAK:
+					if (arg_count == 0) {
+						for (q = 0; q < (int) breakpoint_count; q++) printf("0x%04X\n", breakpoints[q]);
+						if (comp_out) printf("OK\n");
+					} else if (cmd.cmd_argument[0].number < 0 || cmd.cmd_argument[0].number >= 0x10000) {
+						if (!comp_out) fprintf(stderr, "error: invalid address %d\n", cmd.cmd_argument[0].number); else printf("BAD_ADDR\n");
+					} else if ((q = find_breakpoint(cmd.cmd_argument[0].number)) >= 0) {
+						/* zarazka na adrese uz je, prikaz ju zrusi */
+						setBreakpointVirtualMachine(mach, breakpoints[q], 0);
+						breakpoints[q] = breakpoints[--breakpoint_count];
+						printf("OK\n");
+					} else if (breakpoint_count == MAX_BREAKPOINTS || setBreakpointVirtualMachine(mach, cmd.cmd_argument[0].number, 1) != 0) {
+						if (!comp_out) fprintf(stderr, "error: too many breakpoints\n"); else printf("BAD_ARG\n");
+					} else {
+						breakpoints[breakpoint_count++] = cmd.cmd_argument[0].number;
+						printf("OK\n");
+					}
+					break;
+
+				case CMD_REVERSE_STEP:
+				case CMD_REVERSE_CONTINUE:
+				case CMD_REVERSE_WRITE:
+				{
+					uint64_t origin;
+					int found = 1;
+					if (!history.enabled) {
+						if (!comp_out) fprintf(stderr, "error: reverse execution is not available with banks or profiling\n"); else printf("BAD_CMD\n");
+						break;
+					}
+					origin = history.points[0].clock;
+					if (cmd.command == CMD_REVERSE_STEP) {
+						if (arg_count == 0) cmd.cmd_argument[0].number = 1;
+						if (cmd.cmd_argument[0].number <= 0) {
+							if (!comp_out) fprintf(stderr, "invalid step count\n"); else printf("BAD_STEP\n");
+							break;
+						}
+						if (mach->clock - origin < (uint64_t) cmd.cmd_argument[0].number) found = 0;
+						found = (history_travel(found ? mach->clock - cmd.cmd_argument[0].number : origin) == 0) ? found : -1;
+					} else if (cmd.command == CMD_REVERSE_CONTINUE) {
+						found = history_reverse_continue();
+					} else if (arg_count != 1 || cmd.cmd_argument[0].number < 0 || cmd.cmd_argument[0].number >= 0x10000) {
+						if (!comp_out) fprintf(stderr, "reverse-write addr\n"); else printf("BAD_ARG\n");
+						break;
+					} else if ((found = history_reverse_write(cmd.cmd_argument[0].number)) == -2) {
+						if (!comp_out) fprintf(stderr, "error: writes to 0x%04X cannot be watched\n", cmd.cmd_argument[0].number); else printf("BAD_ADDR\n");
+						break;
+					}
+					if (comp_out) {
+						printf("%s\n", (found < 0) ? "INTERRUPTED" : (found == 0) ? "START" : "OK");
+					} else {
+						if (found < 0) printf("Interrupted\n");
+						else if (found == 0) printf("Reached start of history\n");
+						printf("Instruction %llu, PC 0x%04X\n", (unsigned long long) mach->clock, mach->registers[15]);
+						if (auto_stat) print_stat();
+					}
+					break;
+				}
+
 				case CMD_HELP:
-					printf("Available commands:\nstep [steps]\nrun\ndump\ndisassemble [instructions]\nquit\n");
+					printf("Available commands:\nstep [steps]\nrun\ndump\ndisassemble [instructions]\nbank [bank]\nbreak [address]\n"
+						"reverse-step [steps]\nreverse-continue\nreverse-write address\nquit\n");
 					break;
 					
 				case CMD_COMPUTER:
@@ -374,8 +861,15 @@ int main(int argc, char ** argv) {
 					break;
 			}
 		}
+		history_check_interrupt();
 		fflush(stdout);
 	}
 	
+	if (cmdline_profile != NULL && writeProfileVirtualMachine(mach, cmdline_profile, VM_PROFILE_BINARY) != 0) {
+		fprintf(stderr, "error: Unable to write profile to %s\n", cmdline_profile);
+	}
+	if (cmdline_profile_csv != NULL && writeProfileVirtualMachine(mach, cmdline_profile_csv, VM_PROFILE_CSV) != 0) {
+		fprintf(stderr, "error: Unable to write profile to %s\n", cmdline_profile_csv);
+	}
 	return 0;
 }
\ No newline at end of file
@@ -7,6 +7,9 @@
 #include <unistd.h>
 #include <object.h>
 
+/// Najvacsi pocet bank, ktore linker vytvori
+#define BANK_COUNT		256
+
 char * cmdline_outfile = NULL;
 char ** cmdline_infile = NULL;
 long cmdline_safe = 0;
@@ -18,6 +21,9 @@ long cmdline_verbose_1 = 0;
 long cmdline_verbose_2 = 0;
 long cmdline_verbose_3 = 0;
 long cmdline_debug = 0;
+char * cmdline_banks = NULL;
+long cmdline_bank_window = 0x8000;
+long cmdline_bank_size = 0x1000;
 
 struct cmdline_opts options[] = {
 	{ "-o", "--output", "out_file", "Write output object to this file.", (void *) &cmdline_outfile, ARG_STR, MANDATORY, 0, NON_POSITIONAL },
@@ -27,11 +33,107 @@ struct cmdline_opts options[] = {
 	{ "-vv", "--more-verbose", NULL, "Write more verbose information about linking process.", (void *) &cmdline_verbose_2, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL },
 	{ "-l", "--library", "library_name", "Use this library to resolve unresolved symbols after final linkage.", (void *) &cmdline_library, ARG_STR, OPTIONAL, 0, NON_POSITIONAL },
 	{ "-vvv", "--most-verbose", NULL, "Write very verbose information about linking process.", (void *) &cmdline_verbose_3, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL },
+	{ "-B", "--banks", "objects", "Link objects into banks of extended memory, objects of a bank separated by commas, banks by colons (a.o,b.o:c.o). Bank N is written to out_file.bankN.", (void *) &cmdline_banks, ARG_STR, OPTIONAL, 0, NON_POSITIONAL },
+	{ "-w", "--bank-window", "address", "Address of the window which banks are linked to [default 0x8000].", (void *) &cmdline_bank_window, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL },
+	{ "-z", "--bank-size", "size", "Size of the bank window in bytes [default 0x1000].", (void *) &cmdline_bank_size, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL },
 	{ "-h", "--help", NULL, "Show this help", (void *) &cmdline_help, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL}, 
 	{ NULL, NULL, "source_file", "File name of linked objects.", &cmdline_infile, ARG_STR, MANDATORY, 0, NON_POSITIONAL},
 };
 
-struct cmdline_args commandline = { options, 9 };
+struct cmdline_args commandline = { options, 12 };
+
+/** Nacita objekty jednej banky a spoji ich data a kod do jednej sekcie.
+ * @param objects nazvy objektov oddelene ciarkou, retazec sa zmeni
+ * @param index cislo banky
+ * @return sekcia banky s adresami od zaciatku banky
+ */
+SECTION * load_bank(char * objects, unsigned index) {
+	SECTION * bank_data = section_create(".data");
+	SECTION * bank_text = section_create(".text");
+	SECTION * bank = section_create(".bank");
+	SECTION * section;
+	OBJECT * object;
+	char * name, * save;
+	for (name = strtok_r(objects, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+		if (cmdline_verbose_1 || cmdline_verbose_2 || cmdline_verbose_3) printf("Trying to link '%s' into bank\n", name);
+		object = object_load(name);
+		if (object == NULL) exit(3);
+		section = object_get_section_by_name(object, ".data");
+		if (section != NULL) section_append(bank_data, section);
+		section = object_get_section_by_name(object, ".text");
+		if (section != NULL) section_append(bank_text, section);
+	}
+	section_append(bank, bank_data);
+	section_append(bank, bank_text);
+	if (bank->size > cmdline_bank_size) {
+		fprintf(stderr, "error: bank %u (%d bytes) does not fit into bank of %ld bytes\n", index, bank->size, cmdline_bank_size);
+		exit(1);
+	}
+	return bank;
+}
+
+/** Zverejni symboly bank v programe.
+ * Symboly definovane v banke dostanu adresu v okne, takze ich program aj ostatne banky mozu
+ * volat. Symboly, ktore banky pouzivaju, ale nedefinuju, sa do programu pridaju ako
+ * nevyriesene, aby ich linker nasiel v programe alebo v kniznici.
+ * @param binary sekcia programu
+ * @param banks sekcie bank
+ * @param count pocet bank
+ */
+void export_bank_symbols(SECTION * binary, SECTION ** banks, unsigned count) {
+	unsigned q, w;
+	SYMBOL * symbol;
+	for (q = 0; q < count; q++) {
+		for (w = 0; w < banks[q]->symbol_count; w++) {
+			symbol = &(banks[q]->symbols[w]);
+			if (symbol->address == 0xFFFF) continue;
+			if (symbol_get_address(binary, symbol->name) != 0xFFFF) {
+				fprintf(stderr, "error: duplicate symbol '%s' in bank %u\n", symbol->name, q);
+				exit(1);
+			}
+			symbol_set(binary, symbol->name, cmdline_bank_window + symbol->address, symbol->flags);
+		}
+	}
+	for (q = 0; q < count; q++) {
+		for (w = 0; w < banks[q]->symbol_count; w++) {
+			symbol = &(banks[q]->symbols[w]);
+			if (symbol->address == 0xFFFF && symbol_get_address(binary, symbol->name) == 0xFFFF) symbol_set(binary, symbol->name, 0xFFFF, 0);
+		}
+	}
+}
+
+/** Prelinkuje banku na adresu okna a zapise ju ako binarny obraz, ktoreho vstupny bod je
+ * adresa okna a dlzka je velkost banky.
+ * @param binary relokovana sekcia programu, z nej sa beru symboly, ktore banka nedefinuje
+ * @param bank sekcia banky
+ * @param index cislo banky
+ */
+void write_bank(SECTION * binary, SECTION * bank, unsigned index) {
+	SECTION * placed = section_create(".bank");
+	SECTION * image = section_create(".bank");
+	unsigned char * zero = calloc(1, cmdline_bank_window > cmdline_bank_size ? cmdline_bank_window : cmdline_bank_size);
+	char filename[1024];
+	int q;
+
+	// banka sa prilinkuje za prazdne miesto pred oknom, tym sa jej adresy posunu do okna
+	section_append_data(placed, zero, cmdline_bank_window);
+	section_append(placed, bank);
+	for (q = 0; q < placed->symbol_count; q++) {
+		if (placed->symbols[q].address == 0xFFFF) placed->symbols[q].address = symbol_get_address(binary, placed->symbols[q].name);
+	}
+	section_do_relocation(placed);
+
+	section_append_data(image, &(placed->data[cmdline_bank_window]), bank->size);
+	section_append_data(image, zero, cmdline_bank_size - bank->size);
+	snprintf(filename, sizeof(filename), "%s.bank%u", cmdline_outfile, index);
+	if (!binary_write(image, cmdline_bank_window, filename)) {
+		fprintf(stderr, "Failed to write bank '%s'\n", filename);
+		exit(1);
+	}
+	free(zero);
+	section_free(placed, 1);
+	section_free(image, 1);
+}
 
 int main(int argc, char ** argv) {
 	int cmdline_retval = process_commandline(argc, argv, &commandline);
@@ -74,6 +176,26 @@ int main(int argc, char ** argv) {
 	}
 	section_append(global_binary, global_data);
 	section_append(global_binary, global_text);
+
+	SECTION * banks[BANK_COUNT];
+	unsigned bank_count = 0, bank;
+	char * bank_objects, * bank_save;
+
+	if (cmdline_banks != NULL) {
+		if (cmdline_bank_size <= 0 || cmdline_bank_window < 0 || cmdline_bank_window + cmdline_bank_size > 0x10000) {
+			fprintf(stderr, "error: bank window 0x%lX of %ld bytes is outside of address space\n", cmdline_bank_window, cmdline_bank_size);
+			exit(1);
+		}
+		for (bank_objects = strtok_r(cmdline_banks, ":", &bank_save); bank_objects != NULL; bank_objects = strtok_r(NULL, ":", &bank_save)) {
+			if (bank_count == BANK_COUNT) {
+				fprintf(stderr, "error: too many banks, at most %d are supported\n", BANK_COUNT);
+				exit(1);
+			}
+			banks[bank_count] = load_bank(bank_objects, bank_count);
+			bank_count++;
+		}
+		export_bank_symbols(global_binary, banks, bank_count);
+	}
 	
 //	section_free(global_data, 1);
 //	section_free(global_text, 1);
@@ -93,6 +215,11 @@ int main(int argc, char ** argv) {
 		}
 	}
 	
+	if (bank_count > 0 && global_binary->size > cmdline_bank_window) {
+		fprintf(stderr, "error: program (%d bytes) overlaps bank window at 0x%04lX\n", global_binary->size, cmdline_bank_window);
+		exit(1);
+	}
+
 	section_do_relocation(global_binary);
 	
 	ADDRESS entrypoint_address = symbol_get_address(global_binary, cmdline_entrypoint);
@@ -120,6 +247,7 @@ int main(int argc, char ** argv) {
 			exit(1);
 		}
 	}
+	for (bank = 0; bank < bank_count; bank++) write_bank(global_binary, banks[bank], bank);
 	if (cmdline_verbose_1 || cmdline_verbose_2 || cmdline_verbose_3) printf("%s() address is 0x%04X\n", cmdline_entrypoint, entrypoint_address);
 	
 	return 0;
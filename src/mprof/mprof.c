@@ -0,0 +1,283 @@
+/* Sampling profiler for C Minimalistic RISC machine
+ * Writes sampled guest call stacks in folded format for flamegraph tools
+ */
+
+#include <cmdline.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <vm.h>
+#include <object.h>
+#include <bits.h>
+#include <instruction.h>
+
+/// Najvacsia hlbka rekonstruovaneho zasobnika volani
+#define MAX_DEPTH		256
+
+/// Najvacsi pocet slov zasobnika stroja prehladanych pri rekonstrukcii volani
+#define MAX_SCAN		4096
+
+/// Pocet retazcov hashovacej tabulky vzoriek
+#define SAMPLE_BUCKETS	4096
+
+long cmdline_interval = 1000;
+long cmdline_steps = 0;
+long cmdline_help = 0;
+char * cmdline_outfile = NULL;
+char * cmdline_infile = NULL;
+
+struct cmdline_opts options[] = {
+	{ "-n", "--interval", "N", "Take one sample every N executed instructions [default 1000].", (void *) &cmdline_interval, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-s", "--steps", "N", "Execute at most N instructions. If N is 0, run until error or interrupt.", (void *) &cmdline_steps, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-o", "--output", "file", "Write folded stacks to file instead of standard output.", (void *) &cmdline_outfile, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-h", "--help", NULL, "Show this help", (void *) &cmdline_help, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ NULL, NULL, "bin_file", "Virtual memory image file.", &cmdline_infile, ARG_STR, MANDATORY, 0, 1},
+};
+
+struct cmdline_args commandline = { options, 5 };
+
+/// Vzorka: postupnost volanych funkcii od korena a pocet jej vyskytov
+struct sample {
+	struct sample * next;
+	uint64_t count;
+	uint16_t depth;
+	ADDRESS functions[];
+};
+
+/// Symbol pouzity pri preklade adries na mena
+struct prof_symbol {
+	ADDRESS address;
+	const char * name;
+};
+
+static VIRTUAL_MACHINE * mach;
+static ADDRESS functions[MAX_DEPTH];
+static unsigned depth = 0;
+static ADDRESS entrypoint = 0;
+static uint32_t stack_top = VM_MEMORY_FULL_SIZE;
+
+static struct sample * samples[SAMPLE_BUCKETS];
+
+static struct prof_symbol * symbols = NULL;
+static unsigned symbol_count = 0;
+
+void sigint_handler(int signo) {
+	postInterruptVirtualMachine(mach, 1);
+}
+
+int compare_symbols(const void * a, const void * b) {
+	return (int) ((const struct prof_symbol *) a)->address - (int) ((const struct prof_symbol *) b)->address;
+}
+
+/** Pripravi zoradenu tabulku symbolov zo sekcie ladiaceho obrazu.
+ * Interne symboly linkera (zacinajuce "@@") sa vynechavaju.
+ * @param section sekcia .binary
+ */
+void load_symbols(SECTION * section) {
+	unsigned q;
+	symbols = malloc(sizeof(struct prof_symbol) * (section->symbol_count + 1));
+	for (q = 0; q < section->symbol_count; q++) {
+		if (strncmp(section->symbols[q].name, "@@", 2) == 0) continue;
+		symbols[symbol_count].address = section->symbols[q].address;
+		symbols[symbol_count].name = section->symbols[q].name;
+		symbol_count++;
+	}
+	qsort(symbols, symbol_count, sizeof(struct prof_symbol), compare_symbols);
+}
+
+/** Najde symbol, do ktoreho patri adresa.
+ * @param address adresa v pamati stroja
+ * @return index symbolu, -1 ak adresa lezi pred prvym symbolom
+ */
+int find_symbol(ADDRESS address) {
+	unsigned lo = 0, hi = symbol_count;
+	while (lo < hi) {
+		unsigned mid = (lo + hi) / 2;
+		if (symbols[mid].address <= address) lo = mid + 1; else hi = mid;
+	}
+	return (int) lo - 1;
+}
+
+/** Vypise meno adresy: symbol, symbol s posunom, alebo samotnu adresu.
+ * @param out vystupny subor
+ * @param address adresa v pamati stroja
+ */
+void print_address(FILE * out, ADDRESS address) {
+	int q = find_symbol(address);
+	if (q < 0) fprintf(out, "0x%04X", address);
+	else if (symbols[q].address == address) fprintf(out, "%s", symbols[q].name);
+	else fprintf(out, "%s+0x%X", symbols[q].name, address - symbols[q].address);
+}
+
+/** Zapocita aktualny zasobnik volani ako jednu vzorku. */
+void take_sample(void) {
+	unsigned q, hash = depth;
+	struct sample * s;
+	for (q = 0; q < depth; q++) hash = hash * 31 + functions[q];
+	hash %= SAMPLE_BUCKETS;
+	for (s = samples[hash]; s != NULL; s = s->next) {
+		if (s->depth != depth) continue;
+		for (q = 0; q < depth; q++) if (s->functions[q] != functions[q]) break;
+		if (q == depth) {
+			s->count++;
+			return;
+		}
+	}
+	s = malloc(sizeof(struct sample) + depth * sizeof(ADDRESS));
+	if (s == NULL) return;
+	s->depth = depth;
+	s->count = 1;
+	for (q = 0; q < depth; q++) s->functions[q] = functions[q];
+	s->next = samples[hash];
+	samples[hash] = s;
+}
+
+/** Zisti, ci adresa moze byt navratovou adresou volania z funkcie, v ktorej lezi adresa code.
+ * Navratova adresa nasleduje za instrukciou BRANCHL. Jej ciel musi byt v tej istej funkcii
+ * ako code podla symbolov, pri obraze bez symbolov staci, ze ciel nelezi za code.
+ * @param ret kandidat na navratovu adresu
+ * @param code adresa vo volanej funkcii
+ * @param target miesto pre ciel volania
+ * @return 1 ak je ret navratovou adresou volania
+ */
+int is_return(ADDRESS ret, ADDRESS code, ADDRESS * target) {
+	uint16_t instr;
+	if (ret < 2 || (ret & 1)) return 0;
+	instr = mach->read_func(mach->memory, ret - 2, 0);
+	if (!IS_BRANCH(instr) || !(instr & BIT0)) return 0;
+	*target = (instr & BIT11) ? ret - (instr & 0x07FE) : ret + (instr & 0x07FE);
+	if (symbol_count > 0) return find_symbol(*target) == find_symbol(code);
+	return *target <= code;
+}
+
+/** Zrekonstruuje zasobnik volani stroja v okamihu vzorky.
+ * Funkcia, ktora este neulozila LR, sa najde podla LR, ostatne navratove adresy podla slov
+ * na zasobniku stroja od SP smerom k jeho vrcholu (ulozene LR pri PUSH). Kazde prijate slovo
+ * sa stane volajucim predchadzajucej funkcie, koren je vstupny bod programu. Ramce sa ukladaju
+ * do functions ako ciele volani od korena.
+ */
+void unwind(void) {
+	ADDRESS calls[MAX_DEPTH], code = mach->registers[15], target, ret;
+	uint32_t address, end;
+	unsigned count = 0, q;
+	int lr_used = 0;
+	if (is_return(mach->registers[14], code, &target)) {
+		calls[count++] = target;
+		code = mach->registers[14] - 2;
+		lr_used = 1;
+	}
+	end = mach->registers[13] + 2 * MAX_SCAN;
+	if (end > stack_top) end = stack_top;
+	for (address = mach->registers[13]; address + 1 < end && count < MAX_DEPTH - 1; address += 2) {
+		ret = mach->read_func(mach->memory, address, 0);
+		if (lr_used && ret == mach->registers[14]) {
+			/* LR ulozene na zasobnik, uz je zapocitane */
+			lr_used = 0;
+			continue;
+		}
+		if (is_return(ret, code, &target)) {
+			calls[count++] = target;
+			code = ret - 2;
+		}
+	}
+	functions[0] = entrypoint;
+	for (q = 0; q < count; q++) functions[q + 1] = calls[count - 1 - q];
+	depth = count + 1;
+}
+
+int main(int argc, char ** argv) {
+	SECTION * binary_section = NULL;
+	FILE * out = stdout;
+	long executed = 0, sample_count = 0, slice;
+	VM_STOP stop;
+	unsigned q;
+	int rc;
+	int cmdline_retval = process_commandline(argc, argv, &commandline);
+	if (cmdline_help) { print_help(&commandline, argv[0]); return 0; }
+	if (cmdline_retval != 0) return cmdline_retval;
+
+	if (cmdline_interval <= 0) {
+		fprintf(stderr, "error: Invalid sampling interval %ld\n", cmdline_interval);
+		exit(1);
+	}
+
+	mach = createVirtualMachine(NULL, 0, 0);
+	if (mach == NULL) {
+		fprintf(stderr, "error: Unable to allocate device memory\n");
+		exit(1);
+	}
+
+	rc = binary_read(cmdline_infile, mach->memory, &entrypoint, VM_MEMORY_FULL_SIZE);
+
+	if (rc == -1) {
+		OBJECT * binary_object = object_load(cmdline_infile);
+		if (binary_object == NULL) {
+			fprintf(stderr, "Unable to load virtual memory image nor as plain binary nor as debuggable binary.\n");
+			exit(1);
+		}
+		binary_section = object_get_section_by_name(binary_object, ".binary");
+		if (binary_section == NULL) {
+			fprintf(stderr, "Invalid virtual memory image. Cannot find image section.\n");
+			exit(1);
+		}
+		if (section_data_copy(binary_section, mach->memory, VM_MEMORY_FULL_SIZE) != 0) {
+			fprintf(stderr, "Virtual memory image is too big to fit into memory.");
+			exit(1);
+		}
+		entrypoint = symbol_get_address(binary_section, "@@entrypoint");
+		if (entrypoint == 0xFFFF) {
+			fprintf(stderr, "Unable to find image entrypoint!\n");
+			exit(1);
+		}
+		load_symbols(binary_section);
+	} else if (rc != 0) {
+		exit(1);
+	}
+
+	if (cmdline_outfile != NULL) {
+		out = fopen(cmdline_outfile, "w");
+		if (out == NULL) {
+			fprintf(stderr, "error: Unable to open output file '%s'\n", cmdline_outfile);
+			exit(1);
+		}
+	}
+
+	mach->registers[15] = entrypoint;
+	if (mach->registers[13] != 0) stack_top = mach->registers[13];
+
+	signal(SIGINT, sigint_handler);
+
+	/* stroj bezi po usekoch dlzky intervalu, zasobnik volani sa rekonstruuje iba pri vzorke */
+	for (;;) {
+		slice = cmdline_interval;
+		if (cmdline_steps != 0 && cmdline_steps - executed < slice) slice = cmdline_steps - executed;
+		if (slice == 0) break;
+		resumeVirtualMachine(mach, slice, &stop);
+		executed += stop.retired;
+		if (stop.reason == VM_STOP_FAULT) {
+			fprintf(stderr, "Virtual machine stopped at 0x%04X with state %d\n", stop.pc, stop.state);
+			break;
+		}
+		if (stop.reason != VM_STOP_BUDGET || slice < cmdline_interval) break;
+		unwind();
+		take_sample();
+		sample_count++;
+	}
+
+	for (q = 0; q < SAMPLE_BUCKETS; q++) {
+		struct sample * s;
+		for (s = samples[q]; s != NULL; s = s->next) {
+			unsigned w;
+			for (w = 0; w < s->depth; w++) {
+				if (w > 0) fputc(';', out);
+				print_address(out, s->functions[w]);
+			}
+			fprintf(out, " %llu\n", (unsigned long long) s->count);
+		}
+	}
+	if (out != stdout) fclose(out);
+	fprintf(stderr, "%ld instructions executed, %ld samples\n", executed, sample_count);
+	destroyVirtualMachine(mach);
+	return 0;
+}
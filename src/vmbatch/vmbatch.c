@@ -0,0 +1,478 @@
+/* Batch runner for C Minimalistic RISC machine
+ * Runs many virtual machine images in parallel and writes one JSON record per job
+ */
+
+#include <cmdline.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <vm.h>
+
+/// Najvacsia dlzka riadka manifestu
+#define LINE_LENGTH		1024
+
+/// Pocet instrukcii vykonanych medzi kontrolami casoveho limitu
+#define SLICE			50000
+
+long cmdline_threads = 0;
+long cmdline_steps = 0;
+long cmdline_timeout = 0;
+long cmdline_blocks = 0;
+long cmdline_jit = 0;
+long cmdline_lockstep = 0;
+long cmdline_share = 0;
+long cmdline_protect = 0;
+long cmdline_help = 0;
+char * cmdline_outfile = NULL;
+char * cmdline_manifest = NULL;
+
+struct cmdline_opts options[] = {
+	{ "-T", "--threads", "N", "Run N jobs in parallel [default: number of host cores].", (void *) &cmdline_threads, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-s", "--steps", "N", "Default instruction budget of a job. If N is 0, run until error or interrupt.", (void *) &cmdline_steps, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-t", "--timeout", "ms", "Default wall clock limit of a job in milliseconds, 0 for none.", (void *) &cmdline_timeout, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-b", "--blocks", NULL, "Execute code as cached predecoded basic blocks.", (void *) &cmdline_blocks, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-j", "--jit", NULL, "Translate frequently executed code to native x86-64 code.", (void *) &cmdline_jit, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-L", "--lockstep", NULL, "Run consecutive jobs with the same image and limits together in lockstep.", (void *) &cmdline_lockstep, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-S", "--share", NULL, "Load each image once and share its unmodified pages between jobs (copy-on-write).", (void *) &cmdline_share, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-P", "--protect", "N", "Write-protect the first N bytes of guest memory, a write there ends the job.", (void *) &cmdline_protect, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-o", "--output", "file", "Write JSON records to file instead of standard output.", (void *) &cmdline_outfile, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-h", "--help", NULL, "Show this help.", (void *) &cmdline_help, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ NULL, NULL, "manifest", "Job manifest, one job per line: image [input=file@address] [rN=value] [steps=N] [timeout=ms]", (void *) &cmdline_manifest, ARG_STR, MANDATORY, 0, 1 }
+};
+
+struct cmdline_args commandline = { options, 11 };
+
+/// Konecny stav ulohy
+enum job_status { JOB_OK = 0, JOB_BUDGET, JOB_TIMEOUT, JOB_SOFTINT, JOB_ILLEGAL_OPCODE, JOB_OUT_OF_MEMORY, JOB_DIVIDE_BY_ZERO, JOB_UNALIGNED_MEMORY, JOB_JIT_MISMATCH, JOB_WRITE_PROTECTED, JOB_LOAD_ERROR };
+
+/// Nazvy stavov ulohy vo vystupe
+const char * job_status_names[] = { "ok", "budget", "timeout", "softint", "illegal_opcode", "out_of_memory", "divide_by_zero", "unaligned_memory", "jit_mismatch", "write_protected", "load_error" };
+
+/// Uloha: jeden beh obrazu s danym vstupom
+struct job {
+	char * image;
+	char * input;
+	uint16_t input_address;
+	uint16_t register_mask;
+	uint16_t registers[16];
+	long steps;
+	long timeout;
+	VM_IMAGE * shared;				// zdielany obraz pri --share, NULL ak sa obraz nacita do stroja
+	uint16_t entrypoint;
+};
+
+/// Skupina po sebe iducich uloh vykonavana spolocne
+struct group {
+	unsigned first;
+	unsigned count;
+};
+
+/// Fronta skupin uloh vlakna; vlastnik berie z konca, ostatne vlakna kradnu zo zaciatku
+struct worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	unsigned * jobs;
+	unsigned head;
+	unsigned tail;
+};
+
+static struct job * jobs = NULL;
+static unsigned job_count = 0;
+
+static struct group * groups = NULL;
+static unsigned group_count = 0;
+
+static struct worker * workers = NULL;
+static unsigned worker_count = 0;
+
+static FILE * out = NULL;
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Nacita zvysok suboru do pamate.
+ * @param f subor
+ * @param memory miesto pre obsah
+ * @param space najvacsi pocet bytov, ktory sa do pamate zmesti
+ * @return 0 ak sa cely zvysok suboru nacital, -1 pri chybe citania alebo ak je subor vacsi
+ */
+int read_rest(FILE * f, unsigned char * memory, size_t space) {
+	size_t length = fread(memory, 1, space, f);
+	if (ferror(f)) return -1;
+	if (length == space && fgetc(f) != EOF) return -1;
+	return 0;
+}
+
+/** Nacita obraz vo formate vmtest (2 byty vstupneho bodu v poradi MSB, LSB a obsah pamate).
+ * @param filename nazov suboru obrazu
+ * @param memory pamat stroja
+ * @param entrypoint miesto pre adresu vstupneho bodu
+ * @return 0 ak sa obraz podarilo nacitat, -1 ak sa neda precitat alebo sa nezmesti do pamate
+ */
+int load_image(const char * filename, unsigned char * memory, uint16_t * entrypoint) {
+	unsigned char ep[2];
+	int rc;
+	FILE * f = fopen(filename, "rb");
+	if (f == NULL) return -1;
+	if (fread(ep, 1, 2, f) != 2) {
+		fclose(f);
+		return -1;
+	}
+	*entrypoint = (ep[0] << 8) | ep[1];
+	rc = read_rest(f, memory, VM_MEMORY_FULL_SIZE);
+	fclose(f);
+	return rc;
+}
+
+/** Nacita vstupne data ulohy do pamate stroja od danej adresy.
+ * @param filename nazov suboru so vstupom
+ * @param memory pamat stroja
+ * @param address adresa, od ktorej sa vstup zapise
+ * @return 0 ak sa vstup podarilo nacitat, -1 ak sa neda precitat alebo sa od adresy nezmesti
+ * do pamate
+ */
+int load_input(const char * filename, unsigned char * memory, uint16_t address) {
+	int rc;
+	FILE * f = fopen(filename, "rb");
+	if (f == NULL) return -1;
+	rc = read_rest(f, memory + address, VM_MEMORY_FULL_SIZE - address);
+	fclose(f);
+	return rc;
+}
+
+/** Zapise retazec ako JSON retazec.
+ * @param f vystupny subor
+ * @param str retazec
+ */
+void json_string(FILE * f, const char * str) {
+	fputc('"', f);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') fprintf(f, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20) fprintf(f, "\\u%04x", (unsigned char) *str);
+		else fputc(*str, f);
+	}
+	fputc('"', f);
+}
+
+/** Vrati cas v milisekundach od pevneho bodu.
+ * @return monotonny cas v milisekundach
+ */
+double now_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/** Prevedie stav stroja na stav ulohy.
+ * @param state dovod prerusenia behu stroja
+ * @return stav ulohy
+ */
+enum job_status job_status_of(VM_STATE state) {
+	switch (state) {
+		case VM_SOFTINT: return JOB_SOFTINT;
+		case VM_ILLEGAL_OPCODE: return JOB_ILLEGAL_OPCODE;
+		case VM_OUT_OF_MEMORY: return JOB_OUT_OF_MEMORY;
+		case VM_DIVIDE_BY_ZERO: return JOB_DIVIDE_BY_ZERO;
+		case VM_UNALIGNED_MEMORY: return JOB_UNALIGNED_MEMORY;
+		case VM_JIT_MISMATCH: return JOB_JIT_MISMATCH;
+		case VM_WRITE_PROTECTED: return JOB_WRITE_PROTECTED;
+		default: return JOB_OK;
+	}
+}
+
+/** Vytvori stroj ulohy a nacita don obraz, vstup a pociatocne registre.
+ * @param job uloha
+ * @return stroj pripraveny na spustenie alebo NULL, ak sa ulohu nepodarilo nacitat
+ */
+VIRTUAL_MACHINE * prepare_job(struct job * job) {
+	VIRTUAL_MACHINE * mach;
+	uint16_t entrypoint;
+	unsigned q;
+	if (job->shared != NULL) {
+		mach = createFromImageVirtualMachine(job->shared, job->entrypoint);
+		entrypoint = job->entrypoint;
+	} else {
+		mach = createVirtualMachine(NULL, 0, 0);
+	}
+	if (mach == NULL) return NULL;
+	if ((job->shared == NULL && load_image(job->image, mach->memory, &entrypoint) != 0) ||
+		(job->input != NULL && load_input(job->input, mach->memory, job->input_address) != 0)) {
+		destroyVirtualMachine(mach);
+		return NULL;
+	}
+	mach->registers[15] = entrypoint;
+	for (q = 0; q < 16; q++) if (job->register_mask & (1 << q)) mach->registers[q] = job->registers[q];
+	if (cmdline_protect > 0) protectMemoryVirtualMachine(mach, 0, cmdline_protect, 1);
+	if (cmdline_blocks) setModeVirtualMachine(mach, VM_MODE_BLOCKS);
+	if (cmdline_jit) setModeVirtualMachine(mach, VM_MODE_JIT);
+	return mach;
+}
+
+/** Zapise vysledok ulohy a uvolni jej stroj.
+ * @param index poradove cislo ulohy v manifeste
+ * @param mach stroj ulohy alebo NULL, ak sa ulohu nepodarilo nacitat
+ * @param status konecny stav ulohy
+ * @param retired pocet instrukcii vykonanych ulohou
+ * @param elapsed cas behu ulohy v milisekundach
+ */
+void report_job(unsigned index, VIRTUAL_MACHINE * mach, enum job_status status, uint64_t retired, double elapsed) {
+	struct job * job = &jobs[index];
+	unsigned q;
+
+	pthread_mutex_lock(&out_lock);
+	fprintf(out, "{\"job\": %u, \"image\": ", index);
+	json_string(out, job->image);
+	if (job->input != NULL) {
+		fprintf(out, ", \"input\": ");
+		json_string(out, job->input);
+	}
+	fprintf(out, ", \"status\": \"%s\"", job_status_names[status]);
+	if (status != JOB_LOAD_ERROR) {
+		if (status == JOB_SOFTINT) fprintf(out, ", \"interrupt\": %u", mach->ext_interrupt);
+		fprintf(out, ", \"pc\": %u, \"flags\": %u, \"registers\": [", mach->registers[15], mach->flags);
+		for (q = 0; q < 16; q++) fprintf(out, q ? ", %u" : "%u", mach->registers[q]);
+		fprintf(out, "], \"retired\": %llu", (unsigned long long) retired);
+	}
+	fprintf(out, ", \"time_ms\": %.3f}\n", elapsed);
+	pthread_mutex_unlock(&out_lock);
+
+	if (mach != NULL) destroyVirtualMachine(mach);
+}
+
+/** Vykona skupinu uloh. Skupinu s jedinou ulohou vykona samostatne, vacsiu skupinu
+ * spolocne funkciou traceLockstepVirtualMachines. Ulohy skupiny maju rovnaky limit
+ * instrukcii aj casu, takze pocet vykonanych instrukcii je pre vsetky bezace ulohy rovnaky.
+ * @param group skupina uloh
+ */
+void run_group(struct group * group) {
+	VIRTUAL_MACHINE * running[VM_LOCKSTEP_LANES];
+	VM_STATE states[VM_LOCKSTEP_LANES] = { VM_OK };
+	unsigned owner[VM_LOCKSTEP_LANES];
+	uint64_t retired[VM_LOCKSTEP_LANES];
+	struct job * job = &jobs[group->first];
+	long executed = 0;
+	double start = now_ms();
+	unsigned q, active = 0;
+
+	for (q = 0; q < group->count; q++) {
+		VIRTUAL_MACHINE * mach = prepare_job(&jobs[group->first + q]);
+		if (mach == NULL) {
+			report_job(group->first + q, NULL, JOB_LOAD_ERROR, 0, now_ms() - start);
+			continue;
+		}
+		running[active] = mach;
+		retired[active] = 0;
+		owner[active++] = q;
+	}
+
+	while (active > 0) {
+		long slice = SLICE;
+		enum job_status status = JOB_OK;
+		unsigned kept = 0;
+		if (job->steps != 0) {
+			if (executed >= job->steps) status = JOB_BUDGET;
+			else if (job->steps - executed < slice) slice = job->steps - executed;
+		}
+		if (status == JOB_OK) {
+			if (active == 1) states[0] = traceVirtualMachine(running[0], slice);
+			else traceLockstepVirtualMachines(running, active, slice, states);
+			executed += slice;
+			for (q = 0; q < active; q++) retired[q] += running[q]->retired;
+			if (job->timeout != 0 && now_ms() - start >= job->timeout) status = JOB_TIMEOUT;
+		}
+		for (q = 0; q < active; q++) {
+			if (status != JOB_OK || states[q] != VM_OK) {
+				report_job(group->first + owner[q], running[q], states[q] != VM_OK ? job_status_of(states[q]) : status, retired[q], now_ms() - start);
+				continue;
+			}
+			running[kept] = running[q];
+			retired[kept] = retired[q];
+			owner[kept++] = owner[q];
+		}
+		active = kept;
+	}
+}
+
+/** Vyberie dalsiu skupinu uloh: najprv z konca vlastnej fronty, potom ukradne zo zaciatku
+ * fronty ineho vlakna.
+ * @param self index vlakna
+ * @param index miesto pre index skupiny
+ * @return 1 ak bola skupina vybrana, 0 ak uz ziadna skupina nezostala
+ */
+int next_job(unsigned self, unsigned * index) {
+	unsigned q;
+	struct worker * w = &workers[self];
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail) {
+		*index = w->jobs[--w->tail];
+		pthread_mutex_unlock(&w->lock);
+		return 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	for (q = 1; q < worker_count; q++) {
+		struct worker * victim = &workers[(self + q) % worker_count];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->head < victim->tail) {
+			*index = victim->jobs[victim->head++];
+			pthread_mutex_unlock(&victim->lock);
+			return 1;
+		}
+		pthread_mutex_unlock(&victim->lock);
+	}
+	return 0;
+}
+
+void * worker_main(void * arg) {
+	unsigned self = (unsigned) (uintptr_t) arg;
+	unsigned index;
+	while (next_job(self, &index)) run_group(&groups[index]);
+	return NULL;
+}
+
+/** Nacita kazdy obraz manifestu raz do zdielaneho obrazu pamate (--share).
+ * Ulohy s rovnakym obrazom dostanu ten isty zdielany obraz, stroje uloh potom zdielaju
+ * stranky, do ktorych nezapisuju. Ulohe, ktorej obraz sa nepodarilo nacitat, zostane
+ * shared NULL a chybu ohlasi az prepare_job.
+ */
+void share_images(void) {
+	unsigned char * memory = malloc(VM_MEMORY_FULL_SIZE);
+	unsigned q, p;
+	if (memory == NULL) return;
+	for (q = 0; q < job_count; q++) {
+		for (p = 0; p < q; p++) {
+			if (jobs[p].shared != NULL && strcmp(jobs[p].image, jobs[q].image) == 0) break;
+		}
+		if (p < q) {
+			jobs[q].shared = jobs[p].shared;
+			jobs[q].entrypoint = jobs[p].entrypoint;
+			continue;
+		}
+		memset(memory, 0, VM_MEMORY_FULL_SIZE);
+		if (load_image(jobs[q].image, memory, &jobs[q].entrypoint) == 0) {
+			jobs[q].shared = createImageVirtualMachine(memory, VM_MEMORY_FULL_SIZE);
+		}
+	}
+	free(memory);
+}
+
+/** Rozlozi riadok manifestu na ulohu.
+ * @param line riadok manifestu
+ * @param job uloha
+ * @return 1 ak riadok obsahuje ulohu, 0 pre prazdny riadok alebo komentar, -1 pri chybe
+ */
+int parse_job(char * line, struct job * job) {
+	char * token, * save;
+	memset(job, 0, sizeof(struct job));
+	job->steps = cmdline_steps;
+	job->timeout = cmdline_timeout;
+	token = strtok_r(line, " \t\r\n", &save);
+	if (token == NULL || token[0] == '#') return 0;
+	job->image = strdup(token);
+	while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+		if (strncmp(token, "input=", 6) == 0) {
+			char * at = strrchr(token, '@');
+			if (at == NULL) return -1;
+			*at = '\0';
+			job->input = strdup(token + 6);
+			job->input_address = strtol(at + 1, NULL, 0);
+		} else if (strncmp(token, "steps=", 6) == 0) {
+			job->steps = strtol(token + 6, NULL, 0);
+		} else if (strncmp(token, "timeout=", 8) == 0) {
+			job->timeout = strtol(token + 8, NULL, 0);
+		} else if ((token[0] == 'r' || token[0] == 'R') && strchr(token, '=') != NULL) {
+			int reg = strtol(token + 1, NULL, 10);
+			if (reg < 0 || reg > 15) return -1;
+			job->registers[reg] = strtol(strchr(token, '=') + 1, NULL, 0);
+			job->register_mask |= 1 << reg;
+		} else {
+			return -1;
+		}
+	}
+	return 1;
+}
+
+int main(int argc, char ** argv) {
+	char line[LINE_LENGTH];
+	unsigned q, capacity = 0, line_number = 0;
+	FILE * manifest;
+	int cmdline_retval = process_commandline(argc, argv, &commandline);
+	if (cmdline_help) { print_help(&commandline, argv[0]); return 0; }
+	if (cmdline_retval != 0) return cmdline_retval;
+
+	manifest = fopen(cmdline_manifest, "r");
+	if (manifest == NULL) {
+		fprintf(stderr, "error: Unable to open manifest '%s'\n", cmdline_manifest);
+		exit(1);
+	}
+	while (fgets(line, LINE_LENGTH, manifest) != NULL) {
+		int rc;
+		line_number++;
+		if (job_count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			jobs = realloc(jobs, capacity * sizeof(struct job));
+			if (jobs == NULL) {
+				fprintf(stderr, "error: Out of memory\n");
+				exit(1);
+			}
+		}
+		rc = parse_job(line, &jobs[job_count]);
+		if (rc < 0) {
+			fprintf(stderr, "error: Invalid job on manifest line %u\n", line_number);
+			exit(1);
+		}
+		job_count += rc;
+	}
+	fclose(manifest);
+
+	out = stdout;
+	if (cmdline_outfile != NULL) {
+		out = fopen(cmdline_outfile, "w");
+		if (out == NULL) {
+			fprintf(stderr, "error: Unable to open output file '%s'\n", cmdline_outfile);
+			exit(1);
+		}
+	}
+
+	/* Pri behu v lockstep sa spajaju po sebe iduce ulohy s rovnakym obrazom a limitmi. */
+	groups = malloc(sizeof(struct group) * (job_count + 1));
+	for (q = 0; q < job_count; q++) {
+		if (cmdline_lockstep && group_count > 0) {
+			struct group * last = &groups[group_count - 1];
+			struct job * leader = &jobs[last->first];
+			if (last->count < VM_LOCKSTEP_LANES && strcmp(leader->image, jobs[q].image) == 0 &&
+				leader->steps == jobs[q].steps && leader->timeout == jobs[q].timeout) {
+				last->count++;
+				continue;
+			}
+		}
+		groups[group_count].first = q;
+		groups[group_count++].count = 1;
+	}
+
+	worker_count = cmdline_threads > 0 ? cmdline_threads : sysconf(_SC_NPROCESSORS_ONLN);
+	if (worker_count < 1) worker_count = 1;
+	if (worker_count > group_count && group_count > 0) worker_count = group_count;
+
+	if (cmdline_share) share_images();
+
+	workers = calloc(worker_count, sizeof(struct worker));
+	for (q = 0; q < worker_count; q++) {
+		pthread_mutex_init(&workers[q].lock, NULL);
+		workers[q].jobs = malloc(sizeof(unsigned) * (group_count / worker_count + 1));
+	}
+	for (q = 0; q < group_count; q++) {
+		struct worker * w = &workers[q % worker_count];
+		w->jobs[w->tail++] = q;
+	}
+	for (q = 0; q < worker_count; q++) {
+		if (pthread_create(&workers[q].thread, NULL, worker_main, (void *) (uintptr_t) q) != 0) {
+			fprintf(stderr, "error: Unable to start worker thread\n");
+			exit(1);
+		}
+	}
+	for (q = 0; q < worker_count; q++) pthread_join(workers[q].thread, NULL);
+
+	if (out != stdout) fclose(out);
+	return 0;
+}
@@ -0,0 +1,106 @@
+/* Regresny test zapisu nezarovnaneho slova na posledny byte stranky
+ * Zapis zasahuje aj prvy byte nasledujucej stranky, vsetky jadra ho musia ohlasit obom strankam
+ * a zapis musi skoncit chybou, ak je chranena proti zapisu ktorakolvek z nich.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <vm.h>
+
+/** Instrukcie programu a ich adresy. */
+struct test_word {
+	uint16_t address;
+	uint16_t instruction;
+};
+
+/* Program od ENTRYPOINT 1000x zavola funkciu na stranke 0x11 (ADDC R0, 10), potom zapisom slova na 0x10FF
+ * zmeni jej prvu instrukciu na ADDC R0, 15 a zavola ju este raz. Vysledok je R0 = 10015, ak
+ * jadro pouzije stary kod funkcie, R0 = 10010. Program od PROTECTED zapise slovo na 0x10FF pri
+ * stranke 0x11 chranenej proti zapisu. */
+static const struct test_word program[] = {
+	{ 0x1000, 0x1E00 },		// XOR R0, R0
+	{ 0x1002, 0x0B03 },		// ILOAD R3, 0x03
+	{ 0x1004, 0x0BE8 },		// ILOAD R3, 0xE8
+	{ 0x1006, 0x30F9 },		// .loop: BRANCHL 0x1100
+	{ 0x1008, 0x2331 },		// SUBCS R3, 1
+	{ 0x100A, 0x7002 },		// BRANCH CZ .patch
+	{ 0x100C, 0x3808 },		// BRANCH .loop
+	{ 0x100E, 0x0910 },		// .patch: ILOAD R1, 0x10
+	{ 0x1010, 0x09FF },		// ILOAD R1, 0xFF
+	{ 0x1012, 0x0A0F },		// ILOAD R2, 0x0F
+	{ 0x1014, 0x0A00 },		// ILOAD R2, 0x00
+	{ 0x1016, 0x0412 },		// STORE [R1], R2
+	{ 0x1018, 0x30E7 },		// BRANCHL 0x1100
+	{ 0x101A, 0x2E10 },		// INT 0x10
+	{ 0x1020, 0x0910 },		// .protected: ILOAD R1, 0x10
+	{ 0x1022, 0x09FF },		// ILOAD R1, 0xFF
+	{ 0x1024, 0x0AAB },		// ILOAD R2, 0xAB
+	{ 0x1026, 0x0A00 },		// ILOAD R2, 0x00
+	{ 0x1028, 0x0412 },		// STORE [R1], R2
+	{ 0x102A, 0x2E10 },		// INT 0x10
+	{ 0x1100, 0x200A },		// ADDC R0, 10
+	{ 0x1102, 0x2CFE },		// MOV PC, RL
+};
+
+#define ENTRYPOINT	0x1000
+#define PROTECTED	0x1020
+#define EXPECTED_R0	10015
+
+/** Spusti program v danom rezime stroja a overi vysledok, obnovenie snimky a ochranu stranky.
+ * @param mode rezim stroja
+ * @param name nazov rezimu pre vypis
+ * @return 0 ak test prebehol, 1 ak zlyhal
+ */
+static int run_mode(uint8_t mode, const char * name) {
+	VIRTUAL_MACHINE * mach = createVirtualMachine(NULL, 0, ENTRYPOINT);
+	VM_SNAPSHOT * snapshot;
+	VM_STATE state;
+	unsigned q;
+	int failed = 0;
+	if (mach == NULL) {
+		fprintf(stderr, "Unable to allocate device memory\n");
+		return 1;
+	}
+	for (q = 0; q < sizeof(program) / sizeof(program[0]); q++) {
+		mach->memory[program[q].address] = program[q].instruction & 0xFF;
+		mach->memory[program[q].address + 1] = program[q].instruction >> 8;
+	}
+	if (setModeVirtualMachine(mach, mode) != 0) {
+		printf("%s: not available on this host, skipped\n", name);
+		destroyVirtualMachine(mach);
+		return 0;
+	}
+	snapshot = createSnapshotVirtualMachine(mach);
+	state = resumeVirtualMachine(mach, 0, NULL);
+	if (state != VM_SOFTINT || mach->registers[0] != EXPECTED_R0) {
+		printf("%s: stale code executed, state %d, R0 = %u, expected %u\n", name, state, mach->registers[0], EXPECTED_R0);
+		failed = 1;
+	}
+	/* zmenena musi byt aj stranka 0x11, inac ju obnovenie snimky preskoci */
+	restoreSnapshotVirtualMachine(mach, snapshot);
+	if (mach->memory[0x1100] != 0x0A) {
+		printf("%s: snapshot restore missed page 0x11\n", name);
+		failed = 1;
+	}
+	protectMemoryVirtualMachine(mach, 0x1100, VM_PAGE_SIZE, 1);
+	mach->registers[15] = PROTECTED;
+	state = resumeVirtualMachine(mach, 0, NULL);
+	if (state != VM_WRITE_PROTECTED || mach->memory[0x1100] != 0x0A) {
+		printf("%s: write to protected page 0x11 not stopped, state %d\n", name, state);
+		failed = 1;
+	}
+	destroyVirtualMachine(mach);
+	destroySnapshotVirtualMachine(snapshot);
+	if (!failed) printf("%s: OK\n", name);
+	return failed;
+}
+
+int main(void) {
+	int failed = 0;
+	failed |= run_mode(VM_MODE_INTERPRET, "interpret");
+	failed |= run_mode(VM_MODE_BLOCKS, "blocks");
+	failed |= run_mode(VM_MODE_JIT, "jit");
+	failed |= run_mode(VM_MODE_JIT_VERIFY, "jit-verify");
+	return failed;
+}
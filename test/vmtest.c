@@ -4,6 +4,7 @@
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <signal.h>
 
 #include <vm.h>
 
@@ -13,25 +14,51 @@ long cmdline_steps = 0;
 long cmdline_dump = 0;
 long cmdline_interactive = 0;
 long cmdline_help = 0;
+long cmdline_blocks = 0;
+long cmdline_jit = 0;
+long cmdline_jit_verify = 0;
+long cmdline_strict_align = 0;
+char * cmdline_profile = NULL;
+char * cmdline_profile_csv = NULL;
+char * cmdline_checkpoint = NULL;
+long cmdline_checkpoint_every = 0;
+char * cmdline_resume = NULL;
 char * cmdline_infile = NULL;
 
+static volatile sig_atomic_t __interrupted = 0;
+
+static void __onInterrupt(int sig) {
+	(void) sig;
+	__interrupted = 1;
+}
+
 struct cmdline_opts options[] = {
 	{ "-s", "--steps", "N", "Execute N instructions and stop. If N is 0, run until error or interrupt.", (void *) &cmdline_steps, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
 	{ "-d", "--dump-registers", NULL, "Dump registers after executed instructions or after every step in unlimited execution (-s 0).", (void *) &cmdline_dump, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
 	{ "-i", "--interactive", NULL, "Prompt for user action after every step.", (void *) &cmdline_interactive, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-b", "--blocks", NULL, "Execute code as cached predecoded basic blocks.", (void *) &cmdline_blocks, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-j", "--jit", NULL, "Translate frequently executed code to native x86-64 code.", (void *) &cmdline_jit, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-J", "--jit-verify", NULL, "Like --jit, but check every translated block against the interpreter.", (void *) &cmdline_jit_verify, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-a", "--strict-align", NULL, "Fail on unaligned memory accesses.", (void *) &cmdline_strict_align, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-p", "--profile", "FILE", "Count executed instructions and write binary profile to FILE at exit.", (void *) &cmdline_profile, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-P", "--profile-csv", "FILE", "Count executed instructions and write profile as CSV to FILE at exit.", (void *) &cmdline_profile_csv, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-c", "--checkpoint", "FILE", "Write incremental checkpoints to FILE, and a last one at exit.", (void *) &cmdline_checkpoint, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-C", "--checkpoint-every", "N", "Write a checkpoint every N executed instructions.", (void *) &cmdline_checkpoint_every, ARG_NUM, OPTIONAL, 0, NON_POSITIONAL},
+	{ "-r", "--resume", "FILE", "Resume execution from the last checkpoint in FILE.", (void *) &cmdline_resume, ARG_STR, OPTIONAL, 0, NON_POSITIONAL},
 	{ "-h", "--help", NULL, "Show this help.", (void *) &cmdline_help, ARG_BOOL, OPTIONAL, 0, NON_POSITIONAL},
 	{ NULL, NULL, "executable_file", "File name of executable input file.", (void *)&cmdline_infile, ARG_STR, MANDATORY, 0, 1 }
 };
 
-struct cmdline_args commandline = { options, 5 };
+struct cmdline_args commandline = { options, 14 };
 
 int main(int argc, char ** argv) {
-	char * memory = malloc(65535);
-	memset(memory, 0, 65535);
 	struct stat vmm_stat;
 	uint16_t entrypoint = 0;
-	char epbyte, is_ok = 0;
-	int left_steps;
+	unsigned char header[2];
+	char epbyte;
+	int left_steps, remaining;
+	uint64_t executed = 0, next_checkpoint = 0;
+	VM_CHECKPOINT * checkpoint = NULL;
 	
 	int cmdline_retval = process_commandline(argc, argv, &commandline);
 	if (cmdline_help) { print_help(&commandline, argv[0]); return 0; }
@@ -43,39 +70,68 @@ int main(int argc, char ** argv) {
 	left_steps = cmdline_steps;
 	
 	int fd = open(cmdline_infile, O_RDONLY);
-	if (fd != -1) {
-		if (fstat(fd, &vmm_stat) == -1) {
-			fprintf(stderr, "Unable to fstat() virtual memory image file\n");
+	if (fd == -1) {
+		fprintf(stderr, "Unable to open virtual memory image file\n");
+		exit(1);
+	}
+	if (fstat(fd, &vmm_stat) == -1) {
+		fprintf(stderr, "Unable to fstat() virtual memory image file\n");
+		exit(1);
+	}
+	if (read(fd, header, 2) != 2) {
+		fprintf(stderr, "Unabel to read entrypoint from image!\n");
+		exit(1);
+	}
+	close(fd);
+	entrypoint = (header[0] << 8) | header[1];
+	/* pamat stroja je priamo mapovany obraz za hlavickou, nic sa nekopiruje */
+	remaining = vmm_stat.st_size - 2;
+	if (remaining > VM_MEMORY_FULL_SIZE) remaining = VM_MEMORY_FULL_SIZE;
+	VIRTUAL_MACHINE * mach = createFromFileVirtualMachine(cmdline_infile, 2, remaining, entrypoint);
+	if (mach == NULL) {
+		fprintf(stderr, "Unable to map virtual memory image\n");
+		exit(1);
+	}
+	if (cmdline_strict_align) mach->mem_flags |= VM_MEMORY_STRICT_ALIGN;
+	if (cmdline_resume != NULL) {
+		long index = loadCheckpointVirtualMachine(mach, cmdline_resume, -1, &executed);
+		if (index < 0) {
+			fprintf(stderr, "Unable to resume from checkpoint file %s\n", cmdline_resume);
 			exit(1);
 		}
-		do {
-			if (read(fd, &epbyte, 1) == -1) break;
-			entrypoint = (entrypoint << 8) | epbyte;
-			if (read(fd, &epbyte, 1) == -1) break;
-			entrypoint = (entrypoint << 8) | epbyte;
-			is_ok = 1;
-		} while (0);
-		if (is_ok == 0) {
-			fprintf(stderr, "Unabel to read entrypoint from image!\n");
+		printf("Resumed from checkpoint %ld after %llu instructions\n", index, (unsigned long long) executed);
+	}
+	if (cmdline_checkpoint != NULL) {
+		checkpoint = createCheckpointVirtualMachine(mach, cmdline_checkpoint, cmdline_resume != NULL && strcmp(cmdline_resume, cmdline_checkpoint) == 0);
+		if (checkpoint == NULL) {
+			fprintf(stderr, "Unable to create checkpoint file %s\n", cmdline_checkpoint);
 			exit(1);
 		}
-		int cursor = 0, remaining = vmm_stat.st_size - 2, rd;
-		while (remaining > 0) {
-			rd = read(fd, &(memory[cursor]), (remaining > 4096 ? 4096 : remaining));
-			if (rd != -1) { cursor += rd; remaining -= rd; }
-			else {
-				fprintf(stderr, "Unable to read virtual memory data from image!\n");
-				exit(1);
-			}
+		next_checkpoint = executed + cmdline_checkpoint_every;
+		signal(SIGINT, __onInterrupt);
+	}
+	if (cmdline_blocks) setModeVirtualMachine(mach, VM_MODE_BLOCKS);
+	if ((cmdline_jit || cmdline_jit_verify) && setModeVirtualMachine(mach, cmdline_jit_verify ? VM_MODE_JIT_VERIFY : VM_MODE_JIT) != 0) {
+		fprintf(stderr, "JIT is not available on this host, using interpreter\n");
+	}
+	if (cmdline_profile != NULL || cmdline_profile_csv != NULL) {
+		if (setProfilingVirtualMachine(mach, 1) != 0) {
+			fprintf(stderr, "Unable to allocate profile\n");
+			exit(1);
 		}
-	} else {
-		fprintf(stderr, "Unable to open virtual memory image file\n");
-		exit(1);
+		signal(SIGINT, __onInterrupt);
 	}
-	VIRTUAL_MACHINE * mach = createVirtualMachine(memory, 65535, entrypoint);
-	while (left_steps > 0 || cmdline_steps == 0) {
-		VM_STATE state = traceVirtualMachine(mach, left_steps > 0 ? left_steps : 1);
+	while ((left_steps > 0 || cmdline_steps == 0) && !__interrupted) {
+		VM_STOP stop;
+		VM_STATE state = resumeVirtualMachine(mach, left_steps > 0 ? left_steps : 1, &stop);
 		if (cmdline_dump) dumpRegistersVirtualMachine(mach);
+		executed += stop.retired;
+		if (checkpoint != NULL && cmdline_checkpoint_every > 0 && executed >= next_checkpoint) {
+			if (writeCheckpointVirtualMachine(checkpoint, executed) != 0) {
+				fprintf(stderr, "Unable to write checkpoint to %s\n", cmdline_checkpoint);
+			}
+			next_checkpoint = executed + cmdline_checkpoint_every;
+		}
 		
 		switch(state) {
 			case VM_OK:
@@ -93,6 +149,26 @@ int main(int argc, char ** argv) {
 			case VM_OUT_OF_MEMORY:
 				printf("Segmentation fault\n");
 				break;
+
+			case VM_UNALIGNED_MEMORY:
+				printf("Unaligned memory access\n");
+				break;
+
+			case VM_JIT_MISMATCH:
+				printf("JIT translation differs from interpreter\n");
+				break;
+
+			case VM_WRITE_PROTECTED:
+				printf("Write to protected memory\n");
+				break;
+
+			case VM_REPLAY_END:
+				printf("Replay finished\n");
+				break;
+
+			case VM_REPLAY_DIVERGED:
+				printf("Replay diverged from recording\n");
+				break;
 		}
 		
 		if (cmdline_interactive) {
@@ -134,5 +210,18 @@ int main(int argc, char ** argv) {
 			} while (ccc);
 		}
 	}
+	if (cmdline_profile != NULL && writeProfileVirtualMachine(mach, cmdline_profile, VM_PROFILE_BINARY) != 0) {
+		fprintf(stderr, "Unable to write profile to %s\n", cmdline_profile);
+	}
+	if (cmdline_profile_csv != NULL && writeProfileVirtualMachine(mach, cmdline_profile_csv, VM_PROFILE_CSV) != 0) {
+		fprintf(stderr, "Unable to write profile to %s\n", cmdline_profile_csv);
+	}
+	if (checkpoint != NULL) {
+		int rc = writeCheckpointVirtualMachine(checkpoint, executed);
+		if (destroyCheckpointVirtualMachine(checkpoint) != 0 || rc != 0) {
+			fprintf(stderr, "Unable to write checkpoint to %s\n", cmdline_checkpoint);
+		}
+	}
+	destroyVirtualMachine(mach);
 	return 0;
 }
\ No newline at end of file